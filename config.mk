@@ -20,6 +20,7 @@ CHCORE_SPD=opteed
 BOOL_CONFIGS = \
 CHCORE_VERBOSE_BUILD=OFF \
 CHCORE_ENABLE_FMAP=ON \
+CHCORE_FS_WRITE_BACK=ON \
 CHCORE_ENABLE_TZASC_CMA=OFF \
 CHCORE_USER_DEBUG=OFF \
 CHCORE_MINI=ON \
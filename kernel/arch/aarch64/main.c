@@ -26,6 +26,8 @@
 #include <machine.h>
 #include <irq/irq.h>
 #include <object/thread.h>
+#include <object/object.h>
+#include <ipc/futex.h>
 #ifdef CHCORE_OH_TEE
 #include <arch/trustzone/smc.h>
 #include <arch/trustzone/tlogger.h>
@@ -73,6 +75,12 @@ void main(paddr_t boot_flag, void *info)
 
     kinfo("[ChCore] mm init finished\n");
 
+    /* Init the caches of kernel objects */
+    obj_cache_init();
+
+    /* Init the hash buckets of futex waiters */
+    futex_init();
+
     /* Mapping KSTACK into kernel page table. */
     map_range_in_pgtbl_kernel((void *)((unsigned long)boot_ttbr1_l0 + KBASE),
                               KSTACKx_ADDR(0),
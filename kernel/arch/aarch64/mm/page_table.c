@@ -192,6 +192,181 @@ static int get_next_ptp(ptp_t *cur_ptp, u32 level, vaddr_t va, ptp_t **next_ptp,
         return BLOCK_PTP;
 }
 
+/*
+ * Block mappings (1G in L1 and 2M in L2) and contiguous runs of L3 PTEs
+ * (L3_CONT_PTES pages) are used for user mappings when the va, the pa and
+ * the remaining length are all aligned to the block/run size. CoW mappings
+ * always use plain 4K pages since do_cow updates a single L3 PTE.
+ */
+static bool can_map_block(vaddr_t va, paddr_t pa, s64 page_cnt,
+                          u64 block_pages, vmr_prop_t flags, int kind)
+{
+    if (kind != USER_PTE || (flags & VMR_COW))
+        return false;
+
+    if (page_cnt < block_pages)
+        return false;
+
+    return ((va | pa) & ((block_pages << PAGE_SHIFT) - 1)) == 0;
+}
+
+/*
+ * Whether [va, va + page_cnt pages) covers the whole block (or contiguous
+ * run) containing va.
+ */
+static inline bool range_covers_block(vaddr_t va, s64 page_cnt,
+                                      u64 block_pages)
+{
+    return (va & ((block_pages << PAGE_SHIFT) - 1)) == 0
+           && page_cnt >= block_pages;
+}
+
+/*
+ * Install a block mapping in @cur_ptp (at @level) for va.
+ * Return -EEXIST if va is already covered by a next level page table page.
+ */
+static int set_block_pte(ptp_t *cur_ptp, u32 level, vaddr_t va, paddr_t pa,
+                         vmr_prop_t flags, int kind, long *rss)
+{
+    pte_t *entry;
+    pte_t new_pte_val;
+
+    if (level == L1)
+        entry = &(cur_ptp->ent[GET_L1_INDEX(va)]);
+    else
+        entry = &(cur_ptp->ent[GET_L2_INDEX(va)]);
+
+    if (!IS_PTE_INVALID(entry->pte) && IS_PTE_TABLE(entry->pte))
+        return -EEXIST;
+
+    /*
+     * The attribute fields of block descriptors are at the same
+     * positions as those of page descriptors.
+     */
+    new_pte_val.pte = 0;
+    set_pte_flags(&new_pte_val, flags, kind);
+    if (level == L1) {
+        new_pte_val.l1_block.is_valid = 1;
+        new_pte_val.l1_block.pfn = pa >> L1_INDEX_SHIFT;
+    } else {
+        new_pte_val.l2_block.is_valid = 1;
+        new_pte_val.l2_block.pfn = pa >> L2_INDEX_SHIFT;
+    }
+
+    if (rss && IS_PTE_INVALID(entry->pte)) {
+        *rss += (level == L1 ? L1_PER_ENTRY_PAGES : L2_PER_ENTRY_PAGES)
+                * PAGE_SIZE;
+    }
+    entry->pte = new_pte_val.pte;
+
+    return 0;
+}
+
+/*
+ * Replace the block mapping @entry (at @level) containing va with a next
+ * level page table page holding the same translations, so that part of
+ * the block can be unmapped or changed afterwards.
+ */
+static void split_block(pte_t *entry, u32 level, vaddr_t va, long *rss)
+{
+    ptp_t *new_ptp;
+    pte_t block, new_pte_val;
+    paddr_t pa;
+    u64 step;
+    int i;
+
+    BUG_ON(level != L1 && level != L2);
+
+    new_ptp = get_pages(0);
+    BUG_ON(new_ptp == NULL);
+    if (rss) {
+        *rss += PAGE_SIZE;
+    }
+
+    block.pte = entry->pte;
+    if (level == L1) {
+        pa = (paddr_t)block.l1_block.pfn << L1_INDEX_SHIFT;
+        step = L2_PER_ENTRY_PAGES * PAGE_SIZE;
+        va = ROUND_DOWN(va, L1_PER_ENTRY_PAGES * PAGE_SIZE);
+    } else {
+        pa = (paddr_t)block.l2_block.pfn << L2_INDEX_SHIFT;
+        step = PAGE_SIZE;
+        va = ROUND_DOWN(va, L2_PER_ENTRY_PAGES * PAGE_SIZE);
+    }
+
+    for (i = 0; i < PTP_ENTRIES; ++i) {
+        new_pte_val.pte = block.pte;
+        if (level == L1) {
+            new_pte_val.l2_block.pfn = (pa + i * step) >> L2_INDEX_SHIFT;
+        } else {
+            new_pte_val.l3_page.is_page = 1;
+            new_pte_val.l3_page.pfn = (pa + i * step) >> PAGE_SHIFT;
+            /* The pages of a 2M block are contiguous and aligned */
+            new_pte_val.l3_page.Contiguous = 1;
+        }
+        new_ptp->ent[i].pte = new_pte_val.pte;
+    }
+
+    /* Break-before-make: the old block may still be cached in TLBs. */
+    entry->pte = PTE_DESCRIPTOR_INVALID;
+    flush_tlb_by_range_all_asid(va, 1);
+
+    new_pte_val.pte = 0;
+    new_pte_val.table.is_valid = 1;
+    new_pte_val.table.is_table = 1;
+    new_pte_val.table.next_table_addr =
+        virt_to_phys((vaddr_t)new_ptp) >> PAGE_SHIFT;
+    entry->pte = new_pte_val.pte;
+}
+
+/*
+ * Clear the contiguous hint of the run containing l3_ptp->ent[index] (for va)
+ * before part of the run is changed. Like splitting a block, the hint can
+ * only be changed after the old entries are invalidated (break-before-make).
+ */
+static void split_cont_ptes(ptp_t *l3_ptp, int index, vaddr_t va)
+{
+    pte_t saved[L3_CONT_PTES];
+    int first, i;
+
+    first = ROUND_DOWN(index, L3_CONT_PTES);
+    va = ROUND_DOWN(va, L3_CONT_PTES * PAGE_SIZE);
+
+    for (i = 0; i < L3_CONT_PTES; ++i) {
+        saved[i].pte = l3_ptp->ent[first + i].pte;
+        l3_ptp->ent[first + i].pte = PTE_DESCRIPTOR_INVALID;
+    }
+
+    flush_tlb_by_range_all_asid(va, L3_CONT_PTES);
+
+    for (i = 0; i < L3_CONT_PTES; ++i) {
+        saved[i].l3_page.Contiguous = 0;
+        l3_ptp->ent[first + i].pte = saved[i].pte;
+    }
+}
+
+/*
+ * Invalidate the run of L3_CONT_PTES entries from l3_ptp->ent[first] (for va)
+ * before it is rewritten with the contiguous hint. The TLBs are flushed if
+ * any of them was valid (break-before-make), since a TLB may not hold
+ * entries of the old and the new run together.
+ */
+static void break_cont_run(ptp_t *l3_ptp, int first, vaddr_t va)
+{
+    bool valid = false;
+    int i;
+
+    for (i = 0; i < L3_CONT_PTES; ++i) {
+        if (!IS_PTE_INVALID(l3_ptp->ent[first + i].pte)) {
+            l3_ptp->ent[first + i].pte = PTE_DESCRIPTOR_INVALID;
+            valid = true;
+        }
+    }
+
+    if (valid)
+        flush_tlb_by_range_all_asid(va, L3_CONT_PTES);
+}
+
 int debug_query_in_pgtbl(void *pgtbl, vaddr_t va, paddr_t *pa, pte_t **entry)
 {
     ptp_t *l0_ptp, *l1_ptp, *l2_ptp, *l3_ptp;
@@ -262,14 +437,16 @@ void free_page_table(void *pgtbl)
         /* Interate each entry in the l1 page table */
         for (j = 0; j < PTP_ENTRIES; ++j) {
             l1_pte = &l1_ptp->ent[j];
-            if (IS_PTE_INVALID(l1_pte->pte))
+            /* Skip the invalid entries and the 1G blocks */
+            if (IS_PTE_INVALID(l1_pte->pte) || !IS_PTE_TABLE(l1_pte->pte))
                 continue;
             l2_ptp = (ptp_t *)GET_NEXT_PTP(l1_pte);
 
             /* Interate each entry in the l2 page table*/
             for (k = 0; k < PTP_ENTRIES; ++k) {
                 l2_pte = &l2_ptp->ent[k];
-                if (IS_PTE_INVALID(l2_pte->pte))
+                /* Skip the invalid entries and the 2M blocks */
+                if (IS_PTE_INVALID(l2_pte->pte) || !IS_PTE_TABLE(l2_pte->pte))
                     continue;
                 l3_ptp = (ptp_t *)GET_NEXT_PTP(l2_pte);
                 /* Free the l3 page table page */
@@ -347,6 +524,7 @@ static int map_range_in_pgtbl_common(void *pgtbl, vaddr_t va, paddr_t pa,
     int ret;
     int pte_index; // the index of pte in the last level page table
     int i;
+    bool cont;
 
     BUG_ON(pgtbl == NULL); // alloc the root page table page at first
     
@@ -364,23 +542,61 @@ static int map_range_in_pgtbl_common(void *pgtbl, vaddr_t va, paddr_t pa,
         BUG_ON(ret != 0);
 
         // l1
+        if (can_map_block(va, pa, total_page_cnt, L1_PER_ENTRY_PAGES, flags, kind)
+            && set_block_pte(l1_ptp, L1, va, pa, flags, kind, rss) == 0) {
+            va += L1_PER_ENTRY_PAGES * PAGE_SIZE;
+            pa += L1_PER_ENTRY_PAGES * PAGE_SIZE;
+            total_page_cnt -= L1_PER_ENTRY_PAGES;
+            continue;
+        }
         ret = get_next_ptp(l1_ptp, L1, va, &l2_ptp, &pte, true, rss);
+        if (ret == BLOCK_PTP) {
+            split_block(pte, L1, va, rss);
+            ret = get_next_ptp(l1_ptp, L1, va, &l2_ptp, &pte, true, rss);
+        }
         BUG_ON(ret != 0);
 
         // l2
+        if (can_map_block(va, pa, total_page_cnt, L2_PER_ENTRY_PAGES, flags, kind)
+            && set_block_pte(l2_ptp, L2, va, pa, flags, kind, rss) == 0) {
+            va += L2_PER_ENTRY_PAGES * PAGE_SIZE;
+            pa += L2_PER_ENTRY_PAGES * PAGE_SIZE;
+            total_page_cnt -= L2_PER_ENTRY_PAGES;
+            continue;
+        }
         ret = get_next_ptp(l2_ptp, L2, va, &l3_ptp, &pte, true, rss);
+        if (ret == BLOCK_PTP) {
+            split_block(pte, L2, va, rss);
+            ret = get_next_ptp(l2_ptp, L2, va, &l3_ptp, &pte, true, rss);
+        }
         BUG_ON(ret != 0);
 
         // l3
         // step-1: get the index of pte
         pte_index = GET_L3_INDEX(va);
+        cont = false;
         for (i = pte_index; i < PTP_ENTRIES; ++i) {
             pte_t new_pte_val;
 
+            /*
+             * Map each aligned run of L3_CONT_PTES pages with the
+             * contiguous hint if possible. Either way, the old entries
+             * of the run are invalidated first if they are replaced by
+             * a contiguous run or if part of a contiguous run changes.
+             */
+            if (i % L3_CONT_PTES == 0) {
+                cont = can_map_block(va, pa, total_page_cnt, L3_CONT_PTES, flags, kind);
+                if (cont)
+                    break_cont_run(l3_ptp, i, va);
+            }
+            if (!cont && l3_ptp->ent[i].l3_page.Contiguous)
+                split_cont_ptes(l3_ptp, i, va);
+
             new_pte_val.pte = 0;
             new_pte_val.l3_page.is_valid = 1;
             new_pte_val.l3_page.is_page = 1;
             new_pte_val.l3_page.pfn = pa >> PAGE_SHIFT;
+            new_pte_val.l3_page.Contiguous = cont ? 1 : 0;
             set_pte_flags(&new_pte_val, flags, kind);
             l3_ptp->ent[i].pte = new_pte_val.pte;
 
@@ -395,7 +611,10 @@ static int map_range_in_pgtbl_common(void *pgtbl, vaddr_t va, paddr_t pa,
         }
     }
 
-    /* Since we are adding new mappings, there is no need to flush TLBs. */
+    /*
+     * Since we are adding new mappings, there is no need to flush TLBs,
+     * except for the replaced contiguous runs (see break_cont_run).
+     */
     return 0;
 }
 
@@ -464,6 +683,7 @@ int unmap_range_in_pgtbl(void *pgtbl, vaddr_t va, size_t len, long *rss)
     int ret;
     int pte_index; // the index of pte in the last level page table
     int i;
+    bool whole;
 
     BUG_ON(pgtbl == NULL);
 
@@ -498,6 +718,19 @@ int unmap_range_in_pgtbl(void *pgtbl, vaddr_t va, size_t len, long *rss)
                                    left_page_cnt_in_current_level);
             va += left_page_cnt_in_current_level * PAGE_SIZE;
             continue;
+        } else if (ret == BLOCK_PTP) {
+            /* Remove the whole 1G block, or split it for partial unmap */
+            if (range_covers_block(va, total_page_cnt, L1_PER_ENTRY_PAGES)) {
+                pte->pte = PTE_DESCRIPTOR_INVALID;
+                if (rss)
+                    *rss -= L1_PER_ENTRY_PAGES * PAGE_SIZE;
+                try_release_ptp(l0_ptp, l1_ptp, GET_L0_INDEX(va), rss);
+                total_page_cnt -= L1_PER_ENTRY_PAGES;
+                va += L1_PER_ENTRY_PAGES * PAGE_SIZE;
+                continue;
+            }
+            split_block(pte, L1, va, rss);
+            ret = get_next_ptp(l1_ptp, L1, va, &l2_ptp, &pte, false, NULL);
         }
 
         // l2
@@ -510,12 +743,33 @@ int unmap_range_in_pgtbl(void *pgtbl, vaddr_t va, size_t len, long *rss)
                                    left_page_cnt_in_current_level);
             va += left_page_cnt_in_current_level * PAGE_SIZE;
             continue;
+        } else if (ret == BLOCK_PTP) {
+            /* Remove the whole 2M block, or split it for partial unmap */
+            if (range_covers_block(va, total_page_cnt, L2_PER_ENTRY_PAGES)) {
+                pte->pte = PTE_DESCRIPTOR_INVALID;
+                if (rss)
+                    *rss -= L2_PER_ENTRY_PAGES * PAGE_SIZE;
+                if (try_release_ptp(l1_ptp, l2_ptp, GET_L1_INDEX(va), rss))
+                    try_release_ptp(l0_ptp, l1_ptp, GET_L0_INDEX(va), rss);
+                total_page_cnt -= L2_PER_ENTRY_PAGES;
+                va += L2_PER_ENTRY_PAGES * PAGE_SIZE;
+                continue;
+            }
+            split_block(pte, L2, va, rss);
+            ret = get_next_ptp(l2_ptp, L2, va, &l3_ptp, &pte, false, NULL);
         }
 
         // l3
         // step-1: get the index of pte
         pte_index = GET_L3_INDEX(va);
+        whole = false;
         for (i = pte_index; i < PTP_ENTRIES; ++i) {
+            /* Break a contiguous run which is only partially unmapped */
+            if (i % L3_CONT_PTES == 0)
+                whole = range_covers_block(va, total_page_cnt, L3_CONT_PTES);
+            if (!whole && l3_ptp->ent[i].l3_page.Contiguous)
+                split_cont_ptes(l3_ptp, i, va);
+
             if (l3_ptp->ent[i].l3_page.is_valid && rss)
                 *rss -= PAGE_SIZE;
             l3_ptp->ent[i].pte = PTE_DESCRIPTOR_INVALID;
@@ -530,7 +784,8 @@ int unmap_range_in_pgtbl(void *pgtbl, vaddr_t va, size_t len, long *rss)
     return 0;
 }
 
-int mprotect_in_pgtbl(void *pgtbl, vaddr_t va, size_t len, vmr_prop_t flags)
+int mprotect_in_pgtbl(void *pgtbl, vaddr_t va, size_t len, vmr_prop_t flags,
+                      long *rss)
 {
     s64 total_page_cnt; // must be signed
     ptp_t *l0_ptp, *l1_ptp, *l2_ptp, *l3_ptp;
@@ -538,6 +793,7 @@ int mprotect_in_pgtbl(void *pgtbl, vaddr_t va, size_t len, vmr_prop_t flags)
     int ret;
     int pte_index; // the index of pte in the last level page table
     int i;
+    bool whole;
 
     BUG_ON(pgtbl == NULL);
 
@@ -560,6 +816,16 @@ int mprotect_in_pgtbl(void *pgtbl, vaddr_t va, size_t len, vmr_prop_t flags)
             total_page_cnt -= L1_PER_ENTRY_PAGES;
             va += L1_PER_ENTRY_PAGES * PAGE_SIZE;
             continue;
+        } else if (ret == BLOCK_PTP) {
+            /* Change the whole 1G block, or split it for partial mprotect */
+            if (range_covers_block(va, total_page_cnt, L1_PER_ENTRY_PAGES)) {
+                set_pte_flags(pte, flags, USER_PTE);
+                total_page_cnt -= L1_PER_ENTRY_PAGES;
+                va += L1_PER_ENTRY_PAGES * PAGE_SIZE;
+                continue;
+            }
+            split_block(pte, L1, va, rss);
+            ret = get_next_ptp(l1_ptp, L1, va, &l2_ptp, &pte, false, NULL);
         }
 
         // l2
@@ -568,12 +834,32 @@ int mprotect_in_pgtbl(void *pgtbl, vaddr_t va, size_t len, vmr_prop_t flags)
             total_page_cnt -= L2_PER_ENTRY_PAGES;
             va += L2_PER_ENTRY_PAGES * PAGE_SIZE;
             continue;
+        } else if (ret == BLOCK_PTP) {
+            /* Change the whole 2M block, or split it for partial mprotect */
+            if (range_covers_block(va, total_page_cnt, L2_PER_ENTRY_PAGES)) {
+                set_pte_flags(pte, flags, USER_PTE);
+                total_page_cnt -= L2_PER_ENTRY_PAGES;
+                va += L2_PER_ENTRY_PAGES * PAGE_SIZE;
+                continue;
+            }
+            split_block(pte, L2, va, rss);
+            ret = get_next_ptp(l2_ptp, L2, va, &l3_ptp, &pte, false, NULL);
         }
 
         // l3
         // step-1: get the index of pte
         pte_index = GET_L3_INDEX(va);
+        whole = false;
         for (i = pte_index; i < PTP_ENTRIES; ++i) {
+            /*
+             * A contiguous run keeps its hint if all its PTEs get the
+             * same new permission. Otherwise, break the run first.
+             */
+            if (i % L3_CONT_PTES == 0)
+                whole = range_covers_block(va, total_page_cnt, L3_CONT_PTES);
+            if (!whole && l3_ptp->ent[i].l3_page.Contiguous)
+                split_cont_ptes(l3_ptp, i, va);
+
             /* Modify the permission in the pte if it exists */
             if (!IS_PTE_INVALID(l3_ptp->ent[i].pte))
                 set_pte_flags(&(l3_ptp->ent[i]), flags, USER_PTE);
@@ -615,6 +901,11 @@ void update_pte(pte_t *dest, unsigned int level, struct common_pte_t *src)
 {
     switch (level) {
     case L3:
+        /*
+         * CoW mappings never carry the contiguous hint (see
+         * can_map_block), so a single PTE can be updated in place.
+         */
+        BUG_ON(dest->l3_page.Contiguous);
         dest->l3_page.pfn = src->ppn;
         dest->l3_page.AP = __vmr_prot_to_ap(src->perm);
 
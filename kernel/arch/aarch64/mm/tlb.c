@@ -15,6 +15,7 @@
 #include <mm/vmspace.h>
 #include <mm/mm.h>
 #include <arch/sync.h>
+#include <arch/machine/smp.h>
 
 /*
  * Invalidate TLB template:
@@ -35,6 +36,16 @@ static void flush_tlb_by_asid(u64 asid)
     isb();
 }
 
+/* Flush tlbs only in the local core by asid. */
+static void flush_tlb_by_asid_local(u64 asid)
+{
+    /* non-sharable barrier: no other core is involved */
+    dsb(nshst);
+    asm volatile("tlbi aside1, %0\n" : : "r"(asid << TLBI_ASID_SHIFT) :);
+    dsb(nsh);
+    isb();
+}
+
 /* Flush tlbs of designated VAs. The asid info is encoded in @addr_arg. */
 static void flush_tlb_addr_asid(u64 addr_arg, u64 page_cnt)
 {
@@ -50,6 +61,20 @@ static void flush_tlb_addr_asid(u64 addr_arg, u64 page_cnt)
     isb();
 }
 
+/* Flush tlbs of designated VAs only in the local core. */
+static void flush_tlb_addr_asid_local(u64 addr_arg, u64 page_cnt)
+{
+    u64 i;
+
+    dsb(nshst);
+    for (i = 0; i < page_cnt; ++i) {
+        asm volatile("tlbi vae1, %0\n" : : "r"(addr_arg) :);
+        addr_arg++;
+    }
+    dsb(nsh);
+    isb();
+}
+
 /*
  * The arg for 'tlbi vae1is': | ASID | TTL | VA (virtual frame number) |.
  * If ARMv8.4-TTL is not supported, TTL should be 0.
@@ -64,19 +89,154 @@ static u64 get_tlbi_va_arg(vaddr_t addr, u64 asid)
     return arg;
 }
 
+/*
+ * Range TLB invalidation (ARMv8.4-TLBIRANGE).
+ * The arg for 'tlbi rvae1is':
+ * | ASID | TG | SCALE | NUM | TTL | BaseADDR (virtual frame number) |,
+ * which covers (NUM + 1) << (5 * SCALE + 1) pages from BaseADDR.
+ */
+#define TLBI_RANGE_TG_4K     (1UL << 46)
+#define TLBI_RANGE_SCALE_SHIFT 44
+#define TLBI_RANGE_NUM_SHIFT   39
+#define TLBI_RANGE_BADDR_MASK  ((1UL << 37) - 1)
+#define TLBI_RANGE_MAX_SCALE   3
+/* Ranges below this number of pages fit in SCALE 0..TLBI_RANGE_MAX_SCALE */
+#define TLBI_RANGE_MAX_PAGES \
+    (32UL << (5 * TLBI_RANGE_MAX_SCALE + 1))
 
-#define TLB_SHOOTDOWN_THRESHOLD 2
+/* ID_AA64ISAR0_EL1.TLB: 0b0010 means both TLBI outer-shareable and range */
+#define ID_AA64ISAR0_TLB_SHIFT 56
+#define ID_AA64ISAR0_TLB_RANGE 2
 
-static void do_flush_tlb_opt(vaddr_t start_va, u64 page_cnt, u64 asid)
+static int tlbi_range_supported = -1;
+
+static bool has_tlbi_range(void)
 {
-    /* flush tlbs in all the cpus */
-    if (page_cnt > TLB_SHOOTDOWN_THRESHOLD) {
-        /* Flush all the TLBs of the ASID in all the cpus */
-        flush_tlb_by_asid(asid);
-    } else {
+    u64 isar0;
+
+    /* Racing initializations are harmless as they get the same result. */
+    if (unlikely(tlbi_range_supported < 0)) {
+        asm volatile("mrs %0, id_aa64isar0_el1" : "=r"(isar0));
+        tlbi_range_supported =
+            ((isar0 >> ID_AA64ISAR0_TLB_SHIFT) & 0xf) >= ID_AA64ISAR0_TLB_RANGE;
+    }
+
+    return tlbi_range_supported;
+}
+
+/*
+ * Flush [start_va, start_va + page_cnt pages) of the ASID in all the cpus
+ * with as few range TLBIs as possible. Odd pages use 'tlbi vae1is'.
+ * 'tlbi rvae1is' is written as its 'sys' encoding so that it builds
+ * without an ARMv8.4 assembler.
+ */
+static void flush_tlb_range_asid(vaddr_t start_va, u64 page_cnt, u64 asid)
+{
+    u64 scale = 0, num, pages, arg;
+
+    dsb(ish);
+    while (page_cnt > 0) {
+        if (page_cnt % 2 == 1) {
+            arg = get_tlbi_va_arg(start_va, asid);
+            asm volatile("tlbi vae1is, %0\n" : : "r"(arg) :);
+            start_va += PAGE_SIZE;
+            page_cnt -= 1;
+            continue;
+        }
+
+        num = (page_cnt >> (5 * scale + 1)) & 0x1f;
+        if (num > 0) {
+            arg = asid << TLBI_ASID_SHIFT;
+            arg |= TLBI_RANGE_TG_4K;
+            arg |= scale << TLBI_RANGE_SCALE_SHIFT;
+            arg |= (num - 1) << TLBI_RANGE_NUM_SHIFT;
+            arg |= (start_va >> PAGE_SHIFT) & TLBI_RANGE_BADDR_MASK;
+            asm volatile("sys #0, c8, c2, #1, %0\n" : : "r"(arg) :);
+
+            pages = num << (5 * scale + 1);
+            start_va += pages * PAGE_SIZE;
+            page_cnt -= pages;
+        }
+        scale++;
+    }
+    dsb(ish);
+    isb();
+}
+
+/*
+ * Up to TLB_SHOOTDOWN_THRESHOLD pages are flushed one by one. Larger ranges
+ * are flushed with range TLBIs if supported, or else the whole ASID is
+ * flushed since the refills are cheaper than so many TLBIs.
+ */
+#ifndef TLB_SHOOTDOWN_THRESHOLD
+#define TLB_SHOOTDOWN_THRESHOLD 32
+#endif
+
+/*
+ * Whether the TLB entries of @vmspace can only reside in the local cpu,
+ * i.e., it has never run on the other cpus.
+ */
+static bool vmspace_only_on_local_cpu(struct vmspace *vmspace)
+{
+    u32 cpuid, i;
+
+    cpuid = smp_get_cpu_id();
+    /* Make the page table updates visible before checking the cpus */
+    dsb(ish);
+    for (i = 0; i < PLAT_CPU_NUM; ++i) {
+        if (i != cpuid && vmspace->history_cpus[i])
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * How flush_tlb_opt flushed, counted per cpu (the kernel is not preemptive,
+ * so no lock is needed). Broadcast flushes and whole-ASID flushes are the
+ * costly ones.
+ */
+enum tlb_flush_kind {
+    TLB_FLUSH_LOCAL_PAGES,
+    TLB_FLUSH_LOCAL_ASID,
+    TLB_FLUSH_PAGES,
+    TLB_FLUSH_RANGE,
+    TLB_FLUSH_ASID,
+    TLB_FLUSH_KINDS,
+};
+
+static unsigned long tlb_flush_stats[PLAT_CPU_NUM][TLB_FLUSH_KINDS];
+
+static void do_flush_tlb_opt(vaddr_t start_va, u64 page_cnt, u64 asid,
+                             bool local)
+{
+    enum tlb_flush_kind kind;
+
+    if (local) {
+        /* No broadcasting when no other cpu has run the vmspace */
+        if (page_cnt > TLB_SHOOTDOWN_THRESHOLD) {
+            flush_tlb_by_asid_local(asid);
+            kind = TLB_FLUSH_LOCAL_ASID;
+        } else {
+            flush_tlb_addr_asid_local(get_tlbi_va_arg(start_va, asid),
+                                      page_cnt);
+            kind = TLB_FLUSH_LOCAL_PAGES;
+        }
+    } else if (page_cnt <= TLB_SHOOTDOWN_THRESHOLD) {
         /* Flush each TLB entry one-by-one in all the cpus */
         flush_tlb_addr_asid(get_tlbi_va_arg(start_va, asid), page_cnt);
+        kind = TLB_FLUSH_PAGES;
+    } else if (has_tlbi_range() && page_cnt < TLBI_RANGE_MAX_PAGES) {
+        /* Flush the range with a few TLBIs in all the cpus */
+        flush_tlb_range_asid(start_va, page_cnt, asid);
+        kind = TLB_FLUSH_RANGE;
+    } else {
+        /* Flush all the TLBs of the ASID in all the cpus */
+        flush_tlb_by_asid(asid);
+        kind = TLB_FLUSH_ASID;
     }
+
+    tlb_flush_stats[smp_get_cpu_id()][kind] += 1;
 }
 
 /* Exposed functions */
@@ -97,7 +257,8 @@ void flush_tlb_opt(struct vmspace* vmspace, vaddr_t start_va, size_t len)
 
     asid = vmspace->pcid;
 
-    do_flush_tlb_opt(start_va, page_cnt, asid);
+    do_flush_tlb_opt(
+        start_va, page_cnt, asid, vmspace_only_on_local_cpu(vmspace));
 }
 
 void flush_tlb_by_range(struct vmspace* vmspace, vaddr_t start_va, size_t len)
@@ -114,7 +275,42 @@ void flush_tlb_all(void)
     isb();
 }
 
+/*
+ * Flush the TLB entries of [va, va + page_cnt pages) for all the ASIDs in
+ * all the cpus. Used for break-before-make when a block mapping or a
+ * contiguous run is split.
+ */
+void flush_tlb_by_range_all_asid(vaddr_t va, u64 page_cnt)
+{
+    u64 i;
+
+    dsb(ish);
+    for (i = 0; i < page_cnt; ++i) {
+        asm volatile("tlbi vaae1is, %0\n" : : "r"((va >> PAGE_SHIFT) + i) :);
+    }
+    dsb(ish);
+    isb();
+}
+
 void flush_tlb_by_vmspace(struct vmspace* vmspace)
 {
     flush_tlb_by_asid(vmspace->pcid);
 }
+
+void print_tlb_flush_stats(void)
+{
+    unsigned long *stats;
+    int cpuid;
+
+    for (cpuid = 0; cpuid < PLAT_CPU_NUM; cpuid++) {
+        stats = tlb_flush_stats[cpuid];
+        kinfo("tlb flush cpu %d: local pages %lu, local asid %lu, "
+              "pages %lu, range %lu, asid %lu\n",
+              cpuid,
+              stats[TLB_FLUSH_LOCAL_PAGES],
+              stats[TLB_FLUSH_LOCAL_ASID],
+              stats[TLB_FLUSH_PAGES],
+              stats[TLB_FLUSH_RANGE],
+              stats[TLB_FLUSH_ASID]);
+    }
+}
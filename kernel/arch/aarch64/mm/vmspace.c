@@ -13,6 +13,8 @@
 #include <mm/vmspace.h>
 #include <mm/kmalloc.h>
 #include <mm/mm.h>
+#include <arch/machine/smp.h>
+#include <arch/sync.h>
 
 /*
  * ASID:
@@ -46,6 +48,14 @@ void switch_vmspace_to(struct vmspace *vmspace)
 {
     paddr_t pa;
 
+    /*
+     * Any path loading the ASID may fill the TLB of the local cpu, so record
+     * it here for TLB maintainence (see vmspace_only_on_local_cpu). The
+     * record must be visible before any translation using the new ASID.
+     */
+    record_history_cpu(vmspace, smp_get_cpu_id());
+    dsb(ish);
+
     pa = virt_to_phys(vmspace->pgtbl);
     /* The upper 16 bits of TTBR0_EL1 represent ASID */
     pa |= (u64)(vmspace->pcid) << ASID_SHIFT;
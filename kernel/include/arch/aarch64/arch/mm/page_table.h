@@ -67,6 +67,12 @@
 #define L2_PER_ENTRY_PAGES ((PTP_ENTRIES) * (L3_PER_ENTRY_PAGES))
 #define L3_PER_ENTRY_PAGES (1)
 
+/*
+ * Number of L3 PTEs in one contiguous run (64K with 4K pages). The PTEs of
+ * such a run may carry the contiguous hint to share one TLB entry.
+ */
+#define L3_CONT_PTES (16)
+
 /* Bitmask used by GET_VA_OFFSET_Lx */
 #define L1_BLOCK_MASK ((L1_PER_ENTRY_PAGES << PAGE_SHIFT) - 1)
 #define L2_BLOCK_MASK ((L2_PER_ENTRY_PAGES << PAGE_SHIFT) - 1)
@@ -106,13 +112,13 @@ typedef union {
                     pfn             : 18,
                     reserved3       : 2,
                     GP              : 1,
-                    reserved4       : 1,
                     DBM             : 1,   // Dirty bit modifier
                     Contiguous      : 1,
                     PXN             : 1,   // Privileged execute-never
                     UXN             : 1,   // Execute never
                     soft_reserved   : 4,
-                    PBHA            : 4;   // Page based hardware attributes
+                    PBHA            : 4,   // Page based hardware attributes
+                    ignored         : 1;
         } l1_block;
         struct {
                 u64 is_valid        : 1,
@@ -129,13 +135,13 @@ typedef union {
                     pfn             : 27,
                     reserved3       : 2,
                     GP              : 1,
-                    reserved4       : 1,
                     DBM             : 1,   // Dirty bit modifier
                     Contiguous      : 1,
                     PXN             : 1,   // Privileged execute-never
                     UXN             : 1,   // Execute never
                     soft_reserved   : 4,
-                    PBHA            : 4;   // Page based hardware attributes
+                    PBHA            : 4,   // Page based hardware attributes
+                    ignored         : 1;
         } l2_block;
         struct {
                 u64 is_valid        : 1,
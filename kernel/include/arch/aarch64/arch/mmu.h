@@ -45,12 +45,14 @@ int map_range_in_pgtbl(void *pgtbl, vaddr_t va, paddr_t pa, size_t len,
                        vmr_prop_t flags, long *rss);
 int unmap_range_in_pgtbl(void *pgtbl, vaddr_t va, size_t len, long *rss);
 int query_in_pgtbl(void *pgtbl, vaddr_t va, paddr_t *pa, pte_t **entry);
-int mprotect_in_pgtbl(void *pgtbl, vaddr_t va, size_t len, vmr_prop_t prop);
+int mprotect_in_pgtbl(void *pgtbl, vaddr_t va, size_t len, vmr_prop_t prop,
+                      long *rss);
 void set_ttbr0_el1(paddr_t ttbr0);
 
 struct vmspace;
 void flush_tlb_opt(struct vmspace *vmspace, vaddr_t addr, size_t size);
 void flush_tlb_all(void);
+void flush_tlb_by_range_all_asid(vaddr_t va, u64 page_cnt);
 
 #ifdef CHCORE
 
@@ -22,4 +22,21 @@ static inline u64 get_cycles(void)
     return tsc;
 }
 
+/* The generic timer counter, which is usable before the PMU is enabled. */
+static inline u64 get_sys_counter(void)
+{
+    u64 cnt;
+
+    asm volatile("isb; mrs %0, cntvct_el0" : "=r"(cnt));
+    return cnt;
+}
+
+static inline u64 get_sys_counter_freq(void)
+{
+    u64 freq;
+
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+    return freq;
+}
+
 #endif /* ARCH_AARCH64_ARCH_TIME_H */
\ No newline at end of file
@@ -43,6 +43,13 @@
 #define MAX(x, y) ((x) < (y) ? (y) : (x))
 #define MIN(x, y) ((x) < (y) ? (x) : (y))
 
+/*
+ * Lock-free access to a variable written by another CPU: one untorn access
+ * which the compiler neither merges nor repeats. No ordering is implied.
+ */
+#define READ_ONCE(x)     (*(const volatile typeof(x) *)&(x))
+#define WRITE_ONCE(x, v) (*(volatile typeof(x) *)&(x) = (v))
+
 
 #define BUG_ON(expr)                                                        \
     do {                                                                    \
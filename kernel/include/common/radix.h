@@ -32,6 +32,7 @@ struct radix_node {
 };
 struct radix {
     struct radix_node *root;
+    /* Serializes the updates. Lookups are lock-free. */
     struct lock radix_lock;
     void (*value_deleter)(void *);
 };
@@ -40,10 +41,13 @@ struct radix {
 struct radix *new_radix(void);
 void init_radix(struct radix *radix);
 int radix_add(struct radix *radix, u64 key, void *value);
+int radix_add_range(struct radix *radix, u64 key, u64 nr, void *value,
+                    u64 stride);
 void *radix_get(struct radix *radix, u64 key);
 int radix_free(struct radix *radix);
 int radix_del(struct radix *radix, u64 key);
 
 void init_radix_w_deleter(struct radix *radix, void (*value_deleter)(void *));
+void print_radix_stats(void);
 
 #endif /* COMMON_RADIX_H */
\ No newline at end of file
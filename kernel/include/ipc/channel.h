@@ -28,6 +28,8 @@
 
 #define CH_CNT_MAX         2
 #define E_EX_TIMER_TIMEOUT 0xff
+/* sys_tee_msg_receive returns it on doorbells of the message rings */
+#define E_EX_RING_DOORBELL 0xfe
 
 enum message_msgtype {
     MSG_TYPE_INVALID = 0,
@@ -50,6 +52,8 @@ struct client_msg_record {
     void *ksend_buf, *recv_buf;
     size_t send_len, recv_len;
     struct thread *client;
+    /* client's priority, which orders the msg queue */
+    unsigned int prio;
 };
 
 /* server's ipc context */
@@ -67,16 +71,42 @@ struct msg_entry {
 
 enum channel_state { CHANNEL_VALID, CHANNEL_INVALID };
 
+/* The maximum number of rings attached but not accepted yet */
+#define CHANNEL_MAX_PENDING_RINGS 16
+
+/* A message ring attached by a client, see sys_tee_msg_attach_ring */
+struct ring_entry {
+    struct list_head node;
+    /* The cap of the ring PMO in the creater */
+    int pmo_cap;
+    /* The client attaching the ring, stamped by the kernel */
+    struct src_msginfo info;
+};
+
 struct channel {
     /* queue of waiting server threads */
     struct list_head thread_queue;
-    /* queue of message */
+    /* queue of message, sorted by priority */
     struct list_head msg_queue;
+    /* msg_hdls serving calls received from this channel */
+    struct list_head busy_list;
     struct lock lock;
     /* Only creater can receive at this channel */
     struct cap_group *creater;
     /* used to determine whether the channel is valid */
     int state;
+    /* Whether clients can attach message rings to this channel */
+    bool ring_enabled;
+    /* Rings attached by clients but not accepted by the creater yet */
+    struct list_head pending_rings;
+    unsigned int nr_pending_rings;
+    /* Doorbells rung since the creater last waited on the rings */
+    unsigned long ring_doorbells;
+    /*
+     * The creater's thread blocking in sys_tee_msg_ring_wait.
+     * Changed with both channel->lock and its sleep_state.queue_lock held.
+     */
+    struct thread *ring_waiter;
 };
 
 /* full context of current ipc */
@@ -85,11 +115,16 @@ struct msg_hdl {
     struct client_msg_record client_msg_record;
     struct server_msg_record server_msg_record;
     struct lock lock;
+    /* the channel of the call being served, NULL if none */
+    struct channel *channel;
+    struct list_head busy_node;
 };
 
 int close_channel(struct channel *channel, struct cap_group *cap_group);
 void channel_deinit(void *ptr);
 void msg_hdl_deinit(void *ptr);
+void channel_remove_ring_waiter(struct thread *thread);
+void print_channel_pi_stats(void);
 
 int sys_tee_msg_create_msg_hdl(void);
 
@@ -106,6 +141,11 @@ int sys_tee_msg_reply(int msg_hdl_cap, void *reply_buf, size_t reply_len);
 
 int sys_tee_msg_notify(int channel_cap, void *send_buf, size_t send_len);
 
+int sys_tee_msg_attach_ring(int channel_cap, int pmo_cap);
+int sys_tee_msg_ring_notify(int channel_cap);
+int sys_tee_msg_ring_wait(int channel_cap, int timeout);
+int sys_tee_msg_ring_accept(int channel_cap, struct src_msginfo *info);
+
 #endif /* CHCORE_OH_TEE */
 
 #endif /* IPC_CHANNEL_H */
\ No newline at end of file
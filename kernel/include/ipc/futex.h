@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2023 Institute of Parallel And Distributed Systems (IPADS), Shanghai Jiao Tong University (SJTU)
+ * Licensed under the Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *     http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR FIT FOR A PARTICULAR
+ * PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ */
+#ifndef IPC_FUTEX_H
+#define IPC_FUTEX_H
+
+#include <common/types.h>
+#include <common/list.h>
+#include <common/lock.h>
+
+/*
+ * Wait-on-address for threads of the same cap_group. A waiter is keyed by
+ * its cap_group and the user address, and queued in one of the hash buckets.
+ */
+#define FUTEX_HASH_BITS 8
+#define FUTEX_HASH_SIZE (1 << FUTEX_HASH_BITS)
+
+struct futex_bucket {
+    /* Protects waiters and the futex fields of the waiting threads */
+    struct lock lock;
+    struct list_head waiters;
+};
+
+struct thread;
+struct timespec;
+
+void futex_init(void);
+/* Dequeue an exiting thread which still waits on a futex */
+void futex_remove_waiter(struct thread *thread);
+/* Write the address a requeued thread waits on to its user variable */
+void futex_publish_requeue(struct thread *thread);
+void print_futex_stats(void);
+
+/* Syscalls */
+int sys_futex_wait(u32 *uaddr, u32 val, struct timespec *timeout,
+                   vaddr_t *uaddr_ptr);
+int sys_futex_wake(u32 *uaddr, int nr_wake);
+int sys_futex_requeue(u32 *uaddr, u32 *uaddr2, int nr_wake, int nr_requeue);
+
+#endif /* IPC_FUTEX_H */
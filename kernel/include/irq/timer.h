@@ -14,6 +14,7 @@
 
 #include <common/types.h>
 #include <common/list.h>
+#include <common/rbtree.h>
 #include <common/lock.h>
 #include <machine.h>
 
@@ -23,8 +24,8 @@ typedef void (*timer_cb)(struct thread *thread);
 
 /* Every thread has a sleep_state struct */
 struct sleep_state {
-    /* Link sleeping threads on each core */
-    struct list_head sleep_node;
+    /* Link sleeping threads on each core (sleep_tree) */
+    struct rb_node sleep_node;
     /* Time to wake up */
     u64 wakeup_tick;
     /* The cpu id where the thread is sleeping */
@@ -54,6 +55,23 @@ struct sleep_state {
 #define NS_IN_US (1000UL)
 #define US_IN_MS (1000UL)
 
+/* The longest timer interval (in ms) when the tick is stopped (tickless) */
+#ifndef TICKLESS_MAX_MS
+#define TICKLESS_MAX_MS 1000
+#endif
+
+/*
+ * A core with a stopped tick only notices a thread enqueued by another core
+ * if that core interrupts it with IPI_RESCHED. Platforms that can deliver
+ * such IPIs define PLAT_HAS_RESCHED_IPI in machine.h. Otherwise, the tick
+ * is only stopped on uniprocessor platforms, where no remote enqueue exists.
+ */
+#if defined(PLAT_HAS_RESCHED_IPI) || PLAT_CPU_NUM == 1
+#define TICKLESS_ENABLED 1
+#else
+#define TICKLESS_ENABLED 0
+#endif
+
 extern struct list_head sleep_lists[PLAT_CPU_NUM];
 extern u64 tick_per_us;
 int enqueue_sleeper(struct thread *thread, const struct timespec *timeout,
@@ -61,6 +79,13 @@ int enqueue_sleeper(struct thread *thread, const struct timespec *timeout,
 bool try_dequeue_sleeper(struct thread *thread);
 
 void timer_init(void);
+/* Tickless: interfaces for the scheduler */
+void timer_restart_tick(void);
+bool timer_tick_stopped(unsigned int cpuid);
+void timer_kick_cpu(unsigned int cpuid);
+u64 get_timer_irq_count(unsigned int cpuid);
+void get_timer_sleeper_count(unsigned int cpuid, unsigned long *cur,
+                             unsigned long *max);
 void plat_timer_init(void);
 void plat_set_next_timer(u64 tick_delta);
 void handle_timer_irq(void);
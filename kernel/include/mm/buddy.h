@@ -15,6 +15,7 @@
 #include <common/types.h>
 #include <common/list.h>
 #include <common/lock.h>
+#include <machine.h>
 
 #define N_PHYS_MEM_POOLS 8
 
@@ -55,6 +56,38 @@ struct free_list {
 /* One page size is 4K, so the order is 12. */
 #define BUDDY_PAGE_SIZE_ORDER (12)
 
+/*
+ * Per-CPU page caches (pcp) sit in front of the buddy free lists for small
+ * orders: [0, PCP_MAX_ORDER]. Chunks in a pcp list are still marked as
+ * allocated in the buddy system, so they never merge with their buddies.
+ *
+ * An empty pcp list is refilled with @low chunks under one acquisition of
+ * buddy_lock, and a pcp list holding more than @high chunks is drained back
+ * to @low. Both watermarks are counted in 4K pages and scaled by the order.
+ *
+ * A pcp is almost only used by its own CPU, so its lock is uncontended
+ * except when it is drained by another CPU running out of memory.
+ */
+#define PCP_MAX_ORDER    (3)
+#define PCP_NR_ORDERS    (PCP_MAX_ORDER + 1)
+#define PCP_DEFAULT_HIGH (128)
+#define PCP_DEFAULT_LOW  (32)
+
+struct per_cpu_pages {
+    /* Lock order: pcp->lock -> buddy_lock */
+    struct lock lock;
+    struct list_head lists[PCP_NR_ORDERS];
+    unsigned long count[PCP_NR_ORDERS];
+    /*
+     * Statistics: refills and drains are the only acquisitions of
+     * buddy_lock for small orders, so (refills + drains) / allocs is the
+     * share of allocations still hitting the global lock.
+     */
+    unsigned long nr_allocs;
+    unsigned long nr_refills;
+    unsigned long nr_drains;
+} __attribute__((aligned(64)));
+
 /* Each physical memory chunk can be represented by one physical memory pool. */
 struct phys_mem_pool {
     /*
@@ -76,6 +109,11 @@ struct phys_mem_pool {
     /* The free list of different free-memory-chunk orders. */
     struct free_list free_lists[BUDDY_MAX_ORDER];
 
+    /* Per-CPU caches of small chunks and their watermarks (in pages). */
+    struct per_cpu_pages pcp[PLAT_CPU_NUM];
+    unsigned long pcp_high;
+    unsigned long pcp_low;
+
     /*
      * This field is only used in ChCore unit test.
      * The number of (4k) physical pages in this physical memory pool.
@@ -94,6 +132,12 @@ void init_buddy(struct phys_mem_pool *, struct page *start_page,
 struct page *buddy_get_pages(struct phys_mem_pool *, int order);
 void buddy_free_pages(struct phys_mem_pool *, struct page *page);
 
+void buddy_split_allocated(struct page *page);
+void buddy_set_pcp_watermark(struct phys_mem_pool *, unsigned long high,
+                             unsigned long low);
+void buddy_drain_pcp(struct phys_mem_pool *);
+void buddy_print_pcp_stats(struct phys_mem_pool *);
+
 void *page_to_virt(struct page *page);
 struct page *virt_to_page(void *ptr);
 unsigned long get_free_mem_size_from_buddy(struct phys_mem_pool *);
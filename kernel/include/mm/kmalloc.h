@@ -24,11 +24,26 @@ void kfree(void *ptr);
 
 /* Return vaddr of (1 << order) continous free physical pages */
 void *get_pages(int order);
+/* Quiet and cheap get_pages for callers with a fallback */
+void *try_get_pages(int order);
 void free_pages(void *addr);
+void split_pages(void *addr);
 
 void get_mem_usage_msg(void);
 
 void free_pages_without_record(void *addr);
 void get_mem_usage_msg(void);
 
+/* Pool of pre-zeroed chunks refilled by idle CPUs. */
+#define ZEROED_MAX_ORDER  (4)
+#define ZEROED_POOL_PAGES (32)
+
+void init_zeroed_pages(void);
+void *get_zeroed_pages(int order);
+void *try_get_zeroed_pages(int order);
+bool refill_zeroed_pages(void);
+void drain_zeroed_pages(void);
+unsigned long get_free_mem_size_from_zeroed_pages(void);
+void print_zeroed_pages_usage(void);
+
 #endif /* MM_KMALLOC_H */
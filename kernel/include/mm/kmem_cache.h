@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2023 Institute of Parallel And Distributed Systems (IPADS), Shanghai Jiao Tong University (SJTU)
+ * Licensed under the Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *     http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR FIT FOR A PARTICULAR
+ * PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ */
+#ifndef MM_KMEM_CACHE_H
+#define MM_KMEM_CACHE_H
+
+#include <common/types.h>
+#include <common/list.h>
+#include <common/lock.h>
+#include <machine.h>
+#include <mm/slab.h>
+
+/*
+ * A kmem_cache hands out objects of one exact size. Its slabs are carved
+ * from the buddy system like the generic slabs, but each slab starts with a
+ * struct kmem_slab and the objects are shifted by a per-slab colour so that
+ * objects of different slabs do not compete for the same cache sets.
+ */
+#define KMEM_CACHE_NAME_LEN 16
+/* The order of a slab is in [0, KMEM_SLAB_MAX_ORDER]. */
+#define KMEM_SLAB_MAX_ORDER 3
+/* A slab should hold at least so many objects if the size permits. */
+#define KMEM_SLAB_MIN_OBJS 8
+/* slab_header.order of a slab owned by a kmem_cache. */
+#define KMEM_SLAB_ORDER (-1)
+
+typedef void (*kmem_ctor_t)(void *obj);
+
+struct kmem_cache {
+    char name[KMEM_CACHE_NAME_LEN];
+    /* Size of one object, i.e., the stride between two slots. */
+    unsigned long obj_size;
+    unsigned long align;
+    /* Size of one slab in bytes and the number of objects in it. */
+    unsigned long slab_size;
+    unsigned long objs_per_slab;
+    /* Offset of the first object without colouring. */
+    unsigned long objs_offset;
+    /* Colouring: offset of the first object is colour_next * align. */
+    unsigned long colour_num;
+    unsigned long colour_next;
+    /* Optional, invoked on each object before it is returned (no zalloc). */
+    kmem_ctor_t ctor;
+
+    /* Protects slabs and the statistics below. */
+    struct lock lock;
+    struct slab_pointer slabs;
+    unsigned long nr_slabs;
+
+    struct slab_magazine mags[PLAT_CPU_NUM];
+
+    /* As one node of the global cache list. */
+    struct list_head node;
+};
+
+/* struct kmem_slab resides in the beginning of each slab of a kmem_cache. */
+struct kmem_slab {
+    struct slab_header header;
+    struct kmem_cache *cache;
+};
+
+struct kmem_cache *kmem_cache_create(const char *name, unsigned long size,
+                                     unsigned long align, kmem_ctor_t ctor);
+void *kmem_cache_alloc(struct kmem_cache *cache);
+void *kmem_cache_zalloc(struct kmem_cache *cache);
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+
+void kmem_cache_get_usage(struct kmem_cache *cache, unsigned long *total_objs,
+                          unsigned long *free_objs);
+void kmem_cache_print_usage(void);
+unsigned long get_free_mem_size_from_kmem_caches(void);
+
+#endif /* MM_KMEM_CACHE_H */
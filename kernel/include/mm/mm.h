@@ -33,6 +33,7 @@ unsigned long get_free_mem_size(void);
 void set_page_table(paddr_t pgtbl);
 void flush_tlb_by_range(struct vmspace *, vaddr_t start_va, size_t size);
 void flush_tlb_by_vmspace(struct vmspace *);
+void print_tlb_flush_stats(void);
 void flush_idcache(void);
 
 #ifdef CHCORE_ENABLE_TZASC_CMA
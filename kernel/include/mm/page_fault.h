@@ -16,6 +16,15 @@
 #include <common/types.h>
 #include <arch/mmu.h>
 
+/*
+ * On a translation fault on PMO_ANONYM/PMO_SHM, up to FAULT_AROUND_PAGES
+ * uncommitted pages in the aligned window around the faulting page are
+ * populated at once. Set it to 1 to disable fault-around.
+ */
+#ifndef FAULT_AROUND_PAGES
+#define FAULT_AROUND_PAGES 16
+#endif
+
 int handle_trans_fault(struct vmspace *vmspace, vaddr_t fault_addr);
 
 int handle_perm_fault(struct vmspace *vmspace, vaddr_t fault_addr,
@@ -13,6 +13,7 @@
 #define MM_SLAB_H
 
 #include <common/list.h>
+#include <common/lock.h>
 
 /*
  * order range: [SLAB_MIN_ORDER, SLAB_MAX_ORDER]
@@ -46,10 +47,30 @@ struct slab_pointer {
     struct list_head partial_slab_list;
 };
 
+/*
+ * Per-CPU magazine of free objects for one order.
+ * The common alloc/free only touches the magazine of the local CPU and never
+ * takes slabs_locks. An empty magazine is refilled with SLAB_MAG_BATCH objects
+ * from the slabs, and a full one flushes SLAB_MAG_BATCH objects back.
+ *
+ * A magazine is almost only used by its own CPU, so its lock is uncontended
+ * except when it is drained by another CPU running out of memory.
+ */
+#define SLAB_MAG_SIZE  (32)
+#define SLAB_MAG_BATCH (SLAB_MAG_SIZE / 2)
+
+struct slab_magazine {
+    /* Lock order: mag->lock -> slabs_locks / kmem_cache->lock */
+    struct lock lock;
+    unsigned long count;
+    void *objs[SLAB_MAG_SIZE];
+} __attribute__((aligned(64)));
+
 /* All interfaces are kernel/mm module internal interfaces. */
 void init_slab(void);
 void *alloc_in_slab(unsigned long, size_t *);
 void free_in_slab(void *addr);
 unsigned long get_free_mem_size_from_slab(void);
+void slab_drain_magazines(void);
 
 #endif /* MM_SLAB_H */
\ No newline at end of file
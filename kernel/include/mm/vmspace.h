@@ -29,6 +29,13 @@ struct vmregion {
     vmr_prop_t perm;
     struct pmobject *pmo;
     struct list_head cow_private_pages;
+
+    /*
+     * Serializes populating this vmr (committing pages to its pmo and
+     * recording CoW pages), so that faults on different vmrs of the same
+     * vmspace can proceed in parallel.
+     */
+    struct lock vmr_lock;
 };
 
 /* This struct represents one virtual address space */
@@ -43,8 +50,12 @@ struct vmspace {
     /* Address space ID for avoiding TLB conflicts */
     unsigned long pcid;
 
-    /* The lock for manipulating vmregions */
-    struct lock vmspace_lock;
+    /*
+     * The lock for manipulating vmregions.
+     * Page faults only look up the vmr_tree, so they take the read lock
+     * while adding/removing/resizing vmregions takes the write lock.
+     */
+    struct rwlock vmspace_lock;
     /* The lock for manipulating the page table */
     struct lock pgtbl_lock;
 
@@ -58,9 +69,22 @@ struct vmspace {
 
     /* Records size of memory mapped. Protected by pgtbl_lock. */
     unsigned long rss;
+
+    /*
+     * Translation faults handled on anonymous/shared PMOs and the pages
+     * populated by them (including fault-around). Protected by pgtbl_lock.
+     */
+    unsigned long nr_faults;
+    unsigned long nr_fault_pages;
+    /*
+     * Faults which waited for another fault committing pages of the same
+     * pmo, i.e., the ones not handled in parallel. Protected by pgtbl_lock.
+     */
+    unsigned long nr_fault_waits;
 };
 
 /* Interfaces on vmspace management */
+void init_vmregion_cache(void);
 int vmspace_init(struct vmspace *vmspace, unsigned long pcid);
 void vmspace_deinit(void *ptr);
 void plat_vmspace_init(struct vmspace *vmspace);
@@ -48,7 +48,10 @@ struct slot_table {
      */
     unsigned long *full_slots_bmp;
     unsigned long *slots_bmp;
-    /* XXX: Protect mapping of slot_id to slot. Maybe RCU is more suitable */
+    /*
+     * Serialize the changes of the table. Lookups (get_opaque) do not take
+     * it, see cap_sync_readers.
+     */
     struct rwlock table_guard;
 };
 
@@ -114,12 +117,23 @@ static inline void install_slot(struct cap_group *cap_group, cap_t slot_id,
                                 struct object_slot *slot)
 {
     BUG_ON(!get_bit(slot_id, cap_group->slot_table.slots_bmp));
+    /* Lockless lookups see an initialized slot */
+    smp_wmb();
     cap_group->slot_table.slots[slot_id] = slot;
 }
 
 void *get_opaque(struct cap_group *cap_group, cap_t slot_id, bool type_valid,
                  int type);
 
+/*
+ * Lookups run without table_guard, in a short read-side section marked by a
+ * per-CPU sequence. After unpublishing a slot or a slots array, a writer
+ * calls cap_sync_readers to wait for the lookups which may still see it,
+ * before freeing it or dropping the reference held by the slot.
+ */
+void cap_sync_readers(void);
+void print_cap_lookup_stats(void);
+
 int __cap_free(struct cap_group *cap_group, cap_t slot_id,
                bool slot_table_locked, bool copies_list_locked);
 
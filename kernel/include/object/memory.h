@@ -71,6 +71,12 @@ struct pmobject {
     pmo_type_t type;
     /* record physical pages for on-demand-paging pmo */
     struct radix *radix;
+    /*
+     * Serializes looking up and committing pages in radix: one pmo can be
+     * mapped by several vmrs (possibly in different vmspaces), which may
+     * fault on the same page concurrently.
+     */
+    struct lock commit_lock;
     /*
      * The field of 'private' depends on 'type'.
      * PMO_FILE: it points to fmap_fault_pool
@@ -87,6 +93,8 @@ struct pmobject {
 cap_t create_pmo(size_t size, pmo_type_t type, struct cap_group *cap_group,
                  paddr_t paddr, struct pmobject **new_pmo);
 void commit_page_to_pmo(struct pmobject *pmo, unsigned long index, paddr_t pa);
+void commit_pages_to_pmo(struct pmobject *pmo, unsigned long index, paddr_t pa,
+                         unsigned long nr_pages);
 paddr_t get_page_from_pmo(struct pmobject *pmo, unsigned long index);
 int map_pmo_in_current_cap_group(cap_t pmo_cap, unsigned long addr,
                                  unsigned long perm);
@@ -107,6 +115,7 @@ int sys_unmap_pmo(cap_t target_cap_group_cap, cap_t pmo_cap,
 unsigned long sys_handle_brk(unsigned long addr, unsigned long heap_start);
 int sys_handle_mprotect(unsigned long addr, unsigned long length, int prot);
 unsigned long sys_get_free_mem_size(void);
+void sys_get_mem_usage_msg(void);
 int sys_tee_create_ns_pmo(unsigned long paddr, unsigned long size);
 
 #ifdef CHCORE_OH_TEE
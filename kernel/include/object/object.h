@@ -61,6 +61,7 @@ void *obj_get(struct cap_group *cap_group, cap_t slot_id, int type);
 void obj_put(void *obj);
 void obj_ref(void *obj);
 
+void obj_cache_init(void);
 void *obj_alloc(u64 type, u64 size);
 void obj_free(void *obj);
 void free_object_internal(struct object *object);
@@ -68,6 +69,12 @@ cap_t cap_alloc(struct cap_group *cap_group, void *obj);
 int cap_free(struct cap_group *cap_group, cap_t slot_id);
 cap_t cap_copy(struct cap_group *src_cap_group,
                struct cap_group *dest_cap_group, cap_t src_slot_id);
+/* The maximum number of caps copied by one cap_copy_batch */
+#define CAP_COPY_BATCH_MAX 16
+int cap_copy_batch(struct cap_group *src_cap_group,
+                   struct cap_group *dest_cap_group, const cap_t *src_slot_ids,
+                   cap_t *dest_slot_ids, int nr);
+void print_cap_copy_stats(void);
 
 int cap_free_all(struct cap_group *cap_group, cap_t slot_id);
 
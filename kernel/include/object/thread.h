@@ -35,6 +35,7 @@
 
 struct thread {
     struct list_head node; // link threads in a same cap_group
+    struct list_head all_threads_node; // link all the non-idle threads
     struct list_head ready_queue_node; // link threads in a ready queue
     struct list_head
         notification_queue_node; // link threads in a notification waiting queue
@@ -66,11 +67,50 @@ struct thread {
     void *general_ipc_config;
 
     struct sleep_state sleep_state;
+
+    /* Waiting on a futex, protected by the lock of futex_bucket */
+    struct list_head futex_node;
+    struct futex_bucket *futex_bucket;
+    vaddr_t futex_uaddr;
+    /* User variable updated with the new uaddr on requeue, may be NULL */
+    vaddr_t *futex_uaddr_ptr;
+    /*
+     * The uaddr the thread was last requeued to, if not 0. It is written to
+     * futex_uaddr_ptr by switch_context once the thread runs again, in its
+     * own vmspace and without any futex lock held.
+     */
+    vaddr_t futex_requeued_uaddr;
+
+#ifdef CHCORE_OH_TEE
+    /*
+     * Priority inheritance through channels, protected by pi_lock.
+     * The pending call of this thread is either queued in call_channel
+     * or being served with call_msg_hdl.
+     */
+    struct lock pi_lock;
+    struct channel *call_channel;
+    struct msg_hdl *call_msg_hdl;
+    /* Number of calls received but not replied yet */
+    unsigned int nr_served_calls;
+    /* The priority before being boosted (valid if prio_boosted) */
+    unsigned int base_prio;
+    bool prio_boosted;
+    /*
+     * The channel whose rings this thread waits for, protected by
+     * sleep_state.queue_lock. It holds a reference of the channel.
+     */
+    struct channel *ring_channel;
+#endif /* CHCORE_OH_TEE */
 };
 
 extern struct thread *current_threads[PLAT_CPU_NUM];
 extern struct thread idle_threads[PLAT_CPU_NUM];
 
+/* All the non-idle threads, which are only walked for statistics (sys_top) */
+extern struct list_head all_threads;
+extern unsigned int all_threads_cnt;
+extern struct lock all_threads_lock;
+
 /* Used for creating the root thread */
 extern const char binary_procmgr_bin_start;
 extern const unsigned long binary_procmgr_bin_size;
@@ -23,6 +23,22 @@ typedef struct sched_context {
     unsigned int prio;
 } sched_ctx_t;
 
+/* Scheduling statistics of a thread, in the ticks of the arch counter */
+struct sched_stat {
+    /* Total time spent running */
+    u64 runtime;
+    /* Number of times switched in */
+    u64 nr_switches;
+    /* When the thread was switched in last time */
+    u64 last_run;
+    /* When the thread became ready, 0 if it is not waiting in a ready queue */
+    u64 ready_time;
+    /* Wakeup latency: from being enqueued to running */
+    u64 max_wakeup_latency;
+    u64 total_wakeup_latency;
+    u64 nr_wakeups;
+};
+
 /* Thread context */
 struct thread_ctx {
     /* Arch-dependent */
@@ -46,10 +62,14 @@ struct thread_ctx {
     int affinity;
     /* Current Assigned CPU */
     unsigned int cpuid;
+    /* Priority of the ready queue holding the thread (PBRR) */
+    unsigned int ready_prio;
     /* Thread kernel stack state */
     volatile unsigned int kernel_stack_state;
     /* Thread exit state */
     volatile unsigned int thread_exit_state;
+    /* Scheduling statistics (only updated by the running CPU) */
+    struct sched_stat stat;
 } __attribute__((aligned(CACHELINE_SZ)));
 
 struct thread;
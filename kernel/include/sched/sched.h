@@ -15,6 +15,7 @@
 #include <sched/context.h>
 #include <common/list.h>
 #include <machine.h>
+#include <arch/time.h>
 
 /* BUDGET represents the number of TICKs */
 #define DEFAULT_BUDGET 1
@@ -70,10 +71,47 @@ struct sched_ops {
     int (*sched)(void);
     int (*sched_enqueue)(struct thread *thread);
     int (*sched_dequeue)(struct thread *thread);
+    /*
+     * Optional: whether the local CPU needs the periodic tick.
+     * The tick is always kept if it is not provided.
+     */
+    bool (*sched_tick_needed)(void);
+    /*
+     * Optional: move a ready thread to the queue of its new priority,
+     * keeping it on the same CPU. Without it, a new priority only takes
+     * effect when the thread is enqueued next time.
+     */
+    void (*sched_requeue)(struct thread *thread);
     /* Debug tools */
     void (*sched_top)(void);
 };
 
+/*
+ * Snapshot returned by sys_top (shared with user space).
+ * All the times are in nanoseconds.
+ */
+#define TOP_NAME_LEN 32
+
+struct top_cpu_info {
+    unsigned long nr_switches;
+    unsigned long idle_time;
+    unsigned long max_wakeup_latency;
+    unsigned long avg_wakeup_latency;
+};
+
+struct top_thread_info {
+    badge_t badge;
+    unsigned int type;
+    unsigned int state;
+    unsigned int prio;
+    unsigned int cpuid;
+    unsigned long runtime;
+    unsigned long nr_switches;
+    unsigned long max_wakeup_latency;
+    unsigned long avg_wakeup_latency;
+    char name[TOP_NAME_LEN];
+};
+
 /* Provided Scheduling Policies */
 extern struct sched_ops pbrr; /* Priority Based Round Robin */
 extern struct sched_ops rr; /* Simple Round Robin */
@@ -112,6 +150,8 @@ void sched_to_thread(struct thread *target);
 void add_pending_resched(unsigned int cpuid);
 /* Wait until the kernel stack of target thread is free */
 void wait_for_kernel_stack(struct thread *thread);
+/* Change the priority of a thread which may be ready on any CPU */
+void sched_set_prio(struct thread *thread, unsigned int prio);
 
 int sched_init(struct sched_ops *sched_ops);
 
@@ -130,8 +170,21 @@ static inline int sched_dequeue(struct thread *thread)
     return cur_sched_ops->sched_dequeue(thread);
 }
 
+/* Invoked by the policies when @thread is put into a ready queue */
+static inline void sched_stat_ready(struct thread_ctx *ctx)
+{
+    ctx->stat.ready_time = get_sys_counter();
+}
+
+static inline bool sched_tick_needed(void)
+{
+    return cur_sched_ops->sched_tick_needed == NULL
+           || cur_sched_ops->sched_tick_needed();
+}
+
 /* Syscalls */
 void sys_yield(void);
-void sys_top(void);
+int sys_top(unsigned long cpu_buf, unsigned int nr_cpus,
+            unsigned long thread_buf, unsigned int nr_threads);
 
 #endif /* SCHED_SCHED_H */
\ No newline at end of file
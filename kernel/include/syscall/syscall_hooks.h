@@ -17,6 +17,7 @@
 /* sys_create_device_pmo is provided for user-level drivers only. */
 int hook_sys_create_device_pmo(unsigned long paddr, unsigned long size);
 int hook_sys_get_phys_addr(vaddr_t va, paddr_t *pa_buf);
+int hook_sys_top(void);
 int hook_sys_create_cap_group(unsigned long cap_group_args_p);
 int hook_sys_register_recycle(cap_t notifc_cap, vaddr_t msg_buffer);
 int hook_sys_cap_group_recycle(cap_t cap_group_cap);
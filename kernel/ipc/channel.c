@@ -13,10 +13,271 @@
 #include <sched/sched.h>
 #include <mm/uaccess.h>
 #include <common/util.h>
+#include <irq/timer.h>
 
 #define GTASK_PID (4)
 #define GTASK_TID (0xa)
 
+/* The maximum length of a boosting chain, e.g., TA -> service -> driver */
+#define PI_MAX_DEPTH 8
+
+/*
+ * Priority inheritance: a thread serving a call runs at least at the priority
+ * of the caller, and so do the threads serving a channel with queued calls.
+ * Boosts are propagated along the chain of calls in which the boosted thread
+ * is blocked.
+ *
+ * Lock order: channel->lock -> msg_hdl->lock -> thread->pi_lock.
+ * Locks along a chain are only tried, which avoids deadlocks at the cost of
+ * a best-effort propagation under contention.
+ */
+
+/* Per-CPU counters of the boosts, printed by print_channel_pi_stats */
+struct pi_stats {
+    /* Threads raised to a caller's priority */
+    unsigned long nr_boosts;
+    /* Boosts passed on along a chain of calls (depth > 0) */
+    unsigned long nr_chain_boosts;
+    /* Chain hops given up because a lock was contended */
+    unsigned long nr_chain_skips;
+};
+
+static struct pi_stats pi_stats[PLAT_CPU_NUM];
+
+/* The identity of the current thread delivered with its messages */
+static void fill_src_msginfo(struct src_msginfo *info, u16 msg_type)
+{
+    info->msg_type = msg_type;
+    info->src_pid = current_cap_group->pid;
+    info->src_tid = current_thread->cap;
+    if (current_cap_group->pid == GTASK_PID
+        && current_thread->cap == GTASK_TID) {
+        info->src_pid = 0;
+        info->src_tid = 0;
+    }
+}
+
+static unsigned int thread_prio(struct thread *thread)
+{
+    return thread->thread_ctx->sc ? thread->thread_ctx->sc->prio : 0;
+}
+
+/* Block on the first hop and only try the locks along a chain */
+static int pi_lock_thread(struct thread *thread, int depth)
+{
+    if (depth == 0) {
+        lock(&thread->pi_lock);
+        return 0;
+    }
+    if (try_lock(&thread->pi_lock) != 0) {
+        pi_stats[smp_get_cpu_id()].nr_chain_skips++;
+        return -1;
+    }
+    return 0;
+}
+
+/* Keep msg_queue sorted by priority and FIFO among the same priority */
+static void msg_queue_insert(struct channel *channel,
+                             struct msg_entry *msg_entry)
+{
+    struct msg_entry *iter;
+    unsigned int prio = msg_entry->client_msg_record.prio;
+
+    for_each_in_list (
+        iter, struct msg_entry, msg_queue_node, &channel->msg_queue) {
+        if (iter->client_msg_record.prio < prio) {
+            list_add(&msg_entry->msg_queue_node, iter->msg_queue_node.prev);
+            return;
+        }
+    }
+    list_append(&msg_entry->msg_queue_node, &channel->msg_queue);
+}
+
+/* Move the queued call of @client forward after it is boosted */
+static void msg_queue_requeue(struct channel *channel, struct thread *client,
+                              unsigned int prio)
+{
+    struct msg_entry *msg_entry;
+
+    for_each_in_list (
+        msg_entry, struct msg_entry, msg_queue_node, &channel->msg_queue) {
+        if (msg_entry->client_msg_record.client == client
+            && msg_entry->client_msg_record.info.msg_type == MSG_TYPE_CALL) {
+            if (msg_entry->client_msg_record.prio < prio) {
+                list_del(&msg_entry->msg_queue_node);
+                msg_entry->client_msg_record.prio = prio;
+                msg_queue_insert(channel, msg_entry);
+            }
+            return;
+        }
+    }
+}
+
+static void pi_boost_servers(struct channel *channel, unsigned int prio,
+                             int depth);
+
+/* Raise @thread to @prio, called with thread->pi_lock held */
+static void pi_boost_thread(struct thread *thread, unsigned int prio,
+                            int depth)
+{
+    struct channel *channel;
+    struct msg_hdl *msg_hdl;
+    struct thread *server;
+    struct pi_stats *stats;
+
+    if (thread->thread_ctx->sc == NULL || thread_prio(thread) >= prio)
+        return;
+
+    if (!thread->prio_boosted) {
+        thread->base_prio = thread_prio(thread);
+        thread->prio_boosted = true;
+    }
+    sched_set_prio(thread, prio);
+
+    stats = &pi_stats[smp_get_cpu_id()];
+    stats->nr_boosts++;
+    if (depth > 0)
+        stats->nr_chain_boosts++;
+
+    if (++depth >= PI_MAX_DEPTH)
+        return;
+
+    /* The call of @thread is waiting in a msg queue */
+    channel = thread->call_channel;
+    if (channel != NULL) {
+        if (try_lock(&channel->lock) == 0) {
+            msg_queue_requeue(channel, thread, prio);
+            pi_boost_servers(channel, prio, depth);
+            unlock(&channel->lock);
+        } else {
+            stats->nr_chain_skips++;
+        }
+    }
+
+    /* The call of @thread is being served */
+    msg_hdl = thread->call_msg_hdl;
+    if (msg_hdl != NULL) {
+        if (try_lock(&msg_hdl->lock) != 0) {
+            stats->nr_chain_skips++;
+            return;
+        }
+        server = msg_hdl->server_msg_record.server;
+        if (server != NULL && pi_lock_thread(server, depth) == 0) {
+            pi_boost_thread(server, prio, depth);
+            unlock(&server->pi_lock);
+        }
+        unlock(&msg_hdl->lock);
+    }
+}
+
+/* Boost the threads serving @channel, called with channel->lock held */
+static void pi_boost_servers(struct channel *channel, unsigned int prio,
+                             int depth)
+{
+    struct msg_hdl *msg_hdl;
+    struct thread *server;
+
+    for_each_in_list (
+        msg_hdl, struct msg_hdl, busy_node, &channel->busy_list) {
+        server = msg_hdl->server_msg_record.server;
+        if (pi_lock_thread(server, depth) != 0)
+            continue;
+        pi_boost_thread(server, prio, depth);
+        unlock(&server->pi_lock);
+    }
+}
+
+/*
+ * @server starts to serve the call recorded in @msg_hdl.
+ * Called with channel->lock and msg_hdl->lock held.
+ */
+static void pi_start_serving(struct channel *channel, struct msg_hdl *msg_hdl,
+                             struct thread *server)
+{
+    struct thread *client = msg_hdl->client_msg_record.client;
+
+    BUG_ON(msg_hdl->channel != NULL);
+
+    lock(&client->pi_lock);
+    client->call_channel = NULL;
+    client->call_msg_hdl = msg_hdl;
+    unlock(&client->pi_lock);
+
+    obj_ref(channel);
+    msg_hdl->channel = channel;
+    /* Keep @server alive until its boost is dropped in pi_stop_serving */
+    obj_ref(server);
+    msg_hdl->server_msg_record.server = server;
+    list_append(&msg_hdl->busy_node, &channel->busy_list);
+
+    lock(&server->pi_lock);
+    server->nr_served_calls += 1;
+    pi_boost_thread(server, msg_hdl->client_msg_record.prio, 0);
+    unlock(&server->pi_lock);
+}
+
+/*
+ * The server recorded in @msg_hdl stops serving its call, i.e., the call is
+ * replied or abandoned. Drop the inherited priority if it serves no more
+ * calls, except the one of the calls still queued in the channel.
+ */
+static void pi_stop_serving(struct msg_hdl *msg_hdl)
+{
+    struct channel *channel = msg_hdl->channel;
+    struct thread *server, *client;
+    struct msg_entry *msg_entry;
+    unsigned int pending_prio = 0;
+
+    if (channel == NULL)
+        return;
+
+    lock(&channel->lock);
+    lock(&msg_hdl->lock);
+    list_del(&msg_hdl->busy_node);
+    msg_hdl->channel = NULL;
+    server = msg_hdl->server_msg_record.server;
+    /* Abandoned: the client will not be woken up through this msg_hdl */
+    if (msg_hdl->client_msg_record.info.msg_type == MSG_TYPE_CALL) {
+        client = msg_hdl->client_msg_record.client;
+        lock(&client->pi_lock);
+        if (client->call_msg_hdl == msg_hdl)
+            client->call_msg_hdl = NULL;
+        unlock(&client->pi_lock);
+    }
+    unlock(&msg_hdl->lock);
+
+    for_each_in_list (
+        msg_entry, struct msg_entry, msg_queue_node, &channel->msg_queue) {
+        if (msg_entry->client_msg_record.info.msg_type == MSG_TYPE_CALL) {
+            pending_prio = msg_entry->client_msg_record.prio;
+            break;
+        }
+    }
+    unlock(&channel->lock);
+    obj_put(channel);
+
+    lock(&server->pi_lock);
+    BUG_ON(server->nr_served_calls == 0);
+    server->nr_served_calls -= 1;
+    if (server->nr_served_calls == 0 && server->prio_boosted) {
+        if (pending_prio > server->base_prio) {
+            sched_set_prio(server, pending_prio);
+        } else {
+            server->prio_boosted = false;
+            sched_set_prio(server, server->base_prio);
+        }
+    }
+    unlock(&server->pi_lock);
+    obj_put(server);
+}
+
+/* Only the thread serving the call of @msg_hdl can receive or reply with it */
+static bool msg_hdl_served_by_current(struct msg_hdl *msg_hdl)
+{
+    return msg_hdl->channel == NULL
+           || msg_hdl->server_msg_record.server == current_thread;
+}
+
 /*
  * 1. if msg queue is empty, server thread will be inserted into thread queue
  *    and not be sched until client thread enqueue it
@@ -34,6 +295,16 @@ static int __tee_msg_receive(struct channel *channel, void *recv_buf,
         return -EINVAL;
     }
 
+    lock(&msg_hdl->lock);
+    if (!msg_hdl_served_by_current(msg_hdl)) {
+        unlock(&msg_hdl->lock);
+        return -EPERM;
+    }
+    unlock(&msg_hdl->lock);
+
+    /* The previous call on msg_hdl is not replied */
+    pi_stop_serving(msg_hdl);
+
     lock(&channel->lock);
     lock(&msg_hdl->lock);
 
@@ -45,6 +316,13 @@ static int __tee_msg_receive(struct channel *channel, void *recv_buf,
 
     if (list_empty(&channel->msg_queue)) {
         kdebug("%s: list_empty(&channel->msg_queue)\n", __func__);
+        /* Let the caller drain the rings, see __wake_up_ring_receiver */
+        if (channel->ring_doorbells != 0) {
+            channel->ring_doorbells = 0;
+            unlock(&msg_hdl->lock);
+            unlock(&channel->lock);
+            return E_EX_RING_DOORBELL;
+        }
         if (timeout == OS_NO_WAIT) {
             unlock(&msg_hdl->lock);
             unlock(&channel->lock);
@@ -93,6 +371,8 @@ static int __tee_msg_receive(struct channel *channel, void *recv_buf,
         memcpy(&msg_hdl->client_msg_record,
                &msg_entry->client_msg_record,
                sizeof(struct client_msg_record));
+        if (msg_hdl->client_msg_record.info.msg_type == MSG_TYPE_CALL)
+            pi_start_serving(channel, msg_hdl, current_thread);
         ret = 0;
 
         kfree(msg_entry->client_msg_record.ksend_buf);
@@ -131,12 +411,25 @@ static int __tee_msg_send(struct channel *channel,
     if (list_empty(&channel->thread_queue)) {
         kdebug("%s: list_empty(&channel->thread_queue)\n", __func__);
         msg_entry = kmalloc(sizeof(*msg_entry));
+        if (msg_entry == NULL) {
+            ret = -ENOMEM;
+            goto out;
+        }
 
         memcpy(&msg_entry->client_msg_record,
                client_msg_record,
                sizeof(*client_msg_record));
 
-        list_append(&msg_entry->msg_queue_node, &channel->msg_queue);
+        msg_queue_insert(channel, msg_entry);
+
+        /* The caller waits for the threads busy with this channel */
+        if (client_msg_record->info.msg_type == MSG_TYPE_CALL) {
+            client = client_msg_record->client;
+            lock(&client->pi_lock);
+            client->call_channel = channel;
+            unlock(&client->pi_lock);
+            pi_boost_servers(channel, client_msg_record->prio, 0);
+        }
     } else {
         kdebug("%s: !list_empty(&channel->thread_queue)\n", __func__);
         msg_hdl = list_entry(
@@ -177,6 +470,8 @@ static int __tee_msg_send(struct channel *channel,
         }
 
         kfree(client_msg_record->ksend_buf);
+        if (client_msg_record->info.msg_type == MSG_TYPE_CALL)
+            pi_start_serving(channel, msg_hdl, server);
         arch_set_thread_return(server, 0);
         server->thread_ctx->state = TS_INTER;
         BUG_ON(sched_enqueue(server));
@@ -222,14 +517,8 @@ static int __tee_msg_call(struct channel *channel, void *send_buf,
     client_msg_record.send_len = send_len;
     client_msg_record.recv_buf = recv_buf;
     client_msg_record.recv_len = recv_len;
-    client_msg_record.info.msg_type = MSG_TYPE_CALL;
-    client_msg_record.info.src_pid = current_cap_group->pid;
-    client_msg_record.info.src_tid = current_thread->cap;
-    if (current_cap_group->pid == GTASK_PID
-        && current_thread->cap == GTASK_TID) {
-        client_msg_record.info.src_pid = 0;
-        client_msg_record.info.src_tid = 0;
-    }
+    client_msg_record.prio = thread_prio(current_thread);
+    fill_src_msginfo(&client_msg_record.info, MSG_TYPE_CALL);
 
     ret = __tee_msg_send(channel, &client_msg_record);
     if (ret != 0) {
@@ -272,6 +561,11 @@ static int __tee_msg_reply(struct msg_hdl *msg_hdl, void *reply_buf,
         goto out;
     }
 
+    if (!msg_hdl_served_by_current(msg_hdl)) {
+        ret = -EPERM;
+        goto out;
+    }
+
     if ((kreply_buf = kmalloc(reply_len)) == NULL) {
         ret = -ENOMEM;
         goto out;
@@ -309,6 +603,10 @@ static int __tee_msg_reply(struct msg_hdl *msg_hdl, void *reply_buf,
      */
     wait_for_kernel_stack(client);
 
+    lock(&client->pi_lock);
+    client->call_msg_hdl = NULL;
+    unlock(&client->pi_lock);
+
     arch_set_thread_return(client, 0);
     client->thread_ctx->state = TS_INTER;
     BUG_ON(sched_enqueue(client));
@@ -320,6 +618,8 @@ out_free_kreply_buf:
     kfree(kreply_buf);
 out:
     unlock(&msg_hdl->lock);
+    if (ret == 0)
+        pi_stop_serving(msg_hdl);
     return ret;
 }
 
@@ -349,14 +649,8 @@ static int __tee_msg_notify(struct channel *channel, void *send_buf,
     client_msg_record.client = current_thread;
     client_msg_record.ksend_buf = ksend_buf;
     client_msg_record.send_len = send_len;
-    client_msg_record.info.msg_type = MSG_TYPE_NOTIF;
-    client_msg_record.info.src_pid = current_cap_group->pid;
-    client_msg_record.info.src_tid = current_thread->cap;
-    if (current_cap_group->pid == GTASK_PID
-        && current_thread->cap == GTASK_TID) {
-        client_msg_record.info.src_pid = 0;
-        client_msg_record.info.src_tid = 0;
-    }
+    client_msg_record.prio = thread_prio(current_thread);
+    fill_src_msginfo(&client_msg_record.info, MSG_TYPE_NOTIF);
 
     ret = __tee_msg_send(channel, &client_msg_record);
     if (ret != 0) {
@@ -385,6 +679,9 @@ static int __wake_up_all_clients(struct channel *channel)
             BUG_ON(client->thread_ctx->state != TS_WAITING
                    && client->thread_ctx->state != TS_EXIT);
             if (client->thread_ctx->state == TS_WAITING) {
+                lock(&client->pi_lock);
+                client->call_channel = NULL;
+                unlock(&client->pi_lock);
                 arch_set_thread_return(client, -EINVAL);
                 client->thread_ctx->state = TS_INTER;
                 BUG_ON(sched_enqueue(client));
@@ -402,11 +699,16 @@ static int __wake_up_all_clients(struct channel *channel)
 static int __destory_waiting_node(struct channel *channel,
                                   struct cap_group *cap_group)
 {
-    struct msg_entry *entry;
+    struct msg_entry *entry, *tmp;
+    struct thread *client;
 
-    for_each_in_list (
-        entry, struct msg_entry, msg_queue_node, &channel->msg_queue) {
-        if (entry->client_msg_record.client->cap_group == cap_group) {
+    for_each_in_list_safe (entry, tmp, msg_queue_node, &channel->msg_queue) {
+        client = entry->client_msg_record.client;
+        if (client->cap_group == cap_group) {
+            lock(&client->pi_lock);
+            if (client->call_channel == channel)
+                client->call_channel = NULL;
+            unlock(&client->pi_lock);
             list_del(&entry->msg_queue_node);
             kfree(entry->client_msg_record.ksend_buf);
             kfree(entry);
@@ -416,6 +718,138 @@ static int __destory_waiting_node(struct channel *channel,
     return 0;
 }
 
+/*
+ * Detach the ring waiter of @channel and wake it up with @ret if it still
+ * waits. Called with channel->lock and waiter's queue_lock held. The caller
+ * puts the reference of the channel held by the waiter.
+ */
+static void __detach_ring_waiter(struct channel *channel,
+                                 struct thread *waiter, int ret)
+{
+    BUG_ON(channel->ring_waiter != waiter || waiter->ring_channel != channel);
+    channel->ring_waiter = NULL;
+    waiter->ring_channel = NULL;
+
+    if (waiter->thread_ctx->state == TS_WAITING) {
+        arch_set_thread_return(waiter, ret);
+        waiter->thread_ctx->state = TS_INTER;
+        BUG_ON(sched_enqueue(waiter));
+    }
+}
+
+/*
+ * Wake up the creater's thread waiting for doorbells of the message rings,
+ * which returns @ret. Called with channel->lock held by a caller holding
+ * another reference of the channel. Return false if there is no waiter or
+ * its timeout is being handled, which wakes it up anyway (ring_timer_cb).
+ */
+static bool __wake_up_ring_waiter(struct channel *channel, int ret)
+{
+    struct thread *waiter;
+
+    waiter = channel->ring_waiter;
+    if (waiter == NULL)
+        return false;
+
+    /* Make sure that the waiter has called sched() in sys_tee_msg_ring_wait */
+    wait_for_kernel_stack(waiter);
+
+    /* See __futex_wake_waiter */
+    if (try_lock(&waiter->sleep_state.queue_lock) != 0)
+        return false;
+    if (waiter->sleep_state.cb != NULL && !try_dequeue_sleeper(waiter)) {
+        unlock(&waiter->sleep_state.queue_lock);
+        return false;
+    }
+    __detach_ring_waiter(channel, waiter, ret);
+    unlock(&waiter->sleep_state.queue_lock);
+
+    /* Never the last reference, see above */
+    obj_put(channel);
+    return true;
+}
+
+/*
+ * Without a ring waiter, wake up a thread of the creater blocking in
+ * sys_tee_msg_receive, which returns E_EX_RING_DOORBELL. This lets servers
+ * receive calls and ring messages in the same loop (see ipc_msg_receive of
+ * libohtee). Called with channel->lock held. Return false if there is none.
+ */
+static bool __wake_up_ring_receiver(struct channel *channel)
+{
+    struct msg_hdl *msg_hdl;
+    struct thread *server;
+
+    if (list_empty(&channel->thread_queue))
+        return false;
+
+    msg_hdl = list_entry(
+        channel->thread_queue.next, struct msg_hdl, thread_queue_node);
+    lock(&msg_hdl->lock);
+    list_del(&msg_hdl->thread_queue_node);
+    server = msg_hdl->server_msg_record.server;
+    unlock(&msg_hdl->lock);
+
+    /* The server calls sched() after releasing channel->lock */
+    wait_for_kernel_stack(server);
+    arch_set_thread_return(server, E_EX_RING_DOORBELL);
+    server->thread_ctx->state = TS_INTER;
+    BUG_ON(sched_enqueue(server));
+    return true;
+}
+
+/* Ring the doorbell of @channel, called with channel->lock held */
+static void __ring_doorbell(struct channel *channel)
+{
+    channel->ring_doorbells += 1;
+    if (__wake_up_ring_waiter(channel, (int)channel->ring_doorbells)
+        || __wake_up_ring_receiver(channel))
+        channel->ring_doorbells = 0;
+}
+
+/* The ring waiter times out, called with its queue_lock held */
+static void ring_timer_cb(struct thread *thread)
+{
+    struct channel *channel;
+    int ret;
+
+    /* Only cleared with queue_lock held after the sleeper is removed */
+    channel = thread->ring_channel;
+    BUG_ON(channel == NULL);
+
+    lock(&channel->lock);
+    if (channel->state == CHANNEL_INVALID) {
+        ret = -EINVAL;
+    } else if (channel->ring_doorbells != 0) {
+        /* Doorbells failed to wake it up while it was timing out */
+        ret = (int)channel->ring_doorbells;
+        channel->ring_doorbells = 0;
+    } else {
+        ret = E_EX_TIMER_TIMEOUT;
+    }
+    __detach_ring_waiter(channel, thread, ret);
+    unlock(&channel->lock);
+    obj_put(channel);
+}
+
+/* Called when @thread is destroyed, so that ring_waiter never dangles */
+void channel_remove_ring_waiter(struct thread *thread)
+{
+    struct channel *channel;
+
+    lock(&thread->sleep_state.queue_lock);
+    channel = thread->ring_channel;
+    if (channel != NULL) {
+        lock(&channel->lock);
+        __detach_ring_waiter(channel, thread, -EINVAL);
+        unlock(&channel->lock);
+    }
+    unlock(&thread->sleep_state.queue_lock);
+
+    if (channel != NULL)
+        obj_put(channel);
+}
+
 /*
  * close_channel will be called if
  * 1. channel's creater calls sys_tee_msg_stop_channel
@@ -427,6 +861,7 @@ int close_channel(struct channel *channel, struct cap_group *cap_group)
     if (channel->creater == cap_group) {
         channel->state = CHANNEL_INVALID;
         __wake_up_all_clients(channel);
+        __wake_up_ring_waiter(channel, -EINVAL);
     } else {
         __destory_waiting_node(channel, cap_group);
     }
@@ -448,6 +883,7 @@ int sys_tee_msg_create_msg_hdl(void)
 
     /* init msg_hdl */
     lock_init(&msg_hdl->lock);
+    msg_hdl->channel = NULL;
 
     msg_hdl_cap = cap_alloc(current_cap_group, msg_hdl);
     if (msg_hdl_cap < 0) {
@@ -480,8 +916,14 @@ int sys_tee_msg_create_channel(void)
     lock_init(&channel->lock);
     init_list_head(&channel->msg_queue);
     init_list_head(&channel->thread_queue);
+    init_list_head(&channel->busy_list);
     channel->creater = current_cap_group;
     channel->state = CHANNEL_VALID;
+    channel->ring_enabled = false;
+    init_list_head(&channel->pending_rings);
+    channel->nr_pending_rings = 0;
+    channel->ring_doorbells = 0;
+    channel->ring_waiter = NULL;
 
     channel_cap = cap_alloc(current_cap_group, channel);
     if (channel_cap < 0) {
@@ -635,15 +1077,289 @@ out_fail_get_channel:
     return ret;
 }
 
+/*
+ * Message rings: each client attaches a PMO of its own as a ring, in which
+ * it publishes notifications to the creater without copying them through
+ * the kernel. The layout of a ring is up to the user library. The kernel
+ * hands the rings to the creater with the identity of the attaching client,
+ * and provides doorbells: producers ring one after publishing messages into
+ * an idle ring, and the creater waits for them, either in
+ * sys_tee_msg_ring_wait or in sys_tee_msg_receive along with calls.
+ * Doorbells rung while nobody waits are counted, so that one wakeup drains a
+ * batch of messages and no wakeup is lost.
+ */
+
+/*
+ * The creater enables message rings of the channel (@pmo_cap is ignored).
+ * A client attaches the PMO_DATA of @pmo_cap as its ring, which is later
+ * accepted by the creater with sys_tee_msg_ring_accept.
+ */
+int sys_tee_msg_attach_ring(int channel_cap, int pmo_cap)
+{
+    struct channel *channel;
+    struct pmobject *pmo;
+    struct ring_entry *ring;
+    int ret, creater_cap;
+
+    channel = obj_get(current_cap_group, channel_cap, TYPE_CHANNEL);
+    if (channel == NULL) {
+        ret = -ECAPBILITY;
+        goto out_fail_get_channel;
+    }
+
+    if (channel->creater == current_cap_group) {
+        lock(&channel->lock);
+        if (channel->state == CHANNEL_INVALID) {
+            ret = -EINVAL;
+        } else {
+            channel->ring_enabled = true;
+            ret = 0;
+        }
+        unlock(&channel->lock);
+        goto out_put_channel;
+    }
+
+    ring = kmalloc(sizeof(*ring));
+    if (ring == NULL) {
+        ret = -ENOMEM;
+        goto out_put_channel;
+    }
+    fill_src_msginfo(&ring->info, MSG_TYPE_NOTIF);
+
+    creater_cap = cap_copy(current_cap_group, channel->creater, pmo_cap);
+    if (creater_cap < 0) {
+        ret = creater_cap;
+        goto out_free_ring;
+    }
+    ring->pmo_cap = creater_cap;
+
+    /* Check the copied cap, which cannot be changed by the client */
+    pmo = obj_get(channel->creater, creater_cap, TYPE_PMO);
+    if (pmo == NULL) {
+        ret = -ECAPBILITY;
+        goto out_free_cap;
+    }
+    ret = pmo->type == PMO_DATA ? 0 : -EINVAL;
+    obj_put(pmo);
+    if (ret != 0)
+        goto out_free_cap;
+
+    lock(&channel->lock);
+    if (channel->state == CHANNEL_INVALID || !channel->ring_enabled) {
+        ret = -EINVAL;
+        goto out_unlock;
+    }
+    if (channel->nr_pending_rings >= CHANNEL_MAX_PENDING_RINGS) {
+        ret = -EAGAIN;
+        goto out_unlock;
+    }
+    list_append(&ring->node, &channel->pending_rings);
+    channel->nr_pending_rings++;
+    /* Let the creater accept the ring */
+    __ring_doorbell(channel);
+    unlock(&channel->lock);
+    obj_put(channel);
+    return 0;
+
+out_unlock:
+    unlock(&channel->lock);
+out_free_cap:
+    cap_free(channel->creater, creater_cap);
+out_free_ring:
+    kfree(ring);
+out_put_channel:
+    obj_put(channel);
+
+out_fail_get_channel:
+    return ret;
+}
+
+/*
+ * The creater accepts one ring attached by a client. Return the cap of the
+ * ring PMO and fill @info with the identity of the client, or -ENOENT if no
+ * ring is pending.
+ */
+int sys_tee_msg_ring_accept(int channel_cap, struct src_msginfo *info)
+{
+    struct channel *channel;
+    struct ring_entry *ring;
+    int ret;
+
+    if (check_user_addr_range((vaddr_t)info, sizeof(*info)) != 0)
+        return -EINVAL;
+
+    channel = obj_get(current_cap_group, channel_cap, TYPE_CHANNEL);
+    if (channel == NULL) {
+        ret = -ECAPBILITY;
+        goto out_fail_get_channel;
+    }
+
+    if (channel->creater != current_cap_group) {
+        ret = -EINVAL;
+        goto out_put_channel;
+    }
+
+    lock(&channel->lock);
+    if (list_empty(&channel->pending_rings)) {
+        unlock(&channel->lock);
+        ret = -ENOENT;
+        goto out_put_channel;
+    }
+    ring = list_entry(channel->pending_rings.next, struct ring_entry, node);
+    list_del(&ring->node);
+    channel->nr_pending_rings--;
+    unlock(&channel->lock);
+
+    ret = ring->pmo_cap;
+    if (copy_to_user(info, &ring->info, sizeof(*info)) != 0) {
+        cap_free(current_cap_group, ring->pmo_cap);
+        ret = -EFAULT;
+    }
+    kfree(ring);
+
+out_put_channel:
+    obj_put(channel);
+
+out_fail_get_channel:
+    return ret;
+}
+
+/* Ring the doorbell of the message rings after publishing messages */
+int sys_tee_msg_ring_notify(int channel_cap)
+{
+    struct channel *channel;
+    int ret;
+
+    channel = obj_get(current_cap_group, channel_cap, TYPE_CHANNEL);
+    if (channel == NULL) {
+        ret = -ECAPBILITY;
+        goto out_fail_get_channel;
+    }
+
+    lock(&channel->lock);
+    if (channel->state == CHANNEL_INVALID || !channel->ring_enabled) {
+        ret = -EINVAL;
+        goto out_unlock;
+    }
+
+    __ring_doorbell(channel);
+    ret = 0;
+
+out_unlock:
+    unlock(&channel->lock);
+    obj_put(channel);
+
+out_fail_get_channel:
+    return ret;
+}
+
+/*
+ * The creater waits for doorbells of the message rings for at most @timeout
+ * milliseconds, or forever if @timeout is OS_WAIT_FOREVER. Return the number
+ * of doorbells rung since the last wait, or E_EX_TIMER_TIMEOUT if none has
+ * been rung before @timeout.
+ */
+int sys_tee_msg_ring_wait(int channel_cap, int timeout)
+{
+    struct channel *channel;
+    struct thread *thread;
+    struct timespec timeout_k;
+    int ret;
+
+    if ((u32)timeout != OS_WAIT_FOREVER && timeout < 0)
+        return -EINVAL;
+
+    channel = obj_get(current_cap_group, channel_cap, TYPE_CHANNEL);
+    if (channel == NULL) {
+        ret = -ECAPBILITY;
+        goto out_fail_get_channel;
+    }
+
+    if (channel->creater != current_cap_group) {
+        ret = -EINVAL;
+        goto out_put_channel;
+    }
+
+    lock(&channel->lock);
+    if (channel->state == CHANNEL_INVALID || !channel->ring_enabled) {
+        ret = -EINVAL;
+        goto out_unlock;
+    }
+
+    if (channel->ring_doorbells != 0) {
+        ret = (int)channel->ring_doorbells;
+        channel->ring_doorbells = 0;
+        goto out_unlock;
+    }
+
+    if (timeout == OS_NO_WAIT) {
+        ret = E_EX_TIMER_TIMEOUT;
+        goto out_unlock;
+    }
+
+    /* The rings have a single consumer */
+    if (channel->ring_waiter != NULL) {
+        ret = -EBUSY;
+        goto out_unlock;
+    }
+
+    thread = current_thread;
+    lock(&thread->sleep_state.queue_lock);
+
+    /* The reference of channel is put when the waiter is detached */
+    channel->ring_waiter = thread;
+    thread->ring_channel = channel;
+    thread->thread_ctx->state = TS_WAITING;
+    arch_set_thread_return(thread, 0);
+
+    if ((u32)timeout != OS_WAIT_FOREVER) {
+        timeout_k.tv_sec = timeout / 1000;
+        timeout_k.tv_nsec = (timeout % 1000) * US_IN_MS * NS_IN_US;
+        enqueue_sleeper(thread, &timeout_k, ring_timer_cb);
+    }
+
+    /* sched() must be executed before unlock, see wait_notific */
+    sched();
+
+    unlock(&thread->sleep_state.queue_lock);
+    unlock(&channel->lock);
+
+    eret_to_thread(switch_context());
+    BUG_ON(1);
+
+out_unlock:
+    unlock(&channel->lock);
+out_put_channel:
+    obj_put(channel);
+
+out_fail_get_channel:
+    return ret;
+}
+
 void channel_deinit(void *ptr)
 {
-    struct msg_entry *entry;
+    struct msg_entry *entry, *tmp;
+    struct ring_entry *ring, *tmp_ring;
     struct channel *channel;
+    struct thread *client;
 
     channel = (struct channel *)ptr;
 
-    for_each_in_list (
-        entry, struct msg_entry, msg_queue_node, &channel->msg_queue) {
+    /* Busy msg_hdls hold references, so busy_list is empty here */
+    BUG_ON(!list_empty(&channel->busy_list));
+
+    /* The caps of pending rings are freed together with the creater */
+    for_each_in_list_safe (ring, tmp_ring, node, &channel->pending_rings) {
+        list_del(&ring->node);
+        kfree(ring);
+    }
+
+    for_each_in_list_safe (entry, tmp, msg_queue_node, &channel->msg_queue) {
+        client = entry->client_msg_record.client;
+        lock(&client->pi_lock);
+        if (client->call_channel == channel)
+            client->call_channel = NULL;
+        unlock(&client->pi_lock);
         list_del(&entry->msg_queue_node);
         kfree(entry->client_msg_record.ksend_buf);
         kfree(entry);
@@ -652,4 +1368,19 @@ void channel_deinit(void *ptr)
 
 void msg_hdl_deinit(void *ptr)
 {
+    /* The server is gone without replying: drop its boost and the call */
+    pi_stop_serving((struct msg_hdl *)ptr);
+}
+
+void print_channel_pi_stats(void)
+{
+    int cpuid;
+
+    for (cpuid = 0; cpuid < PLAT_CPU_NUM; cpuid++) {
+        printk("CPU %d: pi boosts %lu, chained %lu, chain skips %lu\n",
+               cpuid,
+               pi_stats[cpuid].nr_boosts,
+               pi_stats[cpuid].nr_chain_boosts,
+               pi_stats[cpuid].nr_chain_skips);
+    }
 }
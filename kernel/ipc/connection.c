@@ -581,7 +581,8 @@ static int ipc_send_cap(struct cap_group *target_cap_group,
 {
     int i, r;
     unsigned int cap_slots_offset;
-    cap_t *cap_buf;
+    cap_t src_caps[MAX_CAP_TRANSFER];
+    cap_t dest_caps[MAX_CAP_TRANSFER];
     vaddr_t uaddr;
 
     if (cap_num >= MAX_CAP_TRANSFER) {
@@ -601,47 +602,30 @@ static int ipc_send_cap(struct cap_group *target_cap_group,
         goto out_fail;
 
     uaddr = (vaddr_t)((char *)ipc_msg + cap_slots_offset);
-    if (check_user_addr_range(uaddr, sizeof(*cap_buf) * cap_num) != 0) {
+    if (check_user_addr_range(uaddr, sizeof(*src_caps) * cap_num) != 0) {
         r = -EINVAL;
         goto out_fail;
     }
 
-    cap_buf = kmalloc(cap_num * sizeof(*cap_buf));
-    if (!cap_buf) {
-        r = -ENOMEM;
+    r = copy_from_user(src_caps, (void *)uaddr, sizeof(*src_caps) * cap_num);
+    if (r)
         goto out_fail;
-    }
-
-    r = copy_from_user(cap_buf, (void *)uaddr, sizeof(*cap_buf) * cap_num);
-    if (r) {
-        i = 0;
-        goto out_free_cap;
-    }
 
-    for (i = 0; i < cap_num; i++) {
-        cap_t dest_cap;
-
-        dest_cap = cap_copy(current_cap_group, target_cap_group, cap_buf[i]);
-        if (dest_cap < 0) {
-            r = dest_cap;
-            goto out_free_cap;
-        }
-
-        cap_buf[i] = dest_cap;
-    }
+    /* All the caps are copied with the slot tables locked once */
+    r = cap_copy_batch(
+        current_cap_group, target_cap_group, src_caps, dest_caps, cap_num);
+    if (r < 0)
+        goto out_fail;
 
-    
-    r = copy_to_user((void *)uaddr, cap_buf, sizeof(*cap_buf) * cap_num);
+    r = copy_to_user((void *)uaddr, dest_caps, sizeof(*dest_caps) * cap_num);
     if (r)
         goto out_free_cap;
 
-    kfree(cap_buf);
     return 0;
 
 out_free_cap:
-    for (--i; i >= 0; i--)
-        cap_free(target_cap_group, cap_buf[i]);
-    kfree(cap_buf);
+    for (i = 0; i < cap_num; i++)
+        cap_free(target_cap_group, dest_caps[i]);
 out_fail:
     return r;
 }
@@ -0,0 +1,388 @@
+/*
+ * Copyright (c) 2023 Institute of Parallel And Distributed Systems (IPADS), Shanghai Jiao Tong University (SJTU)
+ * Licensed under the Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *     http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR FIT FOR A PARTICULAR
+ * PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ */
+#include <ipc/futex.h>
+#include <common/errno.h>
+#include <object/thread.h>
+#include <sched/sched.h>
+#include <sched/context.h>
+#include <irq/timer.h>
+#include <mm/uaccess.h>
+
+static struct futex_bucket futex_buckets[FUTEX_HASH_SIZE];
+
+/* Per-CPU counters, printed by print_futex_stats */
+enum futex_stat {
+    FUTEX_STAT_WAIT, /* Threads blocked in sys_futex_wait */
+    FUTEX_STAT_AGAIN, /* Waits returning -EAGAIN as *uaddr changed */
+    FUTEX_STAT_WOKEN, /* Waiters woken up by sys_futex_wake/requeue */
+    FUTEX_STAT_EMPTY_WAKE, /* sys_futex_wake calls finding no waiter */
+    FUTEX_STAT_REQUEUED, /* Waiters moved by sys_futex_requeue */
+    FUTEX_STAT_TIMEOUT, /* Waits ending with -ETIMEDOUT */
+    FUTEX_STATS,
+};
+
+static unsigned long futex_stats[PLAT_CPU_NUM][FUTEX_STATS];
+
+static inline void futex_stat_add(enum futex_stat stat, unsigned long n)
+{
+    futex_stats[smp_get_cpu_id()][stat] += n;
+}
+
+/*
+ * Lock order:
+ * - sys_futex_wait: bucket -> current thread's sleep_state.queue_lock ->
+ *   local sleep_list_lock (in enqueue_sleeper).
+ * - Timeout: local sleep_list_lock -> waiter's queue_lock -> bucket (in
+ *   futex_timer_cb, called by handle_timer_irq).
+ * The two are opposite but cannot deadlock. A running thread is on no sleep
+ * list, so no timer holds its queue_lock while it waits, and a sleep list
+ * is only locked (not tried) by its own CPU with interrupts masked.
+ * Wakers, which hold a bucket lock, only try to grab the locks of a
+ * timing-out waiter and skip it on failure.
+ */
+
+void futex_init(void)
+{
+    int i;
+
+    for (i = 0; i < FUTEX_HASH_SIZE; i++) {
+        lock_init(&futex_buckets[i].lock);
+        init_list_head(&futex_buckets[i].waiters);
+    }
+}
+
+static struct futex_bucket *futex_hash(struct cap_group *cap_group,
+                                       vaddr_t uaddr)
+{
+    u64 key;
+
+    key = (u64)cap_group ^ (u64)uaddr;
+    key *= 0x9E3779B97F4A7C15UL;
+    return &futex_buckets[key >> (64 - FUTEX_HASH_BITS)];
+}
+
+static inline bool futex_match(struct thread *thread,
+                               struct cap_group *cap_group, vaddr_t uaddr)
+{
+    return thread->cap_group == cap_group && thread->futex_uaddr == uaddr;
+}
+
+static inline int futex_check_uaddr(u32 *uaddr)
+{
+    if (((vaddr_t)uaddr & (sizeof(u32) - 1)) != 0)
+        return -EINVAL;
+    if (check_user_addr_range((vaddr_t)uaddr, sizeof(u32)) != 0)
+        return -EINVAL;
+    return 0;
+}
+
+/*
+ * Lock the bucket in which @thread waits. A requeue may move the thread to
+ * another bucket before the lock is grabbed, so recheck after locking.
+ * Return NULL if the thread does not wait on any futex.
+ */
+static struct futex_bucket *futex_lock_waiter_bucket(struct thread *thread)
+{
+    struct futex_bucket *bucket;
+
+    for (;;) {
+        bucket = *(struct futex_bucket *volatile *)&thread->futex_bucket;
+        if (bucket == NULL)
+            return NULL;
+        lock(&bucket->lock);
+        if (thread->futex_bucket == bucket)
+            return bucket;
+        unlock(&bucket->lock);
+    }
+}
+
+/*
+ * Called with the bucket of @thread locked. futex_uaddr_ptr is kept for
+ * futex_publish_requeue if the thread has been requeued.
+ */
+static void __futex_dequeue(struct thread *thread)
+{
+    list_del(&thread->futex_node);
+    thread->futex_bucket = NULL;
+    thread->futex_uaddr = 0;
+    if (thread->futex_requeued_uaddr == 0)
+        thread->futex_uaddr_ptr = NULL;
+}
+
+static void futex_timer_cb(struct thread *thread)
+{
+    struct futex_bucket *bucket;
+
+    bucket = futex_lock_waiter_bucket(thread);
+    if (bucket == NULL)
+        return;
+
+    if (thread->thread_ctx->state == TS_WAITING) {
+        __futex_dequeue(thread);
+        futex_stat_add(FUTEX_STAT_TIMEOUT, 1);
+        arch_set_thread_return(thread, -ETIMEDOUT);
+        thread->thread_ctx->state = TS_INTER;
+        BUG_ON(sched_enqueue(thread));
+    }
+
+    unlock(&bucket->lock);
+}
+
+/*
+ * Wake up @thread waiting in a locked bucket. Return false if its timeout is
+ * being handled, which wakes it up anyway.
+ */
+static bool __futex_wake_waiter(struct thread *thread)
+{
+    if (try_lock(&thread->sleep_state.queue_lock) != 0)
+        return false;
+
+    if (thread->sleep_state.cb != NULL && !try_dequeue_sleeper(thread)) {
+        unlock(&thread->sleep_state.queue_lock);
+        return false;
+    }
+
+    __futex_dequeue(thread);
+    thread->thread_ctx->state = TS_INTER;
+    BUG_ON(sched_enqueue(thread));
+
+    unlock(&thread->sleep_state.queue_lock);
+    return true;
+}
+
+void futex_remove_waiter(struct thread *thread)
+{
+    struct futex_bucket *bucket;
+
+    bucket = futex_lock_waiter_bucket(thread);
+    if (bucket == NULL)
+        return;
+    __futex_dequeue(thread);
+    unlock(&bucket->lock);
+}
+
+/*
+ * Called by switch_context when @thread, which has been requeued and then
+ * woken up, is about to return to user mode in its own vmspace. The
+ * variable is on the waiter's side, so only the waiter itself writes it:
+ * the thread requeueing it holds bucket locks and, once they are dropped,
+ * the waiter may have returned and reused the variable. On failure, the
+ * waiter gets -EFAULT instead of its original return value.
+ */
+void futex_publish_requeue(struct thread *thread)
+{
+    vaddr_t uaddr = thread->futex_requeued_uaddr;
+
+    if (copy_to_user(thread->futex_uaddr_ptr, &uaddr, sizeof(uaddr)) != 0)
+        arch_set_thread_return(thread, -EFAULT);
+    thread->futex_requeued_uaddr = 0;
+    thread->futex_uaddr_ptr = NULL;
+}
+
+/*
+ * Block current thread if *uaddr equals @val, until it is woken up by
+ * sys_futex_wake on the same address or @timeout (relative) expires.
+ * Return 0 if woken up, -EAGAIN if *uaddr does not equal @val, and
+ * -ETIMEDOUT on timeout.
+ * If not NULL, @uaddr_ptr points to a user variable holding @uaddr, which
+ * is updated when current thread is requeued, so that it knows on which
+ * address it waits when it returns.
+ */
+int sys_futex_wait(u32 *uaddr, u32 val, struct timespec *timeout,
+                   vaddr_t *uaddr_ptr)
+{
+    struct futex_bucket *bucket;
+    struct timespec timeout_k;
+    struct thread *thread;
+    u32 cur;
+    int ret;
+
+    ret = futex_check_uaddr(uaddr);
+    if (ret != 0)
+        return ret;
+
+    if (uaddr_ptr
+        && check_user_addr_range((vaddr_t)uaddr_ptr, sizeof(vaddr_t)) != 0)
+        return -EINVAL;
+
+    if (timeout) {
+        if (check_user_addr_range((vaddr_t)timeout, sizeof(timeout_k)) != 0)
+            return -EINVAL;
+        if (copy_from_user(&timeout_k, timeout, sizeof(timeout_k)) != 0)
+            return -EFAULT;
+    }
+
+    thread = current_thread;
+    bucket = futex_hash(current_cap_group, (vaddr_t)uaddr);
+
+    lock(&bucket->lock);
+
+    /*
+     * Compare with the bucket locked: a waker changes *uaddr before locking
+     * the bucket, so either the change is observed here or the waker finds
+     * current thread in the bucket.
+     */
+    if (copy_from_user(&cur, uaddr, sizeof(cur)) != 0) {
+        ret = -EFAULT;
+        goto out_unlock;
+    }
+    if (cur != val) {
+        futex_stat_add(FUTEX_STAT_AGAIN, 1);
+        ret = -EAGAIN;
+        goto out_unlock;
+    }
+
+    lock(&thread->sleep_state.queue_lock);
+
+    list_append(&thread->futex_node, &bucket->waiters);
+    thread->futex_bucket = bucket;
+    thread->futex_uaddr = (vaddr_t)uaddr;
+    thread->futex_uaddr_ptr = uaddr_ptr;
+    thread->futex_requeued_uaddr = 0;
+    thread->thread_ctx->state = TS_WAITING;
+    arch_set_thread_return(thread, 0);
+
+    if (timeout)
+        enqueue_sleeper(thread, &timeout_k, futex_timer_cb);
+    futex_stat_add(FUTEX_STAT_WAIT, 1);
+
+    /* sched() must be executed before unlock, see wait_notific */
+    sched();
+
+    unlock(&thread->sleep_state.queue_lock);
+    unlock(&bucket->lock);
+
+    eret_to_thread(switch_context());
+    /* The control flow will never reach here */
+    BUG_ON(1);
+
+out_unlock:
+    unlock(&bucket->lock);
+    return ret;
+}
+
+/* Wake up at most @nr_wake threads waiting on @uaddr. Return the number. */
+int sys_futex_wake(u32 *uaddr, int nr_wake)
+{
+    struct futex_bucket *bucket;
+    struct thread *thread, *tmp;
+    int woken = 0;
+    int ret;
+
+    ret = futex_check_uaddr(uaddr);
+    if (ret != 0)
+        return ret;
+
+    bucket = futex_hash(current_cap_group, (vaddr_t)uaddr);
+
+    lock(&bucket->lock);
+    for_each_in_list_safe (thread, tmp, futex_node, &bucket->waiters) {
+        if (woken >= nr_wake)
+            break;
+        if (!futex_match(thread, current_cap_group, (vaddr_t)uaddr))
+            continue;
+        if (__futex_wake_waiter(thread))
+            woken++;
+    }
+    unlock(&bucket->lock);
+
+    futex_stat_add(FUTEX_STAT_WOKEN, woken);
+    if (woken == 0)
+        futex_stat_add(FUTEX_STAT_EMPTY_WAKE, 1);
+    return woken;
+}
+
+/*
+ * Wake up at most @nr_wake threads waiting on @uaddr, and move at most
+ * @nr_requeue of the others to wait on @uaddr2. Threads are only requeued
+ * after @nr_wake ones are woken up.
+ * Return the number of threads woken up or requeued.
+ */
+int sys_futex_requeue(u32 *uaddr, u32 *uaddr2, int nr_wake, int nr_requeue)
+{
+    struct futex_bucket *bucket, *bucket2;
+    struct thread *thread, *tmp;
+    int woken = 0, requeued = 0;
+    int ret;
+
+    if (uaddr == uaddr2)
+        return -EINVAL;
+    ret = futex_check_uaddr(uaddr);
+    if (ret != 0)
+        return ret;
+    ret = futex_check_uaddr(uaddr2);
+    if (ret != 0)
+        return ret;
+
+    bucket = futex_hash(current_cap_group, (vaddr_t)uaddr);
+    bucket2 = futex_hash(current_cap_group, (vaddr_t)uaddr2);
+
+    /* Lock two buckets in the order of their addresses */
+    if (bucket < bucket2) {
+        lock(&bucket->lock);
+        lock(&bucket2->lock);
+    } else if (bucket > bucket2) {
+        lock(&bucket2->lock);
+        lock(&bucket->lock);
+    } else {
+        lock(&bucket->lock);
+    }
+
+    for_each_in_list_safe (thread, tmp, futex_node, &bucket->waiters) {
+        if (!futex_match(thread, current_cap_group, (vaddr_t)uaddr))
+            continue;
+        if (woken < nr_wake) {
+            if (__futex_wake_waiter(thread))
+                woken++;
+        } else if (requeued < nr_requeue) {
+            /* The timer callback finds the thread via futex_bucket */
+            list_del(&thread->futex_node);
+            list_append(&thread->futex_node, &bucket2->waiters);
+            thread->futex_bucket = bucket2;
+            thread->futex_uaddr = (vaddr_t)uaddr2;
+            /* Published by the waiter itself, see futex_publish_requeue */
+            if (thread->futex_uaddr_ptr)
+                thread->futex_requeued_uaddr = (vaddr_t)uaddr2;
+            requeued++;
+        } else {
+            break;
+        }
+    }
+
+    unlock(&bucket->lock);
+    if (bucket2 != bucket)
+        unlock(&bucket2->lock);
+
+    futex_stat_add(FUTEX_STAT_WOKEN, woken);
+    futex_stat_add(FUTEX_STAT_REQUEUED, requeued);
+
+    return woken + requeued;
+}
+
+void print_futex_stats(void)
+{
+    unsigned long *stats;
+    int cpuid;
+
+    for (cpuid = 0; cpuid < PLAT_CPU_NUM; cpuid++) {
+        stats = futex_stats[cpuid];
+        printk("CPU %d: futex waits %lu, again %lu, timeouts %lu, "
+               "woken %lu, empty wakes %lu, requeued %lu\n",
+               cpuid,
+               stats[FUTEX_STAT_WAIT],
+               stats[FUTEX_STAT_AGAIN],
+               stats[FUTEX_STAT_TIMEOUT],
+               stats[FUTEX_STAT_WOKEN],
+               stats[FUTEX_STAT_EMPTY_WAKE],
+               stats[FUTEX_STAT_REQUEUED]);
+    }
+}
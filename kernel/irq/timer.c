@@ -11,11 +11,13 @@
  */
 #include <irq/irq.h>
 #include <irq/timer.h>
+#include <irq/ipi.h>
 #include <sched/sched.h>
 #include <arch/machine/smp.h>
 #include <object/thread.h>
 #include <common/kprint.h>
 #include <common/list.h>
+#include <common/rbtree.h>
 #include <common/lock.h>
 #include <mm/uaccess.h>
 #include <sched/context.h>
@@ -28,11 +30,24 @@ struct time_state {
     u64 next_expire;
     /*
      * Record all sleepers on each core.
-     * Threads in sleep_list are sorted by the time to wakeup.
+     * Threads in sleep_tree are sorted by the time to wakeup, so that
+     * inserting and removing a sleeper take O(log n) time.
      */
-    struct list_head sleep_list;
-    /* Protect per core sleep_list */
+    struct rb_root sleep_tree;
+    /* The sleeper to wake up first (the leftmost one in sleep_tree) */
+    struct sleep_state *first_sleeper;
+    /* Protect per core sleep_tree */
     struct lock sleep_list_lock;
+    /* Current and peak number of sleepers in sleep_tree */
+    unsigned long nr_sleepers;
+    unsigned long max_sleepers;
+    /*
+     * Tickless: the periodic tick is stopped when the scheduler does not
+     * need it, and the timer is only programmed for the earliest sleeper.
+     */
+    bool tick_stopped;
+    /* Number of timer irqs handled on this core */
+    u64 nr_timer_irqs;
 };
 
 struct time_state time_states[PLAT_CPU_NUM];
@@ -43,8 +58,13 @@ void timer_init(void)
 
     if (smp_get_cpu_id() == 0) {
         for (i = 0; i < PLAT_CPU_NUM; i++) {
-            init_list_head(&time_states[i].sleep_list);
+            init_rb_root(&time_states[i].sleep_tree);
+            time_states[i].first_sleeper = NULL;
             lock_init(&time_states[i].sleep_list_lock);
+            time_states[i].nr_sleepers = 0;
+            time_states[i].max_sleepers = 0;
+            time_states[i].tick_stopped = false;
+            time_states[i].nr_timer_irqs = 0;
         }
     }
 
@@ -52,23 +72,67 @@ void timer_init(void)
     plat_timer_init();
 }
 
+static bool sleeper_less(const struct rb_node *lhs, const struct rb_node *rhs)
+{
+    return rb_entry(lhs, struct sleep_state, sleep_node)->wakeup_tick
+           < rb_entry(rhs, struct sleep_state, sleep_node)->wakeup_tick;
+}
+
+/*
+ * Should be called when holding sleep_list_lock.
+ * Sleepers with the same wakeup_tick are woken up in FIFO order.
+ */
+static void add_sleeper(struct time_state *time_state,
+                        struct sleep_state *sleeper)
+{
+    rb_insert(&time_state->sleep_tree, &sleeper->sleep_node, sleeper_less);
+    if (++time_state->nr_sleepers > time_state->max_sleepers)
+        time_state->max_sleepers = time_state->nr_sleepers;
+    if (time_state->first_sleeper == NULL
+        || sleeper->wakeup_tick < time_state->first_sleeper->wakeup_tick)
+        time_state->first_sleeper = sleeper;
+}
+
+/* Should be called when holding sleep_list_lock */
+static void remove_sleeper(struct time_state *time_state,
+                           struct sleep_state *sleeper)
+{
+    struct rb_node *next;
+
+    if (time_state->first_sleeper == sleeper) {
+        next = rb_next(&sleeper->sleep_node);
+        time_state->first_sleeper =
+            next ? rb_entry(next, struct sleep_state, sleep_node) : NULL;
+    }
+    rb_erase(&time_state->sleep_tree, &sleeper->sleep_node);
+    time_state->nr_sleepers--;
+}
+
 /* Should be called when holding sleep_list_lock */
 static u64 get_next_tick_delta(void)
 {
     u64 waiting_tick, current_tick;
-    struct list_head *local_sleep_list;
+    struct time_state *local_time_state;
     struct sleep_state *first_sleeper;
 
-    local_sleep_list = &time_states[smp_get_cpu_id()].sleep_list;
+    local_time_state = &time_states[smp_get_cpu_id()];
 
-    /* Default tick */
-    waiting_tick = TICK_MS * US_IN_MS * tick_per_us;
-    if (list_empty(local_sleep_list))
+    /*
+     * Default tick, or the longest interval if the scheduler does not
+     * need the tick (e.g., idle or only one runnable thread).
+     */
+    if (!TICKLESS_ENABLED || sched_tick_needed()) {
+        waiting_tick = TICK_MS * US_IN_MS * tick_per_us;
+        WRITE_ONCE(local_time_state->tick_stopped, false);
+    } else {
+        waiting_tick = TICKLESS_MAX_MS * US_IN_MS * tick_per_us;
+        WRITE_ONCE(local_time_state->tick_stopped, true);
+    }
+    first_sleeper = local_time_state->first_sleeper;
+    if (first_sleeper == NULL)
         return waiting_tick;
 
     current_tick = plat_get_current_tick();
-    first_sleeper =
-        list_entry(local_sleep_list->next, struct sleep_state, sleep_node);
     /* If a thread will wake up before default tick, update the tick. */
     if (current_tick + waiting_tick > first_sleeper->wakeup_tick)
         waiting_tick = first_sleeper->wakeup_tick > current_tick ?
@@ -83,19 +147,19 @@ void handle_timer_irq(void)
 {
     u64 current_tick, tick_delta;
     struct time_state *local_time_state;
-    struct list_head *local_sleep_list;
     struct lock *local_sleep_list_lock;
-    struct sleep_state *iter = NULL, *tmp = NULL;
+    struct sleep_state *iter = NULL;
     struct thread *wakeup_thread;
 
-    /* Remove the thread to wakeup from sleep list */
+    /* Remove the thread to wakeup from sleep tree */
     current_tick = plat_get_current_tick();
     local_time_state = &time_states[smp_get_cpu_id()];
-    local_sleep_list = &local_time_state->sleep_list;
     local_sleep_list_lock = &local_time_state->sleep_list_lock;
 
+    local_time_state->nr_timer_irqs++;
+
     lock(local_sleep_list_lock);
-    for_each_in_list_safe (iter, tmp, sleep_node, local_sleep_list) {
+    while ((iter = local_time_state->first_sleeper) != NULL) {
         if (iter->wakeup_tick > current_tick) {
             break;
         }
@@ -104,12 +168,12 @@ void handle_timer_irq(void)
 
         /*
          * Grab the thread's queue_lock before operating the
-         * waiting list (sleep_list and the wait_list of
+         * waiting list (sleep_tree and the wait_list of
          * timedout notification.
          */
         lock(&wakeup_thread->sleep_state.queue_lock);
 
-        list_del(&iter->sleep_node);
+        remove_sleeper(local_time_state, iter);
 
         BUG_ON(wakeup_thread->sleep_state.cb == sleep_timer_cb
                && wakeup_thread->thread_ctx->state != TS_WAITING);
@@ -143,6 +207,66 @@ void handle_timer_irq(void)
     }
 }
 
+/*
+ * Restart the periodic tick on the local core if it has been stopped,
+ * e.g., when one more thread becomes ready on it.
+ */
+void timer_restart_tick(void)
+{
+    struct time_state *local_time_state;
+    u64 current_tick, tick_delta;
+
+    local_time_state = &time_states[smp_get_cpu_id()];
+    if (!local_time_state->tick_stopped)
+        return;
+
+    WRITE_ONCE(local_time_state->tick_stopped, false);
+    current_tick = plat_get_current_tick();
+    tick_delta = TICK_MS * US_IN_MS * tick_per_us;
+    if (local_time_state->next_expire > current_tick + tick_delta) {
+        local_time_state->next_expire = current_tick + tick_delta;
+        plat_set_next_timer(tick_delta);
+    }
+}
+
+/* Read by other CPUs without locking, so the result is only a hint */
+bool timer_tick_stopped(unsigned int cpuid)
+{
+    BUG_ON(cpuid >= PLAT_CPU_NUM);
+    return READ_ONCE(time_states[cpuid].tick_stopped);
+}
+
+/*
+ * Interrupt a core whose tick is stopped so that it reschedules.
+ * The IPI goes through the IPI tx (not a raw arch_send_ipi), otherwise
+ * handle_ipi() on the target would drop it. Handling IPI_RESCHED takes no
+ * lock, so waiting for the target while holding a ready queue lock is fine.
+ * Without PLAT_HAS_RESCHED_IPI, remote cores never stop their tick
+ * (see TICKLESS_ENABLED), so there is nothing to kick.
+ */
+void timer_kick_cpu(unsigned int cpuid)
+{
+    BUG_ON(cpuid >= PLAT_CPU_NUM);
+#ifdef PLAT_HAS_RESCHED_IPI
+    if (cpuid != smp_get_cpu_id() && READ_ONCE(time_states[cpuid].tick_stopped))
+        send_ipi(cpuid, IPI_RESCHED);
+#endif
+}
+
+u64 get_timer_irq_count(unsigned int cpuid)
+{
+    BUG_ON(cpuid >= PLAT_CPU_NUM);
+    return time_states[cpuid].nr_timer_irqs;
+}
+
+void get_timer_sleeper_count(unsigned int cpuid, unsigned long *cur,
+                             unsigned long *max)
+{
+    BUG_ON(cpuid >= PLAT_CPU_NUM);
+    *cur = READ_ONCE(time_states[cpuid].nr_sleepers);
+    *max = READ_ONCE(time_states[cpuid].max_sleepers);
+}
+
 /*
  * clock_gettime:
  * - the return time is caculated from the system boot
@@ -184,9 +308,7 @@ int enqueue_sleeper(struct thread *thread, const struct timespec *timeout,
     u64 s, ns, total_us;
     u64 wakeup_tick;
     struct time_state *local_time_state;
-    struct list_head *local_sleep_list;
     struct lock *local_sleep_list_lock;
-    struct sleep_state *iter;
 
     s = timeout->tv_sec;
     ns = timeout->tv_nsec;
@@ -197,15 +319,10 @@ int enqueue_sleeper(struct thread *thread, const struct timespec *timeout,
     thread->sleep_state.sleep_cpu = smp_get_cpu_id();
 
     local_time_state = &time_states[smp_get_cpu_id()];
-    local_sleep_list = &local_time_state->sleep_list;
     local_sleep_list_lock = &local_time_state->sleep_list_lock;
 
     lock(local_sleep_list_lock);
-    for_each_in_list (iter, struct sleep_state, sleep_node, local_sleep_list) {
-        if (iter->wakeup_tick > wakeup_tick)
-            break;
-    }
-    list_append(&thread->sleep_state.sleep_node, &iter->sleep_node);
+    add_sleeper(local_time_state, &thread->sleep_state);
     thread->sleep_state.cb = cb;
 
     unlock(local_sleep_list_lock);
@@ -243,7 +360,7 @@ bool try_dequeue_sleeper(struct thread *thread)
     if (try_lock(target_sleep_list_lock) == 0) {
         BUG_ON(thread->sleep_state.cb == NULL);
 
-        list_del(&thread->sleep_state.sleep_node);
+        remove_sleeper(target_time_state, &thread->sleep_state);
         thread->sleep_state.cb = NULL;
         ret = true;
 
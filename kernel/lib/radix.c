@@ -14,6 +14,8 @@
 #include <common/kprint.h>
 #include <common/macro.h>
 #include <common/radix.h>
+#include <arch/sync.h>
+#include <arch/machine/smp.h>
 #endif
 #include <common/errno.h>
 
@@ -56,106 +58,176 @@ static struct radix_node *new_radix_node(void)
     return n;
 }
 
-#ifndef FBINFER
-int radix_add(struct radix *radix, u64 key, void *value)
+/*
+ * Lookups (radix_get) do not take radix_lock. A new node or value is fully
+ * initialized before it is published with a release barrier, and nodes are
+ * never freed before radix_free, which is only invoked when no one else can
+ * access the tree (e.g., in pmo_deinit).
+ */
+static inline void radix_publish(void **slot, void *ptr)
+{
+    smp_wmb();
+    *(void *volatile *)slot = ptr;
+}
+
+/* Per-CPU counters, printed by print_radix_stats */
+struct radix_stats {
+    /* Lock-free lookups */
+    unsigned long nr_lookups;
+    /* Updates, and the ones finding radix_lock held by another updater */
+    unsigned long nr_updates;
+    unsigned long nr_contended;
+};
+
+static struct radix_stats radix_stats[PLAT_CPU_NUM];
+
+static void radix_lock_update(struct radix *radix)
+{
+    struct radix_stats *stats = &radix_stats[smp_get_cpu_id()];
+
+    stats->nr_updates++;
+    if (try_lock(&radix->radix_lock) != 0) {
+        stats->nr_contended++;
+        lock(&radix->radix_lock);
+    }
+}
+
+void print_radix_stats(void)
+{
+    int cpuid;
+
+    for (cpuid = 0; cpuid < PLAT_CPU_NUM; cpuid++) {
+        kinfo("radix cpu %d: lookups %lu, updates %lu (contended %lu)\n",
+              cpuid,
+              radix_stats[cpuid].nr_lookups,
+              radix_stats[cpuid].nr_updates,
+              radix_stats[cpuid].nr_contended);
+    }
+}
+
+/*
+ * Return the leaf node holding @key, creating the missing nodes on the way.
+ * Called with radix_lock held.
+ */
+static struct radix_node *radix_get_leaf_locked(struct radix *radix, u64 key)
 {
-    int ret;
     struct radix_node *node;
     struct radix_node *new;
-    u16 index[RADIX_LEVELS];
     int i;
     int k;
 
-    lock(&radix->radix_lock);
     if (!radix->root) {
         new = new_radix_node();
-        if (IS_ERR(new)) {
-            ret = -ENOMEM;
-            goto fail_out;
-        }
-        radix->root = new;
+        if (IS_ERR(new))
+            return new;
+        radix_publish((void **)&radix->root, new);
     }
     node = radix->root;
 
-    /* calculate index for each level */
-    for (i = 0; i < RADIX_LEVELS; ++i) {
-        index[i] = key & RADIX_NODE_MASK;
-        key >>= RADIX_NODE_BITS;
-    }
-
     /* the intermediate levels */
     for (i = RADIX_LEVELS - 1; i > 0; --i) {
-        k = index[i];
+        k = (key >> (i * RADIX_NODE_BITS)) & RADIX_NODE_MASK;
         if (!node->children[k]) {
             new = new_radix_node();
-            if (IS_ERR(new)) {
-                ret = -ENOMEM;
-                goto fail_out;
-            }
-            node->children[k] = new;
+            if (IS_ERR(new))
+                return new;
+            radix_publish((void **)&node->children[k], new);
         }
         node = node->children[k];
     }
 
+    return node;
+}
+
+#ifndef FBINFER
+int radix_add(struct radix *radix, u64 key, void *value)
+{
+    struct radix_node *node;
+    int k;
+
+    radix_lock_update(radix);
+    node = radix_get_leaf_locked(radix, key);
+    if (IS_ERR(node)) {
+        unlock(&radix->radix_lock);
+        return -ENOMEM;
+    }
+
     /* the leaf level */
-    k = index[0];
+    k = key & RADIX_NODE_MASK;
 
     if ((node->values[k] != NULL) && (value != NULL)) {
         kwarn("Radix: add an existing key\n");
         BUG_ON(1);
     }
 
-    node->values[k] = value;
+    radix_publish(&node->values[k], value);
 
     unlock(&radix->radix_lock);
     return 0;
+}
+
+/*
+ * Add @nr keys starting from @key, where key + i maps to
+ * (@value + i * @stride), e.g., a run of physical pages. The tree is locked
+ * once and walked once per leaf node.
+ */
+int radix_add_range(struct radix *radix, u64 key, u64 nr, void *value,
+                    u64 stride)
+{
+    struct radix_node *node;
+    u64 i = 0;
+    int k;
+
+    radix_lock_update(radix);
+    while (i < nr) {
+        node = radix_get_leaf_locked(radix, key + i);
+        if (IS_ERR(node)) {
+            unlock(&radix->radix_lock);
+            return -ENOMEM;
+        }
 
-fail_out:
+        /* Fill in the leaf until its end or the end of the range */
+        for (k = (key + i) & RADIX_NODE_MASK; k < RADIX_NODE_SIZE && i < nr;
+             k++, i++) {
+            if (node->values[k] != NULL) {
+                kwarn("Radix: add an existing key\n");
+                BUG_ON(1);
+            }
+            radix_publish(&node->values[k], (char *)value + i * stride);
+        }
+    }
     unlock(&radix->radix_lock);
-    return ret;
+    return 0;
 }
 
 void *radix_get(struct radix *radix, u64 key)
 {
-    void *ret;
     struct radix_node *node;
-    u16 index[RADIX_LEVELS];
     int i;
     int k;
 
-    lock(&radix->radix_lock);
-    if (!radix->root) {
-        ret = NULL;
-        goto out;
-    }
-    node = radix->root;
-
-    /* calculate index for each level */
-    for (i = 0; i < RADIX_LEVELS; ++i) {
-        index[i] = key & RADIX_NODE_MASK;
-        key >>= RADIX_NODE_BITS;
-    }
+    /*
+     * Lock-free: each pointer is loaded once, and the address dependency
+     * orders the loads of its content after the publisher's barrier.
+     */
+    radix_stats[smp_get_cpu_id()].nr_lookups++;
+    node = *(struct radix_node *volatile *)&radix->root;
+    if (!node)
+        return NULL;
 
     /* the intermediate levels */
     for (i = RADIX_LEVELS - 1; i > 0; --i) {
-        k = index[i];
-        if (!node->children[k]) {
-            ret = NULL;
-            goto out;
-        }
-        node = node->children[k];
+        k = (key >> (i * RADIX_NODE_BITS)) & RADIX_NODE_MASK;
+        node = *(struct radix_node *volatile *)&node->children[k];
+        if (!node)
+            return NULL;
     }
 
     /* the leaf level */
-    k = index[0];
-    ret = node->values[k];
-
-out:
-    unlock(&radix->radix_lock);
-    return ret;
+    k = key & RADIX_NODE_MASK;
+    return *(void *volatile *)&node->values[k];
 }
 
-
 int radix_del(struct radix *radix, u64 key)
 {
     return radix_add(radix, key, NULL);
@@ -189,12 +261,13 @@ static void radix_free_node(struct radix_node *node, int node_level,
 
 int radix_free(struct radix *radix)
 {
-    lock(&radix->radix_lock);
     if (!radix || !radix->root) {
         WARN("trying to free an empty radix tree");
         return -EINVAL;
     }
 
+    lock(&radix->radix_lock);
+
     // recurssively free nodes and values (if value_deleter is not NULL)
     radix_free_node(radix->root, 0, radix->value_deleter);
     unlock(&radix->radix_lock);
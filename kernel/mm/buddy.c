@@ -13,6 +13,7 @@
 #include <common/macro.h>
 #include <common/kprint.h>
 #include <mm/buddy.h>
+#include <arch/machine/smp.h>
 
 static struct page *get_buddy_chunk(struct phys_mem_pool *pool,
                                     struct page *chunk)
@@ -119,6 +120,57 @@ static struct page *merge_chunk(struct phys_mem_pool *pool, struct page *chunk)
     return merge_chunk(pool, chunk);
 }
 
+/* Get a chunk of @order from the free lists. The buddy_lock must be held. */
+static struct page *__buddy_get_pages(struct phys_mem_pool *pool, int order)
+{
+    int cur_order;
+    struct list_head *free_list;
+    struct page *page = NULL;
+
+    /* Search a chunk (with just enough size) in the free lists. */
+    for (cur_order = order; cur_order < BUDDY_MAX_ORDER; ++cur_order) {
+        free_list = &(pool->free_lists[cur_order].free_list);
+        if (!list_empty(free_list)) {
+            /* Get a free memory chunck from the free list */
+            page = list_entry(free_list->next, struct page, node);
+            list_del(&page->node);
+            pool->free_lists[cur_order].nr_free -= 1;
+            page->allocated = 1;
+            break;
+        }
+    }
+
+    if (unlikely(page == NULL)) {
+        kdebug("[OOM] No enough memory in memory pool %p\n", pool);
+        return NULL;
+    }
+
+    /*
+     * Split the chunk found and return the start part of the chunck
+     * which can meet the required size.
+     */
+    return split_chunk(pool, order, page);
+}
+
+/* Return a chunk to the free lists. The buddy_lock must be held. */
+static void __buddy_free_pages(struct phys_mem_pool *pool, struct page *page)
+{
+    int order;
+    struct list_head *free_list;
+
+    BUG_ON(page->allocated == 0);
+    /* Mark the chunk @page as free. */
+    page->allocated = 0;
+    /* Merge the freed chunk. */
+    page = merge_chunk(pool, page);
+
+    /* Put the merged chunk into the its corresponding free list. */
+    order = page->order;
+    free_list = &(pool->free_lists[order].free_list);
+    list_add(&page->node, free_list);
+    pool->free_lists[order].nr_free += 1;
+}
+
 /*
  * The layout of a phys_mem_pool:
  * | page_metadata are (an array of struct page) | alignment pad | usable memory
@@ -130,7 +182,9 @@ void init_buddy(struct phys_mem_pool *pool, struct page *start_page,
                 vaddr_t start_addr, unsigned long page_num)
 {
     int order;
-    int page_idx;
+    unsigned long page_idx;
+    int cpuid;
+    vaddr_t addr;
     struct page *page;
 
     BUG_ON(lock_init(&pool->buddy_lock) != 0);
@@ -159,18 +213,105 @@ void init_buddy(struct phys_mem_pool *pool, struct page *start_page,
         page->pool = pool;
     }
 
-    /* Put each physical memory page into the free lists. */
-    for (page_idx = 0; page_idx < page_num; ++page_idx) {
+    /* Init the per-CPU page caches. */
+    for (cpuid = 0; cpuid < PLAT_CPU_NUM; ++cpuid) {
+        lock_init(&pool->pcp[cpuid].lock);
+        for (order = 0; order < PCP_NR_ORDERS; ++order) {
+            init_list_head(&pool->pcp[cpuid].lists[order]);
+            pool->pcp[cpuid].count[order] = 0;
+        }
+        pool->pcp[cpuid].nr_allocs = 0;
+        pool->pcp[cpuid].nr_refills = 0;
+        pool->pcp[cpuid].nr_drains = 0;
+    }
+    pool->pcp_high = PCP_DEFAULT_HIGH;
+    pool->pcp_low = PCP_DEFAULT_LOW;
+
+    /*
+     * Carve the pool into maximal chunks that are naturally aligned (the
+     * buddy of a chunk is located by its address) and put them into the
+     * free lists directly. The result is the same as freeing every page
+     * one by one, without merging millions of times.
+     */
+    lock(&pool->buddy_lock);
+    page_idx = 0;
+    while (page_idx < page_num) {
+        addr = start_addr + page_idx * BUDDY_PAGE_SIZE;
+        order = BUDDY_MAX_ORDER - 1;
+        while (order > 0
+               && (!IS_ALIGNED(addr, BUDDY_PAGE_SIZE << order)
+                   || page_idx + (1UL << order) > page_num))
+            order--;
+
         page = start_page + page_idx;
-        buddy_free_pages(pool, page);
+        page->allocated = 0;
+        page->order = order;
+        list_add(&page->node, &pool->free_lists[order].free_list);
+        pool->free_lists[order].nr_free += 1;
+
+        page_idx += 1UL << order;
     }
+    unlock(&pool->buddy_lock);
+}
+
+static inline unsigned long pcp_high(struct phys_mem_pool *pool, int order)
+{
+    return MAX(pool->pcp_high >> order, 1UL);
+}
+
+static inline unsigned long pcp_low(struct phys_mem_pool *pool, int order)
+{
+    return MAX(pool->pcp_low >> order, 1UL);
+}
+
+/* Move a batch of chunks into an empty pcp list. pcp->lock must be held. */
+static void pcp_refill(struct phys_mem_pool *pool, struct per_cpu_pages *pcp,
+                       int order)
+{
+    unsigned long i, batch;
+    struct page *page;
+
+    batch = pcp_low(pool, order);
+    pcp->nr_refills += 1;
+
+    lock(&pool->buddy_lock);
+    for (i = 0; i < batch; ++i) {
+        page = __buddy_get_pages(pool, order);
+        if (page == NULL)
+            break;
+        list_add(&page->node, &pcp->lists[order]);
+        pcp->count[order] += 1;
+    }
+    unlock(&pool->buddy_lock);
+}
+
+/*
+ * Give the oldest chunks of a pcp list back until @target are left.
+ * pcp->lock must be held.
+ */
+static void pcp_drain(struct phys_mem_pool *pool, struct per_cpu_pages *pcp,
+                      int order, unsigned long target)
+{
+    struct page *page;
+
+    if (pcp->count[order] <= target)
+        return;
+    pcp->nr_drains += 1;
+
+    lock(&pool->buddy_lock);
+    while (pcp->count[order] > target) {
+        page = list_entry(pcp->lists[order].prev, struct page, node);
+        list_del(&page->node);
+        pcp->count[order] -= 1;
+        __buddy_free_pages(pool, page);
+    }
+    unlock(&pool->buddy_lock);
 }
 
 struct page *buddy_get_pages(struct phys_mem_pool *pool, int order)
 {
-    int cur_order;
-    struct list_head *free_list;
-    struct page *page = NULL;
+    struct per_cpu_pages *pcp;
+    struct page *page;
 
     if (unlikely(order >= BUDDY_MAX_ORDER)) {
         kwarn("ChCore does not support allocating such too large "
@@ -178,57 +319,123 @@ struct page *buddy_get_pages(struct phys_mem_pool *pool, int order)
         return NULL;
     }
 
-    lock(&pool->buddy_lock);
-
-    /* Search a chunk (with just enough size) in the free lists. */
-    for (cur_order = order; cur_order < BUDDY_MAX_ORDER; ++cur_order) {
-        free_list = &(pool->free_lists[cur_order].free_list);
-        if (!list_empty(free_list)) {
-            /* Get a free memory chunck from the free list */
-            page = list_entry(free_list->next, struct page, node);
-            list_del(&page->node);
-            pool->free_lists[cur_order].nr_free -= 1;
-            page->allocated = 1;
-            break;
-        }
+    if (order > PCP_MAX_ORDER) {
+        lock(&pool->buddy_lock);
+        page = __buddy_get_pages(pool, order);
+        unlock(&pool->buddy_lock);
+        return page;
     }
 
-    if (unlikely(page == NULL)) {
-        kdebug("[OOM] No enough memory in memory pool %p\n", pool);
-        goto out;
+    pcp = &pool->pcp[smp_get_cpu_id()];
+    lock(&pcp->lock);
+    if (list_empty(&pcp->lists[order])) {
+        pcp_refill(pool, pcp, order);
+        if (list_empty(&pcp->lists[order])) {
+            unlock(&pcp->lock);
+            return NULL;
+        }
     }
 
-    /*
-     * Split the chunk found and return the start part of the chunck
-     * which can meet the required size.
-     */
-    page = split_chunk(pool, order, page);
+    page = list_entry(pcp->lists[order].next, struct page, node);
+    list_del(&page->node);
+    pcp->count[order] -= 1;
+    pcp->nr_allocs += 1;
+    unlock(&pcp->lock);
 
-out:
-    unlock(&pool->buddy_lock);
     return page;
 }
 
 void buddy_free_pages(struct phys_mem_pool *pool, struct page *page)
 {
+    struct per_cpu_pages *pcp;
     int order;
-    struct list_head *free_list;
 
-    lock(&pool->buddy_lock);
+    order = page->order;
+    if (order > PCP_MAX_ORDER) {
+        lock(&pool->buddy_lock);
+        __buddy_free_pages(pool, page);
+        unlock(&pool->buddy_lock);
+        return;
+    }
 
     BUG_ON(page->allocated == 0);
-    /* Mark the chunk @page as free. */
-    page->allocated = 0;
-    /* Merge the freed chunk. */
-    page = merge_chunk(pool, page);
 
-    /* Put the merged chunk into the its corresponding free list. */
-    order = page->order;
-    free_list = &(pool->free_lists[order].free_list);
-    list_add(&page->node, free_list);
-    pool->free_lists[order].nr_free += 1;
+    /* Hot chunks are put at the head and handed out first. */
+    pcp = &pool->pcp[smp_get_cpu_id()];
+    lock(&pcp->lock);
+    list_add(&page->node, &pcp->lists[order]);
+    pcp->count[order] += 1;
 
-    unlock(&pool->buddy_lock);
+    if (pcp->count[order] > pcp_high(pool, order))
+        pcp_drain(pool, pcp, order, pcp_low(pool, order));
+    unlock(&pcp->lock);
+}
+
+/*
+ * Turn an allocated chunk into (1 << order) allocated order-0 pages,
+ * which can be freed one by one and merge back as usual.
+ */
+void buddy_split_allocated(struct page *page)
+{
+    unsigned long i, nr_pages;
+
+    BUG_ON(page->allocated == 0);
+
+    nr_pages = 1UL << page->order;
+    for (i = 0; i < nr_pages; ++i) {
+        page[i].order = 0;
+        page[i].allocated = 1;
+    }
+}
+
+void buddy_set_pcp_watermark(struct phys_mem_pool *pool, unsigned long high,
+                             unsigned long low)
+{
+    BUG_ON(low == 0 || low >= high);
+
+    pool->pcp_high = high;
+    pool->pcp_low = low;
+}
+
+/*
+ * Return all the chunks cached by every CPU to the free lists, so that they
+ * can merge into larger chunks.
+ */
+void buddy_drain_pcp(struct phys_mem_pool *pool)
+{
+    struct per_cpu_pages *pcp;
+    int cpuid, order;
+
+    for (cpuid = 0; cpuid < PLAT_CPU_NUM; ++cpuid) {
+        pcp = &pool->pcp[cpuid];
+        lock(&pcp->lock);
+        for (order = 0; order < PCP_NR_ORDERS; ++order)
+            pcp_drain(pool, pcp, order, 0);
+        unlock(&pcp->lock);
+    }
+}
+
+void buddy_print_pcp_stats(struct phys_mem_pool *pool)
+{
+    struct per_cpu_pages *pcp;
+    unsigned long cached;
+    int cpuid, order;
+
+    for (cpuid = 0; cpuid < PLAT_CPU_NUM; ++cpuid) {
+        pcp = &pool->pcp[cpuid];
+        lock(&pcp->lock);
+        cached = 0;
+        for (order = 0; order < PCP_NR_ORDERS; ++order)
+            cached += pcp->count[order] << order;
+        kinfo("pcp cpu %d: allocs %lu, refills %lu, drains %lu, cached "
+              "pages %lu\n",
+              cpuid,
+              pcp->nr_allocs,
+              pcp->nr_refills,
+              pcp->nr_drains,
+              cached);
+        unlock(&pcp->lock);
+    }
 }
 
 void *page_to_virt(struct page *page)
@@ -273,6 +480,15 @@ unsigned long get_free_mem_size_from_buddy(struct phys_mem_pool *pool)
     struct free_list *list;
     unsigned long current_order_size;
     unsigned long total_size = 0;
+    int cpuid;
+
+    /* Chunks cached in the per-CPU lists are free as well. */
+    for (cpuid = 0; cpuid < PLAT_CPU_NUM; cpuid++) {
+        for (order = 0; order < PCP_NR_ORDERS; order++) {
+            total_size += pool->pcp[cpuid].count[order] * BUDDY_PAGE_SIZE
+                          * (1 << order);
+        }
+    }
 
     for (order = 0; order < BUDDY_MAX_ORDER; order++) {
         /* 2^order * 4K */
@@ -18,18 +18,47 @@
 
 #include <mm/slab.h>
 #include <mm/buddy.h>
+#include <mm/kmalloc.h>
 
 #define SLAB_MAX_SIZE (1UL << SLAB_MAX_ORDER)
 #define ZERO_SIZE_PTR ((void *)(-1UL))
 
+/*
+ * Try to get continous physical memory pages from one physmem pool, without
+ * draining any cache or warning on failure. For callers which can fall back
+ * to a smaller allocation.
+ */
+void *try_get_pages(int order)
+{
+    struct page *page;
+    int i;
+
+    for (i = 0; i < physmem_map_num; ++i) {
+        page = buddy_get_pages(&global_mem[i], order);
+        if (page)
+            return page_to_virt(page);
+    }
+    return NULL;
+}
+
 void *_get_pages(int order, bool is_record)
 {
     struct page *page = NULL;
     int i;
     void *addr;
 
-    /* Try to get continous physical memory pages from one physmem pool. */
+    addr = try_get_pages(order);
+    if (likely(addr))
+        return addr;
+
+    /*
+     * Give the objects and chunks cached by all CPUs and the zeroed pool back
+     * and retry. Slabs freed by the magazines land in the pcp lists first.
+     */
+    drain_zeroed_pages();
+    slab_drain_magazines();
     for (i = 0; i < physmem_map_num; ++i) {
+        buddy_drain_pcp(&global_mem[i]);
         page = buddy_get_pages(&global_mem[i], order);
         if (page)
             break;
@@ -67,6 +96,12 @@ void free_pages_without_record(void *addr)
     _free_pages(addr, false);
 }
 
+/* Make each page of the chunk at @addr freeable by free_pages on its own. */
+void split_pages(void *addr)
+{
+    buddy_split_allocated(virt_to_page(addr));
+}
+
 static int size_to_page_order(unsigned long size)
 {
     unsigned long order;
@@ -111,7 +146,7 @@ void *_kmalloc(size_t size, bool is_record, size_t *real_size)
     return addr;
 }
 
-void *kmalloc(size_t size)
+void *kmalloc(unsigned long size)
 {
     size_t real_size;
     void *ret;
@@ -119,11 +154,13 @@ void *kmalloc(size_t size)
     return ret;
 }
 
-void *kzalloc(size_t size)
+void *kzalloc(unsigned long size)
 {
     void *addr;
 
     addr = kmalloc(size);
+    if (unlikely(addr == NULL))
+        return NULL;
     memset(addr, 0, size);
     return addr;
 }
@@ -14,6 +14,10 @@
 #include <common/macro.h>
 #include <mm/slab.h>
 #include <mm/buddy.h>
+#include <mm/kmem_cache.h>
+#include <mm/kmalloc.h>
+#include <common/radix.h>
+#include <arch/time.h>
 
 /* The following two will be filled by parse_mem_map. */
 paddr_t physmem_map[N_PHYS_MEM_POOLS][2];
@@ -73,6 +77,9 @@ static void init_buddy_for_one_physmem_map(int physmem_map_idx)
 void mm_init(void *physmem_info)
 {
     int physmem_map_idx;
+    u64 start_cnt, end_cnt, freq;
+
+    start_cnt = get_sys_counter();
 
     /* Step-1: parse the physmem_info to get each continuous range of the
      * physmem. */
@@ -87,6 +94,16 @@ void mm_init(void *physmem_info)
 
     /* Step-3: init the slab allocator. */
     init_slab();
+
+    /* Step-4: init the caches of mm objects. */
+    init_vmregion_cache();
+    init_zeroed_pages();
+
+    end_cnt = get_sys_counter();
+    freq = get_sys_counter_freq();
+    kinfo("[ChCore] mm init took %llu counter cycles (%llu us)\n",
+          end_cnt - start_cnt,
+          freq ? (end_cnt - start_cnt) * 1000000 / freq : 0);
 }
 
 unsigned long get_free_mem_size(void)
@@ -95,6 +112,7 @@ unsigned long get_free_mem_size(void)
     int i;
 
     size = get_free_mem_size_from_slab();
+    size += get_free_mem_size_from_zeroed_pages();
     for (i = 0; i < physmem_map_num; ++i)
         size += get_free_mem_size_from_buddy(&global_mem[i]);
 
@@ -110,4 +128,20 @@ unsigned long get_total_mem_size(void)
         size += get_total_mem_size_from_buddy(&global_mem[i]);
 
     return size;
-}
\ No newline at end of file
+}
+
+void get_mem_usage_msg(void)
+{
+    int i;
+
+    kinfo("memory: total 0x%lx, free 0x%lx (slab free 0x%lx)\n",
+          get_total_mem_size(),
+          get_free_mem_size(),
+          get_free_mem_size_from_slab());
+    for (i = 0; i < physmem_map_num; ++i)
+        buddy_print_pcp_stats(&global_mem[i]);
+    print_zeroed_pages_usage();
+    kmem_cache_print_usage();
+    print_tlb_flush_stats();
+    print_radix_stats();
+}
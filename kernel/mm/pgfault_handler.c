@@ -22,6 +22,7 @@
 #include <object/user_fault.h>
 #include <object/thread.h>
 #include <mm/page_fault.h>
+#include <mm/kmalloc.h>
 
 static void dump_pgfault_error(void)
 {
@@ -124,6 +125,90 @@ out:
     return ret;
 }
 
+/*
+ * Populate the run of uncommitted pages around @index, within the aligned
+ * window of FAULT_AROUND_PAGES and bounded by @vmr and @pmo. The pages are
+ * taken from one zeroed buddy chunk, so they are committed and mapped at
+ * once. Fall back to a single page if no such chunk is available.
+ *
+ * Return the physical address of the page at @index, or 0 on OOM.
+ */
+static paddr_t fault_around(struct vmspace *vmspace, struct vmregion *vmr,
+                            struct pmobject *pmo, unsigned long index)
+{
+    unsigned long win_first, win_end, first, last, nr_pages, i;
+    vaddr_t win_va;
+    void *chunk;
+    paddr_t pa;
+    int order;
+    long rss = 0;
+
+    win_va = ROUND_DOWN(vmr->start + index * PAGE_SIZE,
+                        FAULT_AROUND_PAGES * PAGE_SIZE);
+    win_first = win_va > vmr->start ? (win_va - vmr->start) / PAGE_SIZE : 0;
+    win_end = MIN(win_first + FAULT_AROUND_PAGES,
+                  DIV_ROUND_UP(MIN(vmr->size, pmo->size), PAGE_SIZE));
+
+    first = index;
+    while (first > win_first && get_page_from_pmo(pmo, first - 1) == 0)
+        first--;
+    last = index;
+    while (last + 1 < win_end && get_page_from_pmo(pmo, last + 1) == 0)
+        last++;
+    nr_pages = last - first + 1;
+
+    order = 0;
+    while ((1UL << order) < nr_pages)
+        order++;
+
+    /* The chunk is already zeroed. Quietly fall back on failure. */
+    chunk = order > 0 ? try_get_zeroed_pages(order) : NULL;
+    if (chunk == NULL) {
+        first = last = index;
+        nr_pages = 1;
+        order = 0;
+        chunk = get_zeroed_pages(0);
+        if (chunk == NULL)
+            return 0;
+    }
+
+    /* Give back the pages beyond the run. */
+    if (order > 0) {
+        split_pages(chunk);
+        for (i = nr_pages; i < (1UL << order); ++i)
+            free_pages((void *)((vaddr_t)chunk + i * PAGE_SIZE));
+    }
+
+    pa = virt_to_phys(chunk);
+
+    /*
+     * Record the physical pages in the radix tree:
+     * the offset is used as index in the radix tree
+     */
+    kdebug("commit: index: %ld, 0x%lx, %ld pages\n", first, pa, nr_pages);
+    commit_pages_to_pmo(pmo, first, pa, nr_pages);
+
+    /* Add mapping in the page table */
+    lock(&vmspace->pgtbl_lock);
+    map_range_in_pgtbl(vmspace->pgtbl,
+                       vmr->start + first * PAGE_SIZE,
+                       pa,
+                       nr_pages * PAGE_SIZE,
+                       vmr->perm,
+                       &rss);
+    vmspace->rss += rss;
+    vmspace->nr_faults += 1;
+    vmspace->nr_fault_pages += nr_pages;
+    unlock(&vmspace->pgtbl_lock);
+
+    if (nr_pages > 1 && (vmr->perm & VMR_EXEC))
+        arch_flush_cache(vmr->start + first * PAGE_SIZE,
+                         nr_pages * PAGE_SIZE,
+                         SYNC_IDCACHE);
+
+    return pa + (index - first) * PAGE_SIZE;
+}
+
 static int check_trans_fault(struct vmspace *vmspace, vaddr_t fault_addr)
 {
     int ret = 0;
@@ -147,21 +232,21 @@ int handle_trans_fault(struct vmspace *vmspace, vaddr_t fault_addr)
     paddr_t pa;
     unsigned long offset;
     unsigned long index;
+    bool commit_waited;
     int ret = 0;
 
     /*
-     * Grab lock here.
-     * Because two threads (in same process) on different cores
-     * may fault on the same page, so we need to prevent them
-     * from adding the same mapping twice.
+     * Grab the read lock here so that the vmr cannot be removed
+     * while handling the fault. Faults on other vmrs can proceed
+     * in parallel.
      */
-    lock(&vmspace->vmspace_lock);
+    read_lock(&vmspace->vmspace_lock);
     vmr = find_vmr_for_va(vmspace, fault_addr);
 
     if (vmr == NULL) {
         kinfo("handle_trans_fault: no vmr found for va 0x%lx!\n", fault_addr);
         dump_pgfault_error();
-        unlock(&vmspace->vmspace_lock);
+        read_unlock(&vmspace->vmspace_lock);
 
 #if defined(CHCORE_ARCH_AARCH64)
         /* kernel fault fixup is only supported on AArch64 and Sparc */
@@ -187,31 +272,22 @@ int handle_trans_fault(struct vmspace *vmspace, vaddr_t fault_addr)
 
         fault_addr = ROUND_DOWN(fault_addr, PAGE_SIZE);
 
+        /*
+         * Two threads on different cores may fault on the same page,
+         * even through different vmrs mapping this pmo, so we need to
+         * prevent them from committing different pages for it.
+         */
+        commit_waited = try_lock(&pmo->commit_lock) != 0;
+        if (commit_waited)
+            lock(&pmo->commit_lock);
         pa = get_page_from_pmo(pmo, index);
         if (pa == 0) {
             /*
              * Not committed before. Then, allocate the physical
-             * page.
+             * pages for the faulting page and its neighbours.
              */
-            void *new_va = get_pages(0);
-            long rss = 0;
-            BUG_ON(new_va == NULL);
-            pa = virt_to_phys(new_va);
+            pa = fault_around(vmspace, vmr, pmo, index);
             BUG_ON(pa == 0);
-            /* Clear to 0 for the newly allocated page */
-            memset((void *)phys_to_virt(pa), 0, PAGE_SIZE);
-            /*
-             * Record the physical page in the radix tree:
-             * the offset is used as index in the radix tree
-             */
-            kdebug("commit: index: %ld, 0x%lx\n", index, pa);
-            commit_page_to_pmo(pmo, index, pa);
-
-            /* Add mapping in the page table */
-            lock(&vmspace->pgtbl_lock);
-            map_range_in_pgtbl(vmspace->pgtbl, fault_addr, pa, PAGE_SIZE, perm, &rss);
-            vmspace->rss += rss;
-            unlock(&vmspace->pgtbl_lock);
         } else {
             /*
              * pa != 0: the faulting address has be committed a
@@ -241,9 +317,18 @@ int handle_trans_fault(struct vmspace *vmspace, vaddr_t fault_addr)
                 map_range_in_pgtbl(
                     vmspace->pgtbl, fault_addr, pa, PAGE_SIZE, perm, &rss);
                 vmspace->rss += rss;
+                vmspace->nr_faults += 1;
+                vmspace->nr_fault_pages += 1;
                 unlock(&vmspace->pgtbl_lock);
             }
         }
+        unlock(&pmo->commit_lock);
+
+        if (commit_waited) {
+            lock(&vmspace->pgtbl_lock);
+            vmspace->nr_fault_waits += 1;
+            unlock(&vmspace->pgtbl_lock);
+        }
 
         if (perm & VMR_EXEC) {
             arch_flush_cache(fault_addr, PAGE_SIZE, SYNC_IDCACHE);
@@ -253,7 +338,7 @@ int handle_trans_fault(struct vmspace *vmspace, vaddr_t fault_addr)
     }
     case PMO_FILE: {
 #ifdef CHCORE_ENABLE_FMAP
-        unlock(&vmspace->vmspace_lock);
+        read_unlock(&vmspace->vmspace_lock);
         fault_addr = ROUND_DOWN(fault_addr, PAGE_SIZE);
         handle_user_fault(pmo, ROUND_DOWN(fault_addr, PAGE_SIZE));
         BUG("Should never be here!\n");
@@ -261,7 +346,7 @@ int handle_trans_fault(struct vmspace *vmspace, vaddr_t fault_addr)
         kinfo("file mmap is not enabled.\n");
         dump_pgfault_error();
 
-        unlock(&vmspace->vmspace_lock);
+        read_unlock(&vmspace->vmspace_lock);
         sys_exit_group(-1);
 
         BUG("should not reach here");
@@ -272,20 +357,28 @@ int handle_trans_fault(struct vmspace *vmspace, vaddr_t fault_addr)
         kinfo("Forbidden memory access (pmo->type is PMO_FORBID).\n");
         dump_pgfault_error();
 
-        unlock(&vmspace->vmspace_lock);
+        read_unlock(&vmspace->vmspace_lock);
         sys_exit_group(-1);
 
         BUG("should not reach here");
         break;
     }
     default: {
+        /*
+         * Eagerly mapped PMOs (e.g., PMO_DATA) are transiently unmapped
+         * when one of their block mappings is being split. Just retry if
+         * the mapping is there now.
+         */
+        if (check_trans_fault(vmspace, fault_addr) == 0)
+            break;
+
         kinfo("handle_trans_fault: faulting vmr->pmo->type"
               "(pmo type %d at 0x%lx)\n",
               vmr->pmo->type,
               fault_addr);
         dump_pgfault_error();
 
-        unlock(&vmspace->vmspace_lock);
+        read_unlock(&vmspace->vmspace_lock);
         sys_exit_group(-1);
 
         BUG("should not reach here");
@@ -293,7 +386,7 @@ int handle_trans_fault(struct vmspace *vmspace, vaddr_t fault_addr)
     }
     }
 
-    unlock(&vmspace->vmspace_lock);
+    read_unlock(&vmspace->vmspace_lock);
     return ret;
 }
 
@@ -347,13 +440,13 @@ int handle_perm_fault(struct vmspace *vmspace, vaddr_t fault_addr,
     struct vmregion *vmr;
     vmr_prop_t declared_perm;
 
-    lock(&vmspace->vmspace_lock);
+    read_lock(&vmspace->vmspace_lock);
     vmr = find_vmr_for_va(vmspace, fault_addr);
 
     if (vmr == NULL) {
         kinfo("handle_perm_fault: no vmr found for va 0x%lx!\n", fault_addr);
         dump_pgfault_error();
-        unlock(&vmspace->vmspace_lock);
+        read_unlock(&vmspace->vmspace_lock);
 #if defined(CHCORE_ARCH_AARCH64)
         return -EFAULT;
 #else
@@ -368,7 +461,9 @@ int handle_perm_fault(struct vmspace *vmspace, vaddr_t fault_addr,
     if ((declared_perm & VMR_READ) && desired_perm == VMR_WRITE) {
         // Handle COW here
         if (declared_perm & VMR_COW) {
+            lock(&vmr->vmr_lock);
             ret = do_cow(vmspace, vmr, fault_addr);
+            unlock(&vmr->vmr_lock);
             if (ret != 0 && ret != -EFAULT) {
                 goto out_illegal;
             } else if (ret == -EFAULT) {
@@ -392,7 +487,7 @@ int handle_perm_fault(struct vmspace *vmspace, vaddr_t fault_addr,
         goto out_illegal;
     }
 out_succ:
-    unlock(&vmspace->vmspace_lock);
+    read_unlock(&vmspace->vmspace_lock);
     return ret;
 out_illegal:
     // Illegal access permission, kill process
@@ -400,7 +495,7 @@ out_illegal:
           fault_addr,
           desired_perm);
     dump_pgfault_error();
-    unlock(&vmspace->vmspace_lock);
+    read_unlock(&vmspace->vmspace_lock);
 #if defined(CHCORE_ARCH_AARCH64)
     return -EPERM;
 #else
@@ -416,7 +511,7 @@ out_trans_fault:
      * they detect such cases, and treat it as a translation fault then
      * handle it atomically.
      */
-    unlock(&vmspace->vmspace_lock);
+    read_unlock(&vmspace->vmspace_lock);
     ret = handle_trans_fault(vmspace, fault_addr);
     return ret;
 }
@@ -14,14 +14,22 @@
 #include <common/kprint.h>
 #include <common/lock.h>
 #include <common/debug.h>
+#include <common/util.h>
 #include <mm/kmalloc.h>
 #include <mm/slab.h>
 #include <mm/buddy.h>
+#include <mm/kmem_cache.h>
+#include <arch/machine/smp.h>
 
 /* slab_pool is also static. We do not add the static modifier due to unit test.
  */
 struct slab_pointer slab_pool[SLAB_MAX_ORDER + 1];
 static struct lock slabs_locks[SLAB_MAX_ORDER + 1];
+static struct slab_magazine slab_mags[PLAT_CPU_NUM][SLAB_MAX_ORDER + 1];
+
+/* All the kmem_caches, for reporting memory usage. */
+static struct list_head kmem_caches;
+static struct lock kmem_caches_lock;
 
 /*
 static inline int order_to_index(int order)
@@ -144,39 +152,74 @@ static void choose_new_current_slab(struct slab_pointer *pool, int order)
     }
 }
 
-static void *alloc_in_slab_impl(int order)
+/* Take one free slot from the current slab of @pool, which must exist. */
+static void *take_free_slot(struct slab_pointer *pool)
 {
     struct slab_header *current_slab;
     struct slab_slot_list *free_list;
     void *next_slot;
 
-    lock(&slabs_locks[order]);
+    current_slab = pool->current_slab;
+    free_list = (struct slab_slot_list *)current_slab->free_list_head;
+    BUG_ON(free_list == NULL);
+
+    next_slot = free_list->next_free;
+    current_slab->free_list_head = next_slot;
+
+    current_slab->current_free_cnt -= 1;
+    /* When current_slab is full, choose a new slab as the current one. */
+    if (unlikely(current_slab->current_free_cnt == 0))
+        choose_new_current_slab(pool, current_slab->order);
+
+    return (void *)free_list;
+}
+
+/* Take one free slot of @order from the slabs. slabs_locks[order] must be held. */
+static void *__alloc_in_slab(int order)
+{
+    struct slab_header *current_slab;
 
     current_slab = slab_pool[order].current_slab;
     /* When serving the first allocation request. */
     if (unlikely(current_slab == NULL)) {
         current_slab = init_slab_cache(order, SIZE_OF_ONE_SLAB);
-        if (current_slab == NULL) {
-            unlock(&slabs_locks[order]);
+        if (current_slab == NULL)
             return NULL;
-        }
         slab_pool[order].current_slab = current_slab;
     }
 
-    free_list = (struct slab_slot_list *)current_slab->free_list_head;
-    BUG_ON(free_list == NULL);
+    return take_free_slot(&slab_pool[order]);
+}
 
-    next_slot = free_list->next_free;
-    current_slab->free_list_head = next_slot;
+static void *alloc_in_slab_impl(int order)
+{
+    struct slab_magazine *mag;
+    void *obj;
+
+    mag = &slab_mags[smp_get_cpu_id()][order];
+    lock(&mag->lock);
+
+    /* Refill the empty magazine with one acquisition of the slab lock. */
+    if (unlikely(mag->count == 0)) {
+        lock(&slabs_locks[order]);
+        while (mag->count < SLAB_MAG_BATCH) {
+            obj = __alloc_in_slab(order);
+            if (obj == NULL)
+                break;
+            mag->objs[mag->count++] = obj;
+        }
+        unlock(&slabs_locks[order]);
 
-    current_slab->current_free_cnt -= 1;
-    /* When current_slab is full, choose a new slab as the current one. */
-    if (unlikely(current_slab->current_free_cnt == 0))
-        choose_new_current_slab(&slab_pool[order], order);
+        if (mag->count == 0) {
+            unlock(&mag->lock);
+            return NULL;
+        }
+    }
 
-    unlock(&slabs_locks[order]);
+    obj = mag->objs[--mag->count];
+    unlock(&mag->lock);
 
-    return (void *)free_list;
+    return obj;
 }
 
 #if ENABLE_DETECTING_DOUBLE_FREE_IN_SLAB == ON
@@ -198,32 +241,59 @@ static int check_slot_is_free(struct slab_header *slab_header,
 }
 #endif
 
-static void try_insert_full_slab_to_partial(struct slab_header *slab)
+static void try_insert_full_slab_to_partial(struct slab_pointer *pool,
+                                            struct slab_header *slab)
 {
     /* @slab is not a full one. */
     if (slab->current_free_cnt != 0)
         return;
 
-    int order;
-    order = slab->order;
-
-    list_append(&slab->node, &slab_pool[order].partial_slab_list);
+    list_append(&slab->node, &pool->partial_slab_list);
 }
 
-static void try_return_slab_to_buddy(struct slab_header *slab, int order)
+/* Return true if @slab is freed. */
+static bool try_return_slab_to_buddy(struct slab_pointer *pool,
+                                     struct slab_header *slab,
+                                     unsigned long slab_size)
 {
     /* The slab is whole free now. */
     if (slab->current_free_cnt != slab->total_free_cnt)
-        return;
+        return false;
 
-    if (slab == slab_pool[order].current_slab)
-        choose_new_current_slab(&slab_pool[order], order);
+    if (slab == pool->current_slab)
+        choose_new_current_slab(pool, slab->order);
     else
         list_del(&slab->node);
 
     /* Clear the slab field in the page structures before freeing them. */
-    set_or_clear_slab_in_page(slab, SIZE_OF_ONE_SLAB, false);
+    set_or_clear_slab_in_page(slab, slab_size, false);
     free_pages_without_record(slab);
+    return true;
+}
+
+/* Put @slot back into @slab, and return true if @slab is freed. */
+static bool put_free_slot(struct slab_pointer *pool, struct slab_header *slab,
+                          struct slab_slot_list *slot, unsigned long slab_size)
+{
+    try_insert_full_slab_to_partial(pool, slab);
+
+#if ENABLE_DETECTING_DOUBLE_FREE_IN_SLAB == ON
+    /*
+     * SLAB double free detection: check whether the slot to free is
+     * already in the free list.
+     */
+    if (check_slot_is_free(slab, slot) == 1) {
+        kinfo("SLAB: double free detected. Address is %p\n",
+              (unsigned long)slot);
+        BUG_ON(1);
+    }
+#endif
+
+    slot->next_free = slab->free_list_head;
+    slab->free_list_head = slot;
+    slab->current_free_cnt += 1;
+
+    return try_return_slab_to_buddy(pool, slab, slab_size);
 }
 
 /* Interfaces exported to the kernel/mm moudule */
@@ -231,13 +301,21 @@ static void try_return_slab_to_buddy(struct slab_header *slab, int order)
 void init_slab(void)
 {
     int order;
+    int cpuid;
 
     /* slab obj size: 32, 64, 128, 256, 512, 1024, 2048 */
     for (order = SLAB_MIN_ORDER; order <= SLAB_MAX_ORDER; order++) {
         lock_init(&slabs_locks[order]);
         slab_pool[order].current_slab = NULL;
         init_list_head(&(slab_pool[order].partial_slab_list));
+        for (cpuid = 0; cpuid < PLAT_CPU_NUM; cpuid++) {
+            lock_init(&slab_mags[cpuid][order].lock);
+            slab_mags[cpuid][order].count = 0;
+        }
     }
+
+    lock_init(&kmem_caches_lock);
+    init_list_head(&kmem_caches);
     kdebug("mm: finish initing slab allocators\n");
 }
 
@@ -254,42 +332,58 @@ void *alloc_in_slab(unsigned long size, size_t *real_size)
     return alloc_in_slab_impl(order);
 }
 
-void free_in_slab(void *addr)
+/* Give one slot back to its slab. slabs_locks[slab->order] must be held. */
+static void __free_in_slab(void *addr)
 {
     struct page *page;
     struct slab_header *slab;
-    struct slab_slot_list *slot;
-    int order;
 
-    slot = (struct slab_slot_list *)addr;
     page = virt_to_page(addr);
     BUG_ON(page == NULL);
 
     slab = page->slab;
-    order = slab->order;
-    lock(&slabs_locks[order]);
+    put_free_slot(&slab_pool[slab->order],
+                  slab,
+                  (struct slab_slot_list *)addr,
+                  SIZE_OF_ONE_SLAB);
+}
 
-    try_insert_full_slab_to_partial(slab);
+void free_in_slab(void *addr)
+{
+    struct page *page;
+    struct slab_header *slab;
+    struct slab_magazine *mag;
+    int order;
+    int i;
 
-#if ENABLE_DETECTING_DOUBLE_FREE_IN_SLAB == ON
-    /*
-     * SLAB double free detection: check whether the slot to free is
-     * already in the free list.
-     */
-    if (check_slot_is_free(slab, slot) == 1) {
-        kinfo("SLAB: double free detected. Address is %p\n",
-              (unsigned long)slot);
-        BUG_ON(1);
-    }
-#endif
+    page = virt_to_page(addr);
+    BUG_ON(page == NULL);
 
-    slot->next_free = slab->free_list_head;
-    slab->free_list_head = slot;
-    slab->current_free_cnt += 1;
+    slab = page->slab;
+    /* The slot belongs to a kmem_cache. */
+    if (slab->order == KMEM_SLAB_ORDER) {
+        kmem_cache_free(((struct kmem_slab *)slab)->cache, addr);
+        return;
+    }
 
-    try_return_slab_to_buddy(slab, order);
+    order = slab->order;
+    mag = &slab_mags[smp_get_cpu_id()][order];
+    lock(&mag->lock);
+
+    /* Flush the oldest half of the full magazine back to the slabs. */
+    if (unlikely(mag->count == SLAB_MAG_SIZE)) {
+        lock(&slabs_locks[order]);
+        for (i = 0; i < SLAB_MAG_BATCH; i++)
+            __free_in_slab(mag->objs[i]);
+        unlock(&slabs_locks[order]);
+
+        for (i = SLAB_MAG_BATCH; i < SLAB_MAG_SIZE; i++)
+            mag->objs[i - SLAB_MAG_BATCH] = mag->objs[i];
+        mag->count -= SLAB_MAG_BATCH;
+    }
 
-    unlock(&slabs_locks[order]);
+    mag->objs[mag->count++] = addr;
+    unlock(&mag->lock);
 }
 
 /* This interface is not marked as static because it is needed in the unit test.
@@ -300,6 +394,7 @@ unsigned long get_free_slot_number(int order)
     struct slab_slot_list *slot;
     unsigned long current_slot_num = 0;
     unsigned long check_slot_num = 0;
+    int cpuid;
 
     lock(&slabs_locks[order]);
 
@@ -331,6 +426,10 @@ out:
 
     BUG_ON(check_slot_num != current_slot_num);
 
+    /* Slots cached in the per-CPU magazines are free as well. */
+    for (cpuid = 0; cpuid < PLAT_CPU_NUM; cpuid++)
+        current_slot_num += slab_mags[cpuid][order].count;
+
     return current_slot_num;
 }
 
@@ -352,5 +451,321 @@ unsigned long get_free_mem_size_from_slab(void)
                slot_num);
     }
 
+    total_size += get_free_mem_size_from_kmem_caches();
+
+    return total_size;
+}
+
+/* kmem_cache: slabs of exact-size objects */
+
+static inline unsigned long kmem_colour_unit(struct kmem_cache *cache)
+{
+    return MAX(cache->align, (unsigned long)CACHELINE_SZ);
+}
+
+static struct slab_header *init_kmem_slab(struct kmem_cache *cache)
+{
+    void *addr;
+    struct kmem_slab *slab;
+    struct slab_slot_list *slot;
+    unsigned long i, offset;
+
+    addr = alloc_slab_memory(cache->slab_size);
+    if (unlikely(addr == NULL))
+        return NULL;
+    slab = (struct kmem_slab *)addr;
+    slab->cache = cache;
+
+    offset = cache->objs_offset + cache->colour_next * kmem_colour_unit(cache);
+    cache->colour_next = (cache->colour_next + 1) % cache->colour_num;
+
+    slot = (struct slab_slot_list *)((unsigned long)addr + offset);
+    slab->header.free_list_head = (void *)slot;
+    slab->header.order = KMEM_SLAB_ORDER;
+    slab->header.total_free_cnt = cache->objs_per_slab;
+    slab->header.current_free_cnt = cache->objs_per_slab;
+
+    /* The last slot has no next one. */
+    for (i = 0; i < cache->objs_per_slab - 1; ++i) {
+        slot->next_free = (void *)((unsigned long)slot + cache->obj_size);
+        slot = (struct slab_slot_list *)((unsigned long)slot + cache->obj_size);
+    }
+    slot->next_free = NULL;
+
+    cache->nr_slabs += 1;
+
+    return &slab->header;
+}
+
+/* cache->lock must be held. */
+static void *__kmem_cache_alloc(struct kmem_cache *cache)
+{
+    struct slab_header *current_slab;
+
+    current_slab = cache->slabs.current_slab;
+    if (unlikely(current_slab == NULL)) {
+        current_slab = init_kmem_slab(cache);
+        if (current_slab == NULL)
+            return NULL;
+        cache->slabs.current_slab = current_slab;
+    }
+
+    return take_free_slot(&cache->slabs);
+}
+
+/* cache->lock must be held. */
+static void __kmem_cache_free(struct kmem_cache *cache, void *obj)
+{
+    struct page *page;
+
+    page = virt_to_page(obj);
+    BUG_ON(page == NULL || page->slab == NULL);
+
+    if (put_free_slot(&cache->slabs,
+                      page->slab,
+                      (struct slab_slot_list *)obj,
+                      cache->slab_size))
+        cache->nr_slabs -= 1;
+}
+
+/*
+ * Create a cache of objects with @size bytes aligned to @align.
+ * The optional @ctor is invoked on each object returned by kmem_cache_alloc.
+ * It initializes the object on every allocation rather than once per slab,
+ * since the free list links through the first word of free objects. Such a
+ * cache cannot be used with kmem_cache_zalloc.
+ */
+struct kmem_cache *kmem_cache_create(const char *name, unsigned long size,
+                                     unsigned long align, kmem_ctor_t ctor)
+{
+    struct kmem_cache *cache;
+    unsigned long obj_size, objs_offset, slab_size, left;
+    int order;
+    int cpuid;
+    int i;
+
+    if (align < sizeof(void *))
+        align = sizeof(void *);
+    BUG_ON((align & (align - 1)) != 0);
+
+    obj_size = ROUND_UP(MAX(size, sizeof(struct slab_slot_list)), align);
+    objs_offset = ROUND_UP(sizeof(struct kmem_slab), align);
+
+    /* Choose the smallest slab holding KMEM_SLAB_MIN_OBJS objects. */
+    for (order = 0; order < KMEM_SLAB_MAX_ORDER; order++) {
+        if ((BUDDY_PAGE_SIZE << order) - objs_offset
+            >= obj_size * KMEM_SLAB_MIN_OBJS)
+            break;
+    }
+    slab_size = BUDDY_PAGE_SIZE << order;
+    if (unlikely(slab_size < objs_offset + obj_size)) {
+        kwarn("%s: object of %s is too large\n", __func__, name);
+        return NULL;
+    }
+
+    cache = kzalloc(sizeof(*cache));
+    if (cache == NULL)
+        return NULL;
+
+    for (i = 0; i < KMEM_CACHE_NAME_LEN - 1 && name[i] != '\0'; i++)
+        cache->name[i] = name[i];
+    cache->obj_size = obj_size;
+    cache->align = align;
+    cache->slab_size = slab_size;
+    cache->objs_offset = objs_offset;
+    cache->objs_per_slab = (slab_size - objs_offset) / obj_size;
+    left = slab_size - objs_offset - cache->objs_per_slab * obj_size;
+    cache->colour_num = left / kmem_colour_unit(cache) + 1;
+    cache->colour_next = 0;
+    cache->ctor = ctor;
+
+    lock_init(&cache->lock);
+    cache->slabs.current_slab = NULL;
+    init_list_head(&cache->slabs.partial_slab_list);
+    cache->nr_slabs = 0;
+    for (cpuid = 0; cpuid < PLAT_CPU_NUM; cpuid++) {
+        lock_init(&cache->mags[cpuid].lock);
+        cache->mags[cpuid].count = 0;
+    }
+
+    lock(&kmem_caches_lock);
+    list_append(&cache->node, &kmem_caches);
+    unlock(&kmem_caches_lock);
+
+    return cache;
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cache)
+{
+    struct slab_magazine *mag;
+    void *obj;
+
+    mag = &cache->mags[smp_get_cpu_id()];
+    lock(&mag->lock);
+
+    if (unlikely(mag->count == 0)) {
+        lock(&cache->lock);
+        while (mag->count < SLAB_MAG_BATCH) {
+            obj = __kmem_cache_alloc(cache);
+            if (obj == NULL)
+                break;
+            mag->objs[mag->count++] = obj;
+        }
+        unlock(&cache->lock);
+
+        if (mag->count == 0) {
+            unlock(&mag->lock);
+            return NULL;
+        }
+    }
+
+    obj = mag->objs[--mag->count];
+    unlock(&mag->lock);
+    if (cache->ctor)
+        cache->ctor(obj);
+
+    return obj;
+}
+
+/* Allocate a zeroed object from @cache, which must have no ctor. */
+void *kmem_cache_zalloc(struct kmem_cache *cache)
+{
+    void *obj;
+
+    /* Zeroing would wipe out what the ctor just initialized */
+    BUG_ON(cache->ctor != NULL);
+
+    obj = kmem_cache_alloc(cache);
+    if (obj)
+        memset(obj, 0, cache->obj_size);
+
+    return obj;
+}
+
+void kmem_cache_free(struct kmem_cache *cache, void *obj)
+{
+    struct slab_magazine *mag;
+    int i;
+
+    mag = &cache->mags[smp_get_cpu_id()];
+    lock(&mag->lock);
+
+    if (unlikely(mag->count == SLAB_MAG_SIZE)) {
+        lock(&cache->lock);
+        for (i = 0; i < SLAB_MAG_BATCH; i++)
+            __kmem_cache_free(cache, mag->objs[i]);
+        unlock(&cache->lock);
+
+        for (i = SLAB_MAG_BATCH; i < SLAB_MAG_SIZE; i++)
+            mag->objs[i - SLAB_MAG_BATCH] = mag->objs[i];
+        mag->count -= SLAB_MAG_BATCH;
+    }
+
+    mag->objs[mag->count++] = obj;
+    unlock(&mag->lock);
+}
+
+void kmem_cache_get_usage(struct kmem_cache *cache, unsigned long *total_objs,
+                          unsigned long *free_objs)
+{
+    struct slab_header *slab;
+    unsigned long nr_free = 0;
+    int cpuid;
+
+    lock(&cache->lock);
+    if (cache->slabs.current_slab)
+        nr_free += cache->slabs.current_slab->current_free_cnt;
+    for_each_in_list (
+        slab, struct slab_header, node, &cache->slabs.partial_slab_list) {
+        nr_free += slab->current_free_cnt;
+    }
+    *total_objs = cache->nr_slabs * cache->objs_per_slab;
+    unlock(&cache->lock);
+
+    for (cpuid = 0; cpuid < PLAT_CPU_NUM; cpuid++)
+        nr_free += cache->mags[cpuid].count;
+    *free_objs = nr_free;
+}
+
+void kmem_cache_print_usage(void)
+{
+    struct kmem_cache *cache;
+    unsigned long total_objs, free_objs;
+
+    lock(&kmem_caches_lock);
+    for_each_in_list (cache, struct kmem_cache, node, &kmem_caches) {
+        kmem_cache_get_usage(cache, &total_objs, &free_objs);
+        kinfo("kmem_cache %s: obj size %lu, slabs %lu, objs %lu/%lu\n",
+              cache->name,
+              cache->obj_size,
+              cache->nr_slabs,
+              total_objs - free_objs,
+              total_objs);
+    }
+    unlock(&kmem_caches_lock);
+}
+
+/*
+ * Give the objects cached in the magazines of every CPU back to their slabs,
+ * so that the slabs turning free go back to the buddy system.
+ *
+ * Called on out of memory, which may happen while refilling a magazine with
+ * its locks held. So locks are only tried, and contended magazines are
+ * skipped rather than waited for.
+ */
+void slab_drain_magazines(void)
+{
+    struct slab_magazine *mag;
+    struct kmem_cache *cache;
+    int cpuid, order;
+    unsigned long i;
+
+    for (order = SLAB_MIN_ORDER; order <= SLAB_MAX_ORDER; order++) {
+        for (cpuid = 0; cpuid < PLAT_CPU_NUM; cpuid++) {
+            mag = &slab_mags[cpuid][order];
+            if (try_lock(&mag->lock) != 0)
+                continue;
+            if (mag->count != 0 && try_lock(&slabs_locks[order]) == 0) {
+                for (i = 0; i < mag->count; i++)
+                    __free_in_slab(mag->objs[i]);
+                mag->count = 0;
+                unlock(&slabs_locks[order]);
+            }
+            unlock(&mag->lock);
+        }
+    }
+
+    if (try_lock(&kmem_caches_lock) != 0)
+        return;
+    for_each_in_list (cache, struct kmem_cache, node, &kmem_caches) {
+        for (cpuid = 0; cpuid < PLAT_CPU_NUM; cpuid++) {
+            mag = &cache->mags[cpuid];
+            if (try_lock(&mag->lock) != 0)
+                continue;
+            if (mag->count != 0 && try_lock(&cache->lock) == 0) {
+                for (i = 0; i < mag->count; i++)
+                    __kmem_cache_free(cache, mag->objs[i]);
+                mag->count = 0;
+                unlock(&cache->lock);
+            }
+            unlock(&mag->lock);
+        }
+    }
+    unlock(&kmem_caches_lock);
+}
+
+unsigned long get_free_mem_size_from_kmem_caches(void)
+{
+    struct kmem_cache *cache;
+    unsigned long total_objs, free_objs;
+    unsigned long total_size = 0;
+
+    lock(&kmem_caches_lock);
+    for_each_in_list (cache, struct kmem_cache, node, &kmem_caches) {
+        kmem_cache_get_usage(cache, &total_objs, &free_objs);
+        total_size += free_objs * cache->obj_size;
+    }
+    unlock(&kmem_caches_lock);
+
     return total_size;
 }
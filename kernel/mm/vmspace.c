@@ -14,6 +14,7 @@
 #include <common/errno.h>
 #include <mm/vmspace.h>
 #include <mm/kmalloc.h>
+#include <mm/kmem_cache.h>
 #include <mm/mm.h>
 #include <mm/uaccess.h>
 
@@ -22,12 +23,21 @@ struct cow_private_page {
     void *page;
 };
 
+static struct kmem_cache *vmregion_cache;
+
+void init_vmregion_cache(void)
+{
+    vmregion_cache =
+        kmem_cache_create("vmregion", sizeof(struct vmregion), 0, NULL);
+    BUG_ON(vmregion_cache == NULL);
+}
+
 static struct vmregion *alloc_vmregion(vaddr_t start, size_t len,
                                        vmr_prop_t perm, struct pmobject *pmo)
 {
     struct vmregion *vmr;
 
-    vmr = kmalloc(sizeof(*vmr));
+    vmr = kmem_cache_alloc(vmregion_cache);
     if (vmr == NULL)
         return NULL;
 
@@ -46,6 +56,7 @@ static struct vmregion *alloc_vmregion(vaddr_t start, size_t len,
 #endif /* CHCORE_OH_TEE */
 
     init_list_head(&vmr->cow_private_pages);
+    lock_init(&vmr->vmr_lock);
 
     return vmr;
 }
@@ -72,7 +83,7 @@ static void free_vmregion(struct vmregion *vmr)
     for_each_in_list_safe (cur_record, tmp, node, &vmr->cow_private_pages) {
         free_cow_private_page(cur_record);
     }
-    kfree((void *)vmr);
+    kmem_cache_free(vmregion_cache, vmr);
 }
 
 /*
@@ -251,10 +262,10 @@ int vmspace_init(struct vmspace *vmspace, unsigned long pcid)
     arch_vmspace_init(vmspace);
 
     /*
-     * Note: acquire vmspace_lock before pgtbl_lock
-     * when locking them together.
+     * Note: acquire vmspace_lock before vmr_lock (or pmo->commit_lock)
+     * and them before pgtbl_lock when locking them together.
      */
-    lock_init(&vmspace->vmspace_lock);
+    rwlock_init(&vmspace->vmspace_lock);
     lock_init(&vmspace->pgtbl_lock);
 
     /* The vmspace does not run on any CPU for now */
@@ -263,6 +274,9 @@ int vmspace_init(struct vmspace *vmspace, unsigned long pcid)
     vmspace->heap_vmr = NULL;
     
     vmspace->rss = 0;
+    vmspace->nr_faults = 0;
+    vmspace->nr_fault_pages = 0;
+    vmspace->nr_fault_waits = 0;
 
     return 0;
 }
@@ -312,9 +326,9 @@ int vmspace_map_range(struct vmspace *vmspace, vaddr_t va, size_t len,
      * Each operation on the vmspace should be protected by
      * the per-vmspace lock, i.e., vmspace_lock.
      */
-    lock(&vmspace->vmspace_lock);
+    write_lock(&vmspace->vmspace_lock);
     ret = add_vmr_to_vmspace(vmspace, vmr);
-    unlock(&vmspace->vmspace_lock);
+    write_unlock(&vmspace->vmspace_lock);
 
     if (ret < 0) {
         kdebug("add_vmr_to_vmspace fails\n");
@@ -373,7 +387,7 @@ int vmspace_unmap_range(struct vmspace *vmspace, vaddr_t va, size_t len)
     size_t size;
     int ret = 0;
 
-    lock(&vmspace->vmspace_lock);
+    write_lock(&vmspace->vmspace_lock);
     vmr = find_vmr_for_va(vmspace, va);
     if (!vmr)
         goto out_unlock;
@@ -388,7 +402,7 @@ int vmspace_unmap_range(struct vmspace *vmspace, vaddr_t va, size_t len)
     }
 
     del_vmr_from_vmspace(vmspace, vmr);
-    unlock(&vmspace->vmspace_lock);
+    write_unlock(&vmspace->vmspace_lock);
 
     /* Remove the potential mappings in the page table. */
     if (len != 0) {
@@ -403,11 +417,14 @@ int vmspace_unmap_range(struct vmspace *vmspace, vaddr_t va, size_t len)
     return 0;
 
 out_unlock:
-    unlock(&vmspace->vmspace_lock);
+    write_unlock(&vmspace->vmspace_lock);
     return ret;
 }
 
-/* This function should be surrounded with the vmspace_lock. */
+/*
+ * This function should be surrounded with the vmspace_lock
+ * (either the read lock or the write lock).
+ */
 struct vmregion *find_vmr_for_va(struct vmspace *vmspace, vaddr_t addr)
 {
     struct vmregion *vmr;
@@ -459,6 +476,12 @@ void kprint_vmr(struct vmspace *vmspace)
               end,
               vmr->pmo->type);
     }
+    kinfo("[%p] rss=0x%lx faults=%lu fault_pages=%lu fault_waits=%lu\n",
+          vmspace,
+          vmspace->rss,
+          vmspace->nr_faults,
+          vmspace->nr_fault_pages,
+          vmspace->nr_fault_waits);
 }
 
 /*
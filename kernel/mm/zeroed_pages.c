@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2023 Institute of Parallel And Distributed Systems (IPADS), Shanghai Jiao Tong University (SJTU)
+ * Licensed under the Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *     http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR FIT FOR A PARTICULAR
+ * PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ */
+#include <common/kprint.h>
+#include <common/list.h>
+#include <common/lock.h>
+#include <common/macro.h>
+#include <common/util.h>
+#include <mm/buddy.h>
+#include <mm/kmalloc.h>
+
+/*
+ * A bounded pool of pre-zeroed chunks for orders [0, ZEROED_MAX_ORDER].
+ * Idle CPUs zero chunks and put them into the pool, so that the page fault
+ * path and PMO creation can skip the inline memset.
+ */
+struct zeroed_pool {
+    struct list_head lists[ZEROED_MAX_ORDER + 1];
+    unsigned long count[ZEROED_MAX_ORDER + 1];
+    unsigned long hits;
+    unsigned long misses;
+    struct lock lock;
+};
+
+static struct zeroed_pool zeroed_pool;
+
+/* The pool keeps at most ZEROED_POOL_PAGES pages for each order. */
+static inline unsigned long zeroed_pool_limit(int order)
+{
+    return MAX(ZEROED_POOL_PAGES >> order, 1UL);
+}
+
+void init_zeroed_pages(void)
+{
+    int order;
+
+    for (order = 0; order <= ZEROED_MAX_ORDER; order++) {
+        init_list_head(&zeroed_pool.lists[order]);
+        zeroed_pool.count[order] = 0;
+    }
+    zeroed_pool.hits = 0;
+    zeroed_pool.misses = 0;
+    lock_init(&zeroed_pool.lock);
+}
+
+static void *__get_zeroed_pages(int order, bool try)
+{
+    struct page *page = NULL;
+    void *addr;
+
+    if (order <= ZEROED_MAX_ORDER) {
+        lock(&zeroed_pool.lock);
+        if (!list_empty(&zeroed_pool.lists[order])) {
+            page = list_entry(
+                zeroed_pool.lists[order].next, struct page, node);
+            list_del(&page->node);
+            zeroed_pool.count[order] -= 1;
+            zeroed_pool.hits += 1;
+        } else {
+            zeroed_pool.misses += 1;
+        }
+        unlock(&zeroed_pool.lock);
+
+        if (page)
+            return page_to_virt(page);
+    }
+
+    addr = try ? try_get_pages(order) : get_pages(order);
+    if (addr)
+        memset(addr, 0, BUDDY_PAGE_SIZE << order);
+    return addr;
+}
+
+/* Return (1 << order) continous zeroed pages, which are freed by free_pages. */
+void *get_zeroed_pages(int order)
+{
+    return __get_zeroed_pages(order, false);
+}
+
+/* The same as get_zeroed_pages but backed by try_get_pages */
+void *try_get_zeroed_pages(int order)
+{
+    return __get_zeroed_pages(order, true);
+}
+
+/*
+ * Invoked by idle threads with interrupts disabled. Zero at most one chunk
+ * per call to bound the interrupt latency.
+ *
+ * Return true if the pool still needs refilling.
+ */
+bool refill_zeroed_pages(void)
+{
+    struct page *page;
+    void *addr;
+    int order;
+
+    lock(&zeroed_pool.lock);
+    for (order = 0; order <= ZEROED_MAX_ORDER; order++) {
+        if (zeroed_pool.count[order] < zeroed_pool_limit(order))
+            break;
+    }
+    unlock(&zeroed_pool.lock);
+
+    if (order > ZEROED_MAX_ORDER)
+        return false;
+
+    /*
+     * Refilling is opportunistic: never drain the caches for it (which
+     * would also give this pool back) or warn of OOM, and stop refilling
+     * once memory runs short.
+     */
+    addr = try_get_pages(order);
+    if (addr == NULL)
+        return false;
+    memset(addr, 0, BUDDY_PAGE_SIZE << order);
+    page = virt_to_page(addr);
+
+    lock(&zeroed_pool.lock);
+    if (zeroed_pool.count[order] < zeroed_pool_limit(order)) {
+        list_add(&page->node, &zeroed_pool.lists[order]);
+        zeroed_pool.count[order] += 1;
+        page = NULL;
+    }
+    unlock(&zeroed_pool.lock);
+
+    /* Another CPU has filled the pool in the meantime. */
+    if (page) {
+        free_pages(addr);
+        return false;
+    }
+
+    return true;
+}
+
+/* Give all the pooled chunks back to the buddy system, e.g., on OOM. */
+void drain_zeroed_pages(void)
+{
+    struct page *page;
+    int order;
+
+    lock(&zeroed_pool.lock);
+    for (order = 0; order <= ZEROED_MAX_ORDER; order++) {
+        while (!list_empty(&zeroed_pool.lists[order])) {
+            page = list_entry(
+                zeroed_pool.lists[order].next, struct page, node);
+            list_del(&page->node);
+            zeroed_pool.count[order] -= 1;
+            buddy_free_pages(page->pool, page);
+        }
+    }
+    unlock(&zeroed_pool.lock);
+}
+
+unsigned long get_free_mem_size_from_zeroed_pages(void)
+{
+    unsigned long total_size = 0;
+    int order;
+
+    for (order = 0; order <= ZEROED_MAX_ORDER; order++)
+        total_size += zeroed_pool.count[order] * (BUDDY_PAGE_SIZE << order);
+
+    return total_size;
+}
+
+void print_zeroed_pages_usage(void)
+{
+    kinfo("zeroed pages: pooled 0x%lx bytes, hits %lu, misses %lu\n",
+          get_free_mem_size_from_zeroed_pages(),
+          zeroed_pool.hits,
+          zeroed_pool.misses);
+}
@@ -25,18 +25,6 @@
 
 struct cap_group *root_cap_group;
 
-/* tool functions */
-static bool is_valid_slot_id(struct slot_table *slot_table, cap_t slot_id)
-{
-    if (slot_id < 0 || slot_id >= slot_table->slots_size)
-        return false;
-    if (!get_bit(slot_id, slot_table->slots_bmp))
-        return false;
-    if (slot_table->slots[slot_id] == NULL)
-        BUG("slot NULL while bmp is not\n");
-    return true;
-}
-
 static int slot_table_init(struct slot_table *slot_table, unsigned int size,
                            bool init_lock)
 {
@@ -116,6 +104,7 @@ static int expand_slot_table(struct slot_table *slot_table)
 {
     unsigned int new_size, old_size;
     struct slot_table new_slot_table;
+    struct object_slot **old_slots;
     int r;
 
     old_size = slot_table->slots_size;
@@ -133,13 +122,22 @@ static int expand_slot_table(struct slot_table *slot_table)
     memcpy(new_slot_table.full_slots_bmp,
            slot_table->full_slots_bmp,
            BITS_TO_LONGS(BITS_TO_LONGS(old_size)) * sizeof(unsigned long));
-    slot_table->slots_size = new_size;
-    kfree(slot_table->slots);
+    old_slots = slot_table->slots;
+    /*
+     * Publish the new slots before the new size, so that a lookup seeing
+     * the new size also sees the new slots (see get_opaque).
+     */
     slot_table->slots = new_slot_table.slots;
+    smp_wmb();
+    slot_table->slots_size = new_size;
+    /* The bitmaps are only accessed with table_guard held */
     kfree(slot_table->slots_bmp);
     slot_table->slots_bmp = new_slot_table.slots_bmp;
     kfree(slot_table->full_slots_bmp);
     slot_table->full_slots_bmp = new_slot_table.full_slots_bmp;
+
+    cap_sync_readers();
+    kfree(old_slots);
     return 0;
 }
 
@@ -183,38 +181,115 @@ out_fail:
     return r;
 }
 
+/* Lockless lookups of slot tables */
+struct cap_reader {
+    /* Odd while the CPU is in a read-side section */
+    volatile unsigned long seq;
+    /* Statistics, only updated by the owner CPU */
+    unsigned long nr_lookups;
+    unsigned long nr_syncs;
+    /* Syncs that had to wait for another CPU to leave its section */
+    unsigned long nr_sync_waits;
+} __attribute__((aligned(CACHELINE_SZ)));
+
+static struct cap_reader cap_readers[PLAT_CPU_NUM];
+
+static inline void cap_read_begin(void)
+{
+    cap_readers[smp_get_cpu_id()].seq++;
+    /* Order the update of seq before the loads of the slot table */
+    smp_mb();
+}
+
+static inline void cap_read_end(void)
+{
+    /* Finish the loads of the slot table before leaving */
+    smp_mb();
+    cap_readers[smp_get_cpu_id()].seq++;
+}
+
+/*
+ * Wait until every other CPU leaves the read-side section it is in (if any).
+ * The kernel is not preemptible and read-side sections never block, so the
+ * wait is short.
+ */
+void cap_sync_readers(void)
+{
+    unsigned long seq;
+    u32 cpuid, self;
+
+    self = smp_get_cpu_id();
+    cap_readers[self].nr_syncs++;
+    /* Order the unpublishing before the checks of readers */
+    smp_mb();
+    for (cpuid = 0; cpuid < PLAT_CPU_NUM; cpuid++) {
+        if (cpuid == self)
+            continue;
+        seq = cap_readers[cpuid].seq;
+        if (seq & 1) {
+            cap_readers[self].nr_sync_waits++;
+            while (cap_readers[cpuid].seq == seq)
+                COMPILER_BARRIER();
+        }
+    }
+    smp_mb();
+}
+
 void *get_opaque(struct cap_group *cap_group, cap_t slot_id, bool type_valid,
                  int type)
 {
     struct slot_table *slot_table = &cap_group->slot_table;
+    struct object_slot **slots;
     struct object_slot *slot;
-    void *obj;
+    unsigned int slots_size;
+    void *obj = NULL;
 
-    read_lock(&slot_table->table_guard);
-    if (!is_valid_slot_id(slot_table, slot_id)) {
-        obj = NULL;
-        goto out_unlock_table;
-    }
+    cap_read_begin();
+    cap_readers[smp_get_cpu_id()].nr_lookups++;
+
+    /* Pairs with expand_slot_table: slots holds at least slots_size */
+    slots_size = *(volatile unsigned int *)&slot_table->slots_size;
+    smp_rmb();
+    slots = *(struct object_slot **volatile *)&slot_table->slots;
+
+    if (slot_id < 0 || slot_id >= slots_size)
+        goto out_read_end;
+
+    /* A reserved slot id is not installed (NULL) yet */
+    slot = *(struct object_slot *volatile *)&slots[slot_id];
+    if (slot == NULL)
+        goto out_read_end;
 
-    slot = get_slot(cap_group, slot_id);
-    BUG_ON(slot == NULL);
     BUG_ON(slot->isvalid == false);
     BUG_ON(slot->object == NULL);
 
     if (!type_valid || slot->object->type == type) {
+        /*
+         * The slot holds a reference, which is only dropped after
+         * cap_sync_readers, so the object is alive here.
+         */
         obj = slot->object->opaque;
-    } else {
-        obj = NULL;
-        goto out_unlock_table;
+        atomic_fetch_add_long(&slot->object->refcount, 1);
     }
 
-    atomic_fetch_add_long(&slot->object->refcount, 1);
-
-out_unlock_table:
-    read_unlock(&slot_table->table_guard);
+out_read_end:
+    cap_read_end();
     return obj;
 }
 
+void print_cap_lookup_stats(void)
+{
+    u32 cpuid;
+
+    for (cpuid = 0; cpuid < PLAT_CPU_NUM; cpuid++) {
+        printk("CPU %u: cap lookups %lu, reader syncs %lu (waited %lu)\n",
+               cpuid,
+               cap_readers[cpuid].nr_lookups,
+               cap_readers[cpuid].nr_syncs,
+               cap_readers[cpuid].nr_sync_waits);
+    }
+}
+
 /* Get an object reference through its cap.
  * The interface will also add the object's refcnt by one.
  */
@@ -19,6 +19,7 @@
 #include <object/thread.h>
 #include <object/irq.h>
 #include <mm/kmalloc.h>
+#include <mm/kmem_cache.h>
 #include <mm/uaccess.h>
 #include <mm/vmspace.h>
 #include <lib/printk.h>
@@ -42,6 +43,42 @@ const obj_deinit_func obj_deinit_tbl[TYPE_NR] = {
 #endif /* CHCORE_OH_TEE */
 };
 
+/* Each kind of object (with its struct object header) has its own cache. */
+static struct kmem_cache *obj_caches[TYPE_NR];
+static struct kmem_cache *slot_cache;
+
+/* Per-CPU counters of cap_copy_batch, printed by print_cap_copy_stats */
+struct cap_copy_stats {
+    unsigned long nr_batches;
+    unsigned long nr_caps;
+    unsigned long nr_fails;
+};
+
+static struct cap_copy_stats cap_copy_stats[PLAT_CPU_NUM];
+
+#define OBJ_CACHE_CREATE(type, name, obj_type)                  \
+    obj_caches[type] = kmem_cache_create(                       \
+        name, sizeof(struct object) + sizeof(obj_type), 0, NULL)
+
+void obj_cache_init(void)
+{
+    OBJ_CACHE_CREATE(TYPE_CAP_GROUP, "cap_group", struct cap_group);
+    OBJ_CACHE_CREATE(TYPE_THREAD, "thread", struct thread);
+    OBJ_CACHE_CREATE(TYPE_CONNECTION, "connection", struct ipc_connection);
+    OBJ_CACHE_CREATE(TYPE_NOTIFICATION, "notification", struct notification);
+    OBJ_CACHE_CREATE(TYPE_IRQ, "irq", struct irq_notification);
+    OBJ_CACHE_CREATE(TYPE_PMO, "pmo", struct pmobject);
+    OBJ_CACHE_CREATE(TYPE_VMSPACE, "vmspace", struct vmspace);
+#ifdef CHCORE_OH_TEE
+    OBJ_CACHE_CREATE(TYPE_CHANNEL, "channel", struct channel);
+    OBJ_CACHE_CREATE(TYPE_MSG_HDL, "msg_hdl", struct msg_hdl);
+#endif /* CHCORE_OH_TEE */
+
+    slot_cache = kmem_cache_create("object_slot",
+                                   sizeof(struct object_slot), 0, NULL);
+    BUG_ON(slot_cache == NULL);
+}
+
 /*
  * Usage:
  * obj = obj_alloc(...);
@@ -54,7 +91,15 @@ void *obj_alloc(u64 type, u64 size)
     struct object *object;
 
     total_size = sizeof(*object) + size;
-    object = kzalloc(total_size);
+    /*
+     * Objects not fitting in the cache of its type fall back to kmalloc.
+     * kfree can free objects from both.
+     */
+    if (type < TYPE_NR && obj_caches[type]
+        && total_size <= obj_caches[type]->obj_size)
+        object = kmem_cache_zalloc(obj_caches[type]);
+    else
+        object = kzalloc(total_size);
     if (!object)
         return NULL;
 
@@ -105,7 +150,7 @@ cap_t cap_alloc(struct cap_group *cap_group, void *obj)
         goto out_unlock_table;
     }
 
-    slot = kmalloc(sizeof(*slot));
+    slot = kmem_cache_alloc(slot_cache);
     if (!slot) {
         r = -ENOMEM;
         goto out_free_slot_id;
@@ -205,6 +250,9 @@ int __cap_free(struct cap_group *cap_group, cap_t slot_id,
     if (!slot_table_locked)
         write_unlock(&slot_table->table_guard);
 
+    /* Wait for the lookups which may still see the slot */
+    cap_sync_readers();
+
     /* Step-2: remove the slot in the copies-list of the object and free the
      * slot */
     object = slot->object;
@@ -215,7 +263,7 @@ int __cap_free(struct cap_group *cap_group, cap_t slot_id,
         list_del(&slot->copies);
         unlock(&object->copies_lock);
     }
-    kfree(slot);
+    kmem_cache_free(slot_cache, slot);
 
     /* Step-3: decrease the refcnt of the object and free it if necessary */
     old_refcount = atomic_fetch_sub_long(&object->refcount, 1);
@@ -236,20 +284,15 @@ int cap_free(struct cap_group *cap_group, cap_t slot_id)
     return __cap_free(cap_group, slot_id, false, false);
 }
 
-cap_t cap_copy(struct cap_group *src_cap_group,
-               struct cap_group *dest_cap_group, cap_t src_slot_id)
+/* Lock the source slot table for read and the destination one for write */
+static void lock_copy_tables(struct cap_group *src_cap_group,
+                             struct cap_group *dest_cap_group)
 {
-    struct object_slot *src_slot, *dest_slot;
-    cap_t r, dest_slot_id;
     struct rwlock *src_table_guard, *dest_table_guard;
-    bool local_copy;
 
-    struct object *object;
-
-    local_copy = (src_cap_group == dest_cap_group);
     src_table_guard = &src_cap_group->slot_table.table_guard;
     dest_table_guard = &dest_cap_group->slot_table.table_guard;
-    if (local_copy) {
+    if (src_cap_group == dest_cap_group) {
         write_lock(dest_table_guard);
     } else {
         /* avoid deadlock */
@@ -260,14 +303,33 @@ cap_t cap_copy(struct cap_group *src_cap_group,
             read_unlock(src_table_guard);
         }
     }
+}
+
+static void unlock_copy_tables(struct cap_group *src_cap_group,
+                               struct cap_group *dest_cap_group)
+{
+    write_unlock(&dest_cap_group->slot_table.table_guard);
+    if (src_cap_group != dest_cap_group)
+        read_unlock(&src_cap_group->slot_table.table_guard);
+}
+
+cap_t cap_copy(struct cap_group *src_cap_group,
+               struct cap_group *dest_cap_group, cap_t src_slot_id)
+{
+    struct object_slot *src_slot, *dest_slot;
+    cap_t r, dest_slot_id;
+
+    struct object *object;
+
+    lock_copy_tables(src_cap_group, dest_cap_group);
 
     dest_slot_id = alloc_slot_id(dest_cap_group);
-    if (dest_slot_id == -1) {
+    if (dest_slot_id < 0) {
         r = -ENOMEM;
         goto out_unlock;
     }
 
-    dest_slot = kmalloc(sizeof(*dest_slot));
+    dest_slot = kmem_cache_alloc(slot_cache);
     if (!dest_slot) {
         r = -ENOMEM;
         goto out_free_slot_id;
@@ -291,21 +353,111 @@ cap_t cap_copy(struct cap_group *src_cap_group,
 
     install_slot(dest_cap_group, dest_slot_id, dest_slot);
 
-    write_unlock(dest_table_guard);
-    if (!local_copy)
-        read_unlock(src_table_guard);
+    unlock_copy_tables(src_cap_group, dest_cap_group);
     return dest_slot_id;
 out_free_slot:
-    kfree(dest_slot);
+    kmem_cache_free(slot_cache, dest_slot);
 out_free_slot_id:
     free_slot_id(dest_cap_group, dest_slot_id);
 out_unlock:
-    write_unlock(dest_table_guard);
-    if (!local_copy)
-        read_unlock(src_table_guard);
+    unlock_copy_tables(src_cap_group, dest_cap_group);
     return r;
 }
 
+/*
+ * Copy @nr caps (@src_slot_ids) of @src_cap_group to @dest_cap_group, with
+ * the slot tables locked only once. Either all or none of the caps are
+ * copied. Return 0 and fill in @dest_slot_ids on success.
+ */
+int cap_copy_batch(struct cap_group *src_cap_group,
+                   struct cap_group *dest_cap_group, const cap_t *src_slot_ids,
+                   cap_t *dest_slot_ids, int nr)
+{
+    struct object_slot *dest_slots[CAP_COPY_BATCH_MAX];
+    struct object_slot *src_slot;
+    struct object *object;
+    int i, r;
+
+    if (nr <= 0 || nr > CAP_COPY_BATCH_MAX)
+        return -EINVAL;
+
+    /* Allocate the slots before locking the tables */
+    for (i = 0; i < nr; i++) {
+        dest_slots[i] = kmem_cache_alloc(slot_cache);
+        if (!dest_slots[i]) {
+            r = -ENOMEM;
+            goto out_free_slots;
+        }
+    }
+
+    lock_copy_tables(src_cap_group, dest_cap_group);
+
+    /* Check all the source caps before changing anything */
+    for (i = 0; i < nr; i++) {
+        src_slot = get_slot(src_cap_group, src_slot_ids[i]);
+        if (!src_slot || src_slot->isvalid == false) {
+            r = -ECAPBILITY;
+            goto out_unlock;
+        }
+    }
+
+    /* Reserve the slot ids, which are not visible until installed */
+    for (i = 0; i < nr; i++) {
+        dest_slot_ids[i] = alloc_slot_id(dest_cap_group);
+        if (dest_slot_ids[i] < 0) {
+            r = -ENOMEM;
+            goto out_free_slot_ids;
+        }
+    }
+
+    for (i = 0; i < nr; i++) {
+        src_slot = get_slot(src_cap_group, src_slot_ids[i]);
+        object = src_slot->object;
+        atomic_fetch_add_long(&object->refcount, 1);
+
+        dest_slots[i]->slot_id = dest_slot_ids[i];
+        dest_slots[i]->cap_group = dest_cap_group;
+        dest_slots[i]->isvalid = true;
+        dest_slots[i]->object = object;
+
+        lock(&object->copies_lock);
+        list_add(&dest_slots[i]->copies, &src_slot->copies);
+        unlock(&object->copies_lock);
+
+        install_slot(dest_cap_group, dest_slot_ids[i], dest_slots[i]);
+    }
+
+    unlock_copy_tables(src_cap_group, dest_cap_group);
+    cap_copy_stats[smp_get_cpu_id()].nr_batches++;
+    cap_copy_stats[smp_get_cpu_id()].nr_caps += nr;
+    return 0;
+
+out_free_slot_ids:
+    for (--i; i >= 0; i--)
+        free_slot_id(dest_cap_group, dest_slot_ids[i]);
+out_unlock:
+    unlock_copy_tables(src_cap_group, dest_cap_group);
+    i = nr;
+out_free_slots:
+    for (--i; i >= 0; i--)
+        kmem_cache_free(slot_cache, dest_slots[i]);
+    cap_copy_stats[smp_get_cpu_id()].nr_fails++;
+    return r;
+}
+
+void print_cap_copy_stats(void)
+{
+    int cpuid;
+
+    for (cpuid = 0; cpuid < PLAT_CPU_NUM; cpuid++) {
+        printk("CPU %d: cap copy batches %lu, caps %lu, failed %lu\n",
+               cpuid,
+               cap_copy_stats[cpuid].nr_batches,
+               cap_copy_stats[cpuid].nr_caps,
+               cap_copy_stats[cpuid].nr_fails);
+    }
+}
+
 /*
  * Free an object points by some cap, which also removes all the caps point to
  * the object.
@@ -363,13 +515,12 @@ int sys_transfer_caps(cap_t dest_group_cap, unsigned long src_caps_buf,
 {
     struct cap_group *dest_cap_group;
     int i;
-    int *src_caps;
-    int *dst_caps;
+    int src_caps[CAP_COPY_BATCH_MAX];
+    int dst_caps[CAP_COPY_BATCH_MAX];
     size_t size;
     int ret;
 
-#define MAX_TRANSFER_NUM 16
-    if ((nr_caps <= 0) || (nr_caps > MAX_TRANSFER_NUM))
+    if ((nr_caps <= 0) || (nr_caps > CAP_COPY_BATCH_MAX))
         return -EINVAL;
 
     size = sizeof(int) * nr_caps;
@@ -381,9 +532,6 @@ int sys_transfer_caps(cap_t dest_group_cap, unsigned long src_caps_buf,
     if (!dest_cap_group)
         return -ECAPBILITY;
 
-    src_caps = kmalloc(size);
-    dst_caps = kmalloc(size);
-
     /* get args from user buffer @src_caps_buf */
     ret = copy_from_user((void *)src_caps, (void *)src_caps_buf, size);
     if (ret) {
@@ -391,8 +539,17 @@ int sys_transfer_caps(cap_t dest_group_cap, unsigned long src_caps_buf,
         goto out_obj_put;
     }
 
-    for (i = 0; i < nr_caps; ++i) {
-        dst_caps[i] = cap_copy(current_cap_group, dest_cap_group, src_caps[i]);
+    /*
+     * Copy all the caps at once. On failure, copy them one by one to report
+     * the result of each cap as before.
+     */
+    ret = cap_copy_batch(
+        current_cap_group, dest_cap_group, src_caps, dst_caps, nr_caps);
+    if (ret < 0) {
+        for (i = 0; i < nr_caps; ++i) {
+            dst_caps[i] =
+                cap_copy(current_cap_group, dest_cap_group, src_caps[i]);
+        }
     }
 
     /* write results to user buffer @dst_caps_buf */
@@ -402,9 +559,6 @@ int sys_transfer_caps(cap_t dest_group_cap, unsigned long src_caps_buf,
         goto out_obj_put;
     }
 
-    kfree(src_caps);
-    kfree(dst_caps);
-
     obj_put(dest_cap_group);
     return 0;
 out_obj_put:
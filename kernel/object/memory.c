@@ -477,19 +477,20 @@ static int read_write_pmo(cap_t pmo_cap, unsigned long offset,
 
         while (size > 0) {
             index = ROUND_DOWN(offset, PAGE_SIZE) / PAGE_SIZE;
+            lock(&pmo->commit_lock);
             pa = get_page_from_pmo(pmo, index);
             if (pa == 0) {
                 /* Allocate a physical page for the anonymous
                  * pmo like a page fault happens.
                  */
-                kva = (vaddr_t)get_pages(0);
+                kva = (vaddr_t)get_zeroed_pages(0);
                 if (kva == 0) {
+                    unlock(&pmo->commit_lock);
                     r = -ENOMEM;
                     goto out_obj_put;
                 }
 
                 pa = virt_to_phys((void *)kva);
-                memset((void *)kva, 0, PAGE_SIZE);
                 commit_page_to_pmo(pmo, index, pa);
 
                 /* No need to map the physical page in the page
@@ -500,6 +501,7 @@ static int read_write_pmo(cap_t pmo_cap, unsigned long offset,
             } else {
                 kva = phys_to_virt(pa);
             }
+            unlock(&pmo->commit_lock);
             /* Now kva is the beginning of some page, we should add
              * the offset inside the page. */
             offset_in_page = offset - ROUND_DOWN(offset, PAGE_SIZE);
@@ -794,6 +796,7 @@ static int pmo_init(struct pmobject *pmo, pmo_type_t type, size_t len,
 #endif /* CHCORE_OH_TEE */
 
     memset((void *)pmo, 0, sizeof(*pmo));
+    lock_init(&pmo->commit_lock);
 
     len = ROUND_UP(len, PAGE_SIZE);
     pmo->size = len;
@@ -805,14 +808,27 @@ static int pmo_init(struct pmobject *pmo, pmo_type_t type, size_t len,
         /*
          * For PMO_DATA, the user will use it soon (we expect).
          * So, we directly allocate the physical memory.
-         * Note that kmalloc(>2048) returns continous physical pages.
+         * Small ones are taken from the pool of zeroed pages.
          */
-        void *new_va = kmalloc(len);
-        if (new_va == NULL)
-            return -ENOMEM;
+        void *new_va;
+        int order = 0;
 
-        /* Clear the allocated memory */
-        memset(new_va, 0, len);
+        while ((PAGE_SIZE << order) < len)
+            order++;
+
+        if (order <= ZEROED_MAX_ORDER) {
+            new_va = get_zeroed_pages(order);
+            if (new_va == NULL)
+                return -ENOMEM;
+        } else {
+            /* Note that kmalloc(>2048) returns continous physical pages. */
+            new_va = kmalloc(len);
+            if (new_va == NULL)
+                return -ENOMEM;
+
+            /* Clear the allocated memory */
+            memset(new_va, 0, len);
+        }
         if (type == PMO_DATA_NOCACHE)
             arch_flush_cache((vaddr_t)new_va, len, CACHE_CLEAN_AND_INV);
         pmo->start = virt_to_phys(new_va);
@@ -932,6 +948,18 @@ void commit_page_to_pmo(struct pmobject *pmo, unsigned long index, paddr_t pa)
     BUG_ON(ret != 0);
 }
 
+/* Commit @nr_pages physically continuous pages starting from @pa. */
+void commit_pages_to_pmo(struct pmobject *pmo, unsigned long index, paddr_t pa,
+                         unsigned long nr_pages)
+{
+    int ret;
+
+    BUG_ON((pmo->type != PMO_ANONYM) && (pmo->type != PMO_SHM)
+           && (pmo->type != PMO_FILE));
+    ret = radix_add_range(pmo->radix, index, nr_pages, (void *)pa, PAGE_SIZE);
+    BUG_ON(ret != 0);
+}
+
 /* Return 0 (NULL) when not found */
 paddr_t get_page_from_pmo(struct pmobject *pmo, unsigned long index)
 {
@@ -1069,7 +1097,7 @@ unsigned long sys_handle_brk(unsigned long addr, unsigned long heap_start)
 
     vmspace = obj_get(current_cap_group, VMSPACE_OBJ_ID, TYPE_VMSPACE);
     BUG_ON(vmspace == NULL);
-    lock(&vmspace->vmspace_lock);
+    write_lock(&vmspace->vmspace_lock);
     if (addr == 0) {
         retval = heap_start;
 
@@ -1114,7 +1142,7 @@ unsigned long sys_handle_brk(unsigned long addr, unsigned long heap_start)
     }
 
 out:
-    unlock(&vmspace->vmspace_lock);
+    write_unlock(&vmspace->vmspace_lock);
     obj_put(vmspace);
     return retval;
 }
@@ -1142,6 +1170,7 @@ int sys_handle_mprotect(unsigned long addr, unsigned long length, int prot)
     struct vmregion *vmr;
     s64 remaining;
     unsigned long va;
+    long rss = 0;
     int ret;
 
     if ((addr % PAGE_SIZE) || (length % PAGE_SIZE)) {
@@ -1155,7 +1184,7 @@ int sys_handle_mprotect(unsigned long addr, unsigned long length, int prot)
     vmspace = obj_get(current_cap_group, VMSPACE_OBJ_ID, TYPE_VMSPACE);
     BUG_ON(vmspace == NULL);
 
-    lock(&vmspace->vmspace_lock);
+    write_lock(&vmspace->vmspace_lock);
     /*
      * Validate the VM range [addr, addr + lenght]
      * - the range is totally mapped
@@ -1195,13 +1224,14 @@ int sys_handle_mprotect(unsigned long addr, unsigned long length, int prot)
 
     /* Modify the existing mappings in pgtbl */
     lock(&vmspace->pgtbl_lock);
-    mprotect_in_pgtbl(vmspace->pgtbl, addr, length, target_prot);
+    mprotect_in_pgtbl(vmspace->pgtbl, addr, length, target_prot, &rss);
+    vmspace->rss += rss;
     unlock(&vmspace->pgtbl_lock);
     ret = 0;
 
 out:
+    write_unlock(&vmspace->vmspace_lock);
     obj_put(vmspace);
-    unlock(&vmspace->vmspace_lock);
 
     return ret;
 }
@@ -1211,6 +1241,11 @@ unsigned long sys_get_free_mem_size(void)
     return get_free_mem_size();
 }
 
+void sys_get_mem_usage_msg(void)
+{
+    get_mem_usage_msg();
+}
+
 #ifdef CHCORE_OH_TEE
 static int __destroy_ns_pmo(struct vmspace *vmspace, struct pmobject *pmobject)
 {
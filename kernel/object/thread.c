@@ -24,10 +24,18 @@
 #include <arch/machine/smp.h>
 #include <arch/time.h>
 #include <irq/ipi.h>
+#include <ipc/futex.h>
+#ifdef CHCORE_OH_TEE
+#include <ipc/channel.h>
+#endif /* CHCORE_OH_TEE */
 #include <common/endianness.h>
 
 #include "thread_env.h"
 
+struct list_head all_threads;
+unsigned int all_threads_cnt;
+struct lock all_threads_lock;
+
 /*
  * local functions
  */
@@ -62,6 +70,25 @@ int thread_init(struct thread *thread, struct cap_group *cap_group,
 
     lock_init(&thread->sleep_state.queue_lock);
 
+    thread->futex_bucket = NULL;
+    thread->futex_uaddr = 0;
+    thread->futex_uaddr_ptr = NULL;
+    thread->futex_requeued_uaddr = 0;
+
+#ifdef CHCORE_OH_TEE
+    lock_init(&thread->pi_lock);
+    thread->call_channel = NULL;
+    thread->call_msg_hdl = NULL;
+    thread->nr_served_calls = 0;
+    thread->prio_boosted = false;
+    thread->ring_channel = NULL;
+#endif /* CHCORE_OH_TEE */
+
+    lock(&all_threads_lock);
+    list_add(&thread->all_threads_node, &all_threads);
+    all_threads_cnt += 1;
+    unlock(&all_threads_lock);
+
     return 0;
 }
 
@@ -81,6 +108,16 @@ void thread_deinit(void *thread_ptr)
     list_del(&thread->node);
     unlock(&cap_group->threads_lock);
 
+    futex_remove_waiter(thread);
+#ifdef CHCORE_OH_TEE
+    channel_remove_ring_waiter(thread);
+#endif /* CHCORE_OH_TEE */
+
+    lock(&all_threads_lock);
+    list_del(&thread->all_threads_node);
+    all_threads_cnt -= 1;
+    unlock(&all_threads_lock);
+
     if (thread->general_ipc_config)
         kfree(thread->general_ipc_config);
 
@@ -140,6 +177,9 @@ void create_root_thread(void)
         vaddr_t kva;
         struct process_metadata meta;
 
+        init_list_head(&all_threads);
+        lock_init(&all_threads_lock);
+
         /*
          * Read from binary.
          * The msg and the binary of of the init process(procmgr) are linked
@@ -633,7 +673,18 @@ int sys_set_prio(cap_t thread_cap, int prio)
     if (prio <= 0 || prio > MAX_PRIO)
         return -EINVAL;
 
+#ifdef CHCORE_OH_TEE
+    /* Keep the inherited priority until the served calls are replied */
+    lock(&current_thread->pi_lock);
+    if (current_thread->prio_boosted) {
+        current_thread->base_prio = prio;
+        prio = MAX(prio, (int)current_thread->thread_ctx->sc->prio);
+    }
+    current_thread->thread_ctx->sc->prio = prio;
+    unlock(&current_thread->pi_lock);
+#else
     current_thread->thread_ctx->sc->prio = prio;
+#endif /* CHCORE_OH_TEE */
 
     return 0;
 }
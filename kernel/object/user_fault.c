@@ -203,14 +203,19 @@ int sys_user_fault_map(badge_t client_badge, vaddr_t fault_va, vaddr_t remap_va,
         return -EINVAL;
     }
     if (page_allocated) {
-        lock(&fault_vmspace->vmspace_lock);
+        read_lock(&fault_vmspace->vmspace_lock);
         fault_vmr = find_vmr_for_va(fault_vmspace, fault_va);
         if (fault_vmr == NULL) {
-            unlock(&fault_vmspace->vmspace_lock);
+            read_unlock(&fault_vmspace->vmspace_lock);
             obj_put(fault_vmspace);
             return -EINVAL;
         }
+        /*
+         * Other vmrs may map this pmo, so commit under its commit_lock as
+         * handle_trans_fault does, rather than under the vmr_lock.
+         */
         fault_pmo = fault_vmr->pmo;
+        lock(&fault_pmo->commit_lock);
         commit_page_to_pmo(fault_pmo, new_pa, new_pa);
     }
 
@@ -223,7 +228,8 @@ int sys_user_fault_map(badge_t client_badge, vaddr_t fault_va, vaddr_t remap_va,
     unlock(&fault_vmspace->pgtbl_lock);
 
     if (page_allocated) {
-        unlock(&fault_vmspace->vmspace_lock);
+        unlock(&fault_pmo->commit_lock);
+        read_unlock(&fault_vmspace->vmspace_lock);
     }
 
     obj_put(fault_vmspace);
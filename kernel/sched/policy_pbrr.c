@@ -14,6 +14,7 @@
 #include <common/bitops.h>
 #include <common/kprint.h>
 #include <object/thread.h>
+#include <irq/timer.h>
 
 /*
  * All the variables (except struct sched_ops pbrr) and functions are static.
@@ -122,10 +123,65 @@ struct pbrr_ready_queue {
     struct list_head queues[PRIO_NUM];
     struct prio_bitmap bitmap;
     struct lock lock;
+    /* Number of ready threads except the idle thread */
+    unsigned int nr_ready;
+    /* Number of threads stolen from other CPUs */
+    unsigned long nr_migrations;
+    /*
+     * Steals given up although a peer had ready threads: its queue was
+     * locked or none of its threads could migrate.
+     */
+    unsigned long nr_steal_fails;
 };
 
 static struct pbrr_ready_queue pbrr_ready_queues[PLAT_CPU_NUM];
 
+/*
+ * Tickless: the tick of a CPU is stopped when no thread is waiting in its
+ * ready queue, i.e., it is idle or only runs one thread. When a thread is
+ * enqueued on @cpuid, restart its tick for round robin. If the thread can
+ * migrate, also wake up one tickless idle CPU so that it can steal work.
+ */
+static void pbrr_kick_tickless_cpus(unsigned int cpuid, bool stealable)
+{
+#if PLAT_CPU_NUM > 1
+    unsigned int i;
+    struct thread *thread;
+#endif
+
+    if (cpuid == smp_get_cpu_id())
+        timer_restart_tick();
+#ifndef CHCORE_KERNEL_RT
+    /* Otherwise, add_pending_resched will interrupt the target CPU */
+    else
+        timer_kick_cpu(cpuid);
+#endif
+
+#if PLAT_CPU_NUM > 1
+    if (!stealable)
+        return;
+
+    /*
+     * current_threads[i] is read without the lock of CPU i, so it is only a
+     * hint: a wrong guess kicks a busy CPU or none. It is compared but never
+     * dereferenced, since a thread running elsewhere may exit meanwhile.
+     */
+    for (i = 0; i < PLAT_CPU_NUM; i++) {
+        thread = READ_ONCE(current_threads[i]);
+        if (i != cpuid && timer_tick_stopped(i) && thread == &idle_threads[i]) {
+            timer_kick_cpu(i);
+            break;
+        }
+    }
+#endif
+}
+
+static bool pbrr_sched_tick_needed(void)
+{
+    /* Also changed by CPUs stealing from this one */
+    return READ_ONCE(pbrr_ready_queues[smp_get_cpu_id()].nr_ready) > 0;
+}
+
 int pbrr_sched_enqueue(struct thread *thread)
 {
     int cpubind;
@@ -148,15 +204,22 @@ int pbrr_sched_enqueue(struct thread *thread)
 
     thread->thread_ctx->cpuid = cpuid;
     thread->thread_ctx->state = TS_READY;
+    sched_stat_ready(thread->thread_ctx);
 
     ready_queue = &pbrr_ready_queues[cpuid];
     lock(&ready_queue->lock);
-    if (thread->thread_ctx->type != TYPE_IDLE)
+    thread->thread_ctx->ready_prio = prio;
+    if (thread->thread_ctx->type != TYPE_IDLE) {
         obj_ref(thread);
+        ready_queue->nr_ready++;
+    }
     list_append(&thread->ready_queue_node, &ready_queue->queues[prio]);
     prio_bitmap_set(&ready_queue->bitmap, prio);
     unlock(&ready_queue->lock);
 
+    if (thread->thread_ctx->type != TYPE_IDLE)
+        pbrr_kick_tickless_cpus(cpuid, cpubind == NO_AFF);
+
 #ifdef CHCORE_KERNEL_RT
 #ifdef CHCORE_KERNEL_TEST
     if (thread->thread_ctx->type != TYPE_TESTS) {
@@ -176,7 +239,8 @@ static void __pbrr_sched_dequeue(struct thread *thread)
     struct pbrr_ready_queue *ready_queue;
 
     cpuid = thread->thread_ctx->cpuid;
-    prio = thread->thread_ctx->sc->prio;
+    /* sc->prio may be changed while the thread is ready (sched_set_prio) */
+    prio = thread->thread_ctx->ready_prio;
     ready_queue = &pbrr_ready_queues[cpuid];
 
     thread->thread_ctx->state = TS_INTER;
@@ -184,13 +248,165 @@ static void __pbrr_sched_dequeue(struct thread *thread)
     if (list_empty(&ready_queue->queues[prio])) {
         prio_bitmap_clear(&ready_queue->bitmap, prio);
     }
-    if (thread->thread_ctx->type != TYPE_IDLE)
+    if (thread->thread_ctx->type != TYPE_IDLE) {
+        ready_queue->nr_ready--;
         obj_put(thread);
+    }
+}
+
+#if PLAT_CPU_NUM > 1
+/*
+ * Whether a ready thread on another CPU can be moved to the local CPU:
+ * it should not be bound to a CPU, its kernel stack should be released
+ * and it should not hold its FPU states in another CPU (lazy FPU).
+ */
+static bool pbrr_can_steal(struct thread *thread)
+{
+    return thread->thread_ctx->type != TYPE_IDLE
+           && thread->thread_ctx->affinity == NO_AFF
+           && thread->thread_ctx->kernel_stack_state == KS_FREE
+           && thread->thread_ctx->is_fpu_owner < 0
+           && thread->thread_ctx->thread_exit_state == TE_RUNNING;
 }
 
+/*
+ * Work stealing: invoked when the local CPU has no ready thread except
+ * the idle thread. Move the highest-priority stealable thread from the
+ * busiest CPU to the local ready queue.
+ *
+ * Return true if one thread is moved.
+ */
+static bool pbrr_steal_thread(unsigned int cpuid)
+{
+    unsigned int i, busiest, max_ready, nr_ready, prio;
+    struct pbrr_ready_queue *src, *dst;
+    struct thread *thread, *victim;
+
+    /*
+     * Find the busiest CPU without locking: it is only a hint, and the
+     * victim is chosen again with both queues locked below.
+     */
+    busiest = cpuid;
+    max_ready = 0;
+    for (i = 0; i < PLAT_CPU_NUM; i++) {
+        nr_ready = READ_ONCE(pbrr_ready_queues[i].nr_ready);
+        if (i != cpuid && nr_ready > max_ready) {
+            max_ready = nr_ready;
+            busiest = i;
+        }
+    }
+    if (busiest == cpuid)
+        return false;
+
+    /*
+     * Do not wait for a busy CPU, just try again at the next scheduling.
+     * Both queues are locked while victim moves so that its cpuid always
+     * names the queue holding it (see pbrr_sched_dequeue).
+     */
+    src = &pbrr_ready_queues[busiest];
+    dst = &pbrr_ready_queues[cpuid];
+    lock(&dst->lock);
+    if (try_lock(&src->lock) != 0) {
+        dst->nr_steal_fails++;
+        unlock(&dst->lock);
+        return false;
+    }
+
+    victim = NULL;
+    for (prio = PRIO_NUM; prio-- > 0 && victim == NULL;) {
+        if (list_empty(&src->queues[prio]))
+            continue;
+        for_each_in_list (
+            thread, struct thread, ready_queue_node, &src->queues[prio]) {
+            if (pbrr_can_steal(thread)) {
+                victim = thread;
+                break;
+            }
+        }
+    }
+
+    if (victim == NULL) {
+        dst->nr_steal_fails++;
+        unlock(&src->lock);
+        unlock(&dst->lock);
+        return false;
+    }
+
+    /* The reference of the ready queue is moved together with victim */
+    prio = victim->thread_ctx->ready_prio;
+    list_del(&victim->ready_queue_node);
+    if (list_empty(&src->queues[prio]))
+        prio_bitmap_clear(&src->bitmap, prio);
+    src->nr_ready--;
+
+    victim->thread_ctx->cpuid = cpuid;
+    list_append(&victim->ready_queue_node, &dst->queues[prio]);
+    prio_bitmap_set(&dst->bitmap, prio);
+    dst->nr_ready++;
+    dst->nr_migrations++;
+    unlock(&src->lock);
+    unlock(&dst->lock);
+
+    return true;
+}
+#endif /* PLAT_CPU_NUM > 1 */
+
+/* Remove @thread from the ready queue of any CPU */
 static int pbrr_sched_dequeue(struct thread *thread)
 {
-    return -1; // unused
+    unsigned int cpuid;
+    struct pbrr_ready_queue *ready_queue;
+
+    BUG_ON(thread == NULL);
+    BUG_ON(thread->thread_ctx == NULL);
+
+    cpuid = thread->thread_ctx->cpuid;
+    ready_queue = &pbrr_ready_queues[cpuid];
+    lock(&ready_queue->lock);
+    /* The thread may be chosen or stolen before the lock is acquired */
+    if (thread->thread_ctx->state != TS_READY
+        || thread->thread_ctx->cpuid != cpuid
+        || thread->thread_ctx->type == TYPE_IDLE) {
+        unlock(&ready_queue->lock);
+        return -EINVAL;
+    }
+    __pbrr_sched_dequeue(thread);
+    unlock(&ready_queue->lock);
+
+    return 0;
+}
+
+/* Move a ready @thread to the queue of its new priority on the same CPU */
+static void pbrr_sched_requeue(struct thread *thread)
+{
+    unsigned int cpuid, prio;
+    struct pbrr_ready_queue *ready_queue;
+
+    cpuid = thread->thread_ctx->cpuid;
+    ready_queue = &pbrr_ready_queues[cpuid];
+    lock(&ready_queue->lock);
+    /* The thread may be chosen or stolen before the lock is acquired */
+    if (thread->thread_ctx->state != TS_READY
+        || thread->thread_ctx->cpuid != cpuid
+        || thread->thread_ctx->type == TYPE_IDLE) {
+        unlock(&ready_queue->lock);
+        return;
+    }
+
+    prio = thread->thread_ctx->ready_prio;
+    list_del(&thread->ready_queue_node);
+    if (list_empty(&ready_queue->queues[prio]))
+        prio_bitmap_clear(&ready_queue->bitmap, prio);
+
+    prio = thread->thread_ctx->sc->prio;
+    thread->thread_ctx->ready_prio = prio;
+    list_append(&thread->ready_queue_node, &ready_queue->queues[prio]);
+    prio_bitmap_set(&ready_queue->bitmap, prio);
+    unlock(&ready_queue->lock);
+
+#ifdef CHCORE_KERNEL_RT
+    add_pending_resched(cpuid);
+#endif
 }
 
 static struct thread *pbrr_sched_choose_thread(void)
@@ -209,6 +425,15 @@ static struct thread *pbrr_sched_choose_thread(void)
                               && (thread->thread_ctx->affinity == NO_AFF
                                   || thread->thread_ctx->affinity == cpuid);
 
+#if PLAT_CPU_NUM > 1
+    /* Pull work from other CPUs instead of running the idle thread */
+    if (READ_ONCE(ready_queue->nr_ready) == 0
+        && (!current_thread_runnable
+            || thread->thread_ctx->type == TYPE_IDLE)) {
+        pbrr_steal_thread(cpuid);
+    }
+#endif
+
     lock(&ready_queue->lock);
 
 retry:
@@ -266,7 +491,22 @@ out_unlock_ready_queue:
 
 static void pbrr_top(void)
 {
-    printk("pbrr_top unimplemented\n");
+    unsigned int i;
+    unsigned long sleepers, max_sleepers;
+
+    for (i = 0; i < PLAT_CPU_NUM; i++) {
+        get_timer_sleeper_count(i, &sleepers, &max_sleepers);
+        printk("CPU %u: ready %u, migrations %lu, steal fails %lu, "
+               "timer irqs %llu, sleepers %lu (max %lu)%s\n",
+               i,
+               pbrr_ready_queues[i].nr_ready,
+               pbrr_ready_queues[i].nr_migrations,
+               pbrr_ready_queues[i].nr_steal_fails,
+               get_timer_irq_count(i),
+               sleepers,
+               max_sleepers,
+               timer_tick_stopped(i) ? " (tickless)" : "");
+    }
 }
 
 int pbrr_sched(void)
@@ -305,6 +545,9 @@ static int pbrr_sched_init(void)
     for (i = 0; i < PLAT_CPU_NUM; i++) {
         prio_bitmap_init(&pbrr_ready_queues[i].bitmap);
         lock_init(&pbrr_ready_queues[i].lock);
+        pbrr_ready_queues[i].nr_ready = 0;
+        pbrr_ready_queues[i].nr_migrations = 0;
+        pbrr_ready_queues[i].nr_steal_fails = 0;
         for (j = 0; j < PRIO_NUM; j++) {
             init_list_head(&pbrr_ready_queues[i].queues[j]);
         }
@@ -322,4 +565,6 @@ struct sched_ops pbrr = {.sched_init = pbrr_sched_init,
                          .sched = pbrr_sched,
                          .sched_enqueue = pbrr_sched_enqueue,
                          .sched_dequeue = pbrr_sched_dequeue,
+                         .sched_tick_needed = pbrr_sched_tick_needed,
+                         .sched_requeue = pbrr_sched_requeue,
                          .sched_top = pbrr_top};
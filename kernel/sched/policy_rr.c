@@ -47,6 +47,7 @@ int __rr_sched_enqueue(struct thread *thread, int cpuid)
     }
     thread->thread_ctx->cpuid = cpuid;
     thread->thread_ctx->state = TS_READY;
+    sched_stat_ready(thread->thread_ctx);
     obj_ref(thread);
     list_append(&(thread->ready_queue_node),
                 &(rr_ready_queue_meta[cpuid].queue_head));
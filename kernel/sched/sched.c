@@ -13,8 +13,15 @@
 #include <sched/context.h>
 #include <sched/fpu.h>
 #include <mm/kmalloc.h>
+#include <mm/uaccess.h>
 #include <irq/ipi.h>
+#include <irq/timer.h>
+#include <object/thread.h>
+#include <ipc/futex.h>
+#include <ipc/channel.h>
+#include <syscall/syscall_hooks.h>
 #include <common/util.h>
+#include <common/errno.h>
 
 /* Scheduler global data */
 struct thread *current_threads[PLAT_CPU_NUM];
@@ -29,6 +36,58 @@ unsigned int resched_bitmaps[PLAT_CPU_NUM];
 /* Chosen Scheduling Policies */
 struct sched_ops *cur_sched_ops;
 
+/* Per-CPU scheduling statistics, in the ticks of the arch counter */
+struct sched_cpu_stat {
+    u64 nr_switches;
+    u64 max_wakeup_latency;
+    u64 total_wakeup_latency;
+    u64 nr_wakeups;
+} __attribute__((aligned(CACHELINE_SZ)));
+
+static struct sched_cpu_stat sched_cpu_stats[PLAT_CPU_NUM];
+
+/*
+ * Charge the elapsed time to @prev and start the accounting of @next.
+ * Both threads are only touched by the local CPU here.
+ */
+static void account_switch(struct thread *prev, struct thread *next,
+                           unsigned int cpuid)
+{
+    struct sched_cpu_stat *cpu_stat = &sched_cpu_stats[cpuid];
+    struct sched_stat *stat;
+    u64 now, latency;
+
+    now = get_sys_counter();
+
+    if (prev != NULL && prev->thread_ctx->stat.last_run != 0) {
+        stat = &prev->thread_ctx->stat;
+        stat->runtime += now - stat->last_run;
+        stat->last_run = 0;
+    }
+
+    stat = &next->thread_ctx->stat;
+    stat->nr_switches++;
+    stat->last_run = now;
+    cpu_stat->nr_switches++;
+
+    if (stat->ready_time != 0) {
+        latency = now - stat->ready_time;
+        stat->ready_time = 0;
+
+        stat->max_wakeup_latency = MAX(stat->max_wakeup_latency, latency);
+        stat->total_wakeup_latency += latency;
+        stat->nr_wakeups++;
+
+        /* Idle threads are always ready, which says nothing about latency */
+        if (next->thread_ctx->type != TYPE_IDLE) {
+            cpu_stat->max_wakeup_latency =
+                MAX(cpu_stat->max_wakeup_latency, latency);
+            cpu_stat->total_wakeup_latency += latency;
+            cpu_stat->nr_wakeups++;
+        }
+    }
+}
+
 /* Scheduler module local interfaces */
 
 /*
@@ -57,6 +116,8 @@ int switch_to_thread(struct thread *target)
         return 0;
     }
 
+    account_switch(current_thread, target, cpuid);
+
     target->thread_ctx->cpuid = cpuid;
 
     target->thread_ctx->state = TS_RUNNING;
@@ -185,7 +246,7 @@ vaddr_t switch_context(void)
 
     prev_thread = target_thread->prev_thread;
     if (prev_thread == THREAD_ITSELF)
-        return (vaddr_t)target_ctx;
+        goto out;
 
 #if FPU_SAVING_MODE == EAGER_FPU_MODE
     save_fpu_state(prev_thread);
@@ -220,6 +281,9 @@ vaddr_t switch_context(void)
 
     arch_switch_context(target_thread);
 
+out:
+    if (unlikely(target_thread->futex_requeued_uaddr))
+        futex_publish_requeue(target_thread);
     return (vaddr_t)target_ctx;
 }
 
@@ -389,6 +453,26 @@ void wait_for_kernel_stack(struct thread *thread)
     }
 }
 
+/*
+ * Change the priority of @thread. If it is waiting in a ready queue, requeue
+ * it so that the new priority takes effect immediately. Otherwise, the new
+ * priority is used when it is enqueued next time.
+ */
+void sched_set_prio(struct thread *thread, unsigned int prio)
+{
+    sched_ctx_t *sc = thread->thread_ctx->sc;
+
+    BUG_ON(prio >= PRIO_NUM);
+
+    if (sc == NULL || sc->prio == prio)
+        return;
+
+    sc->prio = prio;
+    if (thread->thread_ctx->state == TS_READY
+        && cur_sched_ops->sched_requeue != NULL)
+        cur_sched_ops->sched_requeue(thread);
+}
+
 static void init_idle_threads(void)
 {
     unsigned int i;
@@ -456,7 +540,159 @@ void sys_yield(void)
     eret_to_thread(switch_context());
 }
 
-void sys_top(void)
+/* Convert ticks of the arch counter to nanoseconds without overflow */
+static u64 ticks_to_ns(u64 ticks, u64 freq)
+{
+    if (freq == 0)
+        return ticks;
+    return ticks / freq * NS_IN_S + ticks % freq * NS_IN_S / freq;
+}
+
+static void fill_top_thread_info(struct top_thread_info *info,
+                                 struct thread *thread, u64 now, u64 freq)
+{
+    struct thread_ctx *ctx = thread->thread_ctx;
+    struct sched_stat *stat = &ctx->stat;
+    u64 runtime, last_run;
+
+    memset(info, 0, sizeof(*info));
+
+    info->badge = thread->cap_group->badge;
+    info->type = ctx->type;
+    info->state = ctx->state;
+    info->prio = ctx->sc ? ctx->sc->prio : 0;
+    info->cpuid = ctx->cpuid;
+    memcpy(info->name,
+           thread->cap_group->cap_group_name,
+           MIN(strlen(thread->cap_group->cap_group_name), TOP_NAME_LEN - 1));
+
+    /* Include the time of the ongoing run */
+    runtime = stat->runtime;
+    last_run = stat->last_run;
+    if (ctx->state == TS_RUNNING && last_run != 0 && now > last_run)
+        runtime += now - last_run;
+
+    info->runtime = ticks_to_ns(runtime, freq);
+    info->nr_switches = stat->nr_switches;
+    info->max_wakeup_latency = ticks_to_ns(stat->max_wakeup_latency, freq);
+    if (stat->nr_wakeups != 0)
+        info->avg_wakeup_latency = ticks_to_ns(
+            stat->total_wakeup_latency / stat->nr_wakeups, freq);
+}
+
+static int copy_top_cpu_info(unsigned long cpu_buf, unsigned int nr_cpus,
+                             u64 freq)
+{
+    struct top_cpu_info info;
+    struct sched_cpu_stat *cpu_stat;
+    unsigned int i;
+
+    nr_cpus = MIN(nr_cpus, PLAT_CPU_NUM);
+    for (i = 0; i < nr_cpus; i++) {
+        cpu_stat = &sched_cpu_stats[i];
+
+        info.nr_switches = cpu_stat->nr_switches;
+        info.idle_time =
+            ticks_to_ns(idle_threads[i].thread_ctx->stat.runtime, freq);
+        info.max_wakeup_latency =
+            ticks_to_ns(cpu_stat->max_wakeup_latency, freq);
+        info.avg_wakeup_latency =
+            cpu_stat->nr_wakeups == 0 ?
+                0 :
+                ticks_to_ns(cpu_stat->total_wakeup_latency
+                                / cpu_stat->nr_wakeups,
+                            freq);
+
+        if (copy_to_user((char *)(cpu_buf + i * sizeof(info)),
+                         (char *)&info,
+                         sizeof(info))) {
+            return -EFAULT;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Copy a snapshot of the scheduling statistics to user space:
+ * at most @nr_cpus struct top_cpu_info into @cpu_buf and at most @nr_threads
+ * struct top_thread_info into @thread_buf.
+ *
+ * Return the number of (non-idle) threads in the system, which may be larger
+ * than @nr_threads. Print the statistics instead if both buffers are NULL.
+ * Only allowed for system services and drivers.
+ */
+int sys_top(unsigned long cpu_buf, unsigned int nr_cpus,
+            unsigned long thread_buf, unsigned int nr_threads)
 {
-    cur_sched_ops->sched_top();
+    struct top_thread_info *infos = NULL;
+    struct thread *thread;
+    unsigned int cnt = 0, total;
+    u64 now, freq;
+    int ret;
+
+    if ((ret = hook_sys_top()) != 0)
+        return ret;
+
+    if (cpu_buf == 0 && thread_buf == 0) {
+        cur_sched_ops->sched_top();
+        print_futex_stats();
+        print_cap_lookup_stats();
+        print_cap_copy_stats();
+#ifdef CHCORE_OH_TEE
+        print_channel_pi_stats();
+#endif /* CHCORE_OH_TEE */
+        return 0;
+    }
+
+    if (cpu_buf != 0
+        && check_user_addr_range(cpu_buf, nr_cpus * sizeof(struct top_cpu_info)))
+        return -EINVAL;
+    if (thread_buf != 0
+        && check_user_addr_range(thread_buf,
+                                 nr_threads * sizeof(struct top_thread_info)))
+        return -EINVAL;
+
+    freq = get_sys_counter_freq();
+
+    if (cpu_buf != 0) {
+        ret = copy_top_cpu_info(cpu_buf, nr_cpus, freq);
+        if (ret < 0)
+            return ret;
+    }
+
+    if (thread_buf == 0)
+        nr_threads = 0;
+
+    /* Bounded by the current number of threads */
+    nr_threads = MIN(nr_threads, all_threads_cnt);
+    if (nr_threads != 0) {
+        infos = kmalloc(nr_threads * sizeof(*infos));
+        if (infos == NULL)
+            return -ENOMEM;
+    }
+
+    /* Fill in a kernel buffer first: copy_to_user may fault */
+    lock(&all_threads_lock);
+    now = get_sys_counter();
+    total = all_threads_cnt;
+    for_each_in_list (
+        thread, struct thread, all_threads_node, &all_threads) {
+        if (cnt == nr_threads)
+            break;
+        fill_top_thread_info(&infos[cnt], thread, now, freq);
+        cnt++;
+    }
+    unlock(&all_threads_lock);
+
+    ret = total;
+    if (cnt != 0
+        && copy_to_user(
+            (char *)thread_buf, (char *)infos, cnt * sizeof(*infos))) {
+        ret = -EFAULT;
+    }
+
+    if (infos)
+        kfree(infos);
+    return ret;
 }
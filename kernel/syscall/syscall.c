@@ -26,6 +26,7 @@
 #include <object/user_fault.h>
 #include <sched/sched.h>
 #include <ipc/connection.h>
+#include <ipc/futex.h>
 #include <irq/timer.h>
 #include <irq/irq.h>
 #ifdef CHCORE_OH_TEE
@@ -257,6 +258,10 @@ const void *syscall_table[NR_SYSCALL] = {
     [SYS_create_notifc] = sys_create_notifc,
     [SYS_wait] = sys_wait,
     [SYS_notify] = sys_notify,
+    /* - futex */
+    [SYS_futex_wait] = sys_futex_wait,
+    [SYS_futex_wake] = sys_futex_wake,
+    [SYS_futex_requeue] = sys_futex_requeue,
 #ifdef CHCORE_OH_TEE
     /* - oh-tee-ipc */
     [SYS_tee_msg_create_msg_hdl] = sys_tee_msg_create_msg_hdl,
@@ -266,6 +271,10 @@ const void *syscall_table[NR_SYSCALL] = {
     [SYS_tee_msg_reply] = sys_tee_msg_reply,
     [SYS_tee_msg_notify] = sys_tee_msg_notify,
     [SYS_tee_msg_stop_channel] = sys_tee_msg_stop_channel,
+    [SYS_tee_msg_attach_ring] = sys_tee_msg_attach_ring,
+    [SYS_tee_msg_ring_notify] = sys_tee_msg_ring_notify,
+    [SYS_tee_msg_ring_wait] = sys_tee_msg_ring_wait,
+    [SYS_tee_msg_ring_accept] = sys_tee_msg_ring_accept,
 #endif /* CHCORE_OH_TEE */
 
     /* Exception */
@@ -302,6 +311,7 @@ const void *syscall_table[NR_SYSCALL] = {
     [SYS_debug_log] = sys_debug_log,
     [SYS_top] = sys_top,
     [SYS_get_free_mem_size] = sys_get_free_mem_size,
+    [SYS_get_mem_usage_msg] = sys_get_mem_usage_msg,
 
     /* Performance Benchmark */
     [SYS_perf_start] = sys_perf_start,
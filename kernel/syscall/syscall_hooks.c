@@ -43,6 +43,16 @@ int hook_sys_get_phys_addr(vaddr_t va, paddr_t *pa_buf)
     return 0;
 }
 
+int hook_sys_top(void)
+{
+    /* The statistics of all the threads are exposed to system services only. */
+    if (current_cap_group->badge >= APP_BADGE_START) {
+        kwarn("An unthorized process tries to get the statistics.\n");
+        return -EPERM;
+    }
+    return 0;
+}
+
 int hook_sys_create_cap_group(unsigned long cap_group_args_p)
 {
     if ((current_cap_group->badge != ROOT_CAP_GROUP_BADGE)
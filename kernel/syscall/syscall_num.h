@@ -85,6 +85,10 @@
 #define SYS_create_notifc 130
 #define SYS_wait          131
 #define SYS_notify        132
+/* - futex */
+#define SYS_futex_wait    133
+#define SYS_futex_wake    134
+#define SYS_futex_requeue 135
 
 #ifdef CHCORE_OH_TEE
 /* - oh-tee-ipc */
@@ -96,6 +100,11 @@
 #define SYS_tee_msg_call    144
 #define SYS_tee_msg_reply   145
 #define SYS_tee_msg_notify  146
+
+#define SYS_tee_msg_attach_ring 147
+#define SYS_tee_msg_ring_notify 148
+#define SYS_tee_msg_ring_wait   149
+#define SYS_tee_msg_ring_accept 139
 #endif /* CHCORE_OH_TEE */
 
 /* Exception */
@@ -16,6 +16,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <time.h>
+#include <pthread.h>
 
 /* declare that wait forever when receive msg */
 #define OS_WAIT_FOREVER 0xFFFFFFFF
@@ -27,6 +28,8 @@
 
 #define CH_CNT_MAX         2
 #define E_EX_TIMER_TIMEOUT 0xff
+/* Returned by the kernel receive on doorbells of the message rings */
+#define E_EX_RING_DOORBELL 0xfe
 
 #define TID_MASK   0xFFFFULL
 #define PID_OFFSET 16U
@@ -113,6 +116,76 @@ int32_t ipc_msg_receive(cref_t channel, void *recv_buf, size_t recv_len,
                         cref_t msg_hdl, struct src_msginfo *info,
                         int32_t timeout);
 
+/*
+ * Message rings of a channel: each client writes notifications into a ring
+ * in a PMO of its own, which is mapped by the server as well. Only doorbells
+ * go through the kernel, which also stamps the identity of each ring.
+ */
+struct ipc_ring {
+    cref_t channel;
+    cref_t pmo;
+    /* Private copies of the geometry, which the peer cannot tamper with */
+    uint32_t nr_slots;
+    uint32_t msg_size;
+    size_t size;
+    void *base;
+    /* Server side: next position to consume */
+    uint64_t tail;
+    /* Server side: the client attaching the ring, stamped by the kernel */
+    struct src_msginfo info;
+};
+
+/* The rings of a channel accepted by the server */
+struct ipc_ring_set {
+    /* Serializes the receivers, as a ring has a single consumer */
+    pthread_mutex_t lock;
+    cref_t channel;
+    uint32_t nr_rings;
+    uint32_t max_rings;
+    /* The ring drained first by the next receive, for fairness */
+    uint32_t next;
+    /* Receivers waiting in the kernel, with `sleeping` of the rings raised */
+    uint32_t nr_sleepers;
+    struct ipc_ring *rings;
+};
+
+int32_t ipc_ring_create(cref_t channel, struct ipc_ring_set *set);
+
+int32_t ipc_ring_destroy(struct ipc_ring_set *set);
+
+int32_t ipc_ring_attach(cref_t channel, uint32_t nr_slots, uint32_t msg_size,
+                        struct ipc_ring *ring);
+
+int32_t ipc_ring_detach(struct ipc_ring *ring);
+
+int32_t ipc_ring_notification(struct ipc_ring *ring, const void *send_buf,
+                              size_t send_len);
+
+int32_t ipc_ring_receive(struct ipc_ring_set *set, void *recv_buf,
+                         size_t recv_len, struct src_msginfo *info,
+                         int32_t timeout);
+
+/*
+ * Message rings behind ipc_msg_notification and ipc_msg_receive: the
+ * channels created by ipc_create_channel enable rings, and each client
+ * thread sends its notifications to them through a ring of its own.
+ */
+int32_t ipc_ring_enable(cref_t channel);
+
+void ipc_ring_disable(cref_t channel);
+
+/* Drop the rings of all threads, as released channel caps may be reused */
+void ipc_ring_forget_channels(void);
+
+int32_t ipc_ring_flush(cref_t channel);
+
+int32_t ipc_ring_try_notification(cref_t channel, const void *send_buf,
+                                  size_t send_len);
+
+int32_t ipc_ring_try_receive(cref_t channel, void *recv_buf, size_t recv_len,
+                             cref_t msg_hdl, struct src_msginfo *info,
+                             int32_t timeout);
+
 cref_t ipc_msg_create_hdl(void);
 
 int32_t ipc_msg_delete_hdl(cref_t msg_hdl);
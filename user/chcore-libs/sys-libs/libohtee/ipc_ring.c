@@ -0,0 +1,886 @@
+/*
+ * Copyright (c) 2023 Institute of Parallel And Distributed Systems (IPADS), Shanghai Jiao Tong University (SJTU)
+ * Licensed under the Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *     http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR FIT FOR A PARTICULAR
+ * PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ */
+#include <chcore/syscall.h>
+#include <chcore/memory.h>
+#include <chcore/defs.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <ipclib.h>
+
+
+/*
+ * Layout of a ring PMO: a struct ipc_ring_hdr followed by nr_slots slots,
+ * each of which is a struct ipc_ring_slot followed by msg_size bytes.
+ *
+ * Each client creates its own ring and attaches it to the channel, so that
+ * a client can only corrupt or stall its own ring. The server accepts the
+ * rings through the kernel, which reports the identity of the attaching
+ * thread, and never trusts the contents of a ring beyond its own bounds.
+ *
+ * A ring is a bounded multi-producer single-consumer queue. Each slot
+ * carries a sequence number: a producer owns slot (pos % nr_slots) once it
+ * has claimed pos from head and the sequence equals pos, and publishes the
+ * message by setting the sequence to pos + 1. The consumer frees the slot
+ * for the next round by setting it to pos + nr_slots.
+ *
+ * The server drains the rings before sleeping, and raises `sleeping` of each
+ * ring right before waiting in the kernel. Only the producer clearing
+ * `sleeping` rings the doorbell, so a batch of notifications costs a single
+ * wakeup. Several server threads may receive from a set in turn: set->lock
+ * keeps a single consumer, and `sleeping` stays raised while any of them
+ * waits in the kernel.
+ */
+#define IPC_RING_MAGIC     0x52494e47
+#define IPC_RING_LINE_SIZE 64
+#define IPC_RING_MAX_SLOTS 4096
+#define IPC_RING_MAX_MSG   PAGE_SIZE
+
+struct ipc_ring_hdr {
+    uint32_t magic;
+    uint32_t nr_slots;
+    uint32_t msg_size;
+    uint32_t slot_size;
+    /* Next position to be claimed by producers */
+    uint64_t head __attribute__((aligned(IPC_RING_LINE_SIZE)));
+    /* The server is going to wait for the doorbell */
+    uint32_t sleeping __attribute__((aligned(IPC_RING_LINE_SIZE)));
+    /* The client has detached the ring */
+    uint32_t closed;
+} __attribute__((aligned(IPC_RING_LINE_SIZE)));
+
+struct ipc_ring_slot {
+    uint64_t seq;
+    uint32_t len;
+    char data[];
+};
+
+static inline uint32_t __slot_size(uint32_t msg_size)
+{
+    return ROUND_UP(sizeof(struct ipc_ring_slot) + msg_size, sizeof(uint64_t));
+}
+
+static inline size_t __ring_size(uint32_t nr_slots, uint32_t msg_size)
+{
+    return ROUND_UP(sizeof(struct ipc_ring_hdr)
+                        + (size_t)nr_slots * __slot_size(msg_size),
+                    PAGE_SIZE);
+}
+
+static inline bool __ring_geometry_valid(uint32_t nr_slots, uint32_t msg_size)
+{
+    return nr_slots != 0 && nr_slots <= IPC_RING_MAX_SLOTS
+           && (nr_slots & (nr_slots - 1)) == 0 && msg_size != 0
+           && msg_size <= IPC_RING_MAX_MSG;
+}
+
+static inline struct ipc_ring_hdr *__ring_hdr(struct ipc_ring *ring)
+{
+    return (struct ipc_ring_hdr *)ring->base;
+}
+
+static inline struct ipc_ring_slot *__ring_slot(struct ipc_ring *ring,
+                                                uint64_t pos)
+{
+    return (struct ipc_ring_slot *)((char *)ring->base
+                                    + sizeof(struct ipc_ring_hdr)
+                                    + (pos & (ring->nr_slots - 1))
+                                          * __slot_size(ring->msg_size));
+}
+
+/* Called by the server only */
+static bool __ring_empty(struct ipc_ring *ring)
+{
+    struct ipc_ring_slot *slot;
+
+    slot = __ring_slot(ring, ring->tail);
+    return __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != ring->tail + 1;
+}
+
+/* Called by the client only: whether the server has consumed all messages */
+static bool __ring_drained(struct ipc_ring *ring)
+{
+    uint64_t head;
+
+    head = __atomic_load_n(&__ring_hdr(ring)->head, __ATOMIC_RELAXED);
+    if (head == 0)
+        return true;
+    return __atomic_load_n(&__ring_slot(ring, head - 1)->seq, __ATOMIC_ACQUIRE)
+           == head - 1 + ring->nr_slots;
+}
+
+/* Called by the server only */
+static int __ring_pop(struct ipc_ring *ring, void *recv_buf, size_t recv_len,
+                      struct src_msginfo *info)
+{
+    struct ipc_ring_slot *slot;
+    size_t len;
+
+    if (__ring_empty(ring))
+        return -EAGAIN;
+
+    /* The slot is written by the client, so never trust its len */
+    slot = __ring_slot(ring, ring->tail);
+    len = slot->len;
+    len = len < ring->msg_size ? len : ring->msg_size;
+    len = len < recv_len ? len : recv_len;
+    memcpy(recv_buf, slot->data, len);
+    if (info != NULL)
+        memcpy(info, &ring->info, sizeof(*info));
+
+    __atomic_store_n(&slot->seq, ring->tail + ring->nr_slots, __ATOMIC_RELEASE);
+    ring->tail++;
+    return 0;
+}
+
+static int __ring_map(struct ipc_ring *ring, cref_t channel, cref_t pmo,
+                      size_t size)
+{
+    ring->base = chcore_auto_map_pmo(pmo, size, VM_READ | VM_WRITE);
+    if (ring->base == NULL)
+        return -ENOMEM;
+    ring->channel = channel;
+    ring->pmo = pmo;
+    ring->size = size;
+    ring->tail = 0;
+    return 0;
+}
+
+static void __ring_unmap(struct ipc_ring *ring)
+{
+    chcore_auto_unmap_pmo(ring->pmo, (unsigned long)ring->base, ring->size);
+    ring->base = NULL;
+    usys_revoke_cap(ring->pmo, false);
+}
+
+static int __ring_set_reset(cref_t channel, struct ipc_ring_set *set)
+{
+    int ret;
+
+    ret = usys_tee_msg_attach_ring(channel, -1);
+    if (ret < 0)
+        return ret;
+
+    set->channel = channel;
+    set->nr_rings = 0;
+    set->max_rings = 0;
+    set->next = 0;
+    set->rings = NULL;
+    return 0;
+}
+
+/*
+ * Enable the message rings of a channel, called by the creater of @channel.
+ * @channel: cap of the channel
+ * @set: filled in with the rings accepted from clients later
+ *
+ * Return:
+ *      0: success
+ *      errno: fail
+ */
+int32_t ipc_ring_create(cref_t channel, struct ipc_ring_set *set)
+{
+    int ret;
+
+    ret = __ring_set_reset(channel, set);
+    if (ret != 0)
+        return ret;
+
+    pthread_mutex_init(&set->lock, NULL);
+    /* Kept across __ring_set_reset, receivers may still be leaving */
+    set->nr_sleepers = 0;
+    return 0;
+}
+
+/* Unmap all the rings accepted by the server */
+int32_t ipc_ring_destroy(struct ipc_ring_set *set)
+{
+    uint32_t i;
+
+    for (i = 0; i < set->nr_rings; i++)
+        __ring_unmap(&set->rings[i]);
+    free(set->rings);
+    set->rings = NULL;
+    set->nr_rings = 0;
+    set->max_rings = 0;
+    return 0;
+}
+
+/* Make room for one more ring in @set */
+static int __ring_set_grow(struct ipc_ring_set *set)
+{
+    struct ipc_ring *rings;
+    uint32_t max_rings;
+
+    if (set->nr_rings < set->max_rings)
+        return 0;
+
+    max_rings = set->max_rings ? set->max_rings * 2 : 4;
+    rings = realloc(set->rings, max_rings * sizeof(*rings));
+    if (rings == NULL)
+        return -ENOMEM;
+    set->rings = rings;
+    set->max_rings = max_rings;
+    return 0;
+}
+
+/*
+ * Accept the rings attached by clients since the last call, as long as the
+ * set can grow. Rings with a bad geometry are dropped.
+ * Return the number of accepted rings.
+ */
+static uint32_t __ring_accept(struct ipc_ring_set *set)
+{
+    struct ipc_ring *ring;
+    struct ipc_ring_hdr hdr;
+    struct src_msginfo info;
+    uint32_t nr_accepted = 0;
+    size_t size;
+    cref_t pmo;
+    char last;
+
+    while (__ring_set_grow(set) == 0) {
+        pmo = usys_tee_msg_ring_accept(set->channel, &info);
+        if (pmo < 0)
+            break;
+
+        if (usys_read_pmo(pmo, 0, &hdr, sizeof(hdr)) < 0
+            || hdr.magic != IPC_RING_MAGIC
+            || !__ring_geometry_valid(hdr.nr_slots, hdr.msg_size)
+            || hdr.slot_size != __slot_size(hdr.msg_size)) {
+            usys_revoke_cap(pmo, false);
+            continue;
+        }
+
+        /* The PMO should cover all the slots */
+        size = __ring_size(hdr.nr_slots, hdr.msg_size);
+        if (usys_read_pmo(pmo, size - 1, &last, sizeof(last)) < 0) {
+            usys_revoke_cap(pmo, false);
+            continue;
+        }
+
+        ring = &set->rings[set->nr_rings];
+        ring->nr_slots = hdr.nr_slots;
+        ring->msg_size = hdr.msg_size;
+        if (__ring_map(ring, set->channel, pmo, size) != 0) {
+            usys_revoke_cap(pmo, false);
+            continue;
+        }
+        memcpy(&ring->info, &info, sizeof(info));
+        /* Other receivers may wait for doorbells */
+        __atomic_store_n(&__ring_hdr(ring)->sleeping,
+                         set->nr_sleepers != 0,
+                         __ATOMIC_RELAXED);
+        set->nr_rings++;
+        nr_accepted++;
+    }
+
+    return nr_accepted;
+}
+
+/* Drop the ring at @index whose client has detached it */
+static void __ring_release(struct ipc_ring_set *set, uint32_t index)
+{
+    __ring_unmap(&set->rings[index]);
+    set->nr_rings--;
+    if (index != set->nr_rings)
+        memcpy(&set->rings[index],
+               &set->rings[set->nr_rings],
+               sizeof(struct ipc_ring));
+}
+
+/*
+ * Attach a message ring to a channel, called by clients. The messages sent
+ * through the ring are reported to the server as from the calling thread.
+ * @channel: cap of the channel
+ * @nr_slots: capacity of the ring, a power of 2
+ * @msg_size: maximum length of one message
+ * @ring: filled in with the attached ring
+ *
+ * Return:
+ *      0: success
+ *      -EAGAIN: too many rings are waiting for the server
+ *      errno: fail
+ */
+int32_t ipc_ring_attach(cref_t channel, uint32_t nr_slots, uint32_t msg_size,
+                        struct ipc_ring *ring)
+{
+    struct ipc_ring_hdr *hdr;
+    struct ipc_ring_slot *slot;
+    size_t size;
+    cref_t pmo;
+    uint32_t i;
+    int ret;
+
+    if (!__ring_geometry_valid(nr_slots, msg_size))
+        return -EINVAL;
+
+    size = __ring_size(nr_slots, msg_size);
+    pmo = usys_create_pmo(size, PMO_DATA);
+    if (pmo < 0)
+        return pmo;
+
+    ring->nr_slots = nr_slots;
+    ring->msg_size = msg_size;
+    ret = __ring_map(ring, channel, pmo, size);
+    if (ret != 0)
+        goto out_revoke_pmo;
+
+    hdr = __ring_hdr(ring);
+    hdr->magic = IPC_RING_MAGIC;
+    hdr->nr_slots = nr_slots;
+    hdr->msg_size = msg_size;
+    hdr->slot_size = __slot_size(msg_size);
+    hdr->head = 0;
+    hdr->sleeping = 0;
+    hdr->closed = 0;
+    for (i = 0; i < nr_slots; i++) {
+        slot = __ring_slot(ring, i);
+        slot->seq = i;
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    ret = usys_tee_msg_attach_ring(channel, pmo);
+    if (ret < 0)
+        goto out_unmap;
+
+    return 0;
+
+out_unmap:
+    chcore_auto_unmap_pmo(pmo, (unsigned long)ring->base, size);
+out_revoke_pmo:
+    usys_revoke_cap(pmo, false);
+    return ret;
+}
+
+/*
+ * Detach the ring of a client. The server drops the ring once it has
+ * consumed the messages left in it.
+ */
+int32_t ipc_ring_detach(struct ipc_ring *ring)
+{
+    struct ipc_ring_hdr *hdr = __ring_hdr(ring);
+
+    __atomic_store_n(&hdr->closed, 1, __ATOMIC_RELEASE);
+    /* Let a sleeping server notice it, see ipc_ring_notification */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&hdr->sleeping, 0, __ATOMIC_ACQ_REL))
+        usys_tee_msg_ring_notify(ring->channel);
+
+    chcore_auto_unmap_pmo(ring->pmo, (unsigned long)ring->base, ring->size);
+    ring->base = NULL;
+    return usys_revoke_cap(ring->pmo, false);
+}
+
+/*
+ * ipc_ring_notification sends a message through the ring of a client.
+ * @ring: the attached ring
+ * @send_buf: message buffer
+ * @send_len: length of the message, at most msg_size of the ring
+ *
+ * Unlike ipc_msg_notification, the message is not copied through the kernel,
+ * and the kernel is entered only if the server sleeps.
+ * Return:
+ *      0: success
+ *      -EAGAIN: the ring is full
+ *      errno: fail
+ */
+int32_t ipc_ring_notification(struct ipc_ring *ring, const void *send_buf,
+                              size_t send_len)
+{
+    struct ipc_ring_hdr *hdr = __ring_hdr(ring);
+    struct ipc_ring_slot *slot;
+    uint64_t pos, seq;
+    int64_t diff;
+
+    if (send_len > ring->msg_size)
+        return -EINVAL;
+
+    pos = __atomic_load_n(&hdr->head, __ATOMIC_RELAXED);
+    for (;;) {
+        slot = __ring_slot(ring, pos);
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        diff = (int64_t)(seq - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&hdr->head,
+                                            &pos,
+                                            pos + 1,
+                                            true,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            return -EAGAIN;
+        } else {
+            pos = __atomic_load_n(&hdr->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    memcpy(slot->data, send_buf, send_len);
+    slot->len = send_len;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    /* Pairs with the fence in ipc_ring_receive */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&hdr->sleeping, __ATOMIC_RELAXED)
+        && __atomic_exchange_n(&hdr->sleeping, 0, __ATOMIC_ACQ_REL))
+        return usys_tee_msg_ring_notify(ring->channel);
+
+    return 0;
+}
+
+/* Pop one message from the rings of @set in turn. Called by the server. */
+static int __ring_set_pop(struct ipc_ring_set *set, void *recv_buf,
+                          size_t recv_len, struct src_msginfo *info)
+{
+    struct ipc_ring *ring;
+    uint32_t i, index;
+
+    for (i = 0; i < set->nr_rings; i++) {
+        index = (set->next + i) % set->nr_rings;
+        ring = &set->rings[index];
+        if (__ring_pop(ring, recv_buf, recv_len, info) == 0) {
+            set->next = index + 1;
+            return 0;
+        }
+        if (__atomic_load_n(&__ring_hdr(ring)->closed, __ATOMIC_ACQUIRE)
+            && __ring_empty(ring)) {
+            __ring_release(set, index);
+            /* The last ring is moved to index */
+            i--;
+        }
+    }
+
+    return -EAGAIN;
+}
+
+/* Pop one message from the rings of @set, accepting new rings if needed */
+static int __ring_set_receive_nowait(struct ipc_ring_set *set, void *recv_buf,
+                                     size_t recv_len, struct src_msginfo *info)
+{
+    do {
+        if (__ring_set_pop(set, recv_buf, recv_len, info) == 0)
+            return 0;
+    } while (__ring_accept(set) > 0);
+
+    return -EAGAIN;
+}
+
+/* Raise or clear `sleeping` of all the rings, return whether all are empty */
+static bool __ring_set_sleep(struct ipc_ring_set *set, uint32_t sleeping)
+{
+    uint32_t i;
+    bool empty = true;
+
+    for (i = 0; i < set->nr_rings; i++)
+        __atomic_store_n(
+            &__ring_hdr(&set->rings[i])->sleeping, sleeping, __ATOMIC_RELAXED);
+    if (!sleeping)
+        return true;
+
+    /* Pairs with the fence in ipc_ring_notification */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (i = 0; i < set->nr_rings && empty; i++)
+        empty = __ring_empty(&set->rings[i])
+                && !__atomic_load_n(&__ring_hdr(&set->rings[i])->closed,
+                                    __ATOMIC_RELAXED);
+    return empty;
+}
+
+/* A receiver stops waiting for doorbells, called with set->lock held */
+static void __ring_set_exit_sleep(struct ipc_ring_set *set)
+{
+    if (--set->nr_sleepers == 0)
+        __ring_set_sleep(set, 0);
+}
+
+/*
+ * A receiver is going to wait for doorbells, called with set->lock held.
+ * Return false if the rings are not empty anymore, so it should not wait.
+ */
+static bool __ring_set_enter_sleep(struct ipc_ring_set *set)
+{
+    set->nr_sleepers++;
+    if (__ring_set_sleep(set, 1))
+        return true;
+    /* A doorbell may be rung anyway, which only costs a retry */
+    __ring_set_exit_sleep(set);
+    return false;
+}
+
+/*
+ * ipc_ring_receive at the rings of the channel, called by the server.
+ * @set: the rings of the channel
+ * @recv_buf: the buffer to be filled in with client's message
+ * @recv_len: length of the recv buffer
+ * @info: the info of the message, i.e., the client owning the ring
+ * @timeout: OS_NO_WAIT, OS_WAIT_FOREVER, or the longest time (in ms) to wait
+ *           for each doorbell
+ *
+ * Messages already in the rings are returned without entering the kernel.
+ * Return:
+ *      0: success
+ *      E_EX_TIMER_TIMEOUT: the rings are empty and @timeout expires
+ *      errno: fail
+ */
+int32_t ipc_ring_receive(struct ipc_ring_set *set, void *recv_buf,
+                         size_t recv_len, struct src_msginfo *info,
+                         int32_t timeout)
+{
+    int ret;
+
+    pthread_mutex_lock(&set->lock);
+    for (;;) {
+        if (__ring_set_receive_nowait(set, recv_buf, recv_len, info) == 0) {
+            ret = 0;
+            break;
+        }
+        if (timeout == OS_NO_WAIT) {
+            ret = E_EX_TIMER_TIMEOUT;
+            break;
+        }
+        if (!__ring_set_enter_sleep(set))
+            continue;
+
+        pthread_mutex_unlock(&set->lock);
+        ret = usys_tee_msg_ring_wait(set->channel, timeout);
+        pthread_mutex_lock(&set->lock);
+        __ring_set_exit_sleep(set);
+        if (ret < 0 || ret == E_EX_TIMER_TIMEOUT)
+            break;
+    }
+    pthread_mutex_unlock(&set->lock);
+
+    return ret;
+}
+
+/*
+ * Rings behind ipc_msg_notification and ipc_msg_receive.
+ *
+ * Servers look up the ring set of a channel in __ring_sets. A set is never
+ * freed, so that a receiver racing with ipc_ring_disable only finds it
+ * empty; the slot is reused by the next ipc_ring_enable.
+ *
+ * Each client thread attaches a ring to a channel on its first notification,
+ * and keeps using it, or the kernel if the attach fails, so that its
+ * notifications to the channel are received in order.
+ */
+#define IPC_RING_MAX_SETS    8
+#define IPC_RING_CACHE_SIZE  4
+#define IPC_RING_CACHE_SLOTS 64
+
+static struct ipc_ring_set *__ring_sets[IPC_RING_MAX_SETS];
+/* Channel of each set, 0 if the slot is free */
+static cref_t __ring_set_channels[IPC_RING_MAX_SETS];
+static pthread_mutex_t __ring_sets_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct ipc_ring_cache_ent {
+    cref_t channel;
+    bool attached;
+    struct ipc_ring ring;
+};
+
+struct ipc_ring_cache {
+    unsigned long gen;
+    uint32_t nr_ents;
+    struct ipc_ring_cache_ent ents[IPC_RING_CACHE_SIZE];
+};
+
+static pthread_key_t __ring_cache_key;
+static pthread_once_t __ring_cache_once = PTHREAD_ONCE_INIT;
+static bool __ring_cache_ready;
+/* Bumped by ipc_ring_forget_channels */
+static unsigned long __ring_cache_gen;
+
+static struct ipc_ring_set *__ring_set_of(cref_t channel)
+{
+    int i;
+
+    for (i = 0; i < IPC_RING_MAX_SETS; i++)
+        if (__atomic_load_n(&__ring_set_channels[i], __ATOMIC_ACQUIRE)
+            == channel)
+            return __ring_sets[i];
+    return NULL;
+}
+
+/*
+ * Enable the rings of a channel created by ipc_create_channel.
+ * Return:
+ *      0: success
+ *      -ENOSPC: too many channels have rings
+ *      errno: fail
+ */
+int32_t ipc_ring_enable(cref_t channel)
+{
+    struct ipc_ring_set *set;
+    int i, ret;
+
+    pthread_mutex_lock(&__ring_sets_lock);
+    for (i = 0; i < IPC_RING_MAX_SETS; i++)
+        if (__ring_set_channels[i] == 0)
+            break;
+    if (i == IPC_RING_MAX_SETS) {
+        ret = -ENOSPC;
+        goto out_unlock;
+    }
+
+    set = __ring_sets[i];
+    if (set == NULL) {
+        set = malloc(sizeof(*set));
+        if (set == NULL) {
+            ret = -ENOMEM;
+            goto out_unlock;
+        }
+        ret = ipc_ring_create(channel, set);
+        if (ret != 0) {
+            free(set);
+            goto out_unlock;
+        }
+        __ring_sets[i] = set;
+    } else {
+        /* A receiver of the disabled channel may still hold the lock */
+        pthread_mutex_lock(&set->lock);
+        ret = __ring_set_reset(channel, set);
+        pthread_mutex_unlock(&set->lock);
+    }
+
+    if (ret == 0)
+        __atomic_store_n(&__ring_set_channels[i], channel, __ATOMIC_RELEASE);
+
+out_unlock:
+    pthread_mutex_unlock(&__ring_sets_lock);
+    return ret;
+}
+
+/* Drop the rings of a channel removed by ipc_remove_channel */
+void ipc_ring_disable(cref_t channel)
+{
+    struct ipc_ring_set *set;
+    int i;
+
+    pthread_mutex_lock(&__ring_sets_lock);
+    for (i = 0; i < IPC_RING_MAX_SETS; i++) {
+        if (__ring_set_channels[i] != channel)
+            continue;
+        __atomic_store_n(&__ring_set_channels[i], 0, __ATOMIC_RELEASE);
+        set = __ring_sets[i];
+        pthread_mutex_lock(&set->lock);
+        ipc_ring_destroy(set);
+        pthread_mutex_unlock(&set->lock);
+        break;
+    }
+    pthread_mutex_unlock(&__ring_sets_lock);
+}
+
+/* Wait until the server has consumed all the messages in @ring */
+static int __ring_flush(struct ipc_ring *ring)
+{
+    int ret;
+
+    while (!__ring_drained(ring)) {
+        /* Also fails if the server is gone */
+        ret = usys_tee_msg_ring_notify(ring->channel);
+        if (ret < 0)
+            return ret;
+        usys_yield();
+    }
+    return 0;
+}
+
+static void __ring_cache_clear(struct ipc_ring_cache *cache)
+{
+    struct ipc_ring_cache_ent *ent;
+    uint32_t i;
+
+    for (i = 0; i < cache->nr_ents; i++) {
+        ent = &cache->ents[i];
+        if (!ent->attached)
+            continue;
+        /* Messages of a new ring may be received before the old ones */
+        __ring_flush(&ent->ring);
+        ipc_ring_detach(&ent->ring);
+    }
+    cache->nr_ents = 0;
+}
+
+static void __ring_cache_destroy(void *arg)
+{
+    __ring_cache_clear(arg);
+    free(arg);
+}
+
+static void __ring_cache_init(void)
+{
+    __ring_cache_ready =
+        pthread_key_create(&__ring_cache_key, __ring_cache_destroy) == 0;
+}
+
+static struct ipc_ring_cache *__ring_cache(void)
+{
+    struct ipc_ring_cache *cache;
+    unsigned long gen;
+
+    pthread_once(&__ring_cache_once, __ring_cache_init);
+    if (!__ring_cache_ready)
+        return NULL;
+
+    gen = __atomic_load_n(&__ring_cache_gen, __ATOMIC_ACQUIRE);
+    cache = pthread_getspecific(__ring_cache_key);
+    if (cache == NULL) {
+        cache = calloc(1, sizeof(*cache));
+        if (cache == NULL)
+            return NULL;
+        if (pthread_setspecific(__ring_cache_key, cache) != 0) {
+            free(cache);
+            return NULL;
+        }
+        cache->gen = gen;
+    } else if (cache->gen != gen) {
+        __ring_cache_clear(cache);
+        cache->gen = gen;
+    }
+    return cache;
+}
+
+/*
+ * Find the ring of the calling thread to @channel. If @attach, the first
+ * lookup of a channel tries to attach one, and the result sticks.
+ */
+static struct ipc_ring *__ring_of(cref_t channel, bool attach)
+{
+    struct ipc_ring_cache *cache;
+    struct ipc_ring_cache_ent *ent;
+    uint32_t i;
+
+    cache = __ring_cache();
+    if (cache == NULL)
+        return NULL;
+
+    for (i = 0; i < cache->nr_ents; i++) {
+        ent = &cache->ents[i];
+        if (ent->channel == channel)
+            return ent->attached ? &ent->ring : NULL;
+    }
+    if (!attach || cache->nr_ents == IPC_RING_CACHE_SIZE)
+        return NULL;
+
+    ent = &cache->ents[cache->nr_ents++];
+    ent->channel = channel;
+    ent->attached = ipc_ring_attach(channel,
+                                    IPC_RING_CACHE_SLOTS,
+                                    NOTIFY_MAX_LEN,
+                                    &ent->ring)
+                    == 0;
+    return ent->attached ? &ent->ring : NULL;
+}
+
+void ipc_ring_forget_channels(void)
+{
+    __atomic_add_fetch(&__ring_cache_gen, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Wait until the notifications of the calling thread in its ring to @channel
+ * are received, so that a message sent through the kernel next is not
+ * received before them.
+ */
+int32_t ipc_ring_flush(cref_t channel)
+{
+    struct ipc_ring *ring;
+
+    ring = __ring_of(channel, false);
+    if (ring == NULL)
+        return 0;
+    return __ring_flush(ring);
+}
+
+/*
+ * Send a notification through the ring of the calling thread to @channel.
+ * Return:
+ *      0: success
+ *      -ENOENT: send it through the kernel instead
+ *      errno: fail
+ */
+int32_t ipc_ring_try_notification(cref_t channel, const void *send_buf,
+                                  size_t send_len)
+{
+    struct ipc_ring *ring;
+    int ret;
+
+    ring = __ring_of(channel, true);
+    if (ring == NULL)
+        return -ENOENT;
+
+    if (send_len > ring->msg_size) {
+        ret = __ring_flush(ring);
+        return ret < 0 ? ret : -ENOENT;
+    }
+
+    /* Like the kernel msg_queue, a full ring never drops a notification */
+    while ((ret = ipc_ring_notification(ring, send_buf, send_len))
+           == -EAGAIN) {
+        ret = usys_tee_msg_ring_notify(channel);
+        if (ret < 0)
+            return ret;
+        usys_yield();
+    }
+    return ret;
+}
+
+/*
+ * Receive a message from the rings of @channel, or from the kernel if they
+ * are empty. A doorbell rung while waiting in the kernel sends the receiver
+ * back to the rings.
+ * Return:
+ *      -ENOENT: @channel has no rings, receive from the kernel instead
+ *      others: as ipc_msg_receive
+ */
+int32_t ipc_ring_try_receive(cref_t channel, void *recv_buf, size_t recv_len,
+                             cref_t msg_hdl, struct src_msginfo *info,
+                             int32_t timeout)
+{
+    struct ipc_ring_set *set;
+    bool sleeping;
+    int ret;
+
+    set = __ring_set_of(channel);
+    if (set == NULL)
+        return -ENOENT;
+
+    pthread_mutex_lock(&set->lock);
+    for (;;) {
+        if (__ring_set_receive_nowait(set, recv_buf, recv_len, info) == 0) {
+            ret = 0;
+            break;
+        }
+        sleeping = false;
+        if (timeout != OS_NO_WAIT) {
+            if (!__ring_set_enter_sleep(set))
+                continue;
+            sleeping = true;
+        }
+
+        pthread_mutex_unlock(&set->lock);
+        ret = usys_tee_msg_receive(
+            channel, recv_buf, recv_len, msg_hdl, info, timeout);
+        pthread_mutex_lock(&set->lock);
+        if (sleeping)
+            __ring_set_exit_sleep(set);
+        if (ret != E_EX_RING_DOORBELL)
+            break;
+    }
+    pthread_mutex_unlock(&set->lock);
+
+    return ret;
+}
@@ -397,6 +397,8 @@ int32_t ipc_create_channel(const char *name, int32_t ch_cnt, cref_t *pp_ch[],
         if (pp_ch) {
             *pp_ch[i] = chan[i];
         }
+        /* Without rings, notifications just go through the kernel */
+        ipc_ring_enable(chan[i]);
     }
 
     return 0;
@@ -456,6 +458,8 @@ int32_t ipc_remove_channel(uint32_t task_id, const char *name, int32_t ch_num,
     if (ret != 0) {
         goto out;
     }
+    ipc_ring_disable(ch);
+    ipc_ring_forget_channels();
 
     if ((ch_num == 0 || ch_num == 1) && task_id == get_self_taskid()) {
         __ipc_tls.channel[ch_num] = 0;
@@ -482,6 +486,7 @@ uint32_t ipc_release_from_path(const char *path, cref_t rref)
     int ret;
 
     ret = usys_revoke_cap(rref, false);
+    ipc_ring_forget_channels();
 
     return ret;
 }
@@ -510,6 +515,7 @@ uint32_t ipc_release_from_taskid(uint32_t task_id, int32_t ch_num)
     usys_revoke_cap(entry->cap, false);
     htable_del(&entry->task2cap_node);
     free(entry);
+    ipc_ring_forget_channels();
 
 out:
     pthread_mutex_unlock(&task2cap->lock);
@@ -654,6 +660,11 @@ int32_t ipc_msg_call(cref_t channel, void *send_buf, size_t send_len,
 {
     int ret;
 
+    /* Let the notifications sent before be received first */
+    ret = ipc_ring_flush(channel);
+    if (ret < 0)
+        return ret;
+
     ret = usys_tee_msg_call(
         channel, send_buf, send_len, reply_buf, reply_len, NULL);
 
@@ -689,7 +700,9 @@ int32_t ipc_msg_reply(cref_t msg_hdl, void *reply_buf, size_t len)
  * @send_len: length of the send buffer
  *
  * ipc_msg_notification sends message asynchronously to the given channel, which
- * will not block current thread at all.
+ * will not block current thread at all. Notifications to a channel created by
+ * ipc_create_channel go through a ring of the calling thread when possible,
+ * so that the kernel is entered only to wake up the server.
  * Return:
  *      0: success
  *      errno: fail
@@ -698,6 +711,10 @@ int32_t ipc_msg_notification(cref_t ch, void *send_buf, size_t send_len)
 {
     int ret;
 
+    ret = ipc_ring_try_notification(ch, send_buf, send_len);
+    if (ret != -ENOENT)
+        return ret;
+
     ret = usys_tee_msg_notify(ch, send_buf, send_len);
 
     return ret;
@@ -712,7 +729,8 @@ int32_t ipc_msg_notification(cref_t ch, void *send_buf, size_t send_len)
  * @info: the info(client's taskid, message type(sync or async)) of the ipc
  * @timeout: timeout
  *
- * Current server thread will wait for message.
+ * Current server thread will wait for message. Messages in the rings of the
+ * channel and in the kernel are received alike.
  * Return:
  *      0: success
  *      errno: fail
@@ -723,6 +741,11 @@ int32_t ipc_msg_receive(cref_t channel, void *recv_buf, size_t recv_len,
 {
     int ret;
 
+    ret = ipc_ring_try_receive(
+        channel, recv_buf, recv_len, msg_hdl, info, timeout);
+    if (ret != -ENOENT)
+        return ret;
+
     ret = usys_tee_msg_receive(
         channel, recv_buf, recv_len, msg_hdl, info, timeout);
 
@@ -177,6 +177,10 @@
 #define CHCORE_SYS_create_notifc 130
 #define CHCORE_SYS_wait          131
 #define CHCORE_SYS_notify        132
+/* - futex */
+#define CHCORE_SYS_futex_wait    133
+#define CHCORE_SYS_futex_wake    134
+#define CHCORE_SYS_futex_requeue 135
 
 #ifdef CHCORE_OH_TEE
 /* - oh-tee-ipc */
@@ -188,6 +192,11 @@
 #define CHCORE_SYS_tee_msg_call    144
 #define CHCORE_SYS_tee_msg_reply   145
 #define CHCORE_SYS_tee_msg_notify  146
+
+#define CHCORE_SYS_tee_msg_attach_ring 147
+#define CHCORE_SYS_tee_msg_ring_notify 148
+#define CHCORE_SYS_tee_msg_ring_wait   149
+#define CHCORE_SYS_tee_msg_ring_accept 139
 #endif /* CHCORE_OH_TEE */
 
 /* Exception */
@@ -40,8 +40,24 @@ typedef struct ipc_struct {
     /* A spin lock: used to coordinate the access to shared memory */
     volatile int lock;
     enum system_server_identifier server_id;
+
+    /*
+     * Multi-slot connection: nr_slots connections to the same server, each
+     * with its own shadow thread and shm. Up to nr_slots threads can call
+     * the server concurrently. slots is NULL for a single-slot connection.
+     */
+    unsigned int nr_slots;
+    struct ipc_struct *slots;
+    /*
+     * Contention of a multi-slot connection: the calls finding their
+     * preferred slot busy, and the yields because all the slots were busy.
+     */
+    unsigned long nr_slot_busy;
+    unsigned long nr_slot_waits;
 } ipc_struct_t;
 
+#define IPC_MAX_SLOTS 16
+
 extern cap_t fsm_server_cap;
 extern cap_t lwip_server_cap;
 extern cap_t procmgr_server_cap;
@@ -101,6 +117,8 @@ typedef void (*server_destructor)(badge_t);
 
 /* Registeration interfaces */
 ipc_struct_t *ipc_register_client(cap_t server_thread_cap);
+ipc_struct_t *ipc_register_client_slots(cap_t server_thread_cap,
+                                        unsigned int nr_slots);
 
 void *register_cb(void *ipc_handler);
 void *register_cb_single(void *ipc_handler);
@@ -16,6 +16,7 @@
 #include <chcore/type.h>
 #include <stdio.h>
 #include <chcore/memory.h>
+#include <chcore/thread.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -71,7 +72,8 @@ void usys_get_mem_usage_msg(void);
 void usys_perf_start(void);
 void usys_perf_end(void);
 void usys_perf_null(void);
-void usys_top(void);
+int usys_top(struct top_cpu_info *cpu_buf, unsigned int nr_cpus,
+             struct top_thread_info *thread_buf, unsigned int nr_threads);
 
 int usys_user_fault_register(cap_t notific_cap, vaddr_t msg_buffer);
 int usys_user_fault_map(badge_t client_badge, vaddr_t fault_va,
@@ -89,6 +91,9 @@ int usys_irq_stop(cap_t irq_cap);
 cap_t usys_create_notifc(void);
 int usys_wait(cap_t notifc_cap, bool is_block, void *timeout);
 int usys_notify(cap_t notifc_cap);
+int usys_futex_wait(int *uaddr, int val, void *timeout, int **uaddr_ptr);
+int usys_futex_wake(int *uaddr, int nr_wake);
+int usys_futex_requeue(int *uaddr, int *uaddr2, int nr_wake, int nr_requeue);
 void usys_cache_config(unsigned long option);
 
 #ifdef CHCORE_OH_TEE
@@ -113,6 +118,10 @@ int usys_tee_msg_call(cap_t channel_cap, void *send_buf, size_t send_len,
                       void *recv_buf, size_t recv_len, void *timeout);
 int usys_tee_msg_reply(cap_t msg_hdl_cap, void *reply_buf, size_t reply_len);
 int usys_tee_msg_notify(cap_t channel_cap, void *send_buf, size_t send_len);
+int usys_tee_msg_attach_ring(cap_t channel_cap, cap_t pmo_cap);
+int usys_tee_msg_ring_notify(cap_t channel_cap);
+int usys_tee_msg_ring_wait(cap_t channel_cap, int timeout);
+cap_t usys_tee_msg_ring_accept(cap_t channel_cap, void *info);
 #endif /* CHCORE_OH_TEE */
 
 int usys_register_recycle_thread(cap_t cap, unsigned long buffer);
@@ -33,6 +33,32 @@ struct thread_args {
     unsigned int type;
 };
 
+/*
+ * Snapshot returned by usys_top (the same as the kernel).
+ * All the times are in nanoseconds.
+ */
+#define TOP_NAME_LEN 32
+
+struct top_cpu_info {
+    unsigned long nr_switches;
+    unsigned long idle_time;
+    unsigned long max_wakeup_latency;
+    unsigned long avg_wakeup_latency;
+};
+
+struct top_thread_info {
+    badge_t badge;
+    unsigned int type;
+    unsigned int state;
+    unsigned int prio;
+    unsigned int cpuid;
+    unsigned long runtime;
+    unsigned long nr_switches;
+    unsigned long max_wakeup_latency;
+    unsigned long avg_wakeup_latency;
+    char name[TOP_NAME_LEN];
+};
+
 #ifdef __cplusplus
 }
 #endif
@@ -134,7 +134,10 @@ again:
         }
 
         ret = sizeof(uint64_t);
-        goto out;
+        chcore_spin_unlock(&efdp->efd_lock);
+        /* Writers blocked in poll/epoll may proceed now */
+        fd_notify_pollers(fd);
+        return ret;
     }
 
     /* Slow Path */
@@ -197,7 +200,10 @@ again:
         }
         BUG_ON(ret != 0);
         ret = sizeof(uint64_t);
-        goto out;
+        chcore_spin_unlock(&efdp->efd_lock);
+        /* Readers blocked in poll/epoll may proceed now */
+        fd_notify_pollers(fd);
+        return ret;
     }
 
     /* Slow Path */
@@ -250,6 +256,8 @@ static int chcore_eventfd_poll(int fd, struct pollarg *arg)
         mask |= efdp->efd_val < 0xfffffffffffffffe ? POLLOUT | POLLWRNORM : 0;
     }
 
+    /* Both read and write call fd_notify_pollers on changing efd_val */
+    arg->ready_ns = POLL_READY_NOTIFY;
     return mask;
 }
 
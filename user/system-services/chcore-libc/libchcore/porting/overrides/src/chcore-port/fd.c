@@ -64,6 +64,7 @@ int alloc_fd_since(int min)
     }
     /* Init fd_desc structure */
     memset(new_desc, 0, sizeof(struct fd_desc));
+    init_list_head(&new_desc->poll_hooks);
     /* Set default operation */
     new_desc->fd_op = &default_ops;
 
@@ -102,6 +103,7 @@ out_free_new_desc:
 /* XXX Concurrent problem */
 void free_fd(int fd)
 {
+    fd_detach_pollers(fd_dic[fd]);
     free(fd_dic[fd]);
     fd_dic[fd] = 0;
 }
@@ -78,6 +78,10 @@ struct fd_desc {
 
     /* Private data of fd */
     void *private_data;
+
+    /* Hooks of poll/epoll waiting on this fd, see fd_notify_pollers */
+    int volatile poll_lock;
+    struct list_head poll_hooks;
 };
 
 extern struct fd_desc *fd_dic[MAX_FD];
@@ -30,53 +30,38 @@ int cwd_len;
 
 /* For client side mounted fs metadata */
 cap_t mounted_fs_cap[MAX_MOUNT_ID] = {-1};
-pthread_key_t mounted_fs_key;
+
+/*
+ * Connections to the mounted fs, shared by all the threads of the process.
+ * Each has MOUNTED_FS_IPC_SLOTS slots, so that many threads can call the
+ * same fs concurrently without each registering its own connection. They
+ * are recycled with the process: the fs server drops all the files of a
+ * client once one of its connections is closed.
+ */
+static ipc_struct_t *mounted_fs_ipc_struct[MAX_MOUNT_ID];
+static pthread_mutex_t mounted_fs_ipc_lock = PTHREAD_MUTEX_INITIALIZER;
 
 ipc_struct_t *get_ipc_struct_by_mount_id(int mount_id)
 {
-    ipc_struct_t **mounted_fs_ipc_struct;
     ipc_struct_t *res;
 
-    /* Get thread local  */
-    mounted_fs_ipc_struct = pthread_getspecific(mounted_fs_key);
-    if (!mounted_fs_ipc_struct) {
-        mounted_fs_ipc_struct =
-            calloc(1, MAX_MOUNT_ID * sizeof(ipc_struct_t *));
-        BUG_ON(!mounted_fs_ipc_struct);
-        pthread_setspecific(mounted_fs_key, mounted_fs_ipc_struct);
-    }
-
-    /* Find thread local ipc struct, register one if it's not existed */
-    if (!mounted_fs_ipc_struct[mount_id]) {
-        mounted_fs_ipc_struct[mount_id] =
-            ipc_register_client(mounted_fs_cap[mount_id]);
-        BUG_ON(!mounted_fs_ipc_struct[mount_id]);
-    }
+    res = __atomic_load_n(&mounted_fs_ipc_struct[mount_id], __ATOMIC_ACQUIRE);
+    if (res)
+        return res;
 
+    /* Register one if it's not existed */
+    pthread_mutex_lock(&mounted_fs_ipc_lock);
     res = mounted_fs_ipc_struct[mount_id];
-
-    /* Do sanity check here. */
-    BUG_ON(!res);
-    return res;
-}
-
-void disconnect_mounted_fs(void)
-{
-    int i;
-    ipc_struct_t **mounted_fs_ipc_struct;
-    /* Get thread local  */
-    mounted_fs_ipc_struct = pthread_getspecific(mounted_fs_key);
-    if (!mounted_fs_ipc_struct) {
-        return;
-    }
-
-    for (i = 0; i < MAX_MOUNT_ID; i++) {
-        if (mounted_fs_ipc_struct[i]) {
-            ipc_client_close_connection(mounted_fs_ipc_struct[i]);
-        }
+    if (!res) {
+        res = ipc_register_client_slots(mounted_fs_cap[mount_id],
+                                        MOUNTED_FS_IPC_SLOTS);
+        BUG_ON(!res);
+        __atomic_store_n(
+            &mounted_fs_ipc_struct[mount_id], res, __ATOMIC_RELEASE);
     }
+    pthread_mutex_unlock(&mounted_fs_ipc_lock);
 
-    free(mounted_fs_ipc_struct);
+    return res;
 }
 
 /*
@@ -228,8 +213,7 @@ struct fsm_request *fsm_parse_path_forward(ipc_msg_t *ipc_msg,
 
     assert(mounted_fs_cap[mount_id] > 0);
 
-    /* Call this for initialize tls ipc data, and we don't need return value
-     */
+    /* Connect to the mounted fs now, and we don't need return value */
     get_ipc_struct_by_mount_id(mount_id);
 
     return fsm_req;
@@ -239,8 +223,6 @@ struct fsm_request *fsm_parse_path_forward(ipc_msg_t *ipc_msg,
 
 void init_fs_client_side(void)
 {
-    pthread_key_create(&mounted_fs_key, NULL);
-
     /* Initialize cwd as ROOT */
     cwd_path[0] = '/';
     cwd_path[1] = '\0';
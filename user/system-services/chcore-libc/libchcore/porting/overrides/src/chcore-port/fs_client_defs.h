@@ -36,11 +36,11 @@ extern int cwd_len;
 /* ++++++++++++++++++++++++ Client IPC Pool +++++++++++++++++++++++++++++++ */
 
 #define MAX_MOUNT_ID 32
+/* Concurrent calls to one mounted fs from a process */
+#define MOUNTED_FS_IPC_SLOTS 4
 extern cap_t mounted_fs_cap[MAX_MOUNT_ID];
-extern pthread_key_t mounted_fs_key;
 
 ipc_struct_t *get_ipc_struct_by_mount_id(int mount_id);
-void disconnect_mounted_fs(void);
 
 /* ++++++++++++++++++++++++ File Descriptor Extension +++++++++++++++++++++ */
 
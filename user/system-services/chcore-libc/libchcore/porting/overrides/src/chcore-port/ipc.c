@@ -61,6 +61,33 @@ static int disconnect_system_servers();
 
 /* Interfaces for operate the ipc message (begin here) */
 
+/*
+ * Grab a free slot of a multi-slot connection. Start from a per-thread slot
+ * so that concurrent threads usually do not contend on the same one.
+ */
+static ipc_struct_t *ipc_grab_slot(ipc_struct_t *icb)
+{
+    unsigned int i, start;
+    ipc_struct_t *slot;
+
+    start = (unsigned int)__pthread_self()->tid % icb->nr_slots;
+    slot = &icb->slots[start];
+    if (chcore_spin_trylock(&slot->lock) == 0)
+        return slot;
+    __atomic_fetch_add(&icb->nr_slot_busy, 1, __ATOMIC_RELAXED);
+
+    while (1) {
+        for (i = 1; i <= icb->nr_slots; i++) {
+            slot = &icb->slots[(start + i) % icb->nr_slots];
+            if (chcore_spin_trylock(&slot->lock) == 0)
+                return slot;
+        }
+        /* All the slots are in use */
+        __atomic_fetch_add(&icb->nr_slot_waits, 1, __ATOMIC_RELAXED);
+        usys_yield();
+    }
+}
+
 ipc_msg_t *ipc_create_msg(ipc_struct_t *icb, unsigned int data_len)
 {
     return ipc_create_msg_with_cap(icb, data_len, 0);
@@ -83,7 +110,10 @@ ipc_msg_t *ipc_create_msg_with_cap(ipc_struct_t *icb, unsigned int data_len,
     }
 
     /* Grab the ipc lock before setting ipc msg */
-    chcore_spin_lock(&(icb->lock));
+    if (icb->slots != NULL)
+        icb = ipc_grab_slot(icb);
+    else
+        chcore_spin_lock(&(icb->lock));
 
     /* The ips_msg metadata is at the beginning of the memory */
     buf_len = icb->shared_buf_len - sizeof(ipc_msg_t);
@@ -404,6 +434,8 @@ ipc_struct_t *ipc_register_client(cap_t server_thread_cap)
     client_ipc_struct->shared_buf = shm_config.shm_addr;
     client_ipc_struct->shared_buf_len = IPC_PER_SHM_SIZE;
     client_ipc_struct->conn_cap = conn_cap;
+    client_ipc_struct->nr_slots = 0;
+    client_ipc_struct->slots = NULL;
 
     return client_ipc_struct;
 
@@ -417,7 +449,7 @@ out_free_client_ipc_struct:
     return NULL;
 }
 
-int ipc_client_close_connection(ipc_struct_t *ipc_struct)
+static int __ipc_client_close_connection(ipc_struct_t *ipc_struct)
 {
     int ret;
     while (1) {
@@ -426,16 +458,103 @@ int ipc_client_close_connection(ipc_struct_t *ipc_struct)
         if (ret == -EAGAIN) {
             usys_yield();
         } else if (ret < 0) {
-            goto out;
+            return ret;
         } else {
             break;
         }
     }
 
     chcore_free_vaddr(ipc_struct->shared_buf, ipc_struct->shared_buf_len);
+    return 0;
+}
+
+/*
+ * Register a connection with @nr_slots slots, i.e., @nr_slots connections
+ * to the same server which are used by ipc_create_msg in turn. The server
+ * creates one shadow thread for each slot with its register callback
+ * (e.g., register_cb), so a multi-threaded client can issue concurrent
+ * calls without registering a connection for each thread.
+ */
+ipc_struct_t *ipc_register_client_slots(cap_t server_thread_cap,
+                                        unsigned int nr_slots)
+{
+    ipc_struct_t *icb, *slot;
+    unsigned int i;
+
+    if (nr_slots == 0 || nr_slots > IPC_MAX_SLOTS)
+        return NULL;
+
+    icb = malloc(sizeof(*icb));
+    if (icb == NULL)
+        return NULL;
+    icb->slots = calloc(nr_slots, sizeof(*icb->slots));
+    if (icb->slots == NULL)
+        goto out_free_icb;
+
+    for (i = 0; i < nr_slots; i++) {
+        slot = ipc_register_client(server_thread_cap);
+        if (slot == NULL)
+            goto out_close_slots;
+        memcpy(&icb->slots[i], slot, sizeof(*slot));
+        free(slot);
+    }
+
+    /* The connection of the first slot marks icb as connected */
+    icb->conn_cap = icb->slots[0].conn_cap;
+    icb->shared_buf = 0;
+    icb->shared_buf_len = 0;
+    icb->lock = 0;
+    icb->server_id = 0;
+    icb->nr_slots = nr_slots;
+    icb->nr_slot_busy = 0;
+    icb->nr_slot_waits = 0;
+
+    return icb;
+
+out_close_slots:
+    while (i-- > 0)
+        __ipc_client_close_connection(&icb->slots[i]);
+    free(icb->slots);
+out_free_icb:
+    free(icb);
+    return NULL;
+}
+
+/*
+ * Close a connection and free @ipc_struct. No other thread may use it.
+ * A multi-slot connection is only freed once all the slots are closed. On
+ * failure, the slots failing to close are kept in @ipc_struct, which is
+ * left usable with them only, so that closing can be retried. Stopping at
+ * the first failure would leave it with closed slots still to be grabbed.
+ */
+int ipc_client_close_connection(ipc_struct_t *ipc_struct)
+{
+    int ret, err = 0;
+    unsigned int i, nr_left = 0;
+
+    if (ipc_struct->slots != NULL) {
+        for (i = 0; i < ipc_struct->nr_slots; i++) {
+            ret = __ipc_client_close_connection(&ipc_struct->slots[i]);
+            if (ret < 0) {
+                if (err == 0)
+                    err = ret;
+                ipc_struct->slots[nr_left++] = ipc_struct->slots[i];
+            }
+        }
+        if (nr_left > 0) {
+            ipc_struct->nr_slots = nr_left;
+            ipc_struct->conn_cap = ipc_struct->slots[0].conn_cap;
+            return err;
+        }
+        free(ipc_struct->slots);
+    } else {
+        ret = __ipc_client_close_connection(ipc_struct);
+        if (ret < 0)
+            return ret;
+    }
+
     free(ipc_struct);
-out:
-    return ret;
+    return 0;
 }
 
 /* Client uses **ipc_call** to issue an IPC request */
@@ -449,6 +568,10 @@ long ipc_call(ipc_struct_t *icb, ipc_msg_t *ipc_msg)
             return ret;
     }
 
+    /* ipc_msg is in the shm of the slot grabbed by ipc_create_msg */
+    if (icb->slots != NULL)
+        icb = ipc_msg->icb;
+
     do {
         ret = usys_ipc_call(
             icb->conn_cap, (unsigned long)ipc_msg, ipc_msg->cap_slot_number);
@@ -482,8 +605,11 @@ int simple_ipc_forward(ipc_struct_t *ipc_struct, void *data, int len)
     int ret;
 
     ipc_msg = ipc_create_msg(ipc_struct, len);
+    if (ipc_msg == NULL)
+        return -EINVAL;
     ipc_set_msg_data(ipc_msg, data, 0, len);
-    ret = ipc_call(ipc_struct, ipc_msg);
+    /* Call through the connection owning the shm of ipc_msg (maybe a slot) */
+    ret = ipc_call(ipc_msg->icb, ipc_msg);
     ipc_destroy_msg(ipc_msg);
 
     return ret;
@@ -495,6 +621,8 @@ static void ipc_struct_copy(ipc_struct_t *dst, ipc_struct_t *src)
     dst->shared_buf = src->shared_buf;
     dst->shared_buf_len = src->shared_buf_len;
     dst->lock = src->lock;
+    dst->slots = src->slots;
+    dst->nr_slots = src->nr_slots;
 }
 
 static int connect_system_server(ipc_struct_t *ipc_struct)
@@ -559,5 +687,5 @@ int disconnect_system_servers(void)
     disconnect_server(procmgr_ipc_struct);
     disconnect_server(fsm_ipc_struct);
     disconnect_server(lwip_ipc_struct);
-    disconnect_mounted_fs();
+    return 0;
 }
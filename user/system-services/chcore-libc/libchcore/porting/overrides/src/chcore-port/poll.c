@@ -19,6 +19,7 @@
 #include <time.h>
 #include <sys/time.h>
 #include <raw_syscall.h>
+#include <chcore/syscall.h>
 #include <chcore/container/list.h>
 #include <chcore/ipc.h>
 
@@ -43,12 +44,229 @@
         warn(fmt, ##__VA_ARGS__); \
     } while (0)
 
+#define NS_IN_MS (1000000ULL)
+#define NS_IN_S  (1000000000ULL)
+
+/*
+ * How often poll/epoll recheck an fd which cannot notify pollers and does
+ * not know when it becomes ready, e.g., a socket.
+ */
+#define POLL_RECHECK_NS (5 * NS_IN_MS)
+
+/* Flags of epoll_event.events which are not events */
+#define EPOLL_MODE_FLAGS (EPOLLET | EPOLLONESHOT | EPOLLEXCLUSIVE | EPOLLWAKEUP)
+
+static uint64_t poll_now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * NS_IN_S + (uint64_t)now.tv_nsec;
+}
+
+/* Absolute deadline of a timeout in ms, UINT64_MAX if no timeout */
+static uint64_t poll_deadline_ns(int timeout)
+{
+    if (timeout < 0)
+        return UINT64_MAX;
+    return poll_now_ns() + (uint64_t)timeout * NS_IN_MS;
+}
+
+static struct poll_stats poll_stats;
+
+void poll_get_stats(struct poll_stats *stats)
+{
+    stats->nr_waits = __atomic_load_n(&poll_stats.nr_waits, __ATOMIC_RELAXED);
+    stats->nr_notified =
+        __atomic_load_n(&poll_stats.nr_notified, __ATOMIC_RELAXED);
+    stats->nr_rechecks =
+        __atomic_load_n(&poll_stats.nr_rechecks, __ATOMIC_RELAXED);
+}
+
+static inline void poll_stat_inc(unsigned long *stat)
+{
+    __atomic_fetch_add(stat, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Block on notifc_cap until it is notified, deadline_ns passes or an fd has
+ * to be looked at again (scan_deadline_ns).
+ */
+static void poll_wait_notifc(cap_t notifc_cap, uint64_t deadline_ns,
+                             uint64_t scan_deadline_ns)
+{
+    struct timespec ts;
+    uint64_t now_ns, wait_ns;
+    bool recheck = false;
+    int ret;
+
+    if (scan_deadline_ns < deadline_ns) {
+        deadline_ns = scan_deadline_ns;
+        recheck = true;
+    }
+
+    if (deadline_ns == UINT64_MAX) {
+        poll_stat_inc(&poll_stats.nr_waits);
+        ret = usys_wait(notifc_cap, true, NULL);
+    } else {
+        now_ns = poll_now_ns();
+        if (now_ns >= deadline_ns)
+            return;
+        wait_ns = deadline_ns - now_ns;
+        ts.tv_sec = wait_ns / NS_IN_S;
+        ts.tv_nsec = wait_ns % NS_IN_S;
+        poll_stat_inc(&poll_stats.nr_waits);
+        ret = usys_wait(notifc_cap, true, &ts);
+    }
+
+    if (ret == 0)
+        poll_stat_inc(&poll_stats.nr_notified);
+    else if (ret == -ETIMEDOUT && recheck)
+        poll_stat_inc(&poll_stats.nr_rechecks);
+}
+
+/*
+ * When a poll function reports an fd is not ready, it also tells how the fd
+ * becomes ready (see struct pollarg). poll_scan collects the earliest time
+ * that pollers have to look at the fds again.
+ */
+struct poll_scan {
+    uint64_t deadline_ns;
+};
+
+static inline void poll_scan_init(struct poll_scan *scan)
+{
+    scan->deadline_ns = UINT64_MAX;
+}
+
+static void poll_scan_add(struct poll_scan *scan, uint64_t ready_ns)
+{
+    if (ready_ns == POLL_READY_NOTIFY)
+        return;
+    if (ready_ns == POLL_READY_UNKNOWN)
+        ready_ns = poll_now_ns() + POLL_RECHECK_NS;
+    if (ready_ns < scan->deadline_ns)
+        scan->deadline_ns = ready_ns;
+}
+
+/* Poll hooks */
+
+void poll_hook_add(int fd, struct poll_hook *hook, poll_hook_func func)
+{
+    struct fd_desc *desc = fd_dic[fd];
+
+    hook->func = func;
+    chcore_spin_lock(&desc->poll_lock);
+    hook->desc = desc;
+    list_append(&hook->node, &desc->poll_hooks);
+    chcore_spin_unlock(&desc->poll_lock);
+    /* Pairs with fd_notify_pollers: the caller polls the fd after this */
+    a_barrier();
+}
+
+/*
+ * Detach hook from its fd. The fd should not be closed concurrently, which
+ * frees the fd_desc.
+ */
+void poll_hook_del(struct poll_hook *hook)
+{
+    struct fd_desc *desc = hook->desc;
+
+    if (desc == NULL)
+        return;
+
+    chcore_spin_lock(&desc->poll_lock);
+    if (hook->desc == desc) {
+        list_del(&hook->node);
+        hook->desc = NULL;
+    }
+    chcore_spin_unlock(&desc->poll_lock);
+}
+
+/*
+ * Invoked by an fd after it may have become ready, i.e., after the state
+ * checked by its poll function has changed.
+ */
+void fd_notify_pollers(int fd)
+{
+    struct fd_desc *desc = fd_dic[fd];
+    struct poll_hook *hook;
+
+    if (desc == NULL)
+        return;
+
+    /* Pairs with poll_hook_add: the state change is visible to pollers */
+    a_barrier();
+    if (list_empty(&desc->poll_hooks))
+        return;
+
+    chcore_spin_lock(&desc->poll_lock);
+    for_each_in_list (hook, struct poll_hook, node, &desc->poll_hooks)
+        hook->func(hook);
+    chcore_spin_unlock(&desc->poll_lock);
+}
+
+/* Invoked when the fd is freed. Pollers find hook->desc is NULL then. */
+void fd_detach_pollers(struct fd_desc *desc)
+{
+    struct poll_hook *hook, *tmp;
+
+    chcore_spin_lock(&desc->poll_lock);
+    for_each_in_list_safe (hook, tmp, node, &desc->poll_hooks) {
+        list_del(&hook->node);
+        hook->desc = NULL;
+    }
+    chcore_spin_unlock(&desc->poll_lock);
+}
+
+/*
+ * Notification caps used by poll. poll has to create one per thread, so
+ * cache some of them instead of creating one in each call.
+ */
+#define POLL_NOTIFC_CACHE_SIZE 16
+
+static cap_t poll_notifc_cache[POLL_NOTIFC_CACHE_SIZE];
+static int poll_notifc_cnt = 0;
+static int volatile poll_notifc_lock = 0;
+
+static cap_t poll_get_notifc(void)
+{
+    cap_t notifc_cap = -1;
+
+    chcore_spin_lock(&poll_notifc_lock);
+    if (poll_notifc_cnt > 0)
+        notifc_cap = poll_notifc_cache[--poll_notifc_cnt];
+    chcore_spin_unlock(&poll_notifc_lock);
+
+    if (notifc_cap < 0)
+        notifc_cap = chcore_syscall0(CHCORE_SYS_create_notifc);
+    return notifc_cap;
+}
+
+static void poll_put_notifc(cap_t notifc_cap)
+{
+    /* Consume the notifications not waited for */
+    while (usys_wait(notifc_cap, false, NULL) == 0)
+        ;
+
+    chcore_spin_lock(&poll_notifc_lock);
+    if (poll_notifc_cnt < POLL_NOTIFC_CACHE_SIZE) {
+        poll_notifc_cache[poll_notifc_cnt++] = notifc_cap;
+        notifc_cap = -1;
+    }
+    chcore_spin_unlock(&poll_notifc_lock);
+
+    if (notifc_cap >= 0)
+        usys_revoke_cap(notifc_cap, false);
+}
+
 /* epoll operation */
 int chcore_epoll_create1(int flags)
 {
     int epfd = 0, ret = 0;
     struct fd_desc *epoll_fd_desc;
     struct eventpoll *ep = NULL;
+    cap_t notifc_cap;
 
     epfd = alloc_fd();
     if (epfd < 0) {
@@ -60,9 +278,19 @@ int chcore_epoll_create1(int flags)
         ret = -ENOMEM;
         goto fail;
     }
+    if ((notifc_cap = chcore_syscall0(CHCORE_SYS_create_notifc)) < 0) {
+        ret = notifc_cap;
+        goto fail;
+    }
     ep->epi_lock = 0;
     init_list_head(&ep->epi_list);
     ep->wait_count = 0;
+    init_list_head(&ep->watch_list);
+    ep->pass = 0;
+    ep->ready_lock = 0;
+    init_list_head(&ep->ready_list);
+    ep->notifc_cap = notifc_cap;
+    ep->nr_waiters = 0;
 
     epoll_fd_desc = fd_dic[epfd];
     epoll_fd_desc->fd = epfd;
@@ -81,12 +309,86 @@ fail:
     return ret;
 }
 
+/*
+ * Lock order: ep->epi_lock -> fd_desc->poll_lock -> ep->ready_lock.
+ * epi_lock protects the epitems except ready and ready_node, which are
+ * protected by ready_lock as fd_notify_pollers changes them.
+ */
+
+/* Queue epi to be examined. Return true if a waiter should be woken up. */
+static bool ep_mark_ready(struct eventpoll *ep, struct epitem *epi)
+{
+    bool wake = false;
+
+    chcore_spin_lock(&ep->ready_lock);
+    if (!epi->ready) {
+        /* Waiters only sleep with an empty ready_list */
+        wake = list_empty(&ep->ready_list) && ep->nr_waiters > 0;
+        list_append(&epi->ready_node, &ep->ready_list);
+        epi->ready = true;
+    }
+    chcore_spin_unlock(&ep->ready_lock);
+    return wake;
+}
+
+static void ep_poll_hook_func(struct poll_hook *hook)
+{
+    struct epitem *epi = container_of(hook, struct epitem, hook);
+
+    if (ep_mark_ready(epi->ep, epi))
+        usys_notify(epi->ep->notifc_cap);
+}
+
+static void ep_set_watched(struct eventpoll *ep, struct epitem *epi,
+                           bool watched)
+{
+    if (epi->watched == watched)
+        return;
+    if (watched)
+        list_append(&epi->watch_node, &ep->watch_list);
+    else
+        list_del(&epi->watch_node);
+    epi->watched = watched;
+}
+
+static struct epitem *ep_find(struct eventpoll *ep, int fd)
+{
+    struct epitem *epi;
+
+    for_each_in_list (epi, struct epitem, epi_node, &ep->epi_list) {
+        if (epi->fd == fd)
+            return epi;
+    }
+    return NULL;
+}
+
+/* The fd of epi has been closed since it was added */
+static inline bool ep_item_stale(struct epitem *epi)
+{
+    return epi->hook.desc == NULL || epi->hook.desc != fd_dic[epi->fd];
+}
+
+static void ep_remove(struct eventpoll *ep, struct epitem *epi)
+{
+    poll_hook_del(&epi->hook);
+    ep_set_watched(ep, epi, false);
+
+    chcore_spin_lock(&ep->ready_lock);
+    if (epi->ready)
+        list_del(&epi->ready_node);
+    chcore_spin_unlock(&ep->ready_lock);
+
+    list_del(&epi->epi_node);
+    ep->wait_count--;
+    free(epi);
+}
+
 int chcore_epoll_ctl(int epfd, int op, int fd, struct epoll_event *events)
 {
-    struct epitem *epi = NULL, *tmp = NULL;
+    struct epitem *epi = NULL;
     struct eventpoll *ep;
     int ret = 0;
-    int fd_exist = 0;
+    bool wake = false;
 
     /* EINVAL events is NULL */
     if (events == NULL && op != EPOLL_CTL_DEL)
@@ -118,18 +420,26 @@ int chcore_epoll_ctl(int epfd, int op, int fd, struct epoll_event *events)
     if (fd_dic[fd]->fd_op == NULL)
         return -EPERM;
 
+    if (events != NULL && (events->events & (EPOLLEXCLUSIVE | EPOLLWAKEUP)))
+        warn_once("EPOLLEXCLUSIVE and EPOLLWAKEUP not supported!");
+
     chcore_spin_lock(&ep->epi_lock);
+
+    epi = ep_find(ep, fd);
+    /* A closed fd is removed from the epoll instance implicitly */
+    if (epi != NULL && ep_item_stale(epi)) {
+        ep_remove(ep, epi);
+        epi = NULL;
+    }
+
     switch (op) {
     case EPOLL_CTL_ADD:
-        /* Check if already exist */
-        for_each_in_list_safe (epi, tmp, epi_node, &ep->epi_list) {
-            if (epi->fd == fd) {
-                /* EEXIST op was EPOLL_CTL_ADD, and the supplied
-                 * file descriptor fd is already registered with
-                 * this epoll instance. */
-                ret = -EEXIST;
-                goto out;
-            }
+        if (epi != NULL) {
+            /* EEXIST op was EPOLL_CTL_ADD, and the supplied
+             * file descriptor fd is already registered with
+             * this epoll instance. */
+            ret = -EEXIST;
+            goto out;
         }
         if ((epi = malloc(sizeof(*epi))) == NULL) {
             /* ENOMEM There was insufficient memory to handle the
@@ -139,39 +449,35 @@ int chcore_epoll_ctl(int epfd, int op, int fd, struct epoll_event *events)
         }
         epi->fd = fd;
         epi->event = *events;
+        epi->ep = ep;
+        epi->ready = false;
+        epi->watched = false;
+        epi->pass = 0;
         list_append(&epi->epi_node, &ep->epi_list);
         ep->wait_count++;
-        ret = 0;
+        poll_hook_add(fd, &epi->hook, ep_poll_hook_func);
+        /* Examine the fd in the next epoll_wait */
+        wake = ep_mark_ready(ep, epi);
         break;
     case EPOLL_CTL_MOD:
-        /* Check if exist */
-        fd_exist = 0;
-        for_each_in_list_safe (epi, tmp, epi_node, &ep->epi_list) {
-            if (epi->fd == fd) {
-                epi->event = *events; /* Update the event */
-                fd_exist = 1; /* set the flag */
-                break;
-            }
-        }
         /* ENOENT op was EPOLL_CTL_MOD or EPOLL_CTL_DEL, and fd is not
          * registered with this epoll instance. */
-        if (fd_exist == 0)
+        if (epi == NULL) {
             ret = -ENOENT;
+            goto out;
+        }
+        /* Update the event, which also rearms an EPOLLONESHOT fd */
+        epi->event = *events;
+        wake = ep_mark_ready(ep, epi);
         break;
     case EPOLL_CTL_DEL:
-        /* Check if exist */
-        fd_exist = 0;
-        for_each_in_list_safe (epi, tmp, epi_node, &ep->epi_list) {
-            if (epi->fd == fd) {
-                list_del(&epi->epi_node); /* delete the node */
-                fd_exist = 1; /* set the flag */
-                break;
-            }
-        }
         /* ENOENT op was EPOLL_CTL_MOD or EPOLL_CTL_DEL, and fd is not
          * registered with this epoll instance. */
-        if (fd_exist == 0)
+        if (epi == NULL) {
             ret = -ENOENT;
+            goto out;
+        }
+        ep_remove(ep, epi);
         break;
     default:
         /* The requested operation op is not supported by this interface
@@ -181,21 +487,129 @@ int chcore_epoll_ctl(int epfd, int op, int fd, struct epoll_event *events)
 
 out:
     chcore_spin_unlock(&ep->epi_lock);
+    if (wake)
+        usys_notify(ep->notifc_cap);
     return ret;
 }
 
 /*
- * XXX: Convert epoll to poll, which is not efficient as all fds
- * are traserved.
+ * Examine one epitem, and fill in event if it is ready.
+ * Called with ep->epi_lock held. Return true if event is filled in.
+ */
+static bool ep_check_item(struct eventpoll *ep, struct epitem *epi,
+                          struct epoll_event *event, struct poll_scan *scan)
+{
+    struct fd_desc *desc = fd_dic[epi->fd];
+    struct pollarg arg;
+    uint32_t events;
+    int mask;
+
+    epi->pass = ep->pass;
+    events = epi->event.events & ~EPOLL_MODE_FLAGS;
+
+    /* Disabled by EPOLLONESHOT, or the fd has been closed */
+    if (events == 0 || ep_item_stale(epi) || desc->fd_op->poll == NULL) {
+        ep_set_watched(ep, epi, false);
+        return false;
+    }
+
+    arg.events = events;
+    arg.ready_ns = POLL_READY_UNKNOWN;
+    mask = desc->fd_op->poll(epi->fd, &arg);
+    poll_debug("epoll fd %d mask 0x%x\n", epi->fd, mask);
+
+    if (mask < 0) {
+        /* The fd cannot be polled, which will never be ready */
+        ep_set_watched(ep, epi, false);
+        return false;
+    }
+
+    if ((mask & events) == 0) {
+        /* Examine it again on notification or in every pass */
+        ep_set_watched(ep, epi, arg.ready_ns != POLL_READY_NOTIFY);
+        poll_scan_add(scan, arg.ready_ns);
+        return false;
+    }
+
+    event->events = mask;
+    event->data = epi->event.data;
+
+    if (epi->event.events & EPOLLONESHOT) {
+        /* Disabled until rearmed by EPOLL_CTL_MOD */
+        epi->event.events &= EPOLL_MODE_FLAGS;
+        ep_set_watched(ep, epi, false);
+    } else if (epi->watched) {
+        /*
+         * A watched fd is examined in every pass anyway, so EPOLLET
+         * behaves like level-triggered for it. Move it to the tail to
+         * be fair to the others when maxevents is small.
+         */
+        list_del(&epi->watch_node);
+        list_append(&epi->watch_node, &ep->watch_list);
+    } else if (!(epi->event.events & EPOLLET)) {
+        /* Level-triggered: report it until it is not ready */
+        ep_mark_ready(ep, epi);
+    }
+    return true;
+}
+
+/*
+ * Examine the epitems in ready_list and watch_list, and fill in at most
+ * maxevents events. Called with ep->epi_lock held. Return the number of
+ * events.
  */
+static int ep_collect(struct eventpoll *ep, struct epoll_event *events,
+                      int maxevents, struct poll_scan *scan)
+{
+    struct epitem *epi, *tmp;
+    int nr = 0;
+
+    poll_scan_init(scan);
+    ep->pass++;
+
+    /*
+     * Items re-queued in this pass are appended to the tail, so reaching
+     * one of them at the head means all the others have been examined.
+     */
+    while (nr < maxevents) {
+        chcore_spin_lock(&ep->ready_lock);
+        if (list_empty(&ep->ready_list)) {
+            chcore_spin_unlock(&ep->ready_lock);
+            break;
+        }
+        epi = list_entry(ep->ready_list.next, struct epitem, ready_node);
+        if (epi->pass == ep->pass) {
+            chcore_spin_unlock(&ep->ready_lock);
+            break;
+        }
+        list_del(&epi->ready_node);
+        epi->ready = false;
+        chcore_spin_unlock(&ep->ready_lock);
+
+        if (ep_check_item(ep, epi, &events[nr], scan))
+            nr++;
+    }
+
+    for_each_in_list_safe (epi, tmp, watch_node, &ep->watch_list) {
+        if (nr >= maxevents)
+            break;
+        if (epi->pass == ep->pass)
+            continue;
+        if (ep_check_item(ep, epi, &events[nr], scan))
+            nr++;
+    }
+
+    return nr;
+}
+
 int chcore_epoll_pwait(int epfd, struct epoll_event *events, int maxevents,
                        int timeout, const sigset_t *sigmask)
 {
     struct eventpoll *ep;
-    struct epitem *epi = NULL, *tmp = NULL;
-    struct pollfd *fds;
-    epoll_data_t *epdata;
-    int i = 0, ret = 0, ev_idx = 0, nfds = 0;
+    struct poll_scan scan;
+    uint64_t deadline_ns;
+    int ret = 0;
+    bool wake;
     sigset_t origmask;
 
     /* EBADF  epfd or fd is not a valid file descriptor. */
@@ -217,54 +631,42 @@ int chcore_epoll_pwait(int epfd, struct epoll_event *events, int maxevents,
     if (sigmask)
         pthread_sigmask(SIG_SETMASK, sigmask, &origmask);
 
-    chcore_spin_lock(&ep->epi_lock);
-    if ((fds = (struct pollfd *)malloc(ep->wait_count * sizeof(*fds)))
-        == NULL) {
-        chcore_spin_unlock(&ep->epi_lock);
-        return -ENOMEM;
-    }
-    if ((epdata = (epoll_data_t *)malloc(ep->wait_count * sizeof(epoll_data_t)))
-        == NULL) {
-        free(fds);
+    deadline_ns = poll_deadline_ns(timeout);
+
+    while (true) {
+        chcore_spin_lock(&ep->epi_lock);
+        ret = ep_collect(ep, events, maxevents, &scan);
         chcore_spin_unlock(&ep->epi_lock);
-        return -ENOMEM;
-    }
 
-    /* Convert epoll epi_list to fds */
-    /* XXX: can be optimized by using the same format to store epoll_list */
-    nfds = 0; /* index of fds */
-    for_each_in_list_safe (epi, tmp, epi_node, &ep->epi_list) {
-        fds[nfds].fd = epi->fd;
-        /* EPOLLEXCLUSIVE, EPOLLWAKEUP, EPOLLONESHOT and EPOLLET are
-         * special */
-        if (epi->event.events & EPOLLEXCLUSIVE
-            || epi->event.events & EPOLLWAKEUP
-            || epi->event.events & EPOLLONESHOT || epi->event.events & EPOLLET)
-            warn_once("EPOLLEXCLUSIVE, EPOLLWAKEUP, EPOLLONESHOT and "
-                      "EPOLLET not supported!");
-        fds[nfds].events = epi->event.events & ~EPOLLEXCLUSIVE & ~EPOLLWAKEUP
-                           & ~EPOLLONESHOT & ~EPOLLET;
-        /* Copy epdata */
-        epdata[nfds] = epi->event.data;
-        nfds++;
-    }
-    chcore_spin_unlock(&ep->epi_lock);
+        if (ret > 0 || timeout == 0)
+            break;
+        if (deadline_ns != UINT64_MAX && poll_now_ns() >= deadline_ns)
+            break;
 
-    ret = chcore_poll(fds, nfds, timeout);
-    if (ret > 0) {
-        ev_idx = 0; /* index of events */
-        for (i = 0; i < nfds && ev_idx < maxevents; i++) {
-            if ((fds[i].revents & fds[i].events)) {
-                events[ev_idx].events = fds[i].revents;
-                events[ev_idx].data = epdata[i];
-                ev_idx++;
-            }
+        chcore_spin_lock(&ep->ready_lock);
+        if (!list_empty(&ep->ready_list)) {
+            /* Notified after the collection */
+            chcore_spin_unlock(&ep->ready_lock);
+            continue;
         }
+        ep->nr_waiters++;
+        chcore_spin_unlock(&ep->ready_lock);
+
+        poll_wait_notifc(ep->notifc_cap, deadline_ns, scan.deadline_ns);
+
+        chcore_spin_lock(&ep->ready_lock);
+        ep->nr_waiters--;
+        chcore_spin_unlock(&ep->ready_lock);
     }
-    poll_debug("epoll events:%d,%d\n", ret, ev_idx);
-out:
-    free(fds);
-    free(epdata);
+
+    /* Pass the rest of the ready epitems to another waiter */
+    chcore_spin_lock(&ep->ready_lock);
+    wake = !list_empty(&ep->ready_list) && ep->nr_waiters > 0;
+    chcore_spin_unlock(&ep->ready_lock);
+    if (wake)
+        usys_notify(ep->notifc_cap);
+
+    poll_debug("epoll events:%d\n", ret);
     if (sigmask)
         pthread_sigmask(SIG_SETMASK, &origmask, NULL);
     return ret;
@@ -284,13 +686,22 @@ static ssize_t chcore_epoll_write(int fd, void *buf, size_t size)
 
 static int chcore_epoll_close(int fd)
 {
-    
+    struct eventpoll *ep;
+    struct epitem *epi, *tmp;
+
     if (fd < 0 || fd >= MAX_FD || fd_dic[fd] == NULL
         || fd_dic[fd]->type != FD_TYPE_EPOLL
         || fd_dic[fd]->private_data == NULL)
         return -EBADF;
 
-    free(fd_dic[fd]->private_data);
+    ep = fd_dic[fd]->private_data;
+    chcore_spin_lock(&ep->epi_lock);
+    for_each_in_list_safe (epi, tmp, epi_node, &ep->epi_list)
+        ep_remove(ep, epi);
+    chcore_spin_unlock(&ep->epi_lock);
+
+    usys_revoke_cap(ep->notifc_cap, false);
+    free(ep);
     free_fd(fd);
     return 0;
 }
@@ -304,16 +715,98 @@ struct fd_ops epoll_ops = {
     .fcntl = NULL,
 };
 
-int chcore_poll(struct pollfd fds[], nfds_t nfds, int timeout)
+/* A thread blocked in poll, which is woken up by any of its poll_waiters */
+struct poll_wq {
+    cap_t notifc_cap;
+    int volatile woken;
+};
+
+struct poll_waiter {
+    struct poll_hook hook;
+    struct poll_wq *wq;
+};
+
+static void poll_waiter_hook_func(struct poll_hook *hook)
 {
-    unsigned long poll_server_flag = 0; /* Bitmap to record the server */
-    int i, mask, ret;
-    struct pollarg arg;
+    struct poll_waiter *waiter = container_of(hook, struct poll_waiter, hook);
+    struct poll_wq *wq = waiter->wq;
+
+    /* Notify only once for each check of the fds */
+    if (a_cas(&wq->woken, 0, 1) == 0)
+        usys_notify(wq->notifc_cap);
+}
+
+static inline bool poll_fd_valid(int fd)
+{
+    return fd < MAX_FD && fd_dic[fd] != 0 && fd_dic[fd]->fd_op != 0
+           && fd_dic[fd]->fd_op->poll != 0;
+}
+
+/* Check all the fds once. Return the number of ready fds. */
+static int poll_check_fds(struct pollfd fds[], nfds_t nfds,
+                          struct poll_scan *scan)
+{
+    int i, mask;
     int count = 0;
-    int timed_out = 0;
-    cap_t notifc_cap = 0;
-    struct timeval start_time, current_time;
-    long start_ms, current_ms; /* ms */
+    struct pollarg arg;
+
+    poll_scan_init(scan);
+
+    for (i = 0; i < nfds; i++) {
+        /*
+         * The field fd contains a file descriptor for an open
+         * file.  If this field is negative, then the
+         * corresponding events field is ignored and the revents
+         * field returns zero.  (This provides an easy way of
+         * ignoring a file descriptor for a single poll()
+         * call: simply negate the fd field.  Note, however,
+         * that this technique can't be used to ignore file
+         * descriptor 0.)
+         */
+        if (fds[i].fd < 0) {
+            /* False fd, just ignore them */
+            fds[i].revents = 0;
+            continue;
+        }
+
+        /*
+         * Invalid request: fd not open (only returned in
+         * revents; ignored in events). Or target fd does not
+         * support poll function.
+         */
+        if (!poll_fd_valid(fds[i].fd)) {
+            fds[i].revents = POLLNVAL;
+            count++;
+            continue;
+        }
+
+        arg.events = fds[i].events;
+        arg.ready_ns = POLL_READY_UNKNOWN;
+
+        /* Call fd poll function */
+        mask = fd_dic[fds[i].fd]->fd_op->poll(fds[i].fd, &arg);
+        if (mask > 0) {
+            /* Already achieve the requirement */
+            fds[i].revents = mask;
+            count++;
+        } else {
+            fds[i].revents = 0;
+            if (mask == 0)
+                poll_scan_add(scan, arg.ready_ns);
+        }
+        poll_debug("poll fd %d mask 0x%x\n", fds[i].fd, mask);
+    }
+
+    return count;
+}
+
+int chcore_poll(struct pollfd fds[], nfds_t nfds, int timeout)
+{
+    int i, count;
+    struct poll_scan scan;
+    struct poll_wq wq;
+    struct poll_waiter *waiters;
+    uint64_t deadline_ns;
 
     /*
      * EFAULT fds points outside the process's accessible address space.
@@ -338,75 +831,49 @@ int chcore_poll(struct pollfd fds[], nfds_t nfds, int timeout)
 
     poll_debug("Poll nfds:%d fds %p timeout:%d\n", nfds, fds, timeout);
 
-    /* Clear revents */
-    for (i = 0; i < nfds; i++) {
-        fds[i].revents = 0;
+    deadline_ns = poll_deadline_ns(timeout);
+
+    /* Fast path: no need to wait */
+    count = poll_check_fds(fds, nfds, &scan);
+    if (count || timeout == 0)
+        goto out;
+
+    if ((waiters = malloc(nfds * sizeof(*waiters))) == NULL)
+        return -ENOMEM;
+    if ((wq.notifc_cap = poll_get_notifc()) < 0) {
+        free(waiters);
+        return wq.notifc_cap;
     }
 
-    if (timeout > 0) {
-        gettimeofday(&start_time, NULL);
-        start_ms = start_time.tv_sec * 1000 + start_time.tv_usec / 1000;
+    for (i = 0; i < nfds; i++) {
+        waiters[i].hook.desc = NULL;
+        waiters[i].wq = &wq;
+        if (fds[i].fd >= 0 && poll_fd_valid(fds[i].fd))
+            poll_hook_add(fds[i].fd, &waiters[i].hook,
+                          poll_waiter_hook_func);
     }
 
     while (true) {
-        for (i = 0; i < nfds; i++) {
-            /*
-             * The field fd contains a file descriptor for an open
-             * file.  If this field is negative, then the
-             * corresponding events field is ignored and the revents
-             * field returns zero.  (This provides an easy way of
-             * ignoring a file descriptor for a single poll()
-             * call: simply negate the fd field.  Note, however,
-             * that this technique can't be used to ignore file
-             * descriptor 0.)
-             */
-            if (fds[i].fd < 0) {
-                /* False fd, just ignore them */
-                fds[i].revents = 0;
-                continue;
-            }
-
-            /*
-             * Invalid request: fd not open (only returned in
-             * revents; ignored in events). Or target fd does not
-             * support poll function.
-             */
-
-            if (fds[i].fd >= MAX_FD || fd_dic[fds[i].fd] == 0
-                || fd_dic[fds[i].fd]->fd_op == 0
-                || fd_dic[fds[i].fd]->fd_op->poll == 0) {
-                fds[i].revents = POLLNVAL;
-                continue;
-            }
-
-            arg.events = fds[i].events;
-
-            /* Call fd poll function */
-            mask = fd_dic[fds[i].fd]->fd_op->poll(fds[i].fd, &arg);
-            if (mask > 0) {
-                /* Already achieve the requirement */
-                fds[i].revents = mask;
-                count++;
-            }
-            poll_debug("poll fd %d mask 0x%x\n", fds[i].fd, mask);
-        }
+        /* Fds changed after this are notified */
+        wq.woken = 0;
+        a_barrier();
 
-        if (count || timeout == 0)
+        count = poll_check_fds(fds, nfds, &scan);
+        if (count)
+            break;
+        if (deadline_ns != UINT64_MAX && poll_now_ns() >= deadline_ns)
             break;
 
-        usys_yield();
-
-        if (timeout > 0) {
-            gettimeofday(&current_time, NULL);
-            current_ms =
-                current_time.tv_sec * 1000 + current_time.tv_usec / 1000;
-            if ((current_ms - start_ms) > timeout)
-                break;
-        }
+        poll_wait_notifc(wq.notifc_cap, deadline_ns, scan.deadline_ns);
     }
+
+    for (i = 0; i < nfds; i++)
+        poll_hook_del(&waiters[i].hook);
+    poll_put_notifc(wq.notifc_cap);
+    free(waiters);
+
 out:
     poll_debug("poll return count %d\n", count);
-    
     return count;
 }
 
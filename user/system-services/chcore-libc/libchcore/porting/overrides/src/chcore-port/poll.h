@@ -16,13 +16,44 @@
 #include <errno.h>
 #include <poll.h>
 #include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <sys/epoll.h>
+#include <chcore/container/list.h>
+#include <chcore/type.h>
+
+struct fd_desc;
+struct poll_hook;
+
+typedef void (*poll_hook_func)(struct poll_hook *hook);
+
+/*
+ * A poll_hook is attached to an fd by poll/epoll, and is invoked by
+ * fd_notify_pollers whenever the fd may have become ready.
+ */
+struct poll_hook {
+    /* In the poll_hooks list of desc, protected by desc->poll_lock */
+    struct list_head node;
+    /* NULL if not attached, e.g., the fd has been closed */
+    struct fd_desc *desc;
+    poll_hook_func func;
+};
 
 struct epitem {
     int fd;
     struct epoll_event event;
     /* epitem list in the same eventpoll */
     struct list_head epi_node;
+    struct eventpoll *ep;
+    struct poll_hook hook;
+    /* In ep->ready_list, protected by ep->ready_lock */
+    struct list_head ready_node;
+    bool ready;
+    /* In ep->watch_list, protected by ep->epi_lock */
+    struct list_head watch_node;
+    bool watched;
+    /* The last pass of ep_collect that examined this epitem */
+    uint64_t pass;
 };
 
 struct eventpoll {
@@ -30,14 +61,55 @@ struct eventpoll {
     int volatile epi_lock;
     struct list_head epi_list;
     uint32_t wait_count;
+    /*
+     * Epitems whose fds cannot notify pollers, which are examined in every
+     * pass. Such an fd either becomes ready at a known time (timerfd) or has
+     * to be rechecked periodically.
+     */
+    struct list_head watch_list;
+    uint64_t pass;
+    /* Epitems to be examined, filled in by fd_notify_pollers */
+    int volatile ready_lock;
+    struct list_head ready_list;
+    /* Threads in epoll_wait block on notifc_cap */
+    cap_t notifc_cap;
+    uint32_t nr_waiters;
 };
 
+/* Values of pollarg.ready_ns other than the time the fd becomes ready */
+#define POLL_READY_UNKNOWN 0
+#define POLL_READY_NOTIFY  UINT64_MAX
+
 /* Use by poll wait */
 struct pollarg {
     /* Event mask */
     short int events;
+    /*
+     * Set by the poll function if the fd is not ready: the time (in ns of
+     * CLOCK_MONOTONIC) it becomes ready by itself, POLL_READY_NOTIFY if it
+     * calls fd_notify_pollers when it becomes ready, or POLL_READY_UNKNOWN
+     * (default) if pollers should recheck it periodically.
+     */
+    uint64_t ready_ns;
 };
 
+/*
+ * Counters of the waits in poll/epoll: all the waits, the ones ended by a
+ * notification, and the ones ended only to recheck an fd which cannot notify.
+ */
+struct poll_stats {
+    unsigned long nr_waits;
+    unsigned long nr_notified;
+    unsigned long nr_rechecks;
+};
+
+void poll_get_stats(struct poll_stats *stats);
+
+void poll_hook_add(int fd, struct poll_hook *hook, poll_hook_func func);
+void poll_hook_del(struct poll_hook *hook);
+void fd_notify_pollers(int fd);
+void fd_detach_pollers(struct fd_desc *desc);
+
 int chcore_epoll_create1(int flags);
 int chcore_epoll_ctl(int epfd, int op, int fd, struct epoll_event *events);
 int chcore_epoll_pwait(int epfd, struct epoll_event *events, int maxevents,
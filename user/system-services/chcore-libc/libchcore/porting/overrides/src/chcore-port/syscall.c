@@ -215,9 +215,14 @@ void usys_perf_null(void)
     chcore_syscall0(CHCORE_SYS_perf_null);
 }
 
-void usys_top(void)
+int usys_top(struct top_cpu_info *cpu_buf, unsigned int nr_cpus,
+             struct top_thread_info *thread_buf, unsigned int nr_threads)
 {
-    chcore_syscall0(CHCORE_SYS_top);
+    return chcore_syscall4(CHCORE_SYS_top,
+                           (unsigned long)cpu_buf,
+                           nr_cpus,
+                           (unsigned long)thread_buf,
+                           nr_threads);
 }
 
 int usys_user_fault_register(cap_t notific_cap, vaddr_t msg_buffer)
@@ -303,6 +308,30 @@ int usys_notify(cap_t notifc_cap)
     return ret;
 }
 
+int usys_futex_wait(int *uaddr, int val, void *timeout, int **uaddr_ptr)
+{
+    return chcore_syscall4(CHCORE_SYS_futex_wait,
+                           (unsigned long)uaddr,
+                           val,
+                           (unsigned long)timeout,
+                           (unsigned long)uaddr_ptr);
+}
+
+int usys_futex_wake(int *uaddr, int nr_wake)
+{
+    return chcore_syscall2(
+        CHCORE_SYS_futex_wake, (unsigned long)uaddr, nr_wake);
+}
+
+int usys_futex_requeue(int *uaddr, int *uaddr2, int nr_wake, int nr_requeue)
+{
+    return chcore_syscall4(CHCORE_SYS_futex_requeue,
+                           (unsigned long)uaddr,
+                           (unsigned long)uaddr2,
+                           nr_wake,
+                           nr_requeue);
+}
+
 #ifdef CHCORE_OH_TEE
 
 cap_t usys_create_ns_pmo(cap_t cap_group, unsigned long paddr,
@@ -414,6 +443,27 @@ int usys_tee_msg_notify(cap_t channel_cap, void *send_buf, size_t send_len)
                            send_len);
 }
 
+int usys_tee_msg_attach_ring(cap_t channel_cap, cap_t pmo_cap)
+{
+    return chcore_syscall2(CHCORE_SYS_tee_msg_attach_ring, channel_cap, pmo_cap);
+}
+
+int usys_tee_msg_ring_notify(cap_t channel_cap)
+{
+    return chcore_syscall1(CHCORE_SYS_tee_msg_ring_notify, channel_cap);
+}
+
+int usys_tee_msg_ring_wait(cap_t channel_cap, int timeout)
+{
+    return chcore_syscall2(CHCORE_SYS_tee_msg_ring_wait, channel_cap, timeout);
+}
+
+cap_t usys_tee_msg_ring_accept(cap_t channel_cap, void *info)
+{
+    return chcore_syscall2(
+        CHCORE_SYS_tee_msg_ring_accept, channel_cap, (unsigned long)info);
+}
+
 #endif /* CHCORE_OH_TEE */
 
 /* Only used for recycle process */
@@ -123,10 +123,16 @@ void __libc_connect_services(elf_auxv_t *auxv)
 
     fsm_ipc_struct->conn_cap = 0;
     fsm_ipc_struct->server_id = FS_MANAGER;
+    fsm_ipc_struct->slots = NULL;
+    fsm_ipc_struct->nr_slots = 0;
     lwip_ipc_struct->conn_cap = 0;
     lwip_ipc_struct->server_id = NET_MANAGER;
+    lwip_ipc_struct->slots = NULL;
+    lwip_ipc_struct->nr_slots = 0;
     procmgr_ipc_struct->conn_cap = 0;
     procmgr_ipc_struct->server_id = PROC_MANAGER;
+    procmgr_ipc_struct->slots = NULL;
+    procmgr_ipc_struct->nr_slots = 0;
 
     for (i = 0; auxv[i].a_type != AT_CHCORE_CAP_CNT; i++)
         ;
@@ -12,7 +12,6 @@
 
 #include <errno.h>
 #include <fcntl.h>
-#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <sys/time.h>
@@ -141,6 +140,8 @@ int chcore_timerfd_settime(int fd, int flags, struct itimerspec *new_value,
             timer_file->it.it_value = ns_to_timespec(cur_ns + val_ns);
     }
     chcore_spin_unlock(&timer_file->timer_lock);
+    /* Pollers should pick up the new expiration time */
+    fd_notify_pollers(fd);
     return 0;
 }
 
@@ -279,6 +280,8 @@ static int chcore_timerfd_poll(int fd, struct pollarg *arg)
         || fd_dic[fd]->private_data == NULL)
         return -EINVAL;
 
+    /* A disarmed timer changes only in chcore_timerfd_settime */
+    arg->ready_ns = POLL_READY_NOTIFY;
     if (arg->events & POLLIN || arg->events & POLLRDNORM) {
         timer_file = fd_dic[fd]->private_data;
         /* no need to lock, only check the value of it_value */
@@ -287,89 +290,14 @@ static int chcore_timerfd_poll(int fd, struct pollarg *arg)
             clock_gettime(CLOCK_MONOTONIC, &cur_time);
             cur_ns = timespec_to_ns(&cur_time);
             mask = cur_ns >= val_ns ? POLLIN | POLLRDNORM : 0;
+            /* Ready at the expiration time without any notification */
+            arg->ready_ns = val_ns;
         }
     }
 
     return mask;
 }
 
-struct timerfd_poll_arg {
-    uint64_t wait_ns;
-    cap_t notifc_cap;
-};
-
-static void *timerfd_poll_thread_routine(void *arg)
-{
-    struct timerfd_poll_arg *tpa = (struct timerfd_poll_arg *)arg;
-    struct timespec wait_time;
-
-    wait_time = ns_to_timespec(tpa->wait_ns);
-    nanosleep(&wait_time, NULL);
-    // chcore_syscall1(CHCORE_SYS_notify, tpa->notifc_cap);
-    usys_notify(tpa->notifc_cap);
-    free(arg);
-    return NULL;
-}
-
-int chcore_timerfd_async_poll(struct pollfd fds[], nfds_t nfds, int timeout,
-                              cap_t notifc_cap)
-{
-    int ret = 0, i = 0, count = 0, fd = 0;
-    pthread_t tid;
-    struct timer_file *timer_file;
-    struct timespec cur_time;
-    uint64_t wait_ns = UINT64_MAX;
-    uint64_t val_ns = 0, cur_ns = 0;
-    struct timerfd_poll_arg *tpa;
-
-    /* if timeout == 0, we have check in fd_op->poll function directly
-     * return */
-    if (timeout == 0)
-        return 0;
-    /* Find timeout */
-    clock_gettime(CLOCK_MONOTONIC, &cur_time);
-    cur_ns = timespec_to_ns(&cur_time);
-    for (i = 0; i < nfds; i++) {
-        fd = fds[i].fd;
-        if (fd < 0 || fd >= MAX_FD || fd_dic[fd] == NULL
-            || fd_dic[fd]->type != FD_TYPE_TIMER
-            || fd_dic[fd]->private_data == NULL)
-            continue; /* not a valid timerfd */
-        /* get timeout */
-        timer_file = fd_dic[fd]->private_data;
-        val_ns = timespec_to_ns(&timer_file->it.it_value);
-        if (val_ns == 0) { /* timer is disarmed */
-            continue;
-        }
-        if (cur_ns > val_ns) { /* ready */
-            fds[i].revents = fds[i].events & POLLIN
-                                     || fds[i].events & POLLRDNORM ?
-                                 POLLIN | POLLRDNORM :
-                                 0;
-            count += 1;
-        } else { /* not ready */
-            wait_ns = (val_ns - cur_ns) < wait_ns ? (val_ns - cur_ns) : wait_ns;
-        }
-    }
-
-    /* directly return if ready */
-    if (count > 0)
-        return count;
-
-    /* OPT: directly return when timeout is closer */
-    if (timeout > 0 && wait_ns > (uint64_t)timeout * 1000000)
-        return 0;
-
-    tpa = malloc(sizeof(struct timerfd_poll_arg));
-    if (tpa == NULL) {
-        return -ENOMEM;
-    }
-    tpa->notifc_cap = notifc_cap;
-    tpa->wait_ns = wait_ns;
-    ret = pthread_create(&tid, NULL, timerfd_poll_thread_routine, (void *)tpa);
-    return ret;
-}
-
 /* TIMERFD */
 struct fd_ops timer_op = {
     .read = chcore_timerfd_read,
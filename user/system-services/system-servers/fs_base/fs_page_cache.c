@@ -12,6 +12,7 @@
 #include <malloc.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <time.h>
 #include <chcore/defs.h>
 #include <chcore/memory.h>
 #include <chcore/syscall.h>
@@ -149,7 +150,117 @@ static void cached_pages_list_delete_node(struct cached_pages_list *list,
     BUG_ON(list->size < 0);
 }
 
+/*
+ * Move a node between the two lists of a shard. Unlike deleting and then
+ * appending, in_which_list never reads INODE_PAGES_LIST in between, so a
+ * holder of pce_rwlock can tell the page is in the two lists without the
+ * shard lock.
+ */
+static void two_list_move_node(struct cached_pages_list *from,
+                               struct cached_pages_list *to,
+                               struct cached_page *p,
+                               PAGE_CACHE_LIST_TYPE to_type)
+{
+    list_del(&p->two_list_node);
+    from->size--;
+    BUG_ON(from->size < 0);
+
+    list_append(&p->two_list_node, &to->queue);
+    to->size++;
+    p->in_which_list = to_type;
+}
+
+/* ++++++++++++++++++++++++++++ Dirty page tracking +++++++++++++++++++++++++ */
+static inline bool over_dirty_thresh(int ratio)
+{
+    return page_cache.stat.nr_dirty_pages
+           > (u64)MAX_PAGE_CACHE_PAGE * ratio / 100;
+}
+
+/*
+ * Add written pages to the dirty set of their inode, and kick write-back
+ * once there are too many dirty pages.
+ * The caller should hold the write locks of the pages.
+ */
+static void dirty_set_add(struct cached_page **pages, int nr)
+{
+    struct page_cache_entity_of_inode *pce;
+    int i;
+
+    pthread_mutex_lock(&page_cache.dirty_lock);
+    for (i = 0; i < nr; ++i) {
+        if (pages[i]->in_dirty_set)
+            continue;
+
+        pce = pages[i]->owner;
+        if (pce->dirty_pages_cnt++ == 0) {
+            list_append(&pce->dirty_inode_node, &page_cache.dirty_inodes);
+            page_cache.stat.nr_dirty_inodes++;
+        }
+        list_append(&pages[i]->dirty_node, &pce->dirty_pages);
+        pages[i]->in_dirty_set = true;
+        page_cache.stat.nr_dirty_pages++;
+    }
+
+    if (over_dirty_thresh(DIRTY_BACKGROUND_RATIO))
+        pthread_cond_signal(&page_cache.write_back_cond);
+    pthread_mutex_unlock(&page_cache.dirty_lock);
+}
+
+/*
+ * Remove a page from the dirty set of its inode if all its blocks are
+ * clean, or unconditionally if @force.
+ * The caller should hold the lock of the page, so that the page can't
+ * be added to the dirty set concurrently.
+ */
+static void dirty_set_del(struct cached_page *p, bool force)
+{
+    struct page_cache_entity_of_inode *pce = p->owner;
+
+    if (!p->in_dirty_set)
+        return;
+
+    pthread_mutex_lock(&page_cache.dirty_lock);
+    if (p->in_dirty_set && (force || !is_block_or_page_dirty(p, -1))) {
+        list_del(&p->dirty_node);
+        p->in_dirty_set = false;
+        page_cache.stat.nr_dirty_pages--;
+
+        if (--pce->dirty_pages_cnt == 0) {
+            list_del(&pce->dirty_inode_node);
+            page_cache.stat.nr_dirty_inodes--;
+        }
+    }
+    pthread_mutex_unlock(&page_cache.dirty_lock);
+}
+
 /* +++++++++++++++++++++++++ cached_page operations +++++++++++++++++++++++++ */
+/*
+ * Write @nr_blocks blocks in @buf from block @page_block_idx of a page.
+ * Return 0 on success, or -1 if file_write fails, and the caller should
+ * keep the blocks dirty.
+ */
+static int write_blocks(struct page_cache_entity_of_inode *pce, char *buf,
+                        pidx_t file_page_idx, int page_block_idx,
+                        int nr_blocks)
+{
+    page_cache_debug("[write_blocks] write back %d:%d:%d, %d blocks.\n",
+                     pce->host_idx,
+                     file_page_idx,
+                     page_block_idx,
+                     nr_blocks);
+    if (page_cache.user_func.file_write(
+            buf, file_page_idx, page_block_idx, nr_blocks, pce->private_data)
+        <= 0) {
+        fs_debug_error("[write_blocks] file_write %d:%d:%d failed\n",
+                       pce->host_idx,
+                       file_page_idx,
+                       page_block_idx);
+        return -1;
+    }
+    return 0;
+}
+
 /* The caller should guarantee page_block_idx is in legal range. */
 static int flush_single_block(struct cached_page *p, int page_block_idx)
 {
@@ -158,62 +269,127 @@ static int flush_single_block(struct cached_page *p, int page_block_idx)
     BUG_ON(page_block_idx < 0);
 
     if (is_block_or_page_dirty(p, page_block_idx)) {
-        page_cache_debug(
-            "[write_back_routine] %d:%d:%d in active list is dirty, write it back.\n",
-            p->owner->host_idx,
-            p->file_page_idx,
-            page_block_idx);
-        if (page_cache.user_func.file_write(
-                p->content + page_block_idx * CACHED_BLOCK_SIZE,
-                p->file_page_idx,
-                page_block_idx,
-                p->owner->private_data)
-            <= 0) {
-            BUG("[write_back_all_pages] file_write failed\n");
-            ret = -1;
+        ret = write_blocks(p->owner,
+                           p->content + page_block_idx * CACHED_BLOCK_SIZE,
+                           p->file_page_idx,
+                           page_block_idx,
+                           1);
+        if (ret != 0)
             goto out;
-        }
         set_block_or_page_dirty(p, page_block_idx, false);
+        dirty_set_del(p, false);
     }
 
 out:
     return ret;
 }
 
+/* Write each run of adjacent dirty blocks at once. */
 static int flush_single_page(struct cached_page *p)
 {
-    int i, ret = 0;
+    int i, j, ret = 0;
 
     BUG_ON(p == NULL);
 
-    for (i = 0; i < BLOCK_PER_PAGE; ++i) {
-        if (flush_single_block(p, i) != 0) {
-            ret = -1;
-            goto out;
+    for (i = 0; i < BLOCK_PER_PAGE; i = j) {
+        if (!p->dirty[i]) {
+            j = i + 1;
+            continue;
         }
+        for (j = i; j < BLOCK_PER_PAGE && p->dirty[j]; ++j)
+            ;
+
+        ret = write_blocks(p->owner,
+                           p->content + i * CACHED_BLOCK_SIZE,
+                           p->file_page_idx,
+                           i,
+                           j - i);
+        if (ret != 0)
+            goto out;
+        while (i < j)
+            p->dirty[i++] = false;
     }
+    dirty_set_del(p, false);
+
 out:
     return ret;
 }
 
+static inline struct page_cache_shard *page_shard(struct cached_page *p)
+{
+    return &page_cache.shards[p->shard_idx];
+}
+
+static inline void page_cache_stat_inc(u64 *stat)
+{
+    __atomic_fetch_add(stat, 1, __ATOMIC_RELAXED);
+}
+
+static void lock_shard(struct page_cache_shard *shard)
+{
+    if (pthread_mutex_trylock(&shard->lock) != 0) {
+        page_cache_stat_inc(&page_cache.stat.nr_shard_contended);
+        pthread_mutex_lock(&shard->lock);
+    }
+}
+
+/* Spread the pages of one inode, as well as the inodes, among the shards. */
+static inline int shard_idx_of(ino_t host_idx, pidx_t file_page_idx)
+{
+    u64 key;
+
+    key = ((u64)host_idx * 0x9E3779B97F4A7C15UL) ^ (u64)file_page_idx;
+    return key % PAGE_CACHE_SHARD_NR;
+}
+
+static void call_pce_handler(event_handler_t handler, void *private_data)
+{
+    if (!handler)
+        return;
+
+    pthread_mutex_lock(&page_cache.handler_lock);
+    handler(private_data);
+    pthread_mutex_unlock(&page_cache.handler_lock);
+}
+
+/*
+ * The caller should hold pce_rwlock of the owner as a writer and
+ * the write lock of the page.
+ */
 static void free_page(struct cached_page *p)
 {
+    struct page_cache_shard *shard;
+
     BUG_ON(p == NULL);
 
+    /* The page may be deleted without flushing. */
+    dirty_set_del(p, true);
     free(p->content);
 
-    /* Delete from ACTIVE_LIST, INACTIVE_LIST or PINNED_PAGES_LIST. */
+    /*
+     * Delete from ACTIVE_LIST, INACTIVE_LIST or PINNED_PAGES_LIST.
+     * A page isolated by eviction is only in INODE_PAGES_LIST.
+     */
     switch (p->in_which_list) {
     case ACTIVE_LIST:
-        cached_pages_list_delete_node(&page_cache.active_list, p, ACTIVE_LIST);
-        break;
     case INACTIVE_LIST:
-        cached_pages_list_delete_node(
-            &page_cache.inactive_list, p, INACTIVE_LIST);
+        /* Aging may move the page between the two lists until locked. */
+        shard = page_shard(p);
+        lock_shard(shard);
+        if (p->in_which_list == ACTIVE_LIST)
+            cached_pages_list_delete_node(&shard->active_list, p, ACTIVE_LIST);
+        else
+            cached_pages_list_delete_node(
+                &shard->inactive_list, p, INACTIVE_LIST);
+        pthread_mutex_unlock(&shard->lock);
         break;
     case PINNED_PAGES_LIST:
+        pthread_mutex_lock(&page_cache.pinned_lock);
         cached_pages_list_delete_node(
             &page_cache.pinned_pages_list, p, PINNED_PAGES_LIST);
+        pthread_mutex_unlock(&page_cache.pinned_lock);
+        break;
+    case INODE_PAGES_LIST:
         break;
     default:
         BUG("Try to free a page that is not in ACTIVE_LIST, INACTIVE_LIST or PINNED_PAGES_LIST.\n");
@@ -224,17 +400,34 @@ static void free_page(struct cached_page *p)
     radix_del(&p->owner->idx2page, p->file_page_idx, 0);
 
     /* Once pages_cnt in a pce reached 0, trigger handler */
-    if (--(p->owner->pages_cnt) == 0
-        && page_cache.user_func.handler_pce_turns_empty) {
-        page_cache.user_func.handler_pce_turns_empty(p->owner->private_data);
-    }
+    if (--(p->owner->pages_cnt) == 0)
+        call_pce_handler(page_cache.user_func.handler_pce_turns_empty,
+                         p->owner->private_data);
 
+    pthread_rwlock_unlock(&p->page_rwlock);
     pthread_rwlock_destroy(&p->page_rwlock);
 
     free(p);
 }
 
-static void flush_and_free_page(struct cached_page *p)
+/*
+ * Keep @p whose dirty blocks failed to be flushed, in the dirty set so that
+ * the write-back thread retries them. Called with the write lock of @p.
+ */
+static void keep_unflushed_page(struct cached_page *p)
+{
+    fs_debug_error("[keep_unflushed_page] keep dirty page %d:%d\n",
+                   p->owner->host_idx,
+                   p->file_page_idx);
+    dirty_set_add(&p, 1);
+}
+
+/*
+ * The caller should hold pce_rwlock of the owner as a writer.
+ * Return 0 if @p is freed, or -1 if its dirty blocks failed to be flushed,
+ * and it stays in the cache.
+ */
+static int flush_and_free_page(struct cached_page *p)
 {
     BUG_ON(p == NULL);
 
@@ -245,12 +438,26 @@ static void flush_and_free_page(struct cached_page *p)
      * pages with empty contents is marked not dirty.
      * So it won't be flushed.
      */
-    if (is_block_or_page_dirty(p, -1))
-        flush_single_page(p);
+    if (is_block_or_page_dirty(p, -1) && flush_single_page(p) != 0) {
+        keep_unflushed_page(p);
+        pthread_rwlock_unlock(&p->page_rwlock);
+        return -1;
+    }
 
     free_page(p);
+    return 0;
+}
+
+/* The caller should hold pce_rwlock of the owner as a writer. */
+static void lock_and_free_page(struct cached_page *p)
+{
+    BUG_ON(p == NULL);
+
+    pthread_rwlock_wrlock(&p->page_rwlock);
+    free_page(p);
 }
 
+/* The caller should hold pce_rwlock of @owner as a writer. */
 static struct cached_page *new_page(struct page_cache_entity_of_inode *owner,
                                     pidx_t file_page_idx)
 {
@@ -262,10 +469,12 @@ static struct cached_page *new_page(struct page_cache_entity_of_inode *owner,
 
     p->owner = owner;
     p->file_page_idx = file_page_idx;
+    p->shard_idx = shard_idx_of(owner->host_idx, file_page_idx);
 
     init_list_head(&p->two_list_node);
     init_list_head(&p->inode_pages_node);
     init_list_head(&p->pinned_pages_node);
+    init_list_head(&p->dirty_node);
 
     pthread_rwlock_init(&p->page_rwlock, NULL);
 
@@ -278,103 +487,114 @@ static struct cached_page *new_page(struct page_cache_entity_of_inode *owner,
     radix_add(&owner->idx2page, file_page_idx, p);
 
     /* Contribute 1 ref to pce for each cached_page */
-    if (owner->pages_cnt++ == 0
-        && page_cache.user_func.handler_pce_turns_nonempty) {
-        page_cache.user_func.handler_pce_turns_nonempty(owner->private_data);
-    }
+    if (owner->pages_cnt++ == 0)
+        call_pce_handler(page_cache.user_func.handler_pce_turns_nonempty,
+                         owner->private_data);
 
     return p;
 }
 
-static inline void evict_head_page(struct cached_pages_list *list,
-                                   PAGE_CACHE_LIST_TYPE list_type)
+/*
+ * Try to evict @p at the head of the inactive list of @shard.
+ * The shard lock is held, which is behind the locks of the victim in the
+ * lock order, so the latter are only tried. The shard lock is released
+ * while flushing the victim.
+ * Return 0 if @p is evicted, -EBUSY if it is being used, or -EIO if it
+ * failed to be flushed, where it is kept at the tail of the inactive list.
+ */
+static int try_evict_page(struct page_cache_shard *shard, struct cached_page *p)
 {
-    struct cached_page *p;
+    struct page_cache_entity_of_inode *pce = p->owner;
 
-    /* Evict head page. */
-    if (list_type == ACTIVE_LIST || list_type == INACTIVE_LIST) {
-        p = cached_pages_list_top_node(list, list_type);
-        page_cache_debug("[evict_head_page] Evict %d:%d in list %d.\n",
-                         p->owner->host_idx,
-                         p->file_page_idx,
-                         list_type);
-        flush_and_free_page(p);
-    } else {
-        BUG("Try to evict a page that is not in two list.\n");
+    if (pthread_rwlock_trywrlock(&pce->pce_rwlock) != 0)
+        goto out_busy;
+    if (pthread_rwlock_trywrlock(&p->page_rwlock) != 0) {
+        pthread_rwlock_unlock(&pce->pce_rwlock);
+        goto out_busy;
     }
-}
 
-/*
- * Boost a node in active list. Remove the node and append it at tail.
- */
-static inline void boost_active_page(struct cached_page *p)
-{
-    /* Delete node from active list. */
-    cached_pages_list_delete_node(&page_cache.active_list, p, ACTIVE_LIST);
+    /* Isolate the page so that aging does not touch it any more. */
+    cached_pages_list_delete_node(&shard->inactive_list, p, INACTIVE_LIST);
+    pthread_mutex_unlock(&shard->lock);
+
+    page_cache_debug("[try_evict_page] Evict %d:%d.\n",
+                     pce->host_idx,
+                     p->file_page_idx);
+    if (is_block_or_page_dirty(p, -1) && flush_single_page(p) != 0) {
+        /* Rotate the page and try it again in the next round of aging. */
+        keep_unflushed_page(p);
+        lock_shard(shard);
+        cached_pages_list_append_node(&shard->inactive_list, p, INACTIVE_LIST);
+        pthread_rwlock_unlock(&p->page_rwlock);
+        pthread_rwlock_unlock(&pce->pce_rwlock);
+        page_cache_stat_inc(&page_cache.stat.nr_evict_io_fails);
+        return -EIO;
+    }
+    free_page(p);
 
-    /* Append it to the tail. */
-    cached_pages_list_append_node(&page_cache.active_list, p, ACTIVE_LIST);
+    pthread_rwlock_unlock(&pce->pce_rwlock);
+    page_cache_stat_inc(&page_cache.stat.nr_evicted);
+    lock_shard(shard);
+    return 0;
+
+out_busy:
+    page_cache_stat_inc(&page_cache.stat.nr_evict_busy);
+    return -EBUSY;
 }
 
 /*
- * Boost a node in inactive list.
- * Remove the node and append it to the tail of the active list.
+ * Age the two lists of @shard like a CLOCK. Cache hits only mark pages
+ * as referenced, and the promotion is done here in batch:
+ * a referenced page at the head of the inactive list is boosted to the
+ * active list, and a referenced page at the head of the active list gets
+ * a second chance at its tail. Unreferenced pages are demoted from the
+ * active list, or evicted from the inactive list.
+ * The caller should not hold any lock of the page cache.
  */
-static inline void boost_inactive_page(struct cached_page *p)
+static void shrink_shard(struct page_cache_shard *shard)
 {
-    struct cached_page *head_page;
-    /* Delete node from inactive list */
-    cached_pages_list_delete_node(&page_cache.inactive_list, p, INACTIVE_LIST);
-
-    /* Add node to active list */
-    cached_pages_list_append_node(&page_cache.active_list, p, ACTIVE_LIST);
-
-    if (page_cache.active_list.size > ACTIVE_LIST_MAX) {
-        /*
-         * If active list is full,
-         * move head unpinned page to inactive list.
-         */
-        head_page =
-            cached_pages_list_top_node(&page_cache.active_list, ACTIVE_LIST);
-        /**
-         * It should be impossible for head_page == NULL but klocwork
-         * reported a bug here, maybe due to precision of static
-         * analysis
-         */
-        if (head_page == NULL) {
-            WARN("head_page == NULL");
-            return;
+    struct cached_page *p;
+    int nr_scan;
+
+    lock_shard(shard);
+
+    nr_scan = shard->inactive_list.size;
+    while (shard->inactive_list.size > SHARD_INACTIVE_LIST_MAX
+           && nr_scan-- > 0) {
+        p = cached_pages_list_top_node(&shard->inactive_list, INACTIVE_LIST);
+        if (p->referenced) {
+            p->referenced = false;
+            two_list_move_node(
+                &shard->inactive_list, &shard->active_list, p, ACTIVE_LIST);
+        } else if (try_evict_page(shard, p) == -EBUSY) {
+            /* Rotate the busy page, and it is evicted next time. */
+            two_list_move_node(
+                &shard->inactive_list, &shard->inactive_list, p, INACTIVE_LIST);
         }
-        cached_pages_list_delete_node(
-            &page_cache.active_list, head_page, ACTIVE_LIST);
-        cached_pages_list_append_node(
-            &page_cache.inactive_list, head_page, INACTIVE_LIST);
-
-        if (page_cache.inactive_list.size > INACTIVE_LIST_MAX) {
-            /*
-             * if inactive list is full,
-             * evict head unpinned page.
-             */
-            evict_head_page(&page_cache.inactive_list, INACTIVE_LIST);
+    }
+
+    nr_scan = shard->active_list.size;
+    while (shard->active_list.size > SHARD_ACTIVE_LIST_MAX) {
+        p = cached_pages_list_top_node(&shard->active_list, ACTIVE_LIST);
+        if (p->referenced && nr_scan-- > 0) {
+            p->referenced = false;
+            two_list_move_node(
+                &shard->active_list, &shard->active_list, p, ACTIVE_LIST);
+        } else {
+            p->referenced = false;
+            two_list_move_node(
+                &shard->active_list, &shard->inactive_list, p, INACTIVE_LIST);
         }
     }
-}
 
-/* Caller should hold per page_cache mutex lock to protect list operations */
-static inline void boost_page(struct cached_page *p)
-{
-    if (p->in_which_list == ACTIVE_LIST)
-        boost_active_page(p);
-    else if (p->in_which_list == INACTIVE_LIST)
-        boost_inactive_page(p);
-    else
-        BUG("Try to boost page that is not in two lists!\n");
+    pthread_mutex_unlock(&shard->lock);
 }
 
 /*
  * Find a page from active_list, inactive_list and pinned_pages_list, if page
  * not found, create a new one and insert it to inactive list and pages list.
- * Notice: The caller should hold per page_cache mutex lock!
+ * Notice: The caller should hold pce_rwlock of @pce as a writer, and shrink
+ * the shard of a new page after releasing it.
  * return value:
  *      @which_list: ACTIVE_LIST or INACTIVE_LIST or PINNED_PAGES_LIST.
  *      @is_new: if page is newly allocated, is_new = true, else is_new = false.
@@ -382,6 +602,7 @@ static inline void boost_page(struct cached_page *p)
 struct cached_page *find_or_new_page(struct page_cache_entity_of_inode *pce,
                                      pidx_t file_page_idx, bool *is_new)
 {
+    struct page_cache_shard *shard;
     struct cached_page *p;
     bool temp_is_new;
 
@@ -408,15 +629,10 @@ struct cached_page *find_or_new_page(struct page_cache_entity_of_inode *pce,
          * According to two list strategy, a new page should
          * be inserted into inactive list.
          */
-        cached_pages_list_append_node(
-            &page_cache.inactive_list, p, INACTIVE_LIST);
-        if (page_cache.inactive_list.size > INACTIVE_LIST_MAX) {
-            /*
-             * if inactive list is full,
-             * evict head unpinned page.
-             */
-            evict_head_page(&page_cache.inactive_list, INACTIVE_LIST);
-        }
+        shard = page_shard(p);
+        lock_shard(shard);
+        cached_pages_list_append_node(&shard->inactive_list, p, INACTIVE_LIST);
+        pthread_mutex_unlock(&shard->lock);
 
         /* Fill it with corresponding contents. */
         page_cache.user_func.file_read(
@@ -445,77 +661,436 @@ fail:
     return NULL;
 }
 
-/* The caller should hold per page_cache mutex lock! */
-void write_back_all_pages(void)
+/* A run of adjacent dirty blocks being written back. */
+struct write_back_run {
+    char *buf;
+    /* Where the run starts, and its length. */
+    pidx_t file_page_idx;
+    int page_block_idx;
+    int nr_blocks;
+    /* Pages in the run, read-locked until the run is written. */
+    struct cached_page *pages[WRITE_BACK_RUN_PAGES];
+    int nr_pages;
+    /* Counters */
+    u64 nr_runs;
+    u64 nr_written_blocks;
+};
+
+static inline u64 file_block_idx(pidx_t file_page_idx, int page_block_idx)
+{
+    return (u64)file_page_idx * BLOCK_PER_PAGE + page_block_idx;
+}
+
+/* Mark the blocks of @run dirty again after failing to write them. */
+static void redirty_run(struct write_back_run *run)
 {
     struct cached_page *p;
+    u64 idx, end;
+    int i;
 
-    /* Write back pages in active list. */
-    for_each_in_list (
-        p, struct cached_page, two_list_node, &page_cache.active_list.queue) {
-        pthread_rwlock_rdlock(&p->page_rwlock);
-        flush_single_page(p);
-        pthread_rwlock_unlock(&p->page_rwlock);
+    idx = file_block_idx(run->file_page_idx, run->page_block_idx);
+    end = idx + run->nr_blocks;
+    /* The pages of the blocks are in ascending order in run->pages. */
+    for (i = 0; i < run->nr_pages && idx < end; ++i) {
+        p = run->pages[i];
+        while (idx < end && idx < file_block_idx(p->file_page_idx + 1, 0)) {
+            if (idx >= file_block_idx(p->file_page_idx, 0))
+                p->dirty[idx % BLOCK_PER_PAGE] = true;
+            ++idx;
+        }
     }
-    /* Write back pages in inactive list. */
-    for_each_in_list (
-        p, struct cached_page, two_list_node, &page_cache.inactive_list.queue) {
-        pthread_rwlock_rdlock(&p->page_rwlock);
-        flush_single_page(p);
+}
+
+/*
+ * Write the pending blocks of @run at once, then unlock its pages except
+ * @keep, which still has blocks to be added. The blocks stay dirty if the
+ * write fails.
+ */
+static int write_back_run(struct page_cache_entity_of_inode *pce,
+                          struct write_back_run *run, struct cached_page *keep)
+{
+    struct cached_page *p;
+    int i, ret = 0;
+
+    if (run->nr_blocks > 0) {
+        ret = write_blocks(pce,
+                           run->buf,
+                           run->file_page_idx,
+                           run->page_block_idx,
+                           run->nr_blocks);
+        if (ret == 0) {
+            run->nr_runs++;
+            run->nr_written_blocks += run->nr_blocks;
+        } else {
+            redirty_run(run);
+        }
+        run->nr_blocks = 0;
+    }
+
+    for (i = 0; i < run->nr_pages; ++i) {
+        p = run->pages[i];
+        if (p == keep)
+            continue;
+        dirty_set_del(p, false);
         pthread_rwlock_unlock(&p->page_rwlock);
     }
-    /* Write back pages in pinned pages list. */
-    for_each_in_list (p,
-                      struct cached_page,
-                      pinned_pages_node,
-                      &page_cache.pinned_pages_list.queue) {
+    run->nr_pages = 0;
+    if (keep)
+        run->pages[run->nr_pages++] = keep;
+
+    return ret;
+}
+
+static int cmp_page_idx(const void *a, const void *b)
+{
+    pidx_t x = (*(struct cached_page *const *)a)->file_page_idx;
+    pidx_t y = (*(struct cached_page *const *)b)->file_page_idx;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/*
+ * Write back the dirty blocks of an inode in ascending order. Adjacent
+ * dirty blocks, even across pages, are coalesced into one file_write of
+ * at most WRITE_BACK_RUN_BLOCKS blocks. A block is marked clean once it
+ * is copied to the run, so its page stays read-locked until the run is
+ * written, or a newer write-through of the block could be overwritten.
+ */
+static int write_back_pages_of_inode(struct page_cache_entity_of_inode *pce)
+{
+    struct cached_page **pages, *p;
+    struct write_back_run run = {0};
+    int nr, i, j, ret = 0;
+
+    /* Pages can't be freed, thus stay in the dirty set, until unlocked. */
+    pthread_rwlock_rdlock(&pce->pce_rwlock);
+
+    pthread_mutex_lock(&page_cache.dirty_lock);
+    nr = pce->dirty_pages_cnt;
+    pages = nr ? malloc(nr * sizeof(*pages)) : NULL;
+    if (pages) {
+        i = 0;
+        for_each_in_list (
+            p, struct cached_page, dirty_node, &pce->dirty_pages)
+            pages[i++] = p;
+    }
+    pthread_mutex_unlock(&page_cache.dirty_lock);
+
+    if (nr == 0)
+        goto out_unlock;
+    run.buf = malloc(WRITE_BACK_RUN_BLOCKS * CACHED_BLOCK_SIZE);
+    if (pages == NULL || run.buf == NULL) {
+        ret = -1;
+        goto out_free;
+    }
+
+    qsort(pages, nr, sizeof(*pages), cmp_page_idx);
+
+    for (i = 0; i < nr && ret == 0; ++i) {
+        p = pages[i];
         pthread_rwlock_rdlock(&p->page_rwlock);
-        flush_single_page(p);
-        pthread_rwlock_unlock(&p->page_rwlock);
+        run.pages[run.nr_pages++] = p;
+
+        for (j = 0; j < BLOCK_PER_PAGE; ++j) {
+            if (!p->dirty[j])
+                continue;
+
+            /* Write the pending run unless this block extends it. */
+            if (run.nr_blocks == WRITE_BACK_RUN_BLOCKS
+                || (run.nr_blocks > 0
+                    && file_block_idx(p->file_page_idx, j)
+                           != file_block_idx(run.file_page_idx,
+                                             run.page_block_idx)
+                                  + run.nr_blocks)) {
+                ret = write_back_run(pce, &run, p);
+                if (ret != 0)
+                    break;
+            }
+
+            if (run.nr_blocks == 0) {
+                run.file_page_idx = p->file_page_idx;
+                run.page_block_idx = j;
+            }
+            memcpy(run.buf + run.nr_blocks * CACHED_BLOCK_SIZE,
+                   p->content + j * CACHED_BLOCK_SIZE,
+                   CACHED_BLOCK_SIZE);
+            p->dirty[j] = false;
+            run.nr_blocks++;
+        }
+
+        /* The run can only go on into the next page from the last block. */
+        if (ret == 0
+            && (run.nr_blocks == 0
+                || file_block_idx(run.file_page_idx, run.page_block_idx)
+                           + run.nr_blocks
+                       != file_block_idx(p->file_page_idx + 1, 0)))
+            ret = write_back_run(pce, &run, NULL);
     }
+
+    if (write_back_run(pce, &run, NULL) != 0)
+        ret = -1;
+
+    pthread_mutex_lock(&page_cache.dirty_lock);
+    page_cache.stat.nr_write_back_runs += run.nr_runs;
+    page_cache.stat.nr_write_back_blocks += run.nr_written_blocks;
+    pthread_mutex_unlock(&page_cache.dirty_lock);
+
+out_free:
+    free(run.buf);
+    free(pages);
+out_unlock:
+    pthread_rwlock_unlock(&pce->pce_rwlock);
+    return ret;
 }
 
-/* Write back all dirty pages periodically. */
+/* Write back all the dirty inodes. Return -1 if any of them failed. */
+int write_back_all_pages(void)
+{
+    struct page_cache_entity_of_inode *pce;
+    int nr, ret = 0;
+
+    pthread_mutex_lock(&page_cache.dirty_lock);
+    nr = page_cache.stat.nr_dirty_inodes;
+    page_cache.stat.nr_write_back_rounds++;
+    pthread_mutex_unlock(&page_cache.dirty_lock);
+
+    /*
+     * Rotate each inode picked to the tail, so that every inode is visited
+     * once even if it is dirtied again. A page_cache_entity_of_inode is
+     * never freed, so it can be used after dirty_lock is released.
+     */
+    while (nr-- > 0) {
+        pthread_mutex_lock(&page_cache.dirty_lock);
+        if (list_empty(&page_cache.dirty_inodes)) {
+            pthread_mutex_unlock(&page_cache.dirty_lock);
+            break;
+        }
+        pce = list_entry(page_cache.dirty_inodes.next,
+                         struct page_cache_entity_of_inode,
+                         dirty_inode_node);
+        list_del(&pce->dirty_inode_node);
+        list_append(&pce->dirty_inode_node, &page_cache.dirty_inodes);
+        pthread_mutex_unlock(&page_cache.dirty_lock);
+
+        if (write_back_pages_of_inode(pce) != 0)
+            ret = -1;
+    }
+
+    return ret;
+}
+
+/*
+ * Write back all dirty pages periodically, or early once the dirty pages
+ * exceed DIRTY_BACKGROUND_RATIO.
+ */
 void *write_back_routine(void *args)
 {
     struct timespec ts;
 
     while (1) {
-        pthread_mutex_lock(&page_cache.page_cache_lock);
-        if (page_cache.cache_strategy == WRITE_BACK) {
-            page_cache_debug(
-                "[write_back_routine] write back routine started.\n");
-            write_back_all_pages();
-            page_cache_debug(
-                "[write_back_routine] write back routine completed.\n");
+        pthread_mutex_lock(&page_cache.dirty_lock);
+        if (!over_dirty_thresh(DIRTY_BACKGROUND_RATIO)) {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += WRITE_BACK_CYCLE;
+            pthread_cond_timedwait(
+                &page_cache.write_back_cond, &page_cache.dirty_lock, &ts);
         }
-        pthread_mutex_unlock(&page_cache.page_cache_lock);
+        pthread_mutex_unlock(&page_cache.dirty_lock);
 
-        ts.tv_sec = WRITE_BACK_CYCLE;
-        ts.tv_nsec = 0;
-        nanosleep(&ts, NULL);
+        /* Pages dirtied before switching the strategy are written too. */
+        page_cache_debug("[write_back_routine] write back routine started.\n");
+        write_back_all_pages();
+        page_cache_debug(
+            "[write_back_routine] write back routine completed.\n");
     }
 
     return NULL;
 }
 
+/* ++++++++++++++++++++++++++++++++ Read-ahead ++++++++++++++++++++++++++++++ */
+/* Fill @nr new pages from @file_page_idx, with one file_read_pages if any. */
+static void read_pages(struct page_cache_entity_of_inode *pce,
+                       pidx_t file_page_idx, int nr, struct cached_page **pages)
+{
+    char *buf = NULL;
+    int i;
+
+    if (nr > 1 && page_cache.user_func.file_read_pages)
+        buf = malloc(nr * CACHED_PAGE_SIZE);
+
+    if (buf) {
+        page_cache.user_func.file_read_pages(
+            buf, file_page_idx, nr, pce->private_data);
+        for (i = 0; i < nr; ++i)
+            memcpy(pages[i]->content,
+                   buf + i * CACHED_PAGE_SIZE,
+                   CACHED_PAGE_SIZE);
+        free(buf);
+    } else {
+        for (i = 0; i < nr; ++i)
+            page_cache.user_func.file_read(
+                pages[i]->content, file_page_idx + i, pce->private_data);
+    }
+
+#ifdef TEST_COUNT_PAGE_CACHE
+    count.miss = count.miss + nr;
+#endif
+}
+
+/*
+ * Read the uncached pages among @nr pages from @file_page_idx into the
+ * cache. Each batch of adjacent uncached pages is added write-locked, and
+ * filled after pce_rwlock is released, so other pages of the inode can be
+ * accessed meanwhile.
+ */
+static void fill_pages(struct page_cache_entity_of_inode *pce,
+                       pidx_t file_page_idx, int nr)
+{
+    struct cached_page *pages[PAGE_CACHE_BATCH_PAGES];
+    bool shrink[PAGE_CACHE_SHARD_NR] = {false};
+    struct page_cache_shard *shard;
+    pidx_t idx = file_page_idx, end = file_page_idx + nr;
+    int cnt, i;
+
+    while (idx < end) {
+        pthread_rwlock_wrlock(&pce->pce_rwlock);
+        while (idx < end && get_node_from_page_cache_entity(pce, idx))
+            idx++;
+        for (cnt = 0; cnt < PAGE_CACHE_BATCH_PAGES && idx + cnt < end
+                      && !get_node_from_page_cache_entity(pce, idx + cnt);
+             ++cnt) {
+            pages[cnt] = new_page(pce, idx + cnt);
+            if (pages[cnt] == NULL)
+                break;
+            pthread_rwlock_wrlock(&pages[cnt]->page_rwlock);
+
+            shard = page_shard(pages[cnt]);
+            lock_shard(shard);
+            cached_pages_list_append_node(
+                &shard->inactive_list, pages[cnt], INACTIVE_LIST);
+            pthread_mutex_unlock(&shard->lock);
+            shrink[pages[cnt]->shard_idx] = true;
+        }
+
+        pthread_rwlock_unlock(&pce->pce_rwlock);
+        if (cnt == 0)
+            break;
+
+        read_pages(pce, idx, cnt, pages);
+        for (i = 0; i < cnt; ++i)
+            pthread_rwlock_unlock(&pages[i]->page_rwlock);
+        idx += cnt;
+    }
+
+    for (i = 0; i < PAGE_CACHE_SHARD_NR; ++i)
+        if (shrink[i])
+            shrink_shard(&page_cache.shards[i]);
+}
+
+/*
+ * Prefetch queued windows in background.
+ * The pce handlers may be run by fill_pages and shrink_shard, so the
+ * requests are served under fs_wrapper_meta_rwlock like reads from IPC,
+ * and the reference taken by read_ahead_async is dropped with it
+ * write-locked, as dropping the last one frees the vnode.
+ */
+void *read_ahead_routine(void *args)
+{
+    struct read_ahead_request *req;
+
+    while (1) {
+        pthread_mutex_lock(&page_cache.ra_lock);
+        while (list_empty(&page_cache.ra_queue))
+            pthread_cond_wait(&page_cache.ra_cond, &page_cache.ra_lock);
+        req = list_entry(
+            page_cache.ra_queue.next, struct read_ahead_request, node);
+        list_del(&req->node);
+        page_cache.ra_queue_len--;
+        pthread_mutex_unlock(&page_cache.ra_lock);
+
+        page_cache_debug("[read_ahead_routine] prefetch %d:%d, %d pages.\n",
+                         req->pce->host_idx,
+                         req->file_page_idx,
+                         req->nr_pages);
+        pthread_rwlock_rdlock(&fs_wrapper_meta_rwlock);
+        fill_pages(req->pce, req->file_page_idx, req->nr_pages);
+        pthread_rwlock_unlock(&fs_wrapper_meta_rwlock);
+
+        pthread_rwlock_wrlock(&fs_wrapper_meta_rwlock);
+        call_pce_handler(page_cache.user_func.handler_pce_turns_empty,
+                         req->pce->private_data);
+        pthread_rwlock_unlock(&fs_wrapper_meta_rwlock);
+        free(req);
+    }
+
+    return NULL;
+}
+
+/*
+ * Queue a window to be prefetched, or drop it if the queue is full.
+ * The queued request holds a reference of the vnode in private_data,
+ * taken with the pce-turns-nonempty handler. The caller holds one as
+ * well, either by an open file or by a mapping, so the one taken here
+ * is never the last to drop on failure.
+ */
+static void read_ahead_async(struct page_cache_entity_of_inode *pce,
+                             pidx_t file_page_idx, int nr_pages)
+{
+    struct read_ahead_request *req;
+
+    req = (struct read_ahead_request *)malloc(sizeof(*req));
+    if (req == NULL)
+        return;
+    req->pce = pce;
+    req->file_page_idx = file_page_idx;
+    req->nr_pages = nr_pages;
+
+    call_pce_handler(page_cache.user_func.handler_pce_turns_nonempty,
+                     pce->private_data);
+    pthread_mutex_lock(&page_cache.ra_lock);
+    if (page_cache.ra_queue_len >= READ_AHEAD_QUEUE_MAX) {
+        pthread_mutex_unlock(&page_cache.ra_lock);
+        call_pce_handler(page_cache.user_func.handler_pce_turns_empty,
+                         pce->private_data);
+        free(req);
+        return;
+    }
+    list_append(&req->node, &page_cache.ra_queue);
+    page_cache.ra_queue_len++;
+    pthread_cond_signal(&page_cache.ra_cond);
+    pthread_mutex_unlock(&page_cache.ra_lock);
+}
+
 /* +++++++++++++++++++++++++ Exposed Functions+++++++++++++++++++++++++++ */
 
 void fs_page_cache_init(PAGE_CACHE_STRATEGY strategy,
                         struct user_defined_funcs *uf)
 {
     pthread_t thread;
+    int i;
 
     memcpy(&page_cache.user_func, uf, sizeof(*uf));
 
-    cached_pages_list_init(&page_cache.active_list);
-    cached_pages_list_init(&page_cache.inactive_list);
+    for (i = 0; i < PAGE_CACHE_SHARD_NR; ++i) {
+        cached_pages_list_init(&page_cache.shards[i].active_list);
+        cached_pages_list_init(&page_cache.shards[i].inactive_list);
+        pthread_mutex_init(&page_cache.shards[i].lock, NULL);
+    }
     cached_pages_list_init(&page_cache.pinned_pages_list);
+    pthread_mutex_init(&page_cache.pinned_lock, NULL);
+
+    init_list_head(&page_cache.dirty_inodes);
+    pthread_mutex_init(&page_cache.dirty_lock, NULL);
+    pthread_cond_init(&page_cache.write_back_cond, NULL);
+    pthread_mutex_init(&page_cache.handler_lock, NULL);
+
+    init_list_head(&page_cache.ra_queue);
+    pthread_mutex_init(&page_cache.ra_lock, NULL);
+    pthread_cond_init(&page_cache.ra_cond, NULL);
 
     page_cache.cache_strategy = strategy;
     pthread_create(&thread, 0, write_back_routine, NULL);
-
-    pthread_mutex_init(&page_cache.page_cache_lock, NULL);
+    pthread_create(&thread, 0, read_ahead_routine, NULL);
 
     page_cache_debug("fs page cache init finished.\n");
 }
@@ -535,6 +1110,10 @@ new_page_cache_entity_of_inode(ino_t host_idx, void *private_data)
 
     cached_pages_list_init(&pce->pages);
     init_radix(&pce->idx2page);
+    pthread_rwlock_init(&pce->pce_rwlock, NULL);
+    pthread_mutex_init(&pce->fault_ra_lock, NULL);
+    init_list_head(&pce->dirty_pages);
+    init_list_head(&pce->dirty_inode_node);
 
 out:
     return pce;
@@ -542,38 +1121,117 @@ out:
 
 int page_cache_switch_strategy(PAGE_CACHE_STRATEGY new_strategy)
 {
-    if (page_cache.cache_strategy == new_strategy)
-        return 0;
+    PAGE_CACHE_STRATEGY old_strategy = page_cache.cache_strategy;
 
-    pthread_mutex_lock(&page_cache.page_cache_lock);
-
-    if (page_cache.cache_strategy == WRITE_BACK) {
-        /* Write back all the pages. */
-        write_back_all_pages();
-    }
+    if (old_strategy == new_strategy)
+        return 0;
 
     page_cache_debug(
         "[page_cache_switch_strategy] switch cache strategy from %d to %d\n",
-        page_cache.cache_strategy,
+        old_strategy,
         new_strategy);
     page_cache.cache_strategy = new_strategy;
 
-    pthread_mutex_unlock(&page_cache.page_cache_lock);
+    if (old_strategy == WRITE_BACK) {
+        /* Write back all the pages. */
+        write_back_all_pages();
+    }
 
     return 0;
 }
 
+void page_cache_get_stat(struct page_cache_stat *stat)
+{
+    pthread_mutex_lock(&page_cache.dirty_lock);
+    memcpy(stat, &page_cache.stat, sizeof(*stat));
+    pthread_mutex_unlock(&page_cache.dirty_lock);
+}
+
+/* Account a new read-ahead window, which can be seen by FS_REQ_TEST_PERF. */
+static void ra_stat_window(struct page_cache_ra_state *ra, bool async)
+{
+    pthread_mutex_lock(&page_cache.dirty_lock);
+    if (async)
+        page_cache.stat.nr_ra_async_windows++;
+    else
+        page_cache.stat.nr_ra_sync_windows++;
+    if (ra->size > page_cache.stat.max_ra_window)
+        page_cache.stat.max_ra_window = ra->size;
+    pthread_mutex_unlock(&page_cache.dirty_lock);
+}
+
+void page_cache_readahead(struct page_cache_entity_of_inode *pce,
+                          struct page_cache_ra_state *ra,
+                          pidx_t file_page_idx, int nr_pages,
+                          pidx_t nr_file_pages)
+{
+    pidx_t last_idx = file_page_idx + nr_pages - 1;
+    bool sequential;
+    int size;
+
+    if (nr_pages <= 0 || file_page_idx >= nr_file_pages)
+        return;
+
+    sequential = file_page_idx == ra->prev_page
+                 || file_page_idx == ra->prev_page + 1;
+    ra->prev_page = last_idx;
+
+    if (!sequential) {
+        /* Random access, only read the requested pages in batch. */
+        ra->size = 0;
+        fill_pages(pce, file_page_idx, nr_pages);
+        return;
+    }
+
+    if (ra->size == 0 || file_page_idx < ra->prev_start
+        || last_idx >= ra->start + ra->size) {
+        /*
+         * Out of the window, start a new one from here synchronously.
+         * Reading the first page after the requested ones triggers the
+         * asynchronous read-ahead of the next window.
+         */
+        size = MIN(nr_pages * 2, READ_AHEAD_MAX_PAGES);
+        if (size < READ_AHEAD_MIN_PAGES)
+            size = READ_AHEAD_MIN_PAGES;
+        if (size < nr_pages)
+            size = nr_pages;
+        ra->prev_start = file_page_idx;
+        ra->start = file_page_idx;
+        ra->size = size;
+        ra->async_size = ra->size - nr_pages;
+        ra_stat_window(ra, false);
+        fill_pages(pce,
+                   ra->start,
+                   MIN(ra->size, nr_file_pages - ra->start));
+    } else if (ra->async_size > 0
+               && last_idx >= ra->start + ra->size - ra->async_size) {
+        /*
+         * Hit the trigger page, prefetch the next window in background.
+         * The rest of the current window stays in the window, and reading
+         * the first page of the next one triggers the one after it.
+         */
+        ra->prev_start = ra->start;
+        ra->start += ra->size;
+        ra->size = MIN(ra->size * 2, READ_AHEAD_MAX_PAGES);
+        ra->async_size = ra->size;
+        ra_stat_window(ra, true);
+        if (ra->start < nr_file_pages)
+            read_ahead_async(
+                pce, ra->start, MIN(ra->size, nr_file_pages - ra->start));
+    }
+}
+
 int page_cache_check_page(struct page_cache_entity_of_inode *pce,
                           pidx_t file_page_idx)
 {
     struct cached_page *p;
 
-    pthread_mutex_lock(&page_cache.page_cache_lock);
+    pthread_rwlock_rdlock(&pce->pce_rwlock);
 
     /* Find corresponding page from pce list. */
     p = get_node_from_page_cache_entity(pce, file_page_idx);
 
-    pthread_mutex_unlock(&page_cache.page_cache_lock);
+    pthread_rwlock_unlock(&pce->pce_rwlock);
 
     if (p == NULL)
         return 0;
@@ -581,123 +1239,228 @@ int page_cache_check_page(struct page_cache_entity_of_inode *pce,
         return 1;
 }
 
-/* Only boost_page in page_cache_get_block_or_page. */
-void page_cache_put_block_or_page(struct page_cache_entity_of_inode *pce,
-                                  pidx_t file_page_idx, int page_block_idx,
-                                  PAGE_CACHE_OPERATION_TYPE op_type)
+/*
+ * Find or create @nr pages from @file_page_idx and grab their locks in
+ * ascending order, all under one acquisition of pce_rwlock. Cache hits
+ * only take it as a reader.
+ * Return: if succeed, return 0 and the pages in @pages,
+ *	 if failed, return -1.
+ */
+static int get_pages(struct page_cache_entity_of_inode *pce,
+                     pidx_t file_page_idx, int nr,
+                     PAGE_CACHE_OPERATION_TYPE op_type,
+                     struct cached_page **pages)
 {
-    struct cached_page *p;
+    bool shrink[PAGE_CACHE_SHARD_NR] = {false};
     bool is_new;
+    int i;
 
-    BUG_ON(page_block_idx < -1 || page_block_idx >= BLOCK_PER_PAGE);
-    BUG_ON(op_type != READ && op_type != WRITE);
+    BUG_ON(nr <= 0 || nr > PAGE_CACHE_BATCH_PAGES);
 
-    pthread_mutex_lock(&page_cache.page_cache_lock);
+    pthread_rwlock_rdlock(&pce->pce_rwlock);
+    for (i = 0; i < nr; ++i) {
+        pages[i] = get_node_from_page_cache_entity(pce, file_page_idx + i);
+        if (pages[i] == NULL)
+            break;
+        /* Cache hit, the page is boosted when its shard is aged. */
+        pages[i]->referenced = true;
+    }
 
-    p = find_or_new_page(pce, file_page_idx, &is_new);
-    if (p == NULL)
-        goto out;
+    if (i < nr) {
+        /* Some pages are missing, retry as a writer who can add pages. */
+        pthread_rwlock_unlock(&pce->pce_rwlock);
+        pthread_rwlock_wrlock(&pce->pce_rwlock);
+
+        for (i = 0; i < nr; ++i) {
+            pages[i] =
+                find_or_new_page(pce, file_page_idx + i, &is_new);
+            if (pages[i] == NULL) {
+                pthread_rwlock_unlock(&pce->pce_rwlock);
+                return -1;
+            }
+            /* New allocated pages should not be boosted. */
+            if (is_new)
+                shrink[pages[i]->shard_idx] = true;
+            else
+                pages[i]->referenced = true;
+        }
+    } else {
+#ifdef TEST_COUNT_PAGE_CACHE
+        count.hit = count.hit + nr;
+#endif
+    }
 
-    /* Target page must be existed. */
-    BUG_ON(is_new == true);
+    /* Grab read or write lock of the pages, which pins them in the cache. */
+    for (i = 0; i < nr; ++i) {
+        if (op_type == READ)
+            pthread_rwlock_rdlock(&pages[i]->page_rwlock);
+        else
+            pthread_rwlock_wrlock(&pages[i]->page_rwlock);
+    }
+
+    pthread_rwlock_unlock(&pce->pce_rwlock);
+
+    /* Make room for the new pages. */
+    for (i = 0; i < PAGE_CACHE_SHARD_NR; ++i)
+        if (shrink[i])
+            shrink_shard(&page_cache.shards[i]);
+
+    return 0;
+}
+
+/*
+ * Release @nr pages from @file_page_idx got by get_pages. Written pages
+ * should have been marked dirty, and are handled by the cache strategy.
+ * Return 0, or -1 if writing them through fails, where the blocks not
+ * written stay dirty in the cache.
+ */
+static int put_pages(struct page_cache_entity_of_inode *pce,
+                     pidx_t file_page_idx, int nr,
+                     PAGE_CACHE_OPERATION_TYPE op_type,
+                     struct cached_page **pages)
+{
+    PAGE_CACHE_STRATEGY strategy = page_cache.cache_strategy;
+    struct cached_page *p;
+    int i, ret = 0;
 
     /* Nothing need to be done when handling read operations. */
     if (op_type == READ) {
-        pthread_rwlock_unlock(&p->page_rwlock);
-        goto out;
+        for (i = 0; i < nr; ++i)
+            pthread_rwlock_unlock(&pages[i]->page_rwlock);
+        return 0;
     }
 
     /* Handling write operation. */
-    switch (page_cache.cache_strategy) {
-    case DIRECT:
-        /* Directly write block or page to disk. */
-        if (page_block_idx != -1) {
-            set_block_or_page_dirty(p, page_block_idx, true);
-            if (flush_single_block(p, page_block_idx) != 0)
-                BUG("[pc_set_block_or_page] file_write failed.\n");
-        } else {
-            set_block_or_page_dirty(p, -1, true);
-            if (flush_single_page(p) != 0)
-                BUG("[pc_set_block_or_page] file_write failed.\n");
+    if (strategy == WRITE_BACK)
+        dirty_set_add(pages, nr);
+
+    for (i = 0; i < nr; ++i) {
+        /* Directly write dirty blocks to disk unless writing back. */
+        if (strategy != WRITE_BACK && flush_single_page(pages[i]) != 0) {
+            keep_unflushed_page(pages[i]);
+            ret = -1;
         }
 
         /* Must unlock before freeing. */
-        pthread_rwlock_unlock(&p->page_rwlock);
+        pthread_rwlock_unlock(&pages[i]->page_rwlock);
+    }
 
-        /*
-         * Invalidate and free outdated cache.
-         * There won't be any use-after-free error because
-         * page_cache_lock protect us from this error.
-         */
-        flush_and_free_page(p);
-        break;
+    /* Throttle the writer by writing back its inode by itself. */
+    if (strategy == WRITE_BACK && over_dirty_thresh(DIRTY_RATIO))
+        write_back_pages_of_inode(pce);
 
-    case WRITE_BACK:
-        /* Mark this block or page as dirty. */
-        set_block_or_page_dirty(p, page_block_idx, true);
+    /* Keep the dirty pages if failed, which are retried by write-back. */
+    if (strategy != DIRECT || ret != 0)
+        return ret;
 
-        pthread_rwlock_unlock(&p->page_rwlock);
-        break;
+    /*
+     * Invalidate and free outdated cache. The pages may have been evicted
+     * once unlocked, so look them up again.
+     */
+    pthread_rwlock_wrlock(&pce->pce_rwlock);
+    for (i = 0; i < nr; ++i) {
+        p = get_node_from_page_cache_entity(pce, file_page_idx + i);
+        if (p && flush_and_free_page(p) != 0)
+            ret = -1;
+    }
+    pthread_rwlock_unlock(&pce->pce_rwlock);
+    return ret;
+}
 
-    case WRITE_THROUGH:
-        /* Directly write block or page to disk. */
-        if (page_block_idx != -1) {
-            set_block_or_page_dirty(p, page_block_idx, true);
-            if (flush_single_block(p, page_block_idx) != 0)
-                BUG("[pc_set_block_or_page] file_write failed.\n");
-        } else {
-            set_block_or_page_dirty(p, -1, true);
-            if (flush_single_page(p) != 0)
-                BUG("[pc_set_block_or_page] file_write failed.\n");
-        }
+int page_cache_put_block_or_page(struct page_cache_entity_of_inode *pce,
+                                 pidx_t file_page_idx, int page_block_idx,
+                                 PAGE_CACHE_OPERATION_TYPE op_type)
+{
+    struct cached_page *p;
 
-        pthread_rwlock_unlock(&p->page_rwlock);
-        break;
-    }
+    BUG_ON(page_block_idx < -1 || page_block_idx >= BLOCK_PER_PAGE);
+    BUG_ON(op_type != READ && op_type != WRITE);
 
-out:
-    pthread_mutex_unlock(&page_cache.page_cache_lock);
+    /* The caller holds the page lock, so the page cannot be freed. */
+    pthread_rwlock_rdlock(&pce->pce_rwlock);
+    p = get_node_from_page_cache_entity(pce, file_page_idx);
+    pthread_rwlock_unlock(&pce->pce_rwlock);
+
+    /* Target page must be existed. */
+    BUG_ON(p == NULL);
+
+    /* Mark this block or page as dirty. */
+    if (op_type == WRITE)
+        set_block_or_page_dirty(p, page_block_idx, true);
+
+    return put_pages(pce, file_page_idx, 1, op_type, &p);
 }
 
-/* Only boost_page when calling page_cache_get_block_or_page. */
+/*
+ * Only mark the page as referenced when calling page_cache_get_block_or_page,
+ * and a cache hit takes nothing but pce_rwlock as a reader.
+ */
 char *page_cache_get_block_or_page(struct page_cache_entity_of_inode *pce,
                                    pidx_t file_page_idx, int page_block_idx,
                                    PAGE_CACHE_OPERATION_TYPE op_type)
 {
     struct cached_page *p;
-    bool is_new;
-    char *buf;
 
     BUG_ON(page_block_idx < -1 || page_block_idx >= BLOCK_PER_PAGE);
     BUG_ON(op_type != READ && op_type != WRITE);
 
-    pthread_mutex_lock(&page_cache.page_cache_lock);
-
-    p = find_or_new_page(pce, file_page_idx, &is_new);
-    if (p == NULL) {
-        buf = NULL;
-        goto out;
-    }
-
-    /* Grab read or write lock of this page. */
-    if (op_type == READ)
-        pthread_rwlock_rdlock(&p->page_rwlock);
-    else
-        pthread_rwlock_wrlock(&p->page_rwlock);
+    if (get_pages(pce, file_page_idx, 1, op_type, &p) != 0)
+        return NULL;
 
     /* Read from corresponding cached page. */
     if (page_block_idx != -1)
-        buf = p->content + page_block_idx * CACHED_BLOCK_SIZE;
+        return p->content + page_block_idx * CACHED_BLOCK_SIZE;
     else
-        buf = p->content;
+        return p->content;
+}
 
-    /* New allocated pages should not be boosted. */
-    if (is_new == false)
-        boost_page(p);
+ssize_t page_cache_rw_range(struct page_cache_entity_of_inode *pce,
+                            off_t offset, size_t size, char *buf,
+                            PAGE_CACHE_OPERATION_TYPE op_type)
+{
+    struct cached_page *pages[PAGE_CACHE_BATCH_PAGES];
+    pidx_t first_idx, last_idx;
+    size_t copied = 0, copied_before, page_off, copy_size;
+    int nr, i, block_idx;
 
-out:
-    pthread_mutex_unlock(&page_cache.page_cache_lock);
-    return buf;
+    BUG_ON(op_type != READ && op_type != WRITE);
+
+    if (size == 0)
+        return 0;
+
+    last_idx = (offset + size - 1) / CACHED_PAGE_SIZE;
+    while (copied < size) {
+        first_idx = (offset + copied) / CACHED_PAGE_SIZE;
+        nr = MIN(last_idx - first_idx + 1, PAGE_CACHE_BATCH_PAGES);
+        copied_before = copied;
+
+        if (get_pages(pce, first_idx, nr, op_type, pages) != 0)
+            return copied ? copied : -1;
+
+        for (i = 0; i < nr; ++i) {
+            page_off = (offset + copied) % CACHED_PAGE_SIZE;
+            copy_size = MIN(CACHED_PAGE_SIZE - page_off, size - copied);
+
+            if (op_type == READ) {
+                memcpy(buf + copied, pages[i]->content + page_off, copy_size);
+            } else {
+                memcpy(pages[i]->content + page_off, buf + copied, copy_size);
+                /* Mark all the blocks written as dirty. */
+                for (block_idx = page_off / CACHED_BLOCK_SIZE;
+                     block_idx * CACHED_BLOCK_SIZE < page_off + copy_size;
+                     ++block_idx)
+                    pages[i]->dirty[block_idx] = true;
+            }
+
+            copied += copy_size;
+        }
+
+        /* Only report the bytes before the batch failed to be written. */
+        if (put_pages(pce, first_idx, nr, op_type, pages) != 0)
+            return copied_before ? copied_before : -1;
+    }
+
+    return copied;
 }
 
 int page_cache_flush_block_or_page(struct page_cache_entity_of_inode *pce,
@@ -708,7 +1471,7 @@ int page_cache_flush_block_or_page(struct page_cache_entity_of_inode *pce,
 
     BUG_ON(page_block_idx < -1 || page_block_idx >= BLOCK_PER_PAGE);
 
-    pthread_mutex_lock(&page_cache.page_cache_lock);
+    pthread_rwlock_rdlock(&pce->pce_rwlock);
 
     p = get_node_from_page_cache_entity(pce, file_page_idx);
     if (p == NULL) {
@@ -719,108 +1482,109 @@ int page_cache_flush_block_or_page(struct page_cache_entity_of_inode *pce,
 
     pthread_rwlock_rdlock(&p->page_rwlock);
     if (page_block_idx != -1)
-        flush_single_block(p, page_block_idx);
+        ret = flush_single_block(p, page_block_idx);
     else
-        flush_single_page(p);
+        ret = flush_single_page(p);
 
 out:
     if (p)
         pthread_rwlock_unlock(&p->page_rwlock);
-    pthread_mutex_unlock(&page_cache.page_cache_lock);
+    pthread_rwlock_unlock(&pce->pce_rwlock);
     return ret;
 }
 
 int page_cache_flush_pages_of_inode(struct page_cache_entity_of_inode *pce)
 {
-    struct cached_page *p;
-    int ret = 0;
-
-    pthread_mutex_lock(&page_cache.page_cache_lock);
+    int ret;
 
     page_cache_debug(
         "[page_cache_flush_pages_of_inode] write back inode pages started.\n");
 
-    /* Write back pages that belongs to an inode. */
-    for_each_in_list (
-        p, struct cached_page, inode_pages_node, &pce->pages.queue) {
-        pthread_rwlock_rdlock(&p->page_rwlock);
-        if (flush_single_page(p) != 0) {
-            ret = -1;
-            goto fail_unlock;
-        }
-        pthread_rwlock_unlock(&p->page_rwlock);
-    }
+    /* Write back only the dirty blocks of the inode, coalesced in runs. */
+    ret = write_back_pages_of_inode(pce);
 
     page_cache_debug(
         "[page_cache_flush_pages_of_inode] write back inode pages finished.\n");
-    goto out;
-
-fail_unlock:
-    pthread_rwlock_unlock(&p->page_rwlock);
-out:
-    pthread_mutex_unlock(&page_cache.page_cache_lock);
     return ret;
 }
 
 int page_cache_flush_all_pages(void)
 {
-    pthread_mutex_lock(&page_cache.page_cache_lock);
+    int ret;
 
     page_cache_debug("[page_cache_flush_all_pages] flush all pages started.\n");
 
-    write_back_all_pages();
+    ret = write_back_all_pages();
 
     page_cache_debug(
         "[page_cache_flush_all_pages] flush all pages finished.\n");
 
-    pthread_mutex_unlock(&page_cache.page_cache_lock);
-    return 0;
+    return ret;
 }
 
 int page_cache_pin_single_page(struct page_cache_entity_of_inode *pce,
                                pidx_t file_page_idx)
 {
+    struct page_cache_shard *shard = NULL;
     struct cached_page *p;
+    bool is_new;
     int ret = 0;
 
-    pthread_mutex_lock(&page_cache.page_cache_lock);
-
     /* Check max pinned pages. */
-    if (page_cache.pinned_pages_list.size == MAX_PINNED_PAGE) {
+    if (page_cache.pinned_pages_list.size >= MAX_PINNED_PAGE) {
         page_cache_debug("pinned pages number reach limits.\n");
-        ret = -1;
-        goto out;
+        return -1;
     }
 
+    pthread_rwlock_wrlock(&pce->pce_rwlock);
+
     /* Find target page, if not found, create one. */
-    p = find_or_new_page(pce, file_page_idx, NULL);
+    p = find_or_new_page(pce, file_page_idx, &is_new);
     if (p == NULL) {
         ret = -1;
         goto out;
     }
+    if (is_new)
+        shard = page_shard(p);
 
-    /* Remove this page from two lists. */
-    if (p->in_which_list == ACTIVE_LIST) {
-        cached_pages_list_delete_node(&page_cache.active_list, p, ACTIVE_LIST);
-    } else if (p->in_which_list == INACTIVE_LIST) {
-        cached_pages_list_delete_node(
-            &page_cache.inactive_list, p, INACTIVE_LIST);
-    } else if (p->in_which_list == PINNED_PAGES_LIST) {
+    if (p->in_which_list == PINNED_PAGES_LIST) {
         /* Page already pinned. */
         ret = 0;
         goto out;
-    } else {
+    } else if (p->in_which_list != ACTIVE_LIST
+               && p->in_which_list != INACTIVE_LIST) {
         BUG("Invalid list type.\n");
         ret = -1;
         goto out;
     }
 
-    /* Insert this page to pinned pages list. */
-    cached_pages_list_append_node(
-        &page_cache.pinned_pages_list, p, PINNED_PAGES_LIST);
+    pthread_mutex_lock(&page_shard(p)->lock);
+    pthread_mutex_lock(&page_cache.pinned_lock);
+
+    if (page_cache.pinned_pages_list.size >= MAX_PINNED_PAGE) {
+        page_cache_debug("pinned pages number reach limits.\n");
+        ret = -1;
+    } else {
+        /* Remove this page from two lists. */
+        if (p->in_which_list == ACTIVE_LIST)
+            cached_pages_list_delete_node(
+                &page_shard(p)->active_list, p, ACTIVE_LIST);
+        else
+            cached_pages_list_delete_node(
+                &page_shard(p)->inactive_list, p, INACTIVE_LIST);
+
+        /* Insert this page to pinned pages list. */
+        cached_pages_list_append_node(
+            &page_cache.pinned_pages_list, p, PINNED_PAGES_LIST);
+    }
+
+    pthread_mutex_unlock(&page_cache.pinned_lock);
+    pthread_mutex_unlock(&page_shard(p)->lock);
 
 out:
-    pthread_mutex_unlock(&page_cache.page_cache_lock);
+    pthread_rwlock_unlock(&pce->pce_rwlock);
+    if (shard)
+        shrink_shard(shard);
     return ret;
 }
 
@@ -830,7 +1594,7 @@ int page_cache_unpin_single_page(struct page_cache_entity_of_inode *pce,
     struct cached_page *p;
     int ret = 0;
 
-    pthread_mutex_lock(&page_cache.page_cache_lock);
+    pthread_rwlock_wrlock(&pce->pce_rwlock);
 
     /* Ensuring target page is already existed. */
     p = get_node_from_page_cache_entity(pce, file_page_idx);
@@ -851,10 +1615,10 @@ int page_cache_unpin_single_page(struct page_cache_entity_of_inode *pce,
      * Because we are unlikely to access this page again after we unpin it,
      * we just flush and free this page.
      */
-    flush_and_free_page(p);
+    ret = flush_and_free_page(p);
 
 out:
-    pthread_mutex_unlock(&page_cache.page_cache_lock);
+    pthread_rwlock_unlock(&pce->pce_rwlock);
     return ret;
 }
 
@@ -888,7 +1652,7 @@ int page_cache_evict_single_page(struct page_cache_entity_of_inode *pce,
     struct cached_page *p;
     int ret = 0;
 
-    pthread_mutex_lock(&page_cache.page_cache_lock);
+    pthread_rwlock_wrlock(&pce->pce_rwlock);
 
     /* Ensuring target page is already existing. */
     p = get_node_from_page_cache_entity(pce, file_page_idx);
@@ -903,10 +1667,10 @@ int page_cache_evict_single_page(struct page_cache_entity_of_inode *pce,
                      p->owner->host_idx,
                      p->file_page_idx,
                      p->in_which_list);
-    flush_and_free_page(p);
+    ret = flush_and_free_page(p);
 
 out:
-    pthread_mutex_unlock(&page_cache.page_cache_lock);
+    pthread_rwlock_unlock(&pce->pce_rwlock);
     return ret;
 }
 
@@ -915,8 +1679,9 @@ int page_cache_evict_pages_of_inode(struct page_cache_entity_of_inode *pce)
     struct cached_page **p_array;
     struct cached_page *p;
     int queue_size, i = 0;
+    int ret = 0;
 
-    pthread_mutex_lock(&page_cache.page_cache_lock);
+    pthread_rwlock_wrlock(&pce->pce_rwlock);
 
     queue_size = pce->pages.size;
     p_array = (struct cached_page **)calloc(pce->pages.size,
@@ -934,13 +1699,15 @@ int page_cache_evict_pages_of_inode(struct page_cache_entity_of_inode *pce)
                          p_array[i]->owner->host_idx,
                          p_array[i]->file_page_idx,
                          p_array[i]->in_which_list);
-        flush_and_free_page(p_array[i]);
+        /* Go on evicting the others, and keep the page failed to flush. */
+        if (flush_and_free_page(p_array[i]) != 0)
+            ret = -1;
     }
 
     free(p_array);
 
-    pthread_mutex_unlock(&page_cache.page_cache_lock);
-    return 0;
+    pthread_rwlock_unlock(&pce->pce_rwlock);
+    return ret;
 }
 
 int page_cache_delete_single_page(struct page_cache_entity_of_inode *pce,
@@ -949,7 +1716,7 @@ int page_cache_delete_single_page(struct page_cache_entity_of_inode *pce,
     struct cached_page *p;
     int ret = 0;
 
-    pthread_mutex_lock(&page_cache.page_cache_lock);
+    pthread_rwlock_wrlock(&pce->pce_rwlock);
 
     /* Ensuring target page is already existing. */
     p = get_node_from_page_cache_entity(pce, file_page_idx);
@@ -964,10 +1731,10 @@ int page_cache_delete_single_page(struct page_cache_entity_of_inode *pce,
                      p->owner->host_idx,
                      p->file_page_idx,
                      p->in_which_list);
-    free_page(p);
+    lock_and_free_page(p);
 
 out:
-    pthread_mutex_unlock(&page_cache.page_cache_lock);
+    pthread_rwlock_unlock(&pce->pce_rwlock);
     return ret;
 }
 
@@ -977,7 +1744,7 @@ int page_cache_delete_pages_of_inode(struct page_cache_entity_of_inode *pce)
     struct cached_page *p;
     int queue_size, i = 0;
 
-    pthread_mutex_lock(&page_cache.page_cache_lock);
+    pthread_rwlock_wrlock(&pce->pce_rwlock);
 
     queue_size = pce->pages.size;
     p_array = (struct cached_page **)calloc(pce->pages.size,
@@ -995,11 +1762,11 @@ int page_cache_delete_pages_of_inode(struct page_cache_entity_of_inode *pce)
                          p_array[i]->owner->host_idx,
                          p_array[i]->file_page_idx,
                          p_array[i]->in_which_list);
-        free_page(p_array[i]);
+        lock_and_free_page(p_array[i]);
     }
 
     free(p_array);
 
-    pthread_mutex_unlock(&page_cache.page_cache_lock);
+    pthread_rwlock_unlock(&pce->pce_rwlock);
     return 0;
 }
@@ -42,8 +42,39 @@
 #define MAX_PAGE_CACHE_PAGE \
     (ACTIVE_LIST_MAX + INACTIVE_LIST_MAX + MAX_PINNED_PAGE)
 
+/* The two lists are split into shards, each of which has its own lock. */
+#define PAGE_CACHE_SHARD_NR     8
+#define SHARD_ACTIVE_LIST_MAX   (ACTIVE_LIST_MAX / PAGE_CACHE_SHARD_NR)
+#define SHARD_INACTIVE_LIST_MAX (INACTIVE_LIST_MAX / PAGE_CACHE_SHARD_NR)
+
+/*
+ * Read-ahead window sizes in pages, and max windows queued for the
+ * read-ahead thread.
+ */
+#define READ_AHEAD_MIN_PAGES  4
+#define READ_AHEAD_MAX_PAGES  32
+#define READ_AHEAD_QUEUE_MAX  64
+
+/* Max number of pages locked at once by page_cache_rw_range. */
+#define PAGE_CACHE_BATCH_PAGES 32
+
 #define WRITE_BACK_CYCLE 300
 
+/*
+ * Percentage of MAX_PAGE_CACHE_PAGE. Above DIRTY_BACKGROUND_RATIO, the
+ * write-back thread is kicked before WRITE_BACK_CYCLE, and above
+ * DIRTY_RATIO, a writer writes back its inode by itself.
+ */
+#define DIRTY_BACKGROUND_RATIO 10
+#define DIRTY_RATIO            20
+
+/*
+ * Max blocks written back by one file_write, and max pages locked for a
+ * run: those it spans plus the next page being scanned.
+ */
+#define WRITE_BACK_RUN_BLOCKS (PAGE_CACHE_BATCH_PAGES * BLOCK_PER_PAGE)
+#define WRITE_BACK_RUN_PAGES  (WRITE_BACK_RUN_BLOCKS / BLOCK_PER_PAGE + 2)
+
 typedef off_t pidx_t;
 
 /* List types. */
@@ -93,6 +124,15 @@ struct cached_page {
      */
     PAGE_CACHE_LIST_TYPE in_which_list;
 
+    /* Index of the shard whose two lists hold this page. */
+    int shard_idx;
+
+    /*
+     * Set on each cache hit without any list lock. The page is promoted
+     * lazily when its shard is aged, see shrink_shard.
+     */
+    bool referenced;
+
     /* Used for 2-list strategy. */
     struct list_head two_list_node;
 
@@ -104,6 +144,10 @@ struct cached_page {
 
     /* Page lock. */
     pthread_rwlock_t page_rwlock;
+
+    /* Used for the dirty set of the owner, protected by dirty_lock. */
+    struct list_head dirty_node;
+    bool in_dirty_set;
 };
 
 struct cached_pages_list {
@@ -114,6 +158,22 @@ struct cached_pages_list {
     int size;
 };
 
+/*
+ * Read-ahead state of a sequential reader, e.g., an open file.
+ * Reading page (start + size - async_size) of the current window
+ * triggers prefetching the next window in background. All zero initially.
+ * Reads in [prev_start, start + size) are in the window: once the next
+ * window is prefetched, the rest of the previous one is still to be read.
+ */
+struct page_cache_ra_state {
+    pidx_t prev_start;
+    pidx_t start;
+    int size;
+    int async_size;
+    /* Last page read, to detect sequential reads. */
+    pidx_t prev_page;
+};
+
 struct page_cache_entity_of_inode {
     /* Owner inode index. */
     ino_t host_idx;
@@ -132,15 +192,47 @@ struct page_cache_entity_of_inode {
 
     /* Private data used for file read/write functions. */
     void *private_data;
+
+    /*
+     * Protects pages, idx2page and pages_cnt. Lookups grab it as a reader,
+     * while adding or removing pages grabs it as a writer.
+     */
+    pthread_rwlock_t pce_rwlock;
+
+    /*
+     * Dirty set: pages written under WRITE_BACK and not flushed yet.
+     * Protected by fs_page_cache.dirty_lock.
+     */
+    struct list_head dirty_pages;
+    int dirty_pages_cnt;
+
+    /* Used for fs_page_cache.dirty_inodes, if dirty_pages_cnt > 0. */
+    struct list_head dirty_inode_node;
+
+    /*
+     * Read-ahead of fmap faults, shared by the threads faulting on the
+     * inode with only the vnode read-locked, so protected by fault_ra_lock.
+     */
+    struct page_cache_ra_state fault_ra;
+    pthread_mutex_t fault_ra_lock;
 };
 
 /* Read a specific page from file. */
 typedef int (*file_reader_t)(char *buf, pidx_t file_page_idx,
                              void *private_data);
 
-/* Write a specific block or page(when page_block_idx == -1) to file. */
+/* Read @nr_pages pages of file from a specific page into @buf at once. */
+typedef int (*file_pages_reader_t)(char *buf, pidx_t file_page_idx,
+                                   int nr_pages, void *private_data);
+
+/*
+ * Write @nr_blocks blocks from block @page_block_idx of a specific page
+ * to file, which may go on into the following pages. If page_block_idx
+ * == -1, write the whole page.
+ */
 typedef int (*file_writer_t)(char *buf, pidx_t file_page_idx,
-                             int page_block_idx, void *private_data);
+                             int page_block_idx, int nr_blocks,
+                             void *private_data);
 
 typedef int (*event_handler_t)(void *private);
 
@@ -152,6 +244,12 @@ struct user_defined_funcs {
     file_reader_t file_read;
     file_writer_t file_write;
 
+    /*
+     * (Optional, NULL if not used)
+     * Fill multiple pages with one call when reading ahead
+     */
+    file_pages_reader_t file_read_pages;
+
     /*
      * (Optional, NULL if not used)
      * User may do something when pce turns empty to non-empty (combined
@@ -161,7 +259,7 @@ struct user_defined_funcs {
     event_handler_t handler_pce_turns_empty;
 };
 
-struct fs_page_cache {
+struct page_cache_shard {
     /*
      * Using two-list strategy to maintain caches.
      * Once a cold block is accessed, append it to second list. If a block
@@ -170,8 +268,70 @@ struct fs_page_cache {
     struct cached_pages_list active_list;
     struct cached_pages_list inactive_list;
 
+    /* Protects the two lists. */
+    pthread_mutex_t lock;
+};
+
+/* A window to be prefetched by the read-ahead thread. */
+struct read_ahead_request {
+    struct page_cache_entity_of_inode *pce;
+    pidx_t file_page_idx;
+    int nr_pages;
+    struct list_head node;
+};
+
+struct page_cache_stat {
+    /* Pages and inodes in the dirty sets. */
+    u64 nr_dirty_pages;
+    u64 nr_dirty_inodes;
+    /* Rounds of writing back all the dirty inodes. */
+    u64 nr_write_back_rounds;
+    /* file_write calls of coalesced runs, and blocks written by them. */
+    u64 nr_write_back_runs;
+    u64 nr_write_back_blocks;
+    /* Read-ahead windows read synchronously or prefetched, and the largest. */
+    u64 nr_ra_sync_windows;
+    u64 nr_ra_async_windows;
+    u64 max_ra_window;
+    /*
+     * Evicted pages, and victims skipped as busy or failing to be flushed.
+     * Contended acquisitions of the shard locks. These are updated
+     * atomically under the shard locks instead of dirty_lock.
+     */
+    u64 nr_evicted;
+    u64 nr_evict_busy;
+    u64 nr_evict_io_fails;
+    u64 nr_shard_contended;
+};
+
+/*
+ * Lock order: fault_ra_lock -> pce_rwlock -> page_rwlock -> shard lock
+ *             -> pinned_lock.
+ * dirty_lock is taken last, except while waiting for write-back kicks.
+ * ra_lock is never held with others.
+ * Eviction starts from a shard and only tries the locks of the victim.
+ */
+struct fs_page_cache {
+    /* A page is cached in the shard chosen by its inode and index. */
+    struct page_cache_shard shards[PAGE_CACHE_SHARD_NR];
+
     /* pinned pages list. */
     struct cached_pages_list pinned_pages_list;
+    pthread_mutex_t pinned_lock;
+
+    /* Inodes with a non-empty dirty set, in the order they get dirty. */
+    struct list_head dirty_inodes;
+    /* Protects the dirty sets, dirty_inodes and stat. */
+    pthread_mutex_t dirty_lock;
+    /* Kicks the write-back thread. */
+    pthread_cond_t write_back_cond;
+    struct page_cache_stat stat;
+
+    /* Queue of read_ahead_request, and the lock and kick of it. */
+    struct list_head ra_queue;
+    int ra_queue_len;
+    pthread_mutex_t ra_lock;
+    pthread_cond_t ra_cond;
 
     /* Each inode can use different cache strategy. */
     PAGE_CACHE_STRATEGY cache_strategy;
@@ -179,7 +339,8 @@ struct fs_page_cache {
     /* functions supported by page cache user */
     struct user_defined_funcs user_func;
 
-    pthread_mutex_t page_cache_lock;
+    /* Serializes the event handlers in user_func. */
+    pthread_mutex_t handler_lock;
 };
 
 /*
@@ -201,6 +362,23 @@ new_page_cache_entity_of_inode(ino_t host_idx, void *private_data);
  */
 int page_cache_switch_strategy(PAGE_CACHE_STRATEGY new_strategy);
 
+/*
+ * Read ahead for a read of @nr_pages pages from @file_page_idx, in a file
+ * of @nr_file_pages pages. The pages requested are read into the cache in
+ * batch. If the reads tracked by @ra are sequential, a window of pages is
+ * read ahead, and the next window is prefetched in background once the
+ * reads get close to its end.
+ */
+void page_cache_readahead(struct page_cache_entity_of_inode *pce,
+                          struct page_cache_ra_state *ra,
+                          pidx_t file_page_idx, int nr_pages,
+                          pidx_t nr_file_pages);
+
+/*
+ * Get the dirty page, write-back and read-ahead counters.
+ */
+void page_cache_get_stat(struct page_cache_stat *stat);
+
 /*
  * Check if a specific page has been cached.
  * Return: if page exists, return 1,
@@ -221,10 +399,24 @@ char *page_cache_get_block_or_page(struct page_cache_entity_of_inode *pce,
 
 /*
  * Put a block or a page to corresponding page cache.
+ * Return: if succeed, return 0,
+ *	 if failed to write it through, return -1, and it stays dirty.
+ */
+int page_cache_put_block_or_page(struct page_cache_entity_of_inode *pce,
+                                 pidx_t file_page_idx, int page_block_idx,
+                                 PAGE_CACHE_OPERATION_TYPE op_type);
+
+/*
+ * Copy @size bytes of the file from @offset to @buf (READ), or from @buf
+ * to the file (WRITE) via the page cache. Pages are found and locked
+ * PAGE_CACHE_BATCH_PAGES at a time with one acquisition of the inode lock,
+ * and the blocks written are marked dirty in bulk.
+ * Return: if succeed, return bytes copied,
+ *	 if failed, return -1.
  */
-void page_cache_put_block_or_page(struct page_cache_entity_of_inode *pce,
-                                  pidx_t file_page_idx, int page_block_idx,
-                                  PAGE_CACHE_OPERATION_TYPE op_type);
+ssize_t page_cache_rw_range(struct page_cache_entity_of_inode *pce,
+                            off_t offset, size_t size, char *buf,
+                            PAGE_CACHE_OPERATION_TYPE op_type);
 
 /*
  * Flush a block or a page in corresponding page cache,
@@ -239,7 +431,8 @@ int page_cache_flush_block_or_page(struct page_cache_entity_of_inode *pce,
 
 /*
  * Flush all dirty pages that belongs to an inode,
- * the cache still remains.
+ * the cache still remains. Dirty blocks are written in ascending order,
+ * and adjacent ones are coalesced into one file_write.
  * Return: if succeed, return 0,
  *	 if failed, return -1.
  */
@@ -59,6 +59,13 @@ vaddr_t fs_wrapper_fmap_get_page_addr(struct fs_vnode *vnode, off_t offset)
 
     if (using_page_cache) {
         page_idx = offset / PAGE_SIZE;
+        pthread_mutex_lock(&vnode->page_cache->fault_ra_lock);
+        page_cache_readahead(vnode->page_cache,
+                             &vnode->page_cache->fault_ra,
+                             page_idx,
+                             1,
+                             ROUND_UP(vnode->size, PAGE_SIZE) / PAGE_SIZE);
+        pthread_mutex_unlock(&vnode->page_cache->fault_ra_lock);
         page_buf = (vaddr_t)page_cache_get_block_or_page(
             vnode->page_cache, page_idx, -1, READ);
     } else {
@@ -79,6 +79,7 @@ void assign_entry(struct server_entry *e, u64 f, off_t o, int t, void *p,
     e->path = p;
     e->vnode = n;
     e->refcnt = t;
+    memset(&e->ra, 0, sizeof(e->ra));
 }
 
 void fs_vnode_init(void)
@@ -142,22 +143,26 @@ struct fs_vnode *get_fs_vnode_by_id(ino_t vnode_id)
     return rb_entry(node, struct fs_vnode, node);
 }
 
-/* refcnt for vnode */
+/*
+ * refcnt for vnode.
+ * Page faults and read-ahead take references without
+ * fs_wrapper_meta_rwlock, so the count is updated atomically.
+ */
 int inc_ref_fs_vnode(void *n)
 {
-    ((struct fs_vnode *)n)->refcnt++;
+    __atomic_add_fetch(&((struct fs_vnode *)n)->refcnt, 1, __ATOMIC_RELAXED);
     return 0;
 }
 
 int dec_ref_fs_vnode(void *node)
 {
-    int ret;
+    int ret, refcnt;
     struct fs_vnode *n = (struct fs_vnode *)node;
 
-    n->refcnt--;
-    assert(n->refcnt >= 0);
+    refcnt = __atomic_sub_fetch(&n->refcnt, 1, __ATOMIC_ACQ_REL);
+    assert(refcnt >= 0);
 
-    if (n->refcnt == 0) {
+    if (refcnt == 0) {
         ret = server_ops.close(n->private, (n->type == FS_NODE_DIR), true);
         if (ret) {
             printf("Warning: close failed when deref vnode: %d\n", ret);
@@ -64,6 +64,9 @@ struct server_entry {
 
     /* Each vnode is binding with a disk inode */
     struct fs_vnode *vnode;
+
+    /* Read-ahead state of this fd, protected by `lock` */
+    struct page_cache_ra_state ra;
 };
 
 extern struct server_entry *server_entrys[MAX_SERVER_ENTRY_NUM];
@@ -51,8 +51,33 @@ int real_file_reader(char *buffer, pidx_t file_page_idx, void *private)
     return server_ops.read(vnode->private, offset, size, buffer);
 }
 
+int real_file_pages_reader(char *buffer, pidx_t file_page_idx, int nr_pages,
+                           void *private)
+{
+    struct fs_vnode *vnode;
+    size_t size;
+    off_t offset;
+
+    vnode = (struct fs_vnode *)private;
+
+    size = (size_t)nr_pages * CACHED_PAGE_SIZE;
+    offset = file_page_idx * CACHED_PAGE_SIZE;
+
+    memset(buffer, 0, size);
+
+    /* Pages beyond the file end are left zeroed. */
+    if (offset >= vnode->size)
+        return 0;
+    if (offset + size > vnode->size)
+        size = vnode->size - offset;
+#ifdef TEST_COUNT_PAGE_CACHE
+    count.disk_o = count.disk_o + size;
+#endif
+    return server_ops.read(vnode->private, offset, size, buffer);
+}
+
 int real_file_writer(char *buffer, pidx_t file_page_idx, int page_block_idx,
-                     void *private)
+                     int nr_blocks, void *private)
 {
     struct fs_vnode *vnode;
     off_t offset;
@@ -63,7 +88,7 @@ int real_file_writer(char *buffer, pidx_t file_page_idx, int page_block_idx,
     if (page_block_idx == -1) {
         size = CACHED_PAGE_SIZE;
     } else {
-        size = CACHED_BLOCK_SIZE;
+        size = nr_blocks * CACHED_BLOCK_SIZE;
         offset += page_block_idx * CACHED_BLOCK_SIZE;
     }
 
@@ -87,10 +112,16 @@ void init_fs_wrapper(void)
 
     uf.file_read = real_file_reader;
     uf.file_write = real_file_writer;
+    uf.file_read_pages = real_file_pages_reader;
     uf.handler_pce_turns_empty = dec_ref_fs_vnode;
     uf.handler_pce_turns_nonempty = inc_ref_fs_vnode;
 
+#ifdef CHCORE_FS_WRITE_BACK
+    /* Dirty pages are written back in background, or by fsync/sync. */
+    fs_page_cache_init(WRITE_BACK, &uf);
+#else
     fs_page_cache_init(WRITE_THROUGH, &uf);
+#endif
 
 #ifdef CHCORE_ENABLE_FMAP
     /* Module: fmap fault */
@@ -286,8 +286,6 @@ int fs_wrapper_read(ipc_msg_t *ipc_msg, struct fs_request *fr)
     void *operator;
     int ret;
     struct fs_vnode *vnode;
-    char *page_buf;
-    int fptr, page_idx, page_off, copy_size;
 
     ret = 0;
     fd = fr->read.fd;
@@ -346,20 +344,17 @@ int fs_wrapper_read(ipc_msg_t *ipc_msg, struct fs_request *fr)
     if (!using_page_cache) {
         ret = server_ops.read(operator, offset, size, buf);
     } else {
-        for (fptr = offset; fptr < offset + size;
-             fptr = ROUND_DOWN(fptr, PAGE_SIZE) + PAGE_SIZE) {
-            page_idx = fptr / PAGE_SIZE;
-            page_off = fptr - ROUND_DOWN(fptr, PAGE_SIZE);
-            copy_size = MIN(PAGE_SIZE - page_off, offset + size - fptr);
-
-            /* get-read-put */
-            page_buf = page_cache_get_block_or_page(
-                vnode->page_cache, page_idx, -1, READ);
-            memcpy(buf + fptr - offset, page_buf + page_off, copy_size);
-            page_cache_put_block_or_page(vnode->page_cache, page_idx, -1, READ);
-
-            ret += copy_size;
-        }
+        if (size > 0)
+            page_cache_readahead(vnode->page_cache,
+                                 &server_entrys[fd]->ra,
+                                 offset / CACHED_PAGE_SIZE,
+                                 (offset + size - 1) / CACHED_PAGE_SIZE
+                                     - offset / CACHED_PAGE_SIZE + 1,
+                                 ROUND_UP(vnode->size, CACHED_PAGE_SIZE)
+                                     / CACHED_PAGE_SIZE);
+        ret = page_cache_rw_range(vnode->page_cache, offset, size, buf, READ);
+        if (ret < 0)
+            ret = -EIO;
     }
 
     /* Update server_entry and vnode metadata */
@@ -380,8 +375,6 @@ int fs_wrapper_write(ipc_msg_t *ipc_msg, struct fs_request *fr)
     void *operator;
     int ret;
     struct fs_vnode *vnode;
-    char *block_buf;
-    int fptr, page_idx, block_idx, block_off, copy_size;
 
     ret = 0;
     fd = fr->write.fd;
@@ -435,23 +428,10 @@ int fs_wrapper_write(ipc_msg_t *ipc_msg, struct fs_request *fr)
             vnode->size = offset + size;
             server_ops.ftruncate(operator, offset + size);
         }
-        for (fptr = offset; fptr < offset + size;
-             fptr = ROUND_DOWN(fptr, CACHED_BLOCK_SIZE) + CACHED_BLOCK_SIZE) {
-            page_idx = fptr / CACHED_PAGE_SIZE;
-            block_idx =
-                (fptr - ROUND_DOWN(fptr, PAGE_SIZE)) / CACHED_BLOCK_SIZE;
-            block_off = fptr - ROUND_DOWN(fptr, CACHED_BLOCK_SIZE);
-            copy_size =
-                MIN(CACHED_BLOCK_SIZE - block_off, offset + size - fptr);
-
-            /* get-write-put */
-            block_buf = page_cache_get_block_or_page(
-                vnode->page_cache, page_idx, block_idx, WRITE);
-            memcpy(block_buf + block_off, buf + fptr - offset, copy_size);
-            page_cache_put_block_or_page(
-                vnode->page_cache, page_idx, block_idx, WRITE);
-
-            ret += copy_size;
+        ret = page_cache_rw_range(vnode->page_cache, offset, size, buf, WRITE);
+        if (ret < 0) {
+            ret = -EIO;
+            goto out;
         }
     }
 
@@ -686,11 +666,34 @@ int fs_wrapper_rename(ipc_msg_t *ipc_msg, struct fs_request *fr)
 
 int fs_wrapper_count(ipc_msg_t *ipc_msg, struct fs_request *fr)
 {
+    struct page_cache_stat stat;
+
     printf("hit: %d miss: %d disk_writer: %d disk_read: %d\n",
            count.hit,
            count.miss,
            count.disk_i,
            count.disk_o);
+
+    if (using_page_cache) {
+        page_cache_get_stat(&stat);
+        printf("dirty pages: %llu dirty inodes: %llu write-back rounds: %llu "
+               "runs: %llu blocks: %llu\n",
+               (unsigned long long)stat.nr_dirty_pages,
+               (unsigned long long)stat.nr_dirty_inodes,
+               (unsigned long long)stat.nr_write_back_rounds,
+               (unsigned long long)stat.nr_write_back_runs,
+               (unsigned long long)stat.nr_write_back_blocks);
+        printf("read-ahead windows: sync %llu async %llu max %llu pages\n",
+               (unsigned long long)stat.nr_ra_sync_windows,
+               (unsigned long long)stat.nr_ra_async_windows,
+               (unsigned long long)stat.max_ra_window);
+        printf("evicted: %llu busy: %llu io fails: %llu "
+               "shard contended: %llu\n",
+               (unsigned long long)stat.nr_evicted,
+               (unsigned long long)stat.nr_evict_busy,
+               (unsigned long long)stat.nr_evict_io_fails,
+               (unsigned long long)stat.nr_shard_contended);
+    }
     return 0;
 }
 